@@ -0,0 +1,233 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarCloudLayerComponent.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Kismet/GameplayStatics.h"
+#include "Misc/Paths.h"
+#include "Tasks/Task.h"
+
+void ULidarCloudLayerComponent::BeginPlay()
+{
+	// The cloud is sized for the resident blocks before the scanner sets it up
+	MaxPointCount = MaxResidentBlocks * FLidarPointFile::BlockPoints;
+
+	Super::BeginPlay();
+
+	if (CloudFile.IsEmpty() == false)
+	{
+		LoadCloud(CloudFile);
+	}
+}
+
+void ULidarCloudLayerComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	UpdateResidentBlocks();
+
+	// Uploads this frame's installs along with everything else
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+}
+
+bool ULidarCloudLayerComponent::LoadCloud(const FString& File)
+{
+	UnloadCloud();
+
+	const FString Path = FPaths::IsRelative(File) ? FPaths::ProjectSavedDir() / TEXT("Lidar/Exports") / File : File;
+	CloudSource = FLidarPointFile::Open(Path, UnitsToCentimeters);
+	if (CloudSource.IsValid() == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s could not open point cloud %s"), *GetName(), *Path);
+		return false;
+	}
+
+	MaxPointCount = MaxResidentBlocks * FLidarPointFile::BlockPoints;
+	ClearPointCloud();
+	ResizePointCloud(MaxPointCount);
+
+	// Blocks page in as soon as the index reaches them, a saved index makes that all of them at once
+	UE::Tasks::Launch(UE_SOURCE_LOCATION, [Source = CloudSource]()
+	{
+		if (Source->LoadIndex() == false)
+		{
+			Source->BuildIndex();
+		}
+	});
+
+	UE_LOG(LogTemp, Log, TEXT("%s streaming %lld points in %d blocks from %s"), *GetName(), CloudSource->Num(), CloudSource->GetBlockCount(), *Path);
+	return true;
+}
+
+void ULidarCloudLayerComponent::UnloadCloud()
+{
+	// Running tasks hold their own reference to the file, their results are just dropped
+	if (CloudSource.IsValid())
+	{
+		CloudSource->CancelIndex();
+	}
+	CloudSource.Reset();
+	PendingLoads.Reset();
+	SlotBlocks.Reset();
+	BlockSlots.Reset();
+	ClearPointCloud();
+}
+
+FVector ULidarCloudLayerComponent::GetViewLocation() const
+{
+	if (const APlayerCameraManager* CameraManager = UGameplayStatics::GetPlayerCameraManager(this, 0))
+		return CameraManager->GetCameraLocation();
+
+	return GetComponentLocation();
+}
+
+void ULidarCloudLayerComponent::UpdateResidentBlocks()
+{
+	if (CloudSource.IsValid() == false)
+		return;
+
+	// Only the blocks indexed so far, the rest join in as the index task reaches them
+	const FVector View = GetViewLocation();
+	const TConstArrayView<FBox> Bounds = CloudSource->GetBlockBounds();
+
+	// Blocks in range, nearest first, as many as fit
+	TArray<TPair<double, int32>> InRange;
+	const double RadiusSquared = FMath::Square(static_cast<double>(LoadRadius));
+	for (int32 Block = 0; Block < Bounds.Num(); ++Block)
+	{
+		const double DistanceSquared = Bounds[Block].ComputeSquaredDistanceToPoint(View);
+		if (DistanceSquared <= RadiusSquared)
+		{
+			InRange.Emplace(DistanceSquared, Block);
+		}
+	}
+	InRange.Sort([](const TPair<double, int32>& A, const TPair<double, int32>& B) { return A.Key < B.Key; });
+	InRange.SetNum(FMath::Min(InRange.Num(), MaxResidentBlocks));
+
+	TSet<int32> Wanted;
+	for (const TPair<double, int32>& Entry : InRange)
+	{
+		Wanted.Add(Entry.Value);
+	}
+
+	// Install finished decodes, a bounded number per frame
+	int32 Installed = 0;
+	for (auto It = PendingLoads.CreateIterator(); It && Installed < MaxBlockLoadsPerFrame; ++It)
+	{
+		if (It->Value.IsCompleted() == false)
+			continue;
+
+		const TSharedPtr<FDecodedBlock>& Decoded = It->Value.GetResult();
+		if (Wanted.Contains(Decoded->Block))
+		{
+			if (const int32 Slot = FindSlot(Wanted, View); Slot != INDEX_NONE)
+			{
+				InstallBlock(*Decoded, Slot);
+				++Installed;
+			}
+		}
+		It.RemoveCurrent();
+	}
+
+	// Slots a new block could take: free ones, plus those of resident blocks that fell out of range
+	int32 AvailableSlots = MaxResidentBlocks - SlotBlocks.Num() - PendingLoads.Num();
+	for (const int32 Block : SlotBlocks)
+	{
+		AvailableSlots += Wanted.Contains(Block) ? 0 : 1;
+	}
+
+	for (const TPair<double, int32>& Entry : InRange)
+	{
+		if (PendingLoads.Num() >= MaxBlockLoadsPerFrame || AvailableSlots <= 0)
+			break;
+
+		const int32 Block = Entry.Value;
+		if (BlockSlots.Contains(Block) || PendingLoads.Contains(Block))
+			continue;
+
+		PendingLoads.Add(Block, UE::Tasks::Launch(UE_SOURCE_LOCATION, [Source = CloudSource, Block]()
+		{
+			TSharedPtr<FDecodedBlock> Decoded = MakeShared<FDecodedBlock>();
+			Decoded->Block = Block;
+			Source->ReadBlock(Block, Decoded->Positions, Decoded->Colors);
+			return Decoded;
+		}));
+		--AvailableSlots;
+	}
+}
+
+int32 ULidarCloudLayerComponent::FindSlot(const TSet<int32>& Wanted, const FVector& View) const
+{
+	if (SlotBlocks.Num() < MaxResidentBlocks)
+		return SlotBlocks.Num();
+
+	const TConstArrayView<FBox> Bounds = CloudSource->GetBlockBounds();
+	int32 FarthestSlot = INDEX_NONE;
+	double FarthestDistance = -1.0;
+	for (int32 Slot = 0; Slot < SlotBlocks.Num(); ++Slot)
+	{
+		if (Wanted.Contains(SlotBlocks[Slot]))
+			continue;
+
+		const double Distance = Bounds[SlotBlocks[Slot]].ComputeSquaredDistanceToPoint(View);
+		if (Distance > FarthestDistance)
+		{
+			FarthestDistance = Distance;
+			FarthestSlot = Slot;
+		}
+	}
+	return FarthestSlot;
+}
+
+void ULidarCloudLayerComponent::InstallBlock(const FDecodedBlock& Decoded, int32 Slot)
+{
+	LIDAR_SCOPE(LayerInstall);
+
+	FLidarPointCloud& Cloud = GetMutablePointCloud();
+
+	TArray<FLidarPackedPoint> Packed;
+	Packed.Reserve(FLidarPointFile::BlockPoints);
+	auto PackBlock = [&]()
+	{
+		Packed.Reset();
+		for (int32 i = 0; i < Decoded.Positions.Num(); ++i)
+		{
+			FLidarPackedPoint Point;
+			if (LidarPacking::Pack(Decoded.Positions[i], FLinearColor::White, DefaultParticleLifetime, Cloud.GetMutableChunks(), Point))
+			{
+				// Keep the file's color bytes exactly as they were exported
+				Point.Color = Decoded.Colors[i];
+				Packed.Add(Point);
+			}
+		}
+	};
+
+	PackBlock();
+	if (Packed.Num() < Decoded.Positions.Num() && Cloud.CompactChunks())
+	{
+		// The table filled up with chunks of blocks paged out since. Compacting renumbered them, so pack again
+		PackBlock();
+	}
+	Cloud.CountDroppedPoints(Decoded.Positions.Num() - Packed.Num());
+
+	if (Packed.Num() == 0)
+		return;
+
+	// Every slot is a full block wide, a short block repeats its last point so nothing of the previous block shows
+	const FLidarPackedPoint Last = Packed.Last();
+	while (Packed.Num() < FLidarPointFile::BlockPoints)
+	{
+		Packed.Add(Last);
+	}
+
+	if (Slot < SlotBlocks.Num())
+	{
+		BlockSlots.Remove(SlotBlocks[Slot]);
+		SlotBlocks[Slot] = Decoded.Block;
+	}
+	else
+	{
+		SlotBlocks.Add(Decoded.Block);
+	}
+	BlockSlots.Add(Decoded.Block, Slot);
+
+	Cloud.WriteSlots(Slot * FLidarPointFile::BlockPoints, Packed);
+}
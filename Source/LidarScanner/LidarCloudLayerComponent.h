@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarComponent.h"
+#include "LidarPointImport.h"
+#include "Tasks/Task.h"
+#include "LidarCloudLayerComponent.generated.h"
+
+/**
+ * Shows a previously exported or captured PLY/PCD cloud as a background layer through the same Lidar data interface
+ * path as a scanner. The file stays memory mapped, only blocks near the camera are decoded (on workers) and
+ * written into fixed slots of the point cloud, a far block's slot is reused when a nearer one comes into range.
+ */
+UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
+class LIDARSCANNER_API ULidarCloudLayerComponent : public ULidarComponent
+{
+	GENERATED_BODY()
+
+public:
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+
+	/** Loaded at BeginPlay if set, relative paths are looked up in Saved/Lidar/Exports */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Cloud Layer")
+	FString CloudFile;
+	/** File units to centimeters, exports of this project are in meters */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Cloud Layer")
+	float UnitsToCentimeters = 100.f;
+	/** Blocks whose bounds come this close to the camera are paged in */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Cloud Layer", meta = (ClampMin = "0", Units = "cm"))
+	float LoadRadius = 5000.f;
+	/** Blocks resident at once, the point cloud holds this many times FLidarPointFile::BlockPoints points */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Cloud Layer", meta = (ClampMin = "1"))
+	int32 MaxResidentBlocks = 16;
+	/** Blocks decoding in the background at once, and the most installed into the cloud per frame */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Cloud Layer", meta = (ClampMin = "1"))
+	int32 MaxBlockLoadsPerFrame = 2;
+
+	/** Maps the file and starts paging it in, blocks show up as the background index reaches them on first use */
+	UFUNCTION(BlueprintCallable, Category="Cloud Layer")
+	bool LoadCloud(const FString& File);
+	UFUNCTION(BlueprintCallable, Category="Cloud Layer")
+	void UnloadCloud();
+
+	UFUNCTION(BlueprintPure, Category="Cloud Layer")
+	int32 GetResidentBlockCount() const { return BlockSlots.Num(); }
+
+protected:
+	virtual void BeginPlay() override;
+
+private:
+	struct FDecodedBlock
+	{
+		int32 Block = INDEX_NONE;
+		TArray<FVector> Positions;
+		TArray<FColor> Colors;
+	};
+
+	TSharedPtr<FLidarPointFile> CloudSource;
+
+	TMap<int32, UE::Tasks::TTask<TSharedPtr<FDecodedBlock>>> PendingLoads;
+	// Block shown in each slot of the cloud, and the other way round
+	TArray<int32> SlotBlocks;
+	TMap<int32, int32> BlockSlots;
+
+	FVector GetViewLocation() const;
+	void UpdateResidentBlocks();
+	/** A free slot, else the slot of the farthest resident block that is no longer wanted */
+	int32 FindSlot(const TSet<int32>& Wanted, const FVector& View) const;
+	void InstallBlock(const FDecodedBlock& Decoded, int32 Slot);
+};
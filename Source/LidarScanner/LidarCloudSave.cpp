@@ -0,0 +1,268 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarCloudSave.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace LidarCloudArchive
+{
+	// Chunk index, X, Y and Z as low and high byte planes, then the palette index or raw pair planes
+	constexpr int32 WordCount = 4;
+	constexpr int32 RawEntryBytes = 6;
+
+	FORCEINLINE uint16 ZigZag(int16 Value)
+	{
+		return static_cast<uint16>((static_cast<uint16>(Value) << 1) ^ static_cast<uint16>(Value >> 15));
+	}
+
+	FORCEINLINE int16 UnZigZag(uint16 Value)
+	{
+		return static_cast<int16>((Value >> 1) ^ static_cast<uint16>(0 - (Value & 1)));
+	}
+
+	FORCEINLINE uint64 GetEntryKey(const FColor& Color, const FFloat16& Lifetime)
+	{
+		return (static_cast<uint64>(Lifetime.Encoded) << 32) | Color.DWColor();
+	}
+
+	FORCEINLINE void GetWords(const FLidarPackedPoint& Point, uint16 OutWords[WordCount])
+	{
+		OutWords[0] = Point.ChunkIndex;
+		OutWords[1] = static_cast<uint16>(Point.X);
+		OutWords[2] = static_cast<uint16>(Point.Y);
+		OutWords[3] = static_cast<uint16>(Point.Z);
+	}
+
+	int32 GetEntryBytes(int32 PaletteCount)
+	{
+		return PaletteCount == 0 ? RawEntryBytes : PaletteCount <= 256 ? 1 : 2;
+	}
+}
+
+bool LidarCloudArchive::Encode(const FLidarCloudSnapshot& Snapshot, TConstArrayView<FCustomParticleData> PreferredEntries, TArray<uint8>& OutBytes)
+{
+	const int32 Num = Snapshot.Points.Num();
+	const int32 ChunkCount = Snapshot.ChunkCoords.Num();
+	if (ChunkCount > FLidarChunkTable::MaxChunks)
+		return false;
+
+	// Palette of color and lifetime pairs, the dictionary entries first
+	TMap<uint64, int32> EntryIndices;
+	TArray<uint64> Palette;
+	auto AddEntry = [&EntryIndices, &Palette](uint64 Key)
+	{
+		if (EntryIndices.Contains(Key) == false)
+		{
+			EntryIndices.Add(Key, Palette.Add(Key));
+		}
+	};
+
+	for (const FCustomParticleData& Entry : PreferredEntries)
+	{
+		AddEntry(GetEntryKey(LidarPacking::PackColor(Entry.Color), LidarPacking::PackLifetime(Entry.Lifetime)));
+	}
+
+	TArray<int32> PointEntries;
+	PointEntries.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num && Palette.Num() <= MaxPaletteSize; ++i)
+	{
+		const FLidarPackedPoint& Point = Snapshot.Points[i];
+		const uint64 Key = GetEntryKey(Point.Color, Point.Lifetime);
+		if (const int32* Found = EntryIndices.Find(Key))
+		{
+			PointEntries[i] = *Found;
+		}
+		else
+		{
+			PointEntries[i] = Palette.Add(Key);
+			EntryIndices.Add(Key, PointEntries[i]);
+		}
+	}
+
+	if (Palette.Num() > MaxPaletteSize)
+	{
+		Palette.Reset();
+	}
+
+	TArray<uint8> Raw;
+	FMemoryWriter Writer(Raw);
+
+	int32 PointCount = Num;
+	int32 PaletteCount = Palette.Num();
+	Writer << PointCount;
+	Writer << ChunkCount;
+	Writer << PaletteCount;
+
+	for (FIntVector Coord : Snapshot.ChunkCoords)
+	{
+		Writer << Coord;
+	}
+	for (uint64 Key : Palette)
+	{
+		Writer << Key;
+	}
+
+	const int32 EntryBytes = GetEntryBytes(PaletteCount);
+	const int32 PlaneCount = WordCount * 2 + EntryBytes;
+	const int64 RawSize = Raw.Num() + static_cast<int64>(Num) * PlaneCount;
+	if (RawSize > MAX_int32)
+		return false;
+
+	const int32 PlaneStart = Raw.Num();
+	Raw.AddUninitialized(Num * PlaneCount);
+	uint8* Planes = Raw.GetData() + PlaneStart;
+
+	uint16 PreviousWords[WordCount] = {};
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const FLidarPackedPoint& Point = Snapshot.Points[i];
+
+		uint16 Words[WordCount];
+		GetWords(Point, Words);
+		for (int32 Word = 0; Word < WordCount; ++Word)
+		{
+			const uint16 Delta = ZigZag(static_cast<int16>(Words[Word] - PreviousWords[Word]));
+			Planes[(Word * 2) * Num + i] = static_cast<uint8>(Delta & 0xFF);
+			Planes[(Word * 2 + 1) * Num + i] = static_cast<uint8>(Delta >> 8);
+			PreviousWords[Word] = Words[Word];
+		}
+
+		uint8* EntryPlanes = Planes + WordCount * 2 * Num;
+		if (PaletteCount == 0)
+		{
+			const uint8 Bytes[RawEntryBytes] = {Point.Color.R, Point.Color.G, Point.Color.B, Point.Color.A,
+				static_cast<uint8>(Point.Lifetime.Encoded & 0xFF), static_cast<uint8>(Point.Lifetime.Encoded >> 8)};
+			for (int32 Byte = 0; Byte < RawEntryBytes; ++Byte)
+			{
+				EntryPlanes[Byte * Num + i] = Bytes[Byte];
+			}
+		}
+		else
+		{
+			for (int32 Byte = 0; Byte < EntryBytes; ++Byte)
+			{
+				EntryPlanes[Byte * Num + i] = static_cast<uint8>(PointEntries[i] >> (Byte * 8));
+			}
+		}
+	}
+
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, Raw.Num());
+	TArray<uint8> Compressed;
+	Compressed.SetNumUninitialized(CompressedSize);
+	if (FCompression::CompressMemory(NAME_Oodle, Compressed.GetData(), CompressedSize, Raw.GetData(), Raw.Num()) == false)
+		return false;
+
+	OutBytes.Reset();
+	FMemoryWriter Out(OutBytes);
+	uint32 FileMagic = Magic;
+	int32 FileVersion = Version;
+	int32 UncompressedSize = Raw.Num();
+	Out << FileMagic;
+	Out << FileVersion;
+	Out << UncompressedSize;
+	Out.Serialize(Compressed.GetData(), CompressedSize);
+	return true;
+}
+
+bool LidarCloudArchive::Decode(TConstArrayView<uint8> Bytes, FLidarCloudSnapshot& OutSnapshot)
+{
+	constexpr int32 HeaderSize = sizeof(uint32) + sizeof(int32) * 2;
+	if (Bytes.Num() < HeaderSize)
+		return false;
+
+	uint32 FileMagic = 0;
+	int32 FileVersion = 0;
+	int32 UncompressedSize = 0;
+	FMemory::Memcpy(&FileMagic, Bytes.GetData(), sizeof(uint32));
+	FMemory::Memcpy(&FileVersion, Bytes.GetData() + 4, sizeof(int32));
+	FMemory::Memcpy(&UncompressedSize, Bytes.GetData() + 8, sizeof(int32));
+	if (FileMagic != Magic || FileVersion != Version || UncompressedSize < 0)
+		return false;
+
+	TArray<uint8> Raw;
+	Raw.SetNumUninitialized(UncompressedSize);
+	if (FCompression::UncompressMemory(NAME_Oodle, Raw.GetData(), UncompressedSize, Bytes.GetData() + HeaderSize, Bytes.Num() - HeaderSize) == false)
+		return false;
+
+	FMemoryReader Reader(Raw);
+	int32 Num = 0;
+	int32 ChunkCount = 0;
+	int32 PaletteCount = 0;
+	Reader << Num;
+	Reader << ChunkCount;
+	Reader << PaletteCount;
+	if (Reader.IsError() || Num < 0 || ChunkCount < 0 || ChunkCount > FLidarChunkTable::MaxChunks || PaletteCount < 0 || PaletteCount > MaxPaletteSize)
+		return false;
+
+	OutSnapshot.ChunkCoords.SetNumUninitialized(ChunkCount);
+	for (FIntVector& Coord : OutSnapshot.ChunkCoords)
+	{
+		Reader << Coord;
+	}
+
+	TArray<uint64> Palette;
+	Palette.SetNumUninitialized(PaletteCount);
+	for (uint64& Key : Palette)
+	{
+		Reader << Key;
+	}
+
+	const int32 EntryBytes = GetEntryBytes(PaletteCount);
+	const int32 PlaneCount = WordCount * 2 + EntryBytes;
+	if (Reader.IsError() || Raw.Num() - Reader.Tell() != static_cast<int64>(Num) * PlaneCount)
+		return false;
+
+	const uint8* Planes = Raw.GetData() + Reader.Tell();
+	const uint8* EntryPlanes = Planes + WordCount * 2 * Num;
+
+	OutSnapshot.Points.SetNumUninitialized(Num);
+	uint16 Words[WordCount] = {};
+	for (int32 i = 0; i < Num; ++i)
+	{
+		for (int32 Word = 0; Word < WordCount; ++Word)
+		{
+			const uint16 Delta = static_cast<uint16>(Planes[(Word * 2) * Num + i] | (Planes[(Word * 2 + 1) * Num + i] << 8));
+			Words[Word] = static_cast<uint16>(Words[Word] + UnZigZag(Delta));
+		}
+
+		if (Words[0] >= ChunkCount)
+			return false;
+
+		FLidarPackedPoint& Point = OutSnapshot.Points[i];
+		Point.ChunkIndex = Words[0];
+		Point.X = static_cast<int16>(Words[1]);
+		Point.Y = static_cast<int16>(Words[2]);
+		Point.Z = static_cast<int16>(Words[3]);
+		Point.HitCount = 1;
+
+		if (PaletteCount == 0)
+		{
+			Point.Color = FColor(EntryPlanes[i], EntryPlanes[Num + i], EntryPlanes[2 * Num + i], EntryPlanes[3 * Num + i]);
+			Point.Lifetime.Encoded = static_cast<uint16>(EntryPlanes[4 * Num + i] | (EntryPlanes[5 * Num + i] << 8));
+		}
+		else
+		{
+			int32 Entry = 0;
+			for (int32 Byte = 0; Byte < EntryBytes; ++Byte)
+			{
+				Entry |= EntryPlanes[Byte * Num + i] << (Byte * 8);
+			}
+			if (Entry >= PaletteCount)
+				return false;
+
+			Point.Color = FColor(static_cast<uint32>(Palette[Entry]));
+			Point.Lifetime.Encoded = static_cast<uint16>(Palette[Entry] >> 32);
+		}
+	}
+	return true;
+}
+
+void ULidarCloudSaveGame::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	// Byte arrays serialize in bulk
+	Ar << CloudData;
+}
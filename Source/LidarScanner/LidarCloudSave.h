@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/SaveGame.h"
+#include "LidarPackedPoint.h"
+#include "Public/CustomParticleData.h"
+#include "LidarCloudSave.generated.h"
+
+/** Points and the chunks they are packed against, as they go into and come out of a save */
+struct FLidarCloudSnapshot
+{
+	// Oldest first, like the ring they came from
+	TArray<FLidarPackedPoint> Points;
+	// ChunkIndex of the points indexes this
+	TArray<FIntVector> ChunkCoords;
+};
+
+/**
+ * Compact binary form of a point cloud. Positions stay chunk relative int16 offsets, each color and lifetime pair
+ * becomes an index into a palette that starts with the CustomDataDictionary entries. Everything is laid out in byte
+ * planes of deltas and Oodle compressed, so a few million points load in a couple of memcpy sized passes.
+ */
+namespace LidarCloudArchive
+{
+	constexpr uint32 Magic = 0x444C434C; // "LCLD"
+	constexpr int32 Version = 1;
+	// Beyond this many distinct color and lifetime pairs the pairs are stored raw
+	constexpr int32 MaxPaletteSize = 65536;
+
+	/** PreferredEntries take the first palette indices, they do not need to appear in the cloud */
+	LIDARSCANNER_API bool Encode(const FLidarCloudSnapshot& Snapshot, TConstArrayView<FCustomParticleData> PreferredEntries, TArray<uint8>& OutBytes);
+	LIDARSCANNER_API bool Decode(TConstArrayView<uint8> Bytes, FLidarCloudSnapshot& OutSnapshot);
+}
+
+/** Save game holding one scanner's cloud, the cloud itself is a LidarCloudArchive blob serialized in bulk */
+UCLASS()
+class LIDARSCANNER_API ULidarCloudSaveGame : public USaveGame
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, Category="Lidar")
+	FString MapName;
+
+	UPROPERTY(VisibleAnywhere, Category="Lidar")
+	int32 PointCount = 0;
+
+	// Not a UPROPERTY, tagged serialization would write it a byte at a time
+	TArray<uint8> CloudData;
+
+	virtual void Serialize(FArchive& Ar) override;
+};
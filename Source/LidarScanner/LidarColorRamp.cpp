@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarColorRamp.h"
+#include "Engine/HitResult.h"
+
+void FLidarColorRamp::Build(TConstArrayView<FLidarColorStop> Stops, ELidarColorMode InMode, float RangeMin, float RangeMax)
+{
+	Mode = InMode;
+	Min = RangeMin;
+	// An empty range samples the first entry everywhere, LidarScan::LerpColors does the same for MaxDistance <= 0
+	Scale = RangeMax > RangeMin ? (TableSize - 1) / (RangeMax - RangeMin) : 0.f;
+
+	TArray<FLidarColorStop, TInlineAllocator<8>> Sorted(Stops.GetData(), Stops.Num());
+	Sorted.StableSort([](const FLidarColorStop& A, const FLidarColorStop& B) { return A.Position < B.Position; });
+	if (Sorted.Num() == 0)
+	{
+		Sorted.Add(FLidarColorStop());
+	}
+
+	Table.SetNumUninitialized(TableSize);
+
+	int32 Next = 0;
+	for (int32 i = 0; i < TableSize; ++i)
+	{
+		const float Position = static_cast<float>(i) / (TableSize - 1);
+		while (Next < Sorted.Num() && Sorted[Next].Position < Position)
+		{
+			++Next;
+		}
+
+		// Flat before the first stop and after the last one
+		if (Next == 0 || Next == Sorted.Num())
+		{
+			Table[i] = Sorted[FMath::Min(Next, Sorted.Num() - 1)].Color;
+			continue;
+		}
+
+		const FLidarColorStop& From = Sorted[Next - 1];
+		const FLidarColorStop& To = Sorted[Next];
+		const float Alpha = (Position - From.Position) / FMath::Max(To.Position - From.Position, UE_SMALL_NUMBER);
+		Table[i] = FLinearColor::LerpUsingHSV(From.Color, To.Color, Alpha);
+	}
+}
+
+float FLidarColorRamp::GetInput(const FVector& Location, const FVector& Normal, const FVector& TraceDirection, float Distance) const
+{
+	switch (Mode)
+	{
+	case ELidarColorMode::Height:
+		return Location.Z;
+	case ELidarColorMode::IncidenceAngle:
+		{
+			const float CosAngle = FMath::Abs(FVector::DotProduct(Normal, TraceDirection.GetSafeNormal()));
+			return FMath::RadiansToDegrees(FMath::Acos(FMath::Min(CosAngle, 1.f)));
+		}
+	default:
+		return Distance;
+	}
+}
+
+FLinearColor FLidarColorRamp::Sample(float Input) const
+{
+	const float Coord = FMath::Clamp((Input - Min) * Scale, 0.f, static_cast<float>(TableSize - 1));
+	const int32 Index = FMath::Min(static_cast<int32>(Coord), TableSize - 2);
+	return FMath::Lerp(Table[Index], Table[Index + 1], Coord - Index);
+}
+
+FLinearColor FLidarColorRamp::Colorize(const FHitResult& Hit) const
+{
+	return Sample(GetInput(Hit.Location, Hit.ImpactNormal, Hit.TraceEnd - Hit.TraceStart, Hit.Distance));
+}
+
+void FLidarColorRamp::SampleBatch(TConstArrayView<float> Inputs, TArrayView<FLinearColor> Out) const
+{
+	check(Inputs.Num() == Out.Num());
+
+	const FLinearColor* RESTRICT Entries = Table.GetData();
+	const float MaxCoord = static_cast<float>(TableSize - 1);
+
+	// Branch free, the same few instructions for every point
+	for (int32 i = 0; i < Inputs.Num(); ++i)
+	{
+		const float Coord = FMath::Clamp((Inputs[i] - Min) * Scale, 0.f, MaxCoord);
+		const int32 Index = FMath::Min(static_cast<int32>(Coord), TableSize - 2);
+		const float Alpha = Coord - Index;
+
+		const FLinearColor& A = Entries[Index];
+		const FLinearColor& B = Entries[Index + 1];
+		Out[i] = FLinearColor(
+			A.R + (B.R - A.R) * Alpha,
+			A.G + (B.G - A.G) * Alpha,
+			A.B + (B.B - A.B) * Alpha,
+			A.A + (B.A - A.A) * Alpha);
+	}
+}
@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarColorRamp.generated.h"
+
+/** What drives the default point color */
+UENUM(BlueprintType)
+enum class ELidarColorMode : uint8
+{
+	// Hit distance from the scanner, 0 to ParticleColorMaxDistance
+	Distance,
+	// World Z of the hit, across HeightColorRange
+	Height,
+	// Angle between the ray and the surface normal, 0 (head on) to 90 (grazing) degrees
+	IncidenceAngle
+};
+
+/** One color of a gradient, Position is 0 to 1 along the ramp */
+USTRUCT(BlueprintType)
+struct LIDARSCANNER_API FLidarColorStop
+{
+	GENERATED_BODY()
+
+public:
+	FLidarColorStop() = default;
+	FLidarColorStop(float InPosition, const FLinearColor& InColor) : Position(InPosition), Color(InColor) {}
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Color Ramp", meta = (ClampMin = "0", ClampMax = "1"))
+	float Position = 0.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Color Ramp")
+	FLinearColor Color = FLinearColor::White;
+
+	bool operator==(const FLidarColorStop& Other) const { return Position == Other.Position && Color == Other.Color; }
+};
+
+/**
+ * Gradient baked into a fixed size table. Stops are blended in HSV while baking, like the old per hit
+ * LerpUsingHSV, so coloring a point is a clamp, a scale and a lerp between two table entries.
+ * Immutable once built, the component hands the same instance to the worker pipeline.
+ */
+class LIDARSCANNER_API FLidarColorRamp
+{
+public:
+	static constexpr int32 TableSize = 256;
+
+	/** Bakes Stops (sorted by position while baking) for inputs between RangeMin and RangeMax */
+	void Build(TConstArrayView<FLidarColorStop> Stops, ELidarColorMode InMode, float RangeMin, float RangeMax);
+
+	/** Ramp input for a hit in the current mode, TraceDirection does not have to be normalized */
+	float GetInput(const FVector& Location, const FVector& Normal, const FVector& TraceDirection, float Distance) const;
+
+	FLinearColor Sample(float Input) const;
+	FLinearColor Colorize(const FHitResult& Hit) const;
+
+	/** Colors a whole batch of inputs, Out must be as long as Inputs */
+	void SampleBatch(TConstArrayView<float> Inputs, TArrayView<FLinearColor> Out) const;
+
+	ELidarColorMode GetMode() const { return Mode; }
+
+private:
+	TArray<FLinearColor, TFixedAllocator<TableSize>> Table;
+	ELidarColorMode Mode = ELidarColorMode::Distance;
+	float Min = 0.f;
+	// Maps an input straight to a table coordinate
+	float Scale = 0.f;
+};
@@ -7,13 +7,18 @@
 #include "GameFramework/PlayerController.h"
 #include "Camera/PlayerCameraManager.h"
 #include "Kismet/GameplayStatics.h"
+#include "EngineUtils.h"
+#include "Misc/Paths.h"
 #include "EnhancedInputComponent.h"
 #include "EnhancedInputSubsystems.h"
 #include "LidarDataInterface.h"
 #include "NiagaraDataInterfaceArrayFunctionLibrary.h"
+#include "NiagaraDataInterfaceArrayFloat.h"
 #include "Math/UnrealMathUtility.h"
 #include "NiagaraFunctionLibrary.h"
 #include "NiagaraComponent.h"
+#include "LidarTraceBudget.h"
+#include "Async/ParallelFor.h"
 
 
 // Sets default values for this component's properties
@@ -23,6 +28,8 @@ ULidarComponent::ULidarComponent()
 	// off to improve performance if you don't need them.
 	PrimaryComponentTick.bCanEverTick = true;
 	NiagaraComponent = CreateDefaultSubobject<UNiagaraComponent>(TEXT("NiagaraComponent"));
+	// Only for the scan RPCs, no properties replicate
+	SetIsReplicatedByDefault(true);
 }
 
 
@@ -30,7 +37,61 @@ ULidarComponent::ULidarComponent()
 void ULidarComponent::BeginPlay()
 {
 	Super::BeginPlay();
+
+	ResizePointCloud(MaxPointCount);
+	VoxelHash.Reset(VoxelSize, MaxPointCount);
+	UploadCursor = 0;
+
+	PointExpiry.Reset(MaxPointCount, ExpiryBucketSeconds, ExpiryMaxLifetime);
+	ExpiryCursor = 0;
+	ExpiryGeneration = PointCloud.GetGeneration();
+
+	if (bUseSharedPointPool)
+	{
+		if (ULidarPointPoolSubsystem* Subsystem = GetWorld()->GetSubsystem<ULidarPointPoolSubsystem>())
+		{
+			PointPoolHandle = Subsystem->RegisterScanner(this, SharedPoolQuota, NiagaraSystemAsset);
+			PointPool = PointPoolHandle != INDEX_NONE ? Subsystem : nullptr;
+		}
+
+		if (PointPool.IsValid() && NiagaraComponent != nullptr)
+		{
+			NiagaraComponent->Deactivate();
+		}
+	}
+
+	if (bEnableWorldStore)
+	{
+		// One file per scanner and level, so the next session here starts with what this one scanned
+		const FString CacheDir = FPaths::ProjectSavedDir() / TEXT("Lidar/WorldStore") / GetWorld()->GetMapName();
+		WorldStore = MakeUnique<FLidarWorldStore>(CacheDir / FString::Printf(TEXT("%s.%s.lidarcache"), *GetNameSafe(GetOwner()), *GetName()));
+		WorldStoreCursor = PointCloud.GetTotalAppended();
+		WorldStoreGeneration = PointCloud.GetGeneration();
+	}
+
+	RebuildColorRamp();
+
+	if (bRandomizeSeed)
+	{
+		RandomSeed = FMath::Rand();
+		UE_LOG(LogTemp, Log, TEXT("%s scanning with random seed %d"), *GetName(), RandomSeed);
+	}
+	ScanStream.Initialize(RandomSeed);
+}
+
+#if WITH_EDITOR
+void ULidarComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	if (PropertyChangedEvent.GetMemberPropertyName() == GET_MEMBER_NAME_CHECKED(ULidarComponent, CustomDataDictionary))
+	{
+		NotifyCustomDataChanged();
+	}
+
+	UpdateColorRamp();
 }
+#endif
 
 void ULidarComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
@@ -47,6 +108,40 @@ void ULidarComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 		}
 	}
 
+	PendingAsyncRays.Empty();
+	InFlightTraces.Empty();
+	PendingPipelineJobs.Empty();
+	ScanPipeline.Wait();
+
+	// Whatever the export has not handed off yet goes out in one go, then the exporter waits for the disk
+	if (PointExporter.IsValid())
+	{
+		UpdateExport(MAX_int32);
+		PointExporter.Reset();
+	}
+
+	// A save still encoding is finished and handed to the save game system, a load is dropped
+	if (CloudSaveTask.IsValid())
+	{
+		CloudSaveTask.Wait();
+	}
+	CloudLoadTask = {};
+	UpdateCloudPersistence();
+
+	// Every cell goes to the cache file, which stays for the next session on this level
+	if (WorldStore.IsValid())
+	{
+		WorldStore->Flush();
+	}
+	WorldStore.Reset();
+
+	if (ULidarPointPoolSubsystem* Subsystem = PointPool.Get())
+	{
+		Subsystem->UnregisterScanner(PointPoolHandle);
+	}
+	PointPool.Reset();
+	PointPoolHandle = INDEX_NONE;
+
 	// maintain the EndPlay call chain
 	Super::EndPlay(EndPlayReason);
 }
@@ -55,53 +150,229 @@ void ULidarComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 void ULidarComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	LIDAR_SCOPE(Tick);
+
+	UpdateColorRamp();
 
+	// Results of last frame's async traces and pipeline run first, so they land before this frame's scans are queued
+	GatherAsyncTraces();
+	SwapPipelineResults();
+
+	UpdateContinuousScan(DeltaTime);
 	UpdateFullScan(DeltaTime);
+	UpdateScanReplay();
+
+	SubmitAsyncTraces();
+	LaunchPipeline();
+
+	UpdateCloudPersistence();
+	UpdatePointExpiry();
+	UpdateNetPoints();
+	UpdateWorldStore();
+
+	if (ULidarPointPoolSubsystem* Subsystem = PointPool.Get())
+	{
+		LIDAR_SCOPE(PoolSubmit);
+		Subsystem->Submit(PointPoolHandle, PointCloud, SharedPoolPointsPerFrame);
+	}
+	FlushDeltaUpload();
+
+	UpdateExport(ExportPointsPerFrame);
 }
 
 #pragma region NormalScan
 void ULidarComponent::NormalScan()
+{
+	IssueNormalScan(ScanRayAmount);
+}
+
+void ULidarComponent::IssueNormalScan(int32 RayCount)
 {
 	const UWorld* World = GetWorld();
 
-	if(World == nullptr)
+	if(World == nullptr || RayCount <= 0 || ScanRayAmount <= 0 || bReplayingScans)
 		return;
-	
-	FHitResult Hit;
 
-	PositionArray.Empty();
-	ColorArray.Empty();
-	LifetimeArray.Empty();
+	FLidarScanJob Job;
+	Job.Kind = FLidarScanJob::EKind::Normal;
+	GetScanPose(Job.Start, Job.CameraRotation);
+	Job.RayCount = RayCount;
+	Job.Seed = NextScanSeed();
+	Job.ScanRadius = ScanRadius;
+
+	if (bContinuousScanning)
+	{
+		// Batches walk one cone table a second of rays large, each pass under one spin and start, picking up where
+		// the last batch stopped, so no direction repeats within a pass however many rays a frame asks for
+		Job.PatternTable = GetScanPatternTable(ScanPattern, GetContinuousPatternRays());
+		if (ContinuousPassRays == 0 || ContinuousPassRays + RayCount > Job.PatternTable->UnitOffsets.Num())
+		{
+			ContinuousPassSeed = Job.Seed;
+			ContinuousPassRays = 0;
+		}
+		Job.Seed = ContinuousPassSeed;
+		Job.FirstRay = ContinuousPassRays;
+		ContinuousPassRays += RayCount;
+	}
+	else
+	{
+		Job.PatternTable = GetScanPatternTable(ScanPattern, ScanRayAmount);
+	}
+	RunScanJob(MoveTemp(Job));
+}
+
+int32 ULidarComponent::GetContinuousPatternRays() const
+{
+	return FMath::Max(ScanRayAmount, FMath::CeilToInt32(ContinuousRaysPerSecond));
+}
+
+void ULidarComponent::OnFireTriggered()
+{
+	// Held fire is paced by UpdateContinuousScan instead
+	if (bContinuousFire == false)
+	{
+		NormalScan();
+	}
+}
+
+void ULidarComponent::OnFireStarted()
+{
+	if (bContinuousFire)
+	{
+		StartContinuousScan();
+	}
+}
+
+void ULidarComponent::StartContinuousScan()
+{
+	bContinuousScanning = true;
+	ContinuousRayAccumulator = 0.f;
+	ContinuousPassRays = 0;
+}
+
+void ULidarComponent::StopContinuousScan()
+{
+	if (bContinuousScanning == false)
+		return;
+
+	// A tap shorter than one batch still scans what it built up
+	IssueNormalScan(FMath::FloorToInt32(ContinuousRayAccumulator));
+	ContinuousRayAccumulator = 0.f;
+	bContinuousScanning = false;
+}
+
+void ULidarComponent::UpdateContinuousScan(float DeltaTime)
+{
+	if (bContinuousScanning == false)
+		return;
+
+	ContinuousRayAccumulator += ContinuousRaysPerSecond * DeltaTime;
+
+	const int32 Rays = FMath::FloorToInt32(ContinuousRayAccumulator);
+	if (Rays < FMath::Max(1, ContinuousMinBatchRays))
+		return;
+
+	ContinuousRayAccumulator -= Rays;
+	IssueNormalScan(Rays);
+}
+
+void ULidarComponent::GetScanPose(FVector& OutStart, FRotator& OutRotation) const
+{
+	const APlayerController* PlayerController = Character ? Cast<APlayerController>(Character->GetController()) : nullptr;
+
+	if (PlayerController && PlayerController->PlayerCameraManager)
+	{
+		OutRotation = PlayerController->PlayerCameraManager->GetCameraRotation();
+		OutStart = GetOwner()->GetActorLocation() + OutRotation.RotateVector(MuzzleOffset);
+		return;
+	}
+
+	// No player camera (AI, dedicated server, not attached yet), scan along the component
+	OutRotation = GetComponentRotation();
+	OutStart = GetComponentLocation() + OutRotation.RotateVector(MuzzleOffset);
+}
 
-	for (int i = 0; i < ScanRayAmount; ++i)
+const TSharedPtr<const FLidarScanPatternTable>& ULidarComponent::GetScanPatternTable(ELidarScanPattern Pattern, int32 RaysPerScan)
+{
+	RaysPerScan = FMath::Max(1, RaysPerScan);
+	if (ScanPatternTable.IsValid() == false || ScanPatternTable->Pattern != Pattern || ScanPatternTable->RaysPerScan != RaysPerScan)
 	{
-		const FVector2D RandomOffset = GetRandomPointInsideCircle(ScanRadius);
+		// A new instance, pipeline jobs in flight keep the old one alive
+		ScanPatternTable = FLidarScanPatternTable::Build(Pattern, RaysPerScan);
+	}
+	return ScanPatternTable;
+}
+
+int32 ULidarComponent::NextScanSeed()
+{
+	return static_cast<int32>(ScanStream.GetUnsignedInt());
+}
+
+void ULidarComponent::SetRandomSeed(int32 NewSeed)
+{
+	RandomSeed = NewSeed;
+	ScanStream.Initialize(RandomSeed);
+}
 
-		const APlayerController* PlayerController = Cast<APlayerController>(Character->GetController());
-		const FRotator SpawnRotation = PlayerController->PlayerCameraManager->GetCameraRotation();
-		FVector Start = GetOwner()->GetActorLocation() + SpawnRotation.RotateVector(MuzzleOffset);
+void ULidarComponent::RunScanJob(FLidarScanJob&& Job)
+{
+	if (Job.RayCount <= 0)
+		return;
 
-		FVector ForwardVector = FRotationMatrix(SpawnRotation).GetUnitAxis(EAxis::X);
-		FVector RightVector = FRotationMatrix(SpawnRotation).GetUnitAxis(EAxis::Y);
-		FVector UpVector = FRotationMatrix(SpawnRotation).GetUnitAxis(EAxis::Z);
-		
-		FVector Direction = ForwardVector + (RightVector * RandomOffset.X) + (UpVector * RandomOffset.Y);
-		Direction = Direction.GetSafeNormal();
+	// Replays bring the length they were recorded with, everything else traces as far as the scanner does now
+	if (Job.RaycastLength <= 0.f)
+	{
+		Job.RaycastLength = RaycastLength;
+	}
 
-		const bool bHit = LineCast(Start, Direction, Hit);
-		if (bHit == false)
-			continue;
+	if (bApplyingNetworkScan == false && IsNetworked())
+	{
+		ReplicateScanJob(Job);
+	}
 
-		AddParticleData(Hit);
+	if (bRecordingScans)
+	{
+		RecordingSession.Records.Add(FLidarScanRecord::FromJob(Job, static_cast<float>(GetWorld()->GetTimeSeconds() - RecordingStartTime)));
 	}
 
-	SetNiagaraParticleData();
+	if (TraceMode == ELidarTraceMode::WorkerPipeline)
+	{
+		QueuePipelineJob(MoveTemp(Job));
+		return;
+	}
+
+	TArray<FLidarScanRay> Rays;
+	{
+		LIDAR_SCOPE(Directions);
+
+		TArray<FVector> Directions;
+		Directions.SetNumUninitialized(Job.RayCount);
+
+		if (Job.Kind == FLidarScanJob::EKind::Normal)
+		{
+			const FLidarScanPatternTable& Table = *Job.PatternTable;
+			LidarScanPattern::TransformDisk(Table, FLidarDiskTransform::Make(Table, Job.CameraRotation, Job.ScanRadius, Job.Seed), Job.FirstRay, Job.RayCount, Directions.GetData());
+		}
+		else
+		{
+			const FLidarFanTransform Fan = FLidarFanTransform::Make(Job.CameraRotation, Job.VerticalAngle, Job.HorizontalAngle, Job.GetFanRayCount(), Job.Seed);
+			LidarScanPattern::TransformFan(Fan, Job.FirstRay, Job.RayCount, Directions.GetData());
+		}
+
+		Rays.Reserve(Job.RayCount);
+		for (const FVector& Direction : Directions)
+		{
+			Rays.Add({Job.Start, Direction, Job.RaycastLength, Job.Kind == FLidarScanJob::EKind::Full});
+		}
+	}
+
+	TraceRays(Rays);
 }
 
 FVector2D ULidarComponent::GetRandomPointInsideCircle(float Radius)
 {
-	const float a = FMath::RandRange(0.f, 2.f * PI);
-	const float r = FMath::RandRange(0.f, Radius);
+	const float a = ScanStream.FRandRange(0.f, 2.f * PI);
+	const float r = ScanStream.FRandRange(0.f, Radius);
 
 	const float x = FMath::Sqrt(r * Radius) * FMath::Cos(a);
 	const float y = FMath::Sqrt(r * Radius) * FMath::Sin(a);
@@ -125,9 +396,7 @@ void ULidarComponent::AdjustScanRadius(const FInputActionValue& Value)
 
 FLinearColor ULidarComponent::LerpColors(float Distance)
 {
-	// Clamp Alpha to ensure it is between 0.0 and 1.0
-	const float Alpha = FMath::Clamp(Distance / ParticleColorMaxDistance, 0.0f, 1.0f);
-	return FLinearColor::LerpUsingHSV(ParticleColorClose, ParticleColorFar, Alpha);
+	return LidarScan::LerpColors(ParticleColorClose, ParticleColorFar, ParticleColorMaxDistance, Distance);
 }
 
 #pragma region FullScan
@@ -137,68 +406,137 @@ void ULidarComponent::StartFullScan()
 	if (FullScanInProgress)
 		return;
 
-	FullScanCurrentAngle = -FullScanVerticalAngle;
+	FullScanElapsed = 0.f;
+	FullScanNextRow = 0;
+	FullScanRowRay = 0;
 	FullScanInProgress = true;
 
 	if(EnableDebug)
 		GEngine->AddOnScreenDebugMessage(-1, 5.f, FColor::Green, TEXT("STARTED FULL SCAN"));
 }
 
+float ULidarComponent::GetFullScanProgress() const
+{
+	return FullScanInProgress ? static_cast<float>(FullScanNextRow) / FMath::Max(1, FullScanRowCount) : 0.f;
+}
+
+float ULidarComponent::GetFullScanRowAngle(int32 Row) const
+{
+	// Row centers, evenly spread over [-FullScanVerticalAngle, FullScanVerticalAngle]
+	return -FullScanVerticalAngle + 2.f * FullScanVerticalAngle * (Row + 0.5f) / FMath::Max(1, FullScanRowCount);
+}
+
+int32 ULidarComponent::GetFullScanRowsDue() const
+{
+	const int32 RowCount = FMath::Max(1, FullScanRowCount);
+	if (FullScanRate <= 0.f || FullScanVerticalAngle <= 0.f)
+		return RowCount;
+
+	// A row is due once the sweep has passed its center
+	const float SweptFraction = FullScanRate * FullScanElapsed / (2.f * FullScanVerticalAngle);
+	return FMath::Clamp(FMath::FloorToInt32(SweptFraction * RowCount + 0.5f), 0, RowCount);
+}
+
 void ULidarComponent::UpdateFullScan(const float DeltaTime)
 {
+	// Consumed even when idle, so a finished scan's last results don't eat into the next one
+	const double DeferredSeconds = FullScanDeferredSeconds;
+	FullScanDeferredSeconds = 0.0;
+
 	if (FullScanInProgress == false)
 		return;
 
-	if(FullScanCurrentAngle + FullScanRate * DeltaTime >= FullScanVerticalAngle)
+	const int32 RowCount = FMath::Max(1, FullScanRowCount);
+	if (FullScanRayAmount <= 0 || FullScanNextRow >= RowCount)
 	{
 		FullScanInProgress = false;
 		return;
 	}
 
-	FullScanCurrentAngle += FullScanRate * DeltaTime;
+	FullScanElapsed += DeltaTime;
+	const int32 RowsDue = GetFullScanRowsDue();
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double TimeBudget = FullScanTimeBudgetUs * 1e-6;
+	int32 RaysLeft = FullScanRayBudget > 0 ? FullScanRayBudget : MAX_int32;
+	bool bFirstPiece = true;
+
+	// Due rows in order, split wherever a budget runs out and picked up again next frame
+	while (FullScanNextRow < RowsDue && RaysLeft > 0)
+	{
+		int32 PieceRays = FMath::Min(FullScanRayAmount - FullScanRowRay, RaysLeft);
+
+		if (TimeBudget > 0.0)
+		{
+			const double TimeLeft = TimeBudget - DeferredSeconds - (FPlatformTime::Seconds() - StartTime);
+			// Until a ray has been measured, probe with a small piece
+			const int32 Affordable = FullScanSecondsPerRay > 0.0 ? FMath::FloorToInt32(TimeLeft / FullScanSecondsPerRay) : 8;
+			if (Affordable < 1 && bFirstPiece == false)
+				break;
+
+			PieceRays = FMath::Clamp(Affordable, 1, PieceRays);
+		}
+
+		const double PieceStart = FPlatformTime::Seconds();
+		PerformFullScan(GetFullScanRowAngle(FullScanNextRow), FullScanRowRay, PieceRays);
+		if (TraceMode == ELidarTraceMode::Synchronous)
+		{
+			// Elsewhere this only measures queueing, the real cost comes back through ChargeFullScanWork
+			const double SecondsPerRay = (FPlatformTime::Seconds() - PieceStart) / PieceRays;
+			FullScanSecondsPerRay = FullScanSecondsPerRay > 0.0 ? FMath::Lerp(FullScanSecondsPerRay, SecondsPerRay, 0.25) : SecondsPerRay;
+		}
 
+		bFirstPiece = false;
+		RaysLeft -= PieceRays;
+		FullScanRowRay += PieceRays;
+		if (FullScanRowRay >= FullScanRayAmount)
+		{
+			++FullScanNextRow;
+			FullScanRowRay = 0;
+		}
+	}
 
-	PerformFullScan();
+	if (FullScanNextRow >= RowCount)
+	{
+		FullScanInProgress = false;
+	}
 }
 
-void ULidarComponent::PerformFullScan()
+void ULidarComponent::ChargeFullScanWork(double Seconds, int32 RayCount)
 {
-	if (UWorld* const World = GetWorld(); World == nullptr)
+	if (RayCount <= 0)
 		return;
 
-	FHitResult Hit;
+	FullScanDeferredSeconds += Seconds;
+	const double SecondsPerRay = Seconds / RayCount;
+	FullScanSecondsPerRay = FullScanSecondsPerRay > 0.0 ? FMath::Lerp(FullScanSecondsPerRay, SecondsPerRay, 0.25) : SecondsPerRay;
+}
 
-	PositionArray.Empty();
-	ColorArray.Empty();
-	LifetimeArray.Empty();
-	
-	const float HorizontalStep = FullScanHorizontalAngle / static_cast<float>(FullScanRayAmount);
+void ULidarComponent::PerformFullScan(float VerticalAngle, int32 FirstRay, int32 Num)
+{
+	if (UWorld* const World = GetWorld(); World == nullptr || Num <= 0 || bReplayingScans)
+		return;
 
-	for (int i = 0; i < FullScanRayAmount; i++)
+	if (FirstRay == 0)
 	{
-		float BaseYaw = -FullScanHorizontalAngle / 2 + i * HorizontalStep;
-
-		float RandomDeviation = FMath::RandRange(-HorizontalStep / 2, HorizontalStep / 2);
-		float YawDeg = BaseYaw + RandomDeviation;
-
-		const APlayerController* PlayerController = Cast<APlayerController>(Character->GetController());
-		const FRotator CameraRotation = PlayerController->PlayerCameraManager->GetCameraRotation();
-		const FVector StartLocation = GetOwner()->GetActorLocation() + CameraRotation.RotateVector(MuzzleOffset);
-		FVector Direction = GetScanDirection(FullScanCurrentAngle, YawDeg, CameraRotation);
-		if (LineCast(StartLocation, Direction, Hit))
-		{
-			AddParticleData(Hit);
-		}
+		FullScanRowSeed = NextScanSeed();
 	}
-	
-	SetNiagaraParticleData();
+
+	FLidarScanJob Job;
+	Job.Kind = FLidarScanJob::EKind::Full;
+	GetScanPose(Job.Start, Job.CameraRotation);
+	Job.RayCount = Num;
+	Job.FirstRay = FirstRay;
+	Job.FanRayCount = FullScanRayAmount;
+	Job.Seed = FullScanRowSeed;
+	Job.VerticalAngle = VerticalAngle;
+	Job.HorizontalAngle = FullScanHorizontalAngle;
+	RunScanJob(MoveTemp(Job));
 }
 
 FVector ULidarComponent::GetScanDirection(float VerticalAngle, float HorizontalDegrees, FRotator CameraRotation) const
 {
-	const FRotator NewRotation(VerticalAngle, HorizontalDegrees, 0);
-
-	return NewRotation.RotateVector(FRotationMatrix(CameraRotation).GetUnitAxis(EAxis::X));	
+	return LidarScan::ScanDirection(VerticalAngle, HorizontalDegrees, CameraRotation);
 }
 
 
@@ -206,101 +544,1262 @@ FVector ULidarComponent::GetScanDirection(float VerticalAngle, float HorizontalD
 
 void ULidarComponent::AddParticleData(FHitResult& Hit)
 {
-	// Every particle needs a position
-	PositionArray.Add(Hit.Location);
+	ResolveHits(MakeArrayView(&Hit, 1));
+}
+
+void ULidarComponent::ResolveHits(TConstArrayView<FHitResult> Hits)
+{
+	const int32 HitCount = Hits.Num();
+	ScanCounters.AddHits(HitCount);
+
+	HitColors.SetNumUninitialized(HitCount, EAllowShrinking::No);
+	HitLifetimes.SetNumUninitialized(HitCount, EAllowShrinking::No);
+	HitHasCustomData.SetNumUninitialized(HitCount, EAllowShrinking::No);
 
-	if (FCustomParticleData Data; GetParticleDataFromTag(Hit.Component->ComponentTags, Data))
 	{
-		ColorArray.Add(Data.Color);
-		LifetimeArray.Add(Data.Lifetime);
-		return;
+		LIDAR_SCOPE(TagLookup);
+		TagCache.SetDictionary(CustomDataDictionary, CustomDataVersion);
+
+		for (int32 i = 0; i < HitCount; ++i)
+		{
+			FCustomParticleData Data;
+			HitHasCustomData[i] = TagCache.Resolve(Hits[i].GetComponent(), Data);
+			if (HitHasCustomData[i])
+			{
+				HitColors[i] = Data.Color;
+				HitLifetimes[i] = Data.Lifetime;
+			}
+		}
 	}
 
-	// Default behaviour
-	FLinearColor ParticleColor = LerpColors(Hit.Distance);
-	ColorArray.Add(ParticleColor);
-	LifetimeArray.Add(DefaultParticleLifetime);
-}
+	{
+		// Default behaviour
+		LIDAR_SCOPE(Color);
+		if (ColorRamp.IsValid() == false)
+		{
+			RebuildColorRamp();
+		}
+
+		// Same chunking as the pipeline's resolve stage, the ramp is read only
+		const FLidarColorRamp& Ramp = *ColorRamp;
+		const int32 TaskCount = FMath::DivideAndRoundUp(HitCount, PipelineRaysPerTask);
+		ParallelFor(TaskCount, [&](int32 TaskIndex)
+		{
+			const int32 First = TaskIndex * PipelineRaysPerTask;
+			const int32 Last = FMath::Min(First + PipelineRaysPerTask, HitCount);
+			for (int32 i = First; i < Last; ++i)
+			{
+				if (HitHasCustomData[i] == false)
+				{
+					HitColors[i] = Ramp.Colorize(Hits[i]);
+					HitLifetimes[i] = DefaultParticleLifetime;
+				}
+			}
+		});
+	}
 
-bool ULidarComponent::GetParticleDataFromTag(TArray<FName>& Tags, FCustomParticleData& Data)
-{
-	for (FName Tag : Tags)
 	{
-		if(CustomDataDictionary.Contains(Tag) == false)
+		LIDAR_SCOPE(AddPoints);
+		const uint64 AppendedBefore = PointCloud.GetTotalAppended();
+		for (int32 i = 0; i < HitCount; ++i)
 		{
-			continue;
+			AppendPoint(Hits[i].Location, HitColors[i], HitLifetimes[i]);
 		}
+		ScanCounters.AddPoints(static_cast<int32>(PointCloud.GetTotalAppended() - AppendedBefore));
+	}
+}
 
-		Data = CustomDataDictionary[Tag];
-		return true;
+void ULidarComponent::GetColorRampSettings(TArray<FLidarColorStop>& OutStops, FVector2D& OutRange) const
+{
+	OutStops = ColorStops;
+	if (OutStops.Num() == 0)
+	{
+		OutStops.Add({0.f, ParticleColorClose});
+		OutStops.Add({1.f, ParticleColorFar});
+	}
+
+	switch (ColorMode)
+	{
+	case ELidarColorMode::Height:
+		OutRange = HeightColorRange;
+		break;
+	case ELidarColorMode::IncidenceAngle:
+		OutRange = FVector2D(0.f, 90.f);
+		break;
+	default:
+		OutRange = FVector2D(0.f, ParticleColorMaxDistance);
+		break;
 	}
-	return false;
 }
 
+void ULidarComponent::RebuildColorRamp()
+{
+	GetColorRampSettings(ColorRampStops, ColorRampRange);
+	ColorRampMode = ColorMode;
+
+	// Always a fresh instance, a pipeline run may still be reading the old one
+	TSharedPtr<FLidarColorRamp> NewRamp = MakeShared<FLidarColorRamp>();
+	NewRamp->Build(ColorRampStops, ColorRampMode, ColorRampRange.X, ColorRampRange.Y);
+	ColorRamp = NewRamp;
+}
 
-bool ULidarComponent::LineCast(const FVector& Start, const FVector& Direction, FHitResult& Hit) const
+void ULidarComponent::UpdateColorRamp()
 {
-	FCollisionQueryParams QueryParams;
-	QueryParams.AddIgnoredActor(GetOwner());
-	QueryParams.AddIgnoredActor(Character);
+	// Cheap next to a rebuild, catches Blueprint changes to the color properties
+	TArray<FLidarColorStop> Stops;
+	FVector2D Range;
+	GetColorRampSettings(Stops, Range);
 
-	bool bHit = GetWorld()->LineTraceSingleByChannel(Hit, Start, Direction + Direction * RaycastLength, ECC_Camera, QueryParams);
+	if (ColorRamp.IsValid() == false || ColorMode != ColorRampMode || Range != ColorRampRange || Stops != ColorRampStops)
+	{
+		RebuildColorRamp();
+	}
+}
 
-	if (EnableDebug)
+void ULidarComponent::AppendPoint(const FVector& Position, const FLinearColor& Color, float Lifetime)
+{
+	if (bEnableVoxelDeduplication == false)
 	{
-		if (bHit)
-		{
-			DrawDebugSphere(GetWorld(), Hit.Location, 2.f, 2, FColor::Green, false, LineTraceLinger);
-			DrawDebugLine(GetWorld(), Start, Hit.Location, FColor::Green, false, LineTraceLinger);
-		}
-		else
+		PointCloud.Append(Position, Color, Lifetime);
+		return;
+	}
+
+	const FIntVector Voxel = VoxelHash.GetVoxel(Position);
+
+	if (const int32 Slot = VoxelHash.FindSlot(Voxel); Slot != INDEX_NONE)
+	{
+		// Already scanned, already spawned in Niagara. Only the stored point changes
+		PointCloud.AddHit(Slot);
+		if (bVoxelKeepNewestColor)
 		{
-			DrawDebugLine(GetWorld(), Start, Start + Direction * RaycastLength, FColor::Red, false, LineTraceLinger);
+			PointCloud.UpdatePoint(Slot, Color, Lifetime);
+			if (bEnablePointExpiry)
+			{
+				PointExpiry.Track(Slot, Lifetime, GetWorld()->GetTimeSeconds());
+			}
 		}
+		return;
 	}
 
-	return bHit;
+	const int32 Slot = PointCloud.Append(Position, Color, Lifetime);
+	VoxelHash.Assign(Voxel, Slot);
 }
 
-
-
-#pragma region Niagara
-void ULidarComponent::InitializeNiagaraSystem()
+void ULidarComponent::ResizePointCloud(int32 NewCapacity)
 {
-	if (NiagaraSystemAsset)
+	// The data interface reads the points in place on worker ticks, an immediate deactivate waits for those to finish
+	const bool bReallocates = NewCapacity != PointCloud.GetCapacity();
+	const bool bRestart = bReallocates && NiagaraComponent != nullptr && NiagaraComponent->IsActive();
+	if (bRestart)
 	{
-		NiagaraComponent->SetAsset(NiagaraSystemAsset);
-		NiagaraComponent->Activate();
+		NiagaraComponent->DeactivateImmediate();
 	}
-	else
+
+	PointCloud.SetCapacity(NewCapacity);
+
+	// The new instance picks up the cloud from scratch
+	if (bRestart)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("NiagaraSystemAsset is not set on %s"), *GetName());
+		NiagaraComponent->Activate(true);
 	}
 }
 
-void ULidarComponent::SetNiagaraParticleData()
+void ULidarComponent::ClearPointCloud()
 {
-	if (NiagaraComponent)
+	PointCloud.Reset();
+	VoxelHash.Reset(VoxelSize, PointCloud.GetCapacity());
+	UploadCursor = 0;
+
+	if (WorldStore.IsValid())
 	{
-		// We should make these variables exposed to BP maybe, dont like it hardcoded like this
-		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayVector(NiagaraComponent, "ParticlePositions", PositionArray);
-		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayColor(NiagaraComponent, "ParticleColors", ColorArray);
-		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayFloat(NiagaraComponent, "ParticleLifetimes", LifetimeArray);
+		WorldStore->Reset();
+		WorldStoreCursor = 0;
+		WorldStoreGeneration = PointCloud.GetGeneration();
+		WorldStoreRingCells.Reset();
 	}
 }
 
-#pragma endregion
-
-bool ULidarComponent::AttachScanner(ALidarScannerCharacter* TargetCharacter)
+bool ULidarComponent::SavePointCloud(const FString& SlotName, int32 UserIndex)
 {
-	Character = TargetCharacter;
-
-	// Check that the character is valid, and has no weapon component yet
-	if (Character == nullptr || Character->GetInstanceComponents().FindItemByClass<ULidarComponent>())
+	if (IsPersistingPointCloud())
 	{
+		UE_LOG(LogTemp, Warning, TEXT("%s cannot save to %s, a save or load is still running"), *GetName(), *SlotName);
 		return false;
 	}
 
+	// Copied now, later scans are not part of the save
+	FLidarCloudSnapshot Snapshot;
+	Snapshot.Points.Reserve(PointCloud.Num());
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = PointCloud.GetAllSpans(Spans);
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		for (const FLidarPackedPoint& Point : PointCloud.GetPoints().Slice(Spans[i].First, Spans[i].Num))
+		{
+			if (LidarPacking::IsDead(Point) == false)
+			{
+				Snapshot.Points.Add(Point);
+			}
+		}
+	}
+	for (const FVector& Origin : PointCloud.GetChunks().GetOrigins())
+	{
+		Snapshot.ChunkCoords.Add(FLidarChunkTable::GetChunkCoord(Origin));
+	}
+
+	TArray<FCustomParticleData> PreferredEntries;
+	CustomDataDictionary.GenerateValueArray(PreferredEntries);
+
+	CloudSaveSlot = SlotName;
+	CloudSaveUserIndex = UserIndex;
+	CloudSavePointCount = Snapshot.Points.Num();
+	CloudSaveTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Snapshot = MoveTemp(Snapshot), PreferredEntries = MoveTemp(PreferredEntries)]()
+	{
+		TArray<uint8> Bytes;
+		if (LidarCloudArchive::Encode(Snapshot, PreferredEntries, Bytes) == false)
+		{
+			Bytes.Reset();
+		}
+		return Bytes;
+	});
+	return true;
+}
+
+bool ULidarComponent::LoadPointCloud(const FString& SlotName, int32 UserIndex)
+{
+	if (IsPersistingPointCloud())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s cannot load %s, a save or load is still running"), *GetName(), *SlotName);
+		return false;
+	}
+
+	bCloudSlotBusy = true;
+	CloudLoadSlot = SlotName;
+	UGameplayStatics::AsyncLoadGameFromSlot(SlotName, UserIndex, FAsyncLoadGameFromSlotDelegate::CreateWeakLambda(this,
+		[this](const FString& Slot, const int32 User, USaveGame* Loaded)
+		{
+			bCloudSlotBusy = false;
+
+			ULidarCloudSaveGame* CloudSave = Cast<ULidarCloudSaveGame>(Loaded);
+			if (CloudSave == nullptr)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s found no saved point cloud in %s"), *GetName(), *Slot);
+				OnPointCloudLoaded.Broadcast(Slot, false);
+				return;
+			}
+
+			if (CloudSave->MapName != UGameplayStatics::GetCurrentLevelName(this))
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s loading a point cloud saved on %s"), *GetName(), *CloudSave->MapName);
+			}
+
+			CloudLoadTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Bytes = MoveTemp(CloudSave->CloudData)]()
+			{
+				TSharedPtr<FLidarCloudSnapshot> Snapshot = MakeShared<FLidarCloudSnapshot>();
+				return LidarCloudArchive::Decode(Bytes, *Snapshot) ? Snapshot : nullptr;
+			});
+		}));
+	return true;
+}
+
+void ULidarComponent::UpdateCloudPersistence()
+{
+	if (CloudSaveTask.IsValid() && CloudSaveTask.IsCompleted())
+	{
+		TArray<uint8> Bytes = MoveTemp(CloudSaveTask.GetResult());
+		CloudSaveTask = {};
+
+		if (Bytes.Num() == 0)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s could not encode its point cloud for %s"), *GetName(), *CloudSaveSlot);
+			OnPointCloudSaved.Broadcast(CloudSaveSlot, false);
+		}
+		else
+		{
+			ULidarCloudSaveGame* CloudSave = NewObject<ULidarCloudSaveGame>();
+			CloudSave->MapName = UGameplayStatics::GetCurrentLevelName(this);
+			CloudSave->PointCount = CloudSavePointCount;
+			CloudSave->CloudData = MoveTemp(Bytes);
+
+			bCloudSlotBusy = true;
+			UGameplayStatics::AsyncSaveGameToSlot(CloudSave, CloudSaveSlot, CloudSaveUserIndex, FAsyncSaveGameToSlotDelegate::CreateWeakLambda(this,
+				[this](const FString& Slot, const int32 User, bool bSuccess)
+				{
+					bCloudSlotBusy = false;
+					UE_LOG(LogTemp, Log, TEXT("%s %s point cloud slot %s"), *GetName(), bSuccess ? TEXT("saved") : TEXT("failed to save"), *Slot);
+					OnPointCloudSaved.Broadcast(Slot, bSuccess);
+				}));
+		}
+	}
+
+	if (CloudLoadTask.IsValid() && CloudLoadTask.IsCompleted())
+	{
+		const TSharedPtr<FLidarCloudSnapshot> Snapshot = CloudLoadTask.GetResult();
+		CloudLoadTask = {};
+
+		const bool bSuccess = Snapshot.IsValid() && InstallCloudSnapshot(*Snapshot);
+		UE_LOG(LogTemp, Log, TEXT("%s %s point cloud slot %s"), *GetName(), bSuccess ? TEXT("loaded") : TEXT("failed to load"), *CloudLoadSlot);
+		OnPointCloudLoaded.Broadcast(CloudLoadSlot, bSuccess);
+	}
+}
+
+bool ULidarComponent::InstallCloudSnapshot(const FLidarCloudSnapshot& Snapshot)
+{
+	LIDAR_SCOPE(AddPoints);
+
+	ClearPointCloud();
+
+	// A fresh table hands out indices in the order the chunks are added, the saved ChunkIndex values stay valid
+	FLidarChunkTable& Chunks = PointCloud.GetMutableChunks();
+	for (int32 i = 0; i < Snapshot.ChunkCoords.Num(); ++i)
+	{
+		if (Chunks.FindOrAdd(FLidarChunkTable::GetChunkCenter(Snapshot.ChunkCoords[i])) != i)
+		{
+			ClearPointCloud();
+			return false;
+		}
+	}
+
+	// Only the newest points fit if the save came from a larger cloud
+	const int32 First = FMath::Max(0, Snapshot.Points.Num() - PointCloud.GetCapacity());
+	for (int32 i = First; i < Snapshot.Points.Num(); ++i)
+	{
+		const int32 Slot = PointCloud.AppendPacked(Snapshot.Points[i]);
+		if (bEnableVoxelDeduplication && Slot != INDEX_NONE)
+		{
+			VoxelHash.Assign(VoxelHash.GetVoxel(PointCloud.GetPosition(Slot)), Slot);
+		}
+	}
+	return true;
+}
+
+FLidarPoolScannerStats ULidarComponent::GetSharedPoolStats() const
+{
+	const ULidarPointPoolSubsystem* Subsystem = PointPool.Get();
+	return Subsystem ? Subsystem->GetScannerStats(PointPoolHandle) : FLidarPoolScannerStats();
+}
+
+void ULidarComponent::UpdateWorldStore()
+{
+	if (WorldStore.IsValid() == false)
+		return;
+
+	LIDAR_SCOPE(WorldStore);
+
+	if (WorldStoreGeneration != PointCloud.GetGeneration())
+	{
+		WorldStoreGeneration = PointCloud.GetGeneration();
+		WorldStoreCursor = 0;
+	}
+
+	// Points overwritten by the ring before they got here are skipped, a frame never adds close to the capacity
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = PointCloud.GetSpansSince(WorldStoreCursor, Spans);
+	uint64 Appended = PointCloud.GetTotalAppended();
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		Appended -= Spans[i].Num;
+	}
+
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		TConstArrayView<FLidarPackedPoint> Points = PointCloud.GetPoints().Slice(Spans[i].First, Spans[i].Num);
+
+		// A cell seen for the first time has all its points in the ring from here on
+		int32 LastChunkIndex = INDEX_NONE;
+		for (int32 j = 0; j < Points.Num(); ++j)
+		{
+			if (Points[j].ChunkIndex != LastChunkIndex)
+			{
+				LastChunkIndex = Points[j].ChunkIndex;
+				const FIntVector Cell = FLidarChunkTable::GetChunkCoord(PointCloud.GetChunks().GetOrigin(LastChunkIndex));
+				if (WorldStoreRingCells.Contains(Cell) == false)
+				{
+					WorldStoreRingCells.Add(Cell, {PointCloud.GetGeneration(), Appended + j});
+				}
+			}
+		}
+		Appended += Points.Num();
+
+		// Points that expire would come back from the cache with their full lifetime, only permanent ones are kept
+		if (bEnablePointExpiry)
+		{
+			WorldStoreScratch.Reset();
+			for (const FLidarPackedPoint& Point : Points)
+			{
+				if (LidarPacking::UnpackLifetime(Point) >= ExpiryMaxLifetime)
+				{
+					WorldStoreScratch.Add(Point);
+				}
+			}
+			Points = WorldStoreScratch;
+		}
+
+		WorldStore->Add(Points, PointCloud.GetChunks());
+	}
+
+	TArray<FVector, TInlineAllocator<4>> Viewers;
+	for (TActorIterator<ALidarScannerCharacter> It(GetWorld()); It; ++It)
+	{
+		Viewers.Add(It->GetActorLocation());
+	}
+
+	WorldStore->Update(Viewers, WorldStorePageInDistance, WorldStorePageOutDistance, WorldStoreMaxPagingPerFrame,
+		[this](const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)
+		{
+			// Walking back and forth over a cell border pages it in again while the ring still shows all of it
+			const uint64 Oldest = PointCloud.GetTotalAppended() - PointCloud.Num();
+			const FLidarRingCell* RingCell = WorldStoreRingCells.Find(Cell);
+			if (RingCell && RingCell->Generation == PointCloud.GetGeneration() && RingCell->FirstAppended >= Oldest)
+				return;
+
+			// Shown again through the ring. With deduplication, points the ring still holds are not added twice
+			WorldStoreRingCells.Add(Cell, {PointCloud.GetGeneration(), PointCloud.GetTotalAppended()});
+			for (const FLidarStoredPoint& Point : Points)
+			{
+				const FVector Position = FLidarWorldStore::GetPosition(Cell, Point);
+				if (bEnableVoxelDeduplication == false)
+				{
+					PointCloud.Append(Position, Point.Color.ReinterpretAsLinear(), Point.Lifetime);
+					continue;
+				}
+
+				const FIntVector Voxel = VoxelHash.GetVoxel(Position);
+				if (VoxelHash.FindSlot(Voxel) == INDEX_NONE)
+				{
+					VoxelHash.Assign(Voxel, PointCloud.Append(Position, Point.Color.ReinterpretAsLinear(), Point.Lifetime));
+				}
+			}
+		});
+
+	// What came back is already stored
+	WorldStoreCursor = PointCloud.GetTotalAppended();
+}
+
+void ULidarComponent::UpdatePointExpiry()
+{
+	if (bEnablePointExpiry == false)
+		return;
+
+	LIDAR_SCOPE(PointExpiry);
+
+	if (ExpiryGeneration != PointCloud.GetGeneration())
+	{
+		ExpiryGeneration = PointCloud.GetGeneration();
+		ExpiryCursor = 0;
+		PointExpiry.Reset(PointCloud.GetCapacity(), ExpiryBucketSeconds, ExpiryMaxLifetime);
+	}
+
+	// Lifetimes count from the frame the points reach the cloud, the frame Niagara gets them
+	const double Now = GetWorld()->GetTimeSeconds();
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = PointCloud.GetSpansSince(ExpiryCursor, Spans);
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		for (int32 Slot = Spans[i].First; Slot < Spans[i].First + Spans[i].Num; ++Slot)
+		{
+			PointExpiry.Track(Slot, PointCloud.GetLifetime(Slot), Now);
+		}
+	}
+	ExpiryCursor = PointCloud.GetTotalAppended();
+
+	// Moving points under a running export could hand some of them over twice, it only kills until the export is done
+	PointExpiry.Update(Now, PointCloud, bEnableVoxelDeduplication ? &VoxelHash : nullptr, ExpiryTimeBudgetUs * 1e-6,
+		PointExporter.IsValid() ? 0 : ExpiryCompactionZone, ExpiryMaxChangedSlots);
+}
+
+bool ULidarComponent::ExportPointCloud(const FString& File, ELidarExportFormat Format)
+{
+	if (PointExporter.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s is still exporting to %s"), *GetName(), *PointExporter->GetPath());
+		return false;
+	}
+
+	PointExporter = MakeUnique<FLidarPointExporter>(File, Format);
+	ExportCursor = PointCloud.GetTotalAppended() - PointCloud.Num();
+	ExportEndCursor = PointCloud.GetTotalAppended();
+	ExportGeneration = PointCloud.GetGeneration();
+	ExportChunkCount = 0;
+	ExportChunkGeneration = PointCloud.GetChunkGeneration();
+	return true;
+}
+
+void ULidarComponent::UpdateExport(int32 MaxPoints)
+{
+	if (PointExporter.IsValid() == false)
+		return;
+
+	if (PointExporter->IsFinishing() == false)
+	{
+		LIDAR_SCOPE(ExportHandOff);
+
+		if (PointCloud.GetGeneration() != ExportGeneration)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s point cloud was cleared during export, %s ends early"), *GetName(), *PointExporter->GetPath());
+			ExportCursor = ExportEndCursor;
+		}
+
+		// The ring may have overwritten points that were not handed off yet, they are lost
+		const uint64 Oldest = PointCloud.GetTotalAppended() - PointCloud.Num();
+		if (ExportCursor < Oldest)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s overwrote %llu points before they were exported, raise ExportPointsPerFrame"), *GetName(), Oldest - ExportCursor);
+			ExportCursor = FMath::Min(Oldest, ExportEndCursor);
+		}
+
+		const int32 BatchNum = static_cast<int32>(FMath::Min<uint64>(ExportEndCursor - ExportCursor, FMath::Max(1, MaxPoints)));
+		if (BatchNum > 0)
+		{
+			// One copy of the packed points, the worker unpacks and encodes them
+			TSharedRef<FLidarExportBatch> Batch = MakeShared<FLidarExportBatch>();
+			const TConstArrayView<FVector> Origins = PointCloud.GetChunks().GetOrigins();
+			if (ExportChunkGeneration != PointCloud.GetChunkGeneration())
+			{
+				// Compacted, the exporter's copy no longer matches the chunk indices
+				ExportChunkGeneration = PointCloud.GetChunkGeneration();
+				ExportChunkCount = 0;
+				Batch->bResetChunkOrigins = true;
+			}
+			Batch->NewChunkOrigins = Origins.RightChop(ExportChunkCount);
+			ExportChunkCount = Origins.Num();
+			Batch->Points.Reserve(BatchNum);
+
+			// Expired points keep their slot until it is reused, they are left out
+			int32 Taken = 0;
+			FLidarPointSpan Spans[2];
+			const int32 SpanCount = PointCloud.GetSpansSince(ExportCursor, Spans);
+			for (int32 i = 0; i < SpanCount && Taken < BatchNum; ++i)
+			{
+				const int32 Take = FMath::Min(Spans[i].Num, BatchNum - Taken);
+				for (const FLidarPackedPoint& Point : PointCloud.GetPoints().Slice(Spans[i].First, Take))
+				{
+					if (LidarPacking::IsDead(Point) == false)
+					{
+						Batch->Points.Add(Point);
+					}
+				}
+				Taken += Take;
+			}
+
+			ExportCursor += Taken;
+			PointExporter->Enqueue(Batch);
+		}
+
+		if (ExportCursor >= ExportEndCursor)
+		{
+			PointExporter->Finish();
+		}
+	}
+
+	if (PointExporter->IsDone())
+	{
+		if (PointExporter->HasFailed())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s could not write %s"), *GetName(), *PointExporter->GetPath());
+		}
+		else
+		{
+			UE_LOG(LogTemp, Log, TEXT("%s exported %lld points to %s"), *GetName(), PointExporter->GetPointsWritten(), *PointExporter->GetPath());
+		}
+		PointExporter.Reset();
+	}
+}
+
+void ULidarComponent::NotifyCustomDataChanged()
+{
+	++CustomDataVersion;
+}
+
+void ULidarComponent::InvalidateTagCache(UPrimitiveComponent* Component)
+{
+	if (Component == nullptr)
+	{
+		// Same effect as a dictionary change, both caches start over on their next use
+		NotifyCustomDataChanged();
+		return;
+	}
+
+	TagCache.Invalidate(Component);
+}
+
+bool ULidarComponent::GetParticleDataFromTag(TArray<FName>& Tags, FCustomParticleData& Data)
+{
+	if (const FCustomParticleData* Found = LidarScan::FindCustomData(CustomDataDictionary, Tags))
+	{
+		Data = *Found;
+		return true;
+	}
+	return false;
+}
+
+
+FVector ULidarComponent::GetTraceEnd(const FLidarScanRay& Ray) const
+{
+	return LidarScan::TraceEnd(Ray.Start, Ray.Direction, Ray.Length);
+}
+
+FCollisionQueryParams ULidarComponent::GetTraceQueryParams() const
+{
+	FCollisionQueryParams QueryParams;
+	QueryParams.AddIgnoredActor(GetOwner());
+	QueryParams.AddIgnoredActor(Character);
+	return QueryParams;
+}
+
+void ULidarComponent::DrawTraceDebug(const FLidarScanRay& Ray, const FHitResult* Hit) const
+{
+	if (EnableDebug == false)
+		return;
+
+	if (Hit)
+	{
+		DrawDebugSphere(GetWorld(), Hit->Location, 2.f, 2, FColor::Green, false, LineTraceLinger);
+		DrawDebugLine(GetWorld(), Ray.Start, Hit->Location, FColor::Green, false, LineTraceLinger);
+	}
+	else
+	{
+		DrawDebugLine(GetWorld(), Ray.Start, Ray.Start + Ray.Direction * Ray.Length, FColor::Red, false, LineTraceLinger);
+	}
+}
+
+void ULidarComponent::DrawTraceDebug(TConstArrayView<FLidarScanRay> Rays) const
+{
+	if (EnableDebug == false)
+		return;
+
+	LIDAR_SCOPE(DebugDraw);
+	// TraceHitRays is in ray order, walk both together
+	for (int32 RayIndex = 0, HitIndex = 0; RayIndex < Rays.Num(); ++RayIndex)
+	{
+		const bool bHit = TraceHitRays.IsValidIndex(HitIndex) && TraceHitRays[HitIndex] == RayIndex;
+		DrawTraceDebug(Rays[RayIndex], bHit ? &TraceHits[HitIndex++] : nullptr);
+	}
+}
+
+#pragma region Tracing
+
+void ULidarComponent::TraceRays(const TArray<FLidarScanRay>& Rays)
+{
+	if (TraceMode == ELidarTraceMode::AsyncBatched)
+	{
+		// Submitted at the end of this tick, picked up in GatherAsyncTraces next frame
+		PendingAsyncRays.Append(Rays);
+
+		// A backlog the budget can't keep up with goes stale, keep the newest rays
+		const int32 Excess = PendingAsyncRays.Num() - FMath::Max(MaxPendingAsyncRays, 1);
+		if (Excess > 0)
+		{
+			PendingAsyncRays.RemoveAt(0, Excess, EAllowShrinking::No);
+			ScanCounters.AddDroppedRays(Excess);
+		}
+		return;
+	}
+
+	ScanCounters.AddRays(Rays.Num());
+	TraceHits.Reset();
+	TraceHitRays.Reset();
+	{
+		LIDAR_SCOPE(Trace);
+		const FCollisionQueryParams QueryParams = GetTraceQueryParams();
+
+		FHitResult Hit;
+		for (int32 RayIndex = 0; RayIndex < Rays.Num(); ++RayIndex)
+		{
+			const FLidarScanRay& Ray = Rays[RayIndex];
+			if (GetWorld()->LineTraceSingleByChannel(Hit, Ray.Start, GetTraceEnd(Ray), ECC_Camera, QueryParams))
+			{
+				TraceHits.Add(Hit);
+				TraceHitRays.Add(RayIndex);
+			}
+		}
+	}
+
+	DrawTraceDebug(Rays);
+	ResolveHits(TraceHits);
+
+	SetNiagaraParticleData();
+}
+
+void ULidarComponent::SubmitAsyncTraces()
+{
+	if (PendingAsyncRays.IsEmpty())
+		return;
+
+	UWorld* World = GetWorld();
+	if (World == nullptr)
+		return;
+
+	LIDAR_SCOPE(Trace);
+	const FCollisionQueryParams QueryParams = GetTraceQueryParams();
+	ULidarTraceBudgetSubsystem* Budget = World->GetSubsystem<ULidarTraceBudgetSubsystem>();
+	const int32 SubmitCount = Budget ? Budget->RequestRays(this, PendingAsyncRays.Num()) : PendingAsyncRays.Num();
+	if (SubmitCount <= 0)
+		return;
+
+	ScanCounters.AddRays(SubmitCount);
+
+	InFlightTraces.Reserve(InFlightTraces.Num() + SubmitCount);
+	for (int32 i = 0; i < SubmitCount; ++i)
+	{
+		const FLidarScanRay& Ray = PendingAsyncRays[i];
+
+		FLidarInFlightTrace& Trace = InFlightTraces.AddDefaulted_GetRef();
+		Trace.Ray = Ray;
+		Trace.Handle = World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Ray.Start, GetTraceEnd(Ray), ECC_Camera, QueryParams);
+	}
+
+	// Whatever is left over goes out next frame, in the same order
+	PendingAsyncRays.RemoveAt(0, SubmitCount, EAllowShrinking::No);
+}
+
+void ULidarComponent::GatherAsyncTraces()
+{
+	if (InFlightTraces.IsEmpty())
+		return;
+
+	UWorld* World = GetWorld();
+	if (World == nullptr)
+		return;
+
+	const double GatherStart = FPlatformTime::Seconds();
+	int32 FullScanRays = 0;
+
+	TArray<FLidarScanRay> Rays;
+	TraceHits.Reset();
+	TraceHitRays.Reset();
+	{
+		LIDAR_SCOPE(Trace);
+
+		FTraceDatum Datum;
+		for (const FLidarInFlightTrace& Trace : InFlightTraces)
+		{
+			// Async trace data only lives for one frame, a missing result means the trace was dropped
+			if (World->QueryTraceData(Trace.Handle, Datum) == false)
+				continue;
+
+			if (Datum.OutHits.Num() > 0 && Datum.OutHits[0].bBlockingHit)
+			{
+				TraceHits.Add(Datum.OutHits[0]);
+				TraceHitRays.Add(Rays.Num());
+			}
+			Rays.Add(Trace.Ray);
+			FullScanRays += Trace.Ray.bFullScan ? 1 : 0;
+		}
+	}
+
+	InFlightTraces.Reset();
+
+	DrawTraceDebug(Rays);
+	ResolveHits(TraceHits);
+
+	SetNiagaraParticleData();
+
+	// The traces themselves ran on the physics threads, what lands on this frame is gathering and resolving them
+	if (FullScanRays > 0)
+	{
+		ChargeFullScanWork((FPlatformTime::Seconds() - GatherStart) * FullScanRays / Rays.Num(), FullScanRays);
+	}
+}
+
+#pragma region Session
+
+void ULidarComponent::StartScanRecording()
+{
+	RecordingSession = FLidarScanSession();
+	RecordingSession.MapName = GetWorld()->GetMapName();
+	RecordingStartTime = GetWorld()->GetTimeSeconds();
+	bRecordingScans = true;
+}
+
+bool ULidarComponent::StopScanRecording(const FString& File)
+{
+	if (bRecordingScans == false)
+		return false;
+
+	bRecordingScans = false;
+
+	if (RecordingSession.SaveToFile(File) == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s could not save scan session %s"), *GetName(), *FLidarScanSession::ResolvePath(File));
+		return false;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("%s saved %d scans to %s"), *GetName(), RecordingSession.Records.Num(), *FLidarScanSession::ResolvePath(File));
+	return true;
+}
+
+bool ULidarComponent::StartScanReplay(const FString& File, bool bAsFastAsPossible)
+{
+	if (ReplaySession.LoadFromFile(File) == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s could not load scan session %s"), *GetName(), *FLidarScanSession::ResolvePath(File));
+		return false;
+	}
+
+	if (ReplaySession.MapName != GetWorld()->GetMapName())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Scan session %s was recorded on %s, replaying on %s"), *File, *ReplaySession.MapName, *GetWorld()->GetMapName());
+	}
+
+	bReplayingScans = true;
+	bReplayAsFastAsPossible = bAsFastAsPossible;
+	ReplayStartTime = GetWorld()->GetTimeSeconds();
+	ReplayIndex = 0;
+	FullScanInProgress = false;
+	return true;
+}
+
+void ULidarComponent::StopScanReplay()
+{
+	bReplayingScans = false;
+	ReplaySession = FLidarScanSession();
+}
+
+void ULidarComponent::UpdateScanReplay()
+{
+	if (bReplayingScans == false)
+		return;
+
+	const TArray<FLidarScanRecord>& Records = ReplaySession.Records;
+
+	// Fast mode runs one recorded frame per tick, scans of the same frame share a time stamp
+	const float ReplayTime = bReplayAsFastAsPossible
+		? (Records.IsValidIndex(ReplayIndex) ? Records[ReplayIndex].Time : 0.f)
+		: static_cast<float>(GetWorld()->GetTimeSeconds() - ReplayStartTime);
+
+	for (; ReplayIndex < Records.Num() && Records[ReplayIndex].Time <= ReplayTime; ++ReplayIndex)
+	{
+		const FLidarScanRecord& Record = Records[ReplayIndex];
+
+		FLidarScanJob Job = Record.ToJob();
+		if (Job.Kind == FLidarScanJob::EKind::Normal)
+		{
+			Job.PatternTable = GetScanPatternTable(Record.Pattern, Record.PatternRayCount > 0 ? Record.PatternRayCount : Record.RayCount);
+		}
+		RunScanJob(MoveTemp(Job));
+	}
+
+	if (ReplayIndex >= Records.Num())
+	{
+		UE_LOG(LogTemp, Log, TEXT("%s finished replaying %d scans"), *GetName(), Records.Num());
+		StopScanReplay();
+	}
+}
+
+#pragma endregion
+
+#pragma region Replication
+
+bool ULidarComponent::IsLocallyControlled() const
+{
+	return Character != nullptr && Character->IsLocallyControlled();
+}
+
+bool ULidarComponent::IsNetworked() const
+{
+	return ReplicationMode != ELidarReplicationMode::None && GetNetMode() != NM_Standalone;
+}
+
+void ULidarComponent::ReplicateScanJob(FLidarScanJob& Job)
+{
+	const bool bAuthority = GetOwner()->HasAuthority();
+
+	// Other players' scanners on a client only trace what the server relays
+	if (bAuthority == false && IsLocallyControlled() == false)
+		return;
+
+	// Traced from the pose and length the receivers get, so their rays match ours
+	FLidarScanRecord Record = FLidarScanRecord::FromJob(Job, 0.f);
+	const int32 Bytes = FLidarNetScan::Quantize(Record);
+	Job.Start = Record.Start;
+	Job.CameraRotation = Record.Rotation;
+	Job.RaycastLength = Record.RaycastLength;
+
+	if (bAuthority == false)
+	{
+		FLidarNetScan Scan;
+		Scan.Record = Record;
+		ServerRunScan(Scan);
+	}
+	else if (ReplicationMode == ELidarReplicationMode::ScanSeeds)
+	{
+		if (ULidarReplicationSubsystem* Subsystem = GetWorld()->GetSubsystem<ULidarReplicationSubsystem>())
+		{
+			Subsystem->QueueScan(this, Record, Bytes);
+		}
+	}
+}
+
+void ULidarComponent::ServerRunScan_Implementation(const FLidarNetScan& Scan)
+{
+	FLidarScanRecord Record = Scan.Record;
+	const bool bNormal = Record.Kind == static_cast<uint8>(FLidarScanJob::EKind::Normal);
+
+	// Shape parameters are held to the server's own settings, a client can't widen or lengthen its scans
+	Record.RaycastLength = FMath::Clamp(Record.RaycastLength, 0.f, RaycastLength);
+	Record.ScanRadius = FMath::Clamp(Record.ScanRadius, ScanRadiusMin, ScanRadiusMax);
+	Record.VerticalAngle = FMath::Clamp(Record.VerticalAngle, -FullScanVerticalAngle, FullScanVerticalAngle);
+	Record.HorizontalAngle = FMath::Clamp(Record.HorizontalAngle, 0.f, FullScanHorizontalAngle);
+
+	// The client picks pose and seed, how much it may trace is up to the server's settings
+	const int32 MaxRays = bNormal ? GetContinuousPatternRays() : FullScanRayAmount;
+	const int32 TableRays = bNormal ? Record.PatternRayCount : Record.FanRayCount;
+
+	FVector Start;
+	FRotator Rotation;
+	GetScanPose(Start, Rotation);
+
+	if (Record.RayCount > MaxRays || TableRays > MaxRays || FVector::Dist(Start, Record.Start) > NetMaxPoseError)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s rejected a client scan of %d rays, %.0f cm from the server's pose"), *GetName(), Record.RayCount, FVector::Dist(Start, Record.Start));
+		return;
+	}
+
+	// Reliable RPCs arrive however fast the client sends them, the connection's ray budget decides what gets traced
+	const AActor* NetOwner = GetOwner() ? GetOwner()->GetNetOwner() : nullptr;
+	ULidarNetRelayComponent* Relay = NetOwner ? NetOwner->FindComponentByClass<ULidarNetRelayComponent>() : nullptr;
+	if (Relay == nullptr || Relay->ConsumeClientRays(Record.RayCount) == false)
+	{
+		UE_LOG(LogTemp, Verbose, TEXT("%s rejected a client scan of %d rays over the connection's ray budget"), *GetName(), Record.RayCount);
+		return;
+	}
+
+	FLidarScanJob Job = Record.ToJob();
+	if (bNormal)
+	{
+		Job.PatternTable = GetScanPatternTable(Record.Pattern, Record.PatternRayCount > 0 ? Record.PatternRayCount : Record.RayCount);
+	}
+	RunScanJob(MoveTemp(Job));
+}
+
+void ULidarComponent::ReceiveNetworkScans(TConstArrayView<FLidarNetScan> Scans)
+{
+	TGuardValue<bool> ApplyingGuard(bApplyingNetworkScan, true);
+
+	for (const FLidarNetScan& Scan : Scans)
+	{
+		FLidarScanJob Job = Scan.Record.ToJob();
+		if (Job.Kind == FLidarScanJob::EKind::Normal)
+		{
+			Job.PatternTable = GetScanPatternTable(Scan.Record.Pattern, Scan.Record.PatternRayCount > 0 ? Scan.Record.PatternRayCount : Scan.Record.RayCount);
+		}
+		RunScanJob(MoveTemp(Job));
+	}
+}
+
+int32 ULidarComponent::ReceiveNetworkPoints(TConstArrayView<uint8> Batch)
+{
+	const uint64 AppendedBefore = PointCloud.GetTotalAppended();
+	int32 Count = 0;
+
+	const bool bValid = LidarNetCodec::DecodePoints(Batch, [this, &Count](const FVector& Position, const FColor& Color, float Lifetime)
+	{
+		AppendPoint(Position, Color.ReinterpretAsLinear(), Lifetime);
+		++Count;
+	});
+
+	if (bValid == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s received a malformed point batch of %d bytes"), *GetName(), Batch.Num());
+	}
+
+	ScanCounters.AddPoints(static_cast<int32>(PointCloud.GetTotalAppended() - AppendedBefore));
+	return Count;
+}
+
+void ULidarComponent::UpdateNetPoints()
+{
+	if (ReplicationMode != ELidarReplicationMode::Points || IsNetworked() == false || GetOwner()->HasAuthority() == false)
+		return;
+
+	ULidarReplicationSubsystem* Subsystem = GetWorld()->GetSubsystem<ULidarReplicationSubsystem>();
+	if (Subsystem == nullptr)
+		return;
+
+	if (NetPointGeneration != PointCloud.GetGeneration())
+	{
+		NetPointGeneration = PointCloud.GetGeneration();
+		NetPointCursor = 0;
+	}
+
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = PointCloud.GetSpansSince(NetPointCursor, Spans);
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		TConstArrayView<FLidarPackedPoint> Points = PointCloud.GetPoints().Slice(Spans[i].First, Spans[i].Num);
+		while (Points.Num() > 0)
+		{
+			TArray<uint8> Batch;
+			const int32 Count = LidarNetCodec::EncodePoints(Points, PointCloud.GetChunks(), NetPointQuantization, NetPointBatchBytes, Batch);
+			if (Count == 0)
+				break;
+
+			Subsystem->QueuePoints(this, MoveTemp(Batch), Count, LidarPacking::UnpackPosition(Points[0], PointCloud.GetChunks()));
+			Points = Points.RightChop(Count);
+		}
+	}
+
+	NetPointCursor = PointCloud.GetTotalAppended();
+}
+
+#pragma endregion
+
+#pragma region Stats
+
+FLidarScanCounters ULidarComponent::GetScanCounters() const
+{
+	FLidarScanCounters Counters = ScanCounters;
+	Counters.PointsUploaded += GpuUploadedPoints.load(std::memory_order_relaxed);
+	Counters.BytesUploaded += GpuUploadedBytes.load(std::memory_order_relaxed);
+	return Counters;
+}
+
+void ULidarComponent::ResetScanCounters()
+{
+	ScanCounters = FLidarScanCounters();
+	GpuUploadedPoints = 0;
+	GpuUploadedBytes = 0;
+}
+
+void ULidarComponent::CountGpuUpload(int32 Points, int64 Bytes)
+{
+	GpuUploadedPoints.fetch_add(Points, std::memory_order_relaxed);
+	GpuUploadedBytes.fetch_add(Bytes, std::memory_order_relaxed);
+	LidarStats::CountUpload(Points, Bytes);
+}
+
+#pragma endregion
+
+FLidarPointStyle ULidarComponent::MakePointStyle() const
+{
+	FLidarPointStyle Style;
+	Style.ColorRamp = ColorRamp;
+	Style.DefaultLifetime = DefaultParticleLifetime;
+	return Style;
+}
+
+void ULidarComponent::QueuePipelineJob(FLidarScanJob&& Job)
+{
+	PendingPipelineJobs.Add(MoveTemp(Job));
+}
+
+void ULidarComponent::LaunchPipeline()
+{
+	// A busy pipeline keeps the jobs queued, they go out together with the next frame's scans
+	if (PendingPipelineJobs.IsEmpty() || ScanPipeline.IsBusy())
+		return;
+
+	FLidarScanPipeline::FSettings Settings;
+	Settings.World = GetWorld();
+	Settings.QueryParams = GetTraceQueryParams();
+	Settings.RaysPerTask = PipelineRaysPerTask;
+	Settings.bRecordDebugTraces = EnableDebug;
+	Settings.Style = MakePointStyle();
+
+	ScanPipeline.Launch(MoveTemp(PendingPipelineJobs), MoveTemp(Settings));
+	PendingPipelineJobs.Reset();
+}
+
+void ULidarComponent::SwapPipelineResults()
+{
+	if (ScanPipeline.TrySwap(ScanResults) == false)
+		return;
+
+	const FLidarPipelineStats& Stats = ScanPipeline.GetStats();
+	ScanCounters.AddRays(Stats.RayCount);
+	ScanCounters.AddHits(Stats.HitCount);
+
+	// The run's worker time, the full scan's share of it by ray count
+	if (Stats.FullScanRayCount > 0)
+	{
+		ChargeFullScanWork(Stats.TotalMs * 1e-3 * Stats.FullScanRayCount / Stats.RayCount, Stats.FullScanRayCount);
+	}
+
+	{
+		// Hit components are only safe to look at here, the workers just carried them along
+		LIDAR_SCOPE(TagLookup);
+		TagCache.SetDictionary(CustomDataDictionary, CustomDataVersion);
+		for (int32 i = 0; i < ScanResults.HitComponents.Num(); ++i)
+		{
+			if (FCustomParticleData Data; TagCache.Resolve(ScanResults.HitComponents[i].Get(), Data))
+			{
+				ScanResults.Colors[i] = Data.Color;
+				ScanResults.Lifetimes[i] = Data.Lifetime;
+			}
+		}
+	}
+
+	{
+		LIDAR_SCOPE(AddPoints);
+		const uint64 AppendedBefore = PointCloud.GetTotalAppended();
+		if (bEnableVoxelDeduplication)
+		{
+			for (int32 i = 0; i < ScanResults.Num(); ++i)
+			{
+				AppendPoint(ScanResults.Positions[i], ScanResults.Colors[i], ScanResults.Lifetimes[i]);
+			}
+		}
+		else
+		{
+			PointCloud.Append(ScanResults.Positions, ScanResults.Colors, ScanResults.Lifetimes);
+		}
+		ScanCounters.AddPoints(static_cast<int32>(PointCloud.GetTotalAppended() - AppendedBefore));
+	}
+
+	if (EnableDebug)
+	{
+		LIDAR_SCOPE(DebugDraw);
+		for (const FLidarDebugTrace& Trace : ScanResults.DebugTraces)
+		{
+			const FColor Color = Trace.bHit ? FColor::Green : FColor::Red;
+			if (Trace.bHit)
+			{
+				DrawDebugSphere(GetWorld(), Trace.End, 2.f, 2, Color, false, LineTraceLinger);
+			}
+			DrawDebugLine(GetWorld(), Trace.Start, Trace.End, Color, false, LineTraceLinger);
+		}
+
+		GEngine->AddOnScreenDebugMessage(static_cast<uint64>(GetUniqueID()), 0.f, FColor::Cyan,
+			FString::Printf(TEXT("Lidar pipeline: %d rays / %d tasks | dir %.2f trace %.2f resolve %.2f pack %.2f | total %.2f ms"),
+				Stats.RayCount, Stats.TaskCount, Stats.DirectionsMs, Stats.TraceMs, Stats.ResolveMs, Stats.PackMs, Stats.TotalMs));
+	}
+
+	SetNiagaraParticleData();
+}
+
+#pragma endregion
+
+#pragma region Niagara
+void ULidarComponent::InitializeNiagaraSystem()
+{
+	// The pool renders this scanner, the own system stays inactive
+	if (PointPool.IsValid())
+		return;
+
+	if (NiagaraSystemAsset)
+	{
+		NiagaraComponent->SetAsset(NiagaraSystemAsset);
+		NiagaraComponent->Activate();
+
+		ResolveNiagaraBindings();
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("NiagaraSystemAsset is not set on %s"), *GetName());
+	}
+}
+
+void ULidarComponent::SetNiagaraParticleData()
+{
+	if (PointPool.IsValid())
+		return;
+
+	if (bUseDeltaUpload)
+	{
+		// Coalesced with every other scan this frame, sent at the end of TickComponent
+		bDeltaUploadPending = true;
+		return;
+	}
+
+	if (NiagaraComponent)
+	{
+		LIDAR_SCOPE(NiagaraUpload);
+
+		// Only points appended since the last upload, the cloud itself holds everything else
+		UploadBuffer.Reset();
+
+		FLidarPointSpan Spans[2];
+		const int32 SpanCount = PointCloud.GetSpansSince(UploadCursor, Spans);
+		for (int32 i = 0; i < SpanCount; ++i)
+		{
+			PointCloud.UnpackSpan(Spans[i], UploadBuffer.Positions, UploadBuffer.Colors, UploadBuffer.Lifetimes);
+		}
+		UploadCursor = PointCloud.GetTotalAppended();
+
+		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayVector(NiagaraComponent, PositionsParameterName, UploadBuffer.Positions);
+		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayColor(NiagaraComponent, ColorsParameterName, UploadBuffer.Colors);
+		UNiagaraDataInterfaceArrayFunctionLibrary::SetNiagaraArrayFloat(NiagaraComponent, LifetimesParameterName, UploadBuffer.Lifetimes);
+
+		ScanCounters.AddUpload(UploadBuffer.Num(), static_cast<int64>(UploadBuffer.Num()) * (UploadBuffer.Positions.GetTypeSize() + UploadBuffer.Colors.GetTypeSize() + UploadBuffer.Lifetimes.GetTypeSize()));
+	}
+}
+
+void ULidarComponent::ResolveNiagaraBindings()
+{
+	PositionsDataInterface = UNiagaraFunctionLibrary::GetDataInterface<UNiagaraDataInterfaceArrayFloat3>(NiagaraComponent, PositionsParameterName);
+	ColorsDataInterface = UNiagaraFunctionLibrary::GetDataInterface<UNiagaraDataInterfaceArrayColor>(NiagaraComponent, ColorsParameterName);
+	LifetimesDataInterface = UNiagaraFunctionLibrary::GetDataInterface<UNiagaraDataInterfaceArrayFloat>(NiagaraComponent, LifetimesParameterName);
+	NewPointCountVariable = FNiagaraVariable(FNiagaraTypeDefinition::GetIntDef(), FName(FString(TEXT("User.")) + NewPointCountParameterName.ToString()));
+	LastNewPointCount = 0;
+
+	if (bUseDeltaUpload && (PositionsDataInterface.IsValid() == false || ColorsDataInterface.IsValid() == false || LifetimesDataInterface.IsValid() == false))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s could not resolve the Niagara array parameters for delta upload"), *GetName());
+	}
+}
+
+void ULidarComponent::FlushDeltaUpload()
+{
+	if (bUseDeltaUpload == false || NiagaraComponent == nullptr || PointPool.IsValid())
+		return;
+
+	UNiagaraDataInterfaceArrayFloat3* PositionsDI = PositionsDataInterface.Get();
+	UNiagaraDataInterfaceArrayColor* ColorsDI = ColorsDataInterface.Get();
+	UNiagaraDataInterfaceArrayFloat* LifetimesDI = LifetimesDataInterface.Get();
+	if (PositionsDI == nullptr || ColorsDI == nullptr || LifetimesDI == nullptr)
+		return;
+
+	LIDAR_SCOPE(NiagaraUpload);
+
+	int32 NewPointCount = 0;
+	if (bDeltaUploadPending)
+	{
+		// Only this frame's spans, the cost follows the new points, not the cloud
+		UploadBuffer.Reset();
+
+		FLidarPointSpan Spans[2];
+		const int32 SpanCount = PointCloud.GetSpansSince(UploadCursor, Spans);
+		for (int32 i = 0; i < SpanCount; ++i)
+		{
+			PointCloud.UnpackSpan(Spans[i], UploadBuffer.Positions, UploadBuffer.Colors, UploadBuffer.Lifetimes);
+			NewPointCount += Spans[i].Num;
+		}
+		UploadCursor = PointCloud.GetTotalAppended();
+		bDeltaUploadPending = false;
+
+		// Through the runtime proxies, they take the array lock and hand the data to the render thread.
+		// Same calls as SetNiagaraArray*, minus the parameter lookup by name
+		PositionsDI->SetVariantArrayData(MakeArrayView(UploadBuffer.Positions));
+		ColorsDI->SetVariantArrayData(MakeArrayView(UploadBuffer.Colors));
+		LifetimesDI->SetVariantArrayData(MakeArrayView(UploadBuffer.Lifetimes));
+
+		ScanCounters.AddUpload(NewPointCount, static_cast<int64>(NewPointCount) * (UploadBuffer.Positions.GetTypeSize() + UploadBuffer.Colors.GetTypeSize() + UploadBuffer.Lifetimes.GetTypeSize()));
+	}
+
+	// Frames without new points still have to reset the spawn count once
+	if (NewPointCount != LastNewPointCount)
+	{
+		NiagaraComponent->GetOverrideParameters().SetParameterValue(NewPointCount, NewPointCountVariable, true);
+		LastNewPointCount = NewPointCount;
+	}
+}
+
+#pragma endregion
+
+bool ULidarComponent::AttachScanner(ALidarScannerCharacter* TargetCharacter)
+{
+	Character = TargetCharacter;
+
+	// Check that the character is valid, and has no weapon component yet
+	if (Character == nullptr || Character->GetInstanceComponents().FindItemByClass<ULidarComponent>())
+	{
+		return false;
+	}
+
+	// The weapon joins the character's connection, scans go to the server through it
+	GetOwner()->SetOwner(Character);
+
 	// Attach the weapon to the First Person Character
 	FAttachmentTransformRules AttachmentRules(EAttachmentRule::SnapToTarget, true);
 	AttachToComponent(Character->GetMesh1P(), AttachmentRules, FName(TEXT("GripPoint")));
@@ -317,7 +1816,10 @@ bool ULidarComponent::AttachScanner(ALidarScannerCharacter* TargetCharacter)
 		if (UEnhancedInputComponent* EnhancedInputComponent = Cast<UEnhancedInputComponent>(PlayerController->InputComponent))
 		{
 			// Bind Inputs
-			EnhancedInputComponent->BindAction(FireAction, ETriggerEvent::Triggered, this, &ULidarComponent::NormalScan);
+			EnhancedInputComponent->BindAction(FireAction, ETriggerEvent::Triggered, this, &ULidarComponent::OnFireTriggered);
+			EnhancedInputComponent->BindAction(FireAction, ETriggerEvent::Started, this, &ULidarComponent::OnFireStarted);
+			EnhancedInputComponent->BindAction(FireAction, ETriggerEvent::Completed, this, &ULidarComponent::StopContinuousScan);
+			EnhancedInputComponent->BindAction(FireAction, ETriggerEvent::Canceled, this, &ULidarComponent::StopContinuousScan);
 			EnhancedInputComponent->BindAction(FullScanAction, ETriggerEvent::Triggered, this, &ULidarComponent::StartFullScan);
 			EnhancedInputComponent->BindAction(AdjustScanRadiusAction, ETriggerEvent::Triggered, this, &ULidarComponent::AdjustScanRadius);
 		}
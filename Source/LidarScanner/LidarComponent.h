@@ -5,11 +5,50 @@
 #include "CoreMinimal.h"
 #include "LidarScannerCharacter.h"
 #include "NiagaraComponent.h"
-#include "ParticleStruct.h"
+#include "LidarScanPipeline.h"
+#include "LidarPointCloud.h"
+#include "LidarVoxelHash.h"
+#include "LidarPointExpiry.h"
+#include "LidarTagCache.h"
+#include "LidarColorRamp.h"
+#include "LidarScanPattern.h"
+#include "LidarScanSession.h"
+#include "LidarStats.h"
+#include "LidarPointExport.h"
+#include "LidarWorldStore.h"
+#include "LidarCloudSave.h"
+#include "LidarPointPool.h"
+#include "LidarNetReplication.h"
 #include "Components/SceneComponent.h"
+#include "UObject/UObjectIterator.h"
 #include "Public/CustomParticleData.h"
+#include <atomic>
 #include "LidarComponent.generated.h"
 
+UENUM(BlueprintType)
+enum class ELidarTraceMode : uint8
+{
+	// One blocking LineTraceSingleByChannel per ray on the game thread
+	Synchronous,
+	// Rays are queued and submitted as async traces, results are gathered next frame
+	AsyncBatched,
+	// Whole scans run on worker threads into a back buffer, swapped in and uploaded next frame
+	WorkerPipeline
+};
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnLidarCloudPersisted, const FString&, SlotName, bool, bSuccess);
+
+/** A single scan ray, Direction is normalized */
+struct FLidarScanRay
+{
+	FVector Start;
+	FVector Direction;
+	// The RaycastLength of the scan it belongs to
+	float Length;
+	// Part of a full scan, whose deferred tracing cost counts against FullScanTimeBudgetUs
+	bool bFullScan = false;
+};
+
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class LIDARSCANNER_API ULidarComponent : public USceneComponent
@@ -26,10 +65,20 @@ protected:
 	UFUNCTION()
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
+	/** For subclasses that fill the cloud themselves instead of scanning */
+	FLidarPointCloud& GetMutablePointCloud() { return PointCloud; }
+
+	/** Sets the cloud's capacity, stopping this scanner's Niagara system around a reallocation so no worker tick reads freed points */
+	void ResizePointCloud(int32 NewCapacity);
+
 public:	
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
 	UFUNCTION(BlueprintCallable, Category="Scanner")
 	bool AttachScanner(ALidarScannerCharacter* TargetCharacter);
 
@@ -57,9 +106,47 @@ public:
 	bool EnableDebug = true;
 	UPROPERTY(EditAnywhere ,Category="General Variables")
 	float LineTraceLinger = 1.f;
+
+	UPROPERTY(EditAnywhere ,Category="Tracing")
+	ELidarTraceMode TraceMode = ELidarTraceMode::Synchronous;
+	/**
+	 * Max rays waiting for an async trace, the oldest are dropped past it. How many go out per frame is the
+	 * world's Lidar.Trace.MaxAsyncRaysPerFrame, shared by all scanners.
+	 */
+	UPROPERTY(EditAnywhere ,Category="Tracing", meta = (ClampMin = "1", EditCondition = "TraceMode == ELidarTraceMode::AsyncBatched"))
+	int32 MaxPendingAsyncRays = 4096;
+	/** How many rays one pipeline task processes per stage, smaller spreads better over cores. Also the chunk size of the game thread paths' coloring */
+	UPROPERTY(EditAnywhere ,Category="Tracing", meta = (ClampMin = "1"))
+	int32 PipelineRaysPerTask = 64;
+
+	/** Seed of the scanner's random stream, every scan draws its own seed from it */
+	UPROPERTY(EditAnywhere ,Category="Tracing")
+	int32 RandomSeed = 0;
+	/** Pick a fresh RandomSeed at BeginPlay (it is logged), turn off for reproducible runs */
+	UPROPERTY(EditAnywhere ,Category="Tracing")
+	bool bRandomizeSeed = true;
+
+	UFUNCTION(BlueprintCallable, Category="Tracing")
+	void SetRandomSeed(int32 NewSeed);
+
+	/** Stage timings of the last finished worker pipeline run */
+	UFUNCTION(BlueprintCallable, Category="Tracing")
+	FLidarPipelineStats GetPipelineStats() const { return ScanPipeline.GetStats(); }
+
+	/** Rays, hits, points and uploads of this scanner so far, Lidar.Stats.Dump logs them for every scanner */
+	UFUNCTION(BlueprintPure, Category="Stats")
+	FLidarScanCounters GetScanCounters() const;
+	UFUNCTION(BlueprintCallable, Category="Stats")
+	void ResetScanCounters();
+
+	/** What the Lidar data interface packed for the GPU from this scanner, may be called from a Niagara worker */
+	void CountGpuUpload(int32 Points, int64 Bytes);
+
 private:
-	TArray<FParticleStruct> Particles;
-	
+	FLidarScanCounters ScanCounters;
+	std::atomic<int64> GpuUploadedPoints{0};
+	std::atomic<int64> GpuUploadedBytes{0};
+
 public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly ,Category="VFX")
 	UNiagaraComponent* NiagaraComponent;
@@ -79,9 +166,46 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="VFX")
 	FLinearColor ParticleColorFar;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="VFX|Color")
+	ELidarColorMode ColorMode = ELidarColorMode::Distance;
+	/** Gradient for the default color, when empty it runs from ParticleColorClose to ParticleColorFar */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="VFX|Color")
+	TArray<FLidarColorStop> ColorStops;
+	/** World Z mapped onto the gradient in Height mode */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="VFX|Color", meta = (EditCondition = "ColorMode == ELidarColorMode::Height"))
+	FVector2D HeightColorRange = FVector2D(0.f, 1000.f);
+
+	/** Bakes the color settings into the ramp, done on its own at BeginPlay, on edits and on the next tick after a runtime change */
+	UFUNCTION(BlueprintCallable, Category="VFX|Color")
+	void RebuildColorRamp();
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "VFX")
 	TMap<FName, FCustomParticleData> CustomDataDictionary;
 
+	/** Call after changing an entry of CustomDataDictionary at runtime, hits keep using the cached data otherwise */
+	UFUNCTION(BlueprintCallable, Category = "VFX")
+	void NotifyCustomDataChanged();
+
+	/** Call after changing a component's tags so its hits resolve again, null forgets every component */
+	UFUNCTION(BlueprintCallable, Category = "VFX")
+	void InvalidateTagCache(UPrimitiveComponent* Component);
+
+	/**
+	 * Upload once per frame, straight into data interfaces resolved in InitializeNiagaraSystem,
+	 * and only the points added this frame. The emitter should spawn NewPointCountParameterName particles.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="VFX|Upload")
+	bool bUseDeltaUpload = false;
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="VFX|Upload")
+	FName PositionsParameterName = TEXT("ParticlePositions");
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="VFX|Upload")
+	FName ColorsParameterName = TEXT("ParticleColors");
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="VFX|Upload")
+	FName LifetimesParameterName = TEXT("ParticleLifetimes");
+	/** User int parameter set to the number of points uploaded this frame (delta upload only) */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="VFX|Upload")
+	FName NewPointCountParameterName = TEXT("NewPointCount");
+
 	UFUNCTION(BlueprintCallable)
 	void SetNiagaraParticleData();
 
@@ -96,10 +220,222 @@ public:
 
 	UFUNCTION(BlueprintCallable)
 	void AddParticleData(FHitResult& Hit);
+
+public:
+	/** Max points kept by the scanner, once reached the oldest points are overwritten */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud", meta = (ClampMin = "1"))
+	int32 MaxPointCount = 500000;
+
+	UFUNCTION(BlueprintCallable, Category="Point Cloud")
+	void AppendPoint(const FVector& Position, const FLinearColor& Color, float Lifetime);
+
+	UFUNCTION(BlueprintCallable, Category="Point Cloud")
+	void ClearPointCloud();
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud")
+	int32 GetPointCount() const { return PointCloud.Num(); }
+
+	/** Keep at most one point per voxel, repeated hits update that point instead of adding new ones */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud")
+	bool bEnableVoxelDeduplication = false;
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud", meta = (ClampMin = "0.1", Units = "cm", EditCondition = "bEnableVoxelDeduplication"))
+	float VoxelSize = 5.f;
+	/** On a repeated hit, replace the voxel's color and lifetime with the newest hit's, otherwise only count the hit */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud", meta = (EditCondition = "bEnableVoxelDeduplication"))
+	bool bVoxelKeepNewestColor = true;
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud")
+	int32 GetOccupiedVoxelCount() const { return VoxelHash.Num(); }
+
+	/**
+	 * Remove points from the cloud once their lifetime runs out, not only from Niagara. Their slots then take the
+	 * points the ring would overwrite next, so short lived points don't push long lived ones out.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|Expiry")
+	bool bEnablePointExpiry = true;
+	/** Points expiring within the same this many seconds are dropped together, that late at most */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|Expiry", meta = (ClampMin = "0.01", Units = "s", EditCondition = "bEnablePointExpiry"))
+	float ExpiryBucketSeconds = 0.5f;
+	/** Points living this long or longer are permanent and never tracked */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|Expiry", meta = (ClampMin = "0", Units = "s", EditCondition = "bEnablePointExpiry"))
+	float ExpiryMaxLifetime = 600.f;
+	/** Slots ahead of the ring's head whose live points are moved into freed slots, a few frames of appends is plenty */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|Expiry", meta = (ClampMin = "0", EditCondition = "bEnablePointExpiry"))
+	int32 ExpiryCompactionZone = 16384;
+	/** Game thread time per frame for killing expired points and compacting, in microseconds */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|Expiry", meta = (ClampMin = "0", Units = "us", EditCondition = "bEnablePointExpiry"))
+	float ExpiryTimeBudgetUs = 250.f;
+	/** Slots killed or moved per frame at most, each one is uploaded to the GPU and the shared pool again */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|Expiry", meta = (ClampMin = "1", EditCondition = "bEnablePointExpiry"))
+	int32 ExpiryMaxChangedSlots = 4096;
+
+	FLidarPointExpiryStats GetPointExpiryStats() const { return PointExpiry.GetStats(); }
+
+	const FLidarPointCloud& GetPointCloud() const { return PointCloud; }
+
+	/** Max points handed to the export worker per frame, larger clouds are handed over across several frames */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|Export", meta = (ClampMin = "1"))
+	int32 ExportPointsPerFrame = 262144;
+
+	/**
+	 * Writes the points stored right now to File on a background thread, relative paths go to Saved/Lidar/Exports.
+	 * Points scanned after the call are not part of it. False if an export is still running.
+	 */
+	UFUNCTION(BlueprintCallable, Category="Point Cloud|Export")
+	bool ExportPointCloud(const FString& File, ELidarExportFormat Format = ELidarExportFormat::Ply);
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud|Export")
+	bool IsExportingPointCloud() const { return PointExporter.IsValid(); }
+
+	/**
+	 * Also keep every added point in 32 m world cells. Cells far from every lidar character are compressed into a
+	 * cache file under Saved/Lidar/WorldStore/<level> and read back in on a worker when one returns, then shown again.
+	 * The file is kept at EndPlay, the next session on the level shows those cells again once a character gets close.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|World Store")
+	bool bEnableWorldStore = false;
+	/** Paged out cells come back once a character is this close to their center */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|World Store", meta = (ClampMin = "0", Units = "cm", EditCondition = "bEnableWorldStore"))
+	float WorldStorePageInDistance = 15000.f;
+	/** Cells page out once every character is farther than this from their center, keep it above the page in distance */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|World Store", meta = (ClampMin = "0", Units = "cm", EditCondition = "bEnableWorldStore"))
+	float WorldStorePageOutDistance = 25000.f;
+	/** Cells that may start paging in or out per frame */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|World Store", meta = (ClampMin = "1", EditCondition = "bEnableWorldStore"))
+	int32 WorldStoreMaxPagingPerFrame = 4;
+
+	/** Null unless bEnableWorldStore was set at BeginPlay */
+	const FLidarWorldStore* GetWorldStore() const { return WorldStore.Get(); }
+
+	/**
+	 * Saves the stored points to a save game slot. The cloud is copied right away, encoding and compression run on
+	 * a worker and the slot is written asynchronously. False if a save or load is still running.
+	 */
+	UFUNCTION(BlueprintCallable, Category="Point Cloud|Save")
+	bool SavePointCloud(const FString& SlotName, int32 UserIndex = 0);
+
+	/** Replaces the stored points with a saved cloud, read and decoded off the game thread. False if a save or load is still running */
+	UFUNCTION(BlueprintCallable, Category="Point Cloud|Save")
+	bool LoadPointCloud(const FString& SlotName, int32 UserIndex = 0);
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud|Save")
+	bool IsPersistingPointCloud() const { return CloudSaveTask.IsValid() || CloudLoadTask.IsValid() || bCloudSlotBusy; }
+
+	UPROPERTY(BlueprintAssignable, Category="Point Cloud|Save")
+	FOnLidarCloudPersisted OnPointCloudSaved;
+
+	UPROPERTY(BlueprintAssignable, Category="Point Cloud|Save")
+	FOnLidarCloudPersisted OnPointCloudLoaded;
+
+	/**
+	 * Render through the world's shared point pool instead of this component's own Niagara system. New points are
+	 * forwarded to a region of the pool each frame and NiagaraSystemAsset renders the whole pool, so it has to read
+	 * the Lidar data interface. Falls back to the own system if the pool has no room left.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|Shared Pool")
+	bool bUseSharedPointPool = false;
+	/** Slots of the pool this scanner owns, its newest points up to this many are shown */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Point Cloud|Shared Pool", meta = (ClampMin = "1", EditCondition = "bUseSharedPointPool"))
+	int32 SharedPoolQuota = 100000;
+	/** Points forwarded to the pool per frame, the rest wait for the next frames */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Point Cloud|Shared Pool", meta = (ClampMin = "1", EditCondition = "bUseSharedPointPool"))
+	int32 SharedPoolPointsPerFrame = 20000;
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud|Shared Pool")
+	bool IsInSharedPointPool() const { return PointPool.IsValid(); }
+
+	UFUNCTION(BlueprintPure, Category="Point Cloud|Shared Pool")
+	FLidarPoolScannerStats GetSharedPoolStats() const;
+
 private:
-	TArray<FVector> PositionArray;
-	TArray<FLinearColor> ColorArray;
-	TArray<float> LifetimeArray;
+	FLidarPointCloud PointCloud;
+	FLidarVoxelHash VoxelHash;
+
+	FLidarPointExpiry PointExpiry;
+	// Points appended up to here are tracked by the expiry
+	uint64 ExpiryCursor = 0;
+	uint32 ExpiryGeneration = 0;
+
+	/** Tracks the new points, then kills expired ones and compacts under ExpiryTimeBudgetUs */
+	void UpdatePointExpiry();
+
+	TUniquePtr<FLidarWorldStore> WorldStore;
+	// Points appended up to here are in the world store
+	uint64 WorldStoreCursor = 0;
+	uint32 WorldStoreGeneration = 0;
+	// Points of the appended spans that outlive the expiry
+	TArray<FLidarPackedPoint> WorldStoreScratch;
+
+	/** Where a world store cell's points start in the ring, every one of them is still there while that append is */
+	struct FLidarRingCell
+	{
+		uint32 Generation = 0;
+		uint64 FirstAppended = 0;
+	};
+	TMap<FIntVector, FLidarRingCell> WorldStoreRingCells;
+
+	/** Moves new points into the world store, pages cells and shows the ones that came back */
+	void UpdateWorldStore();
+
+	TWeakObjectPtr<ULidarPointPoolSubsystem> PointPool;
+	int32 PointPoolHandle = INDEX_NONE;
+
+	UE::Tasks::TTask<TArray<uint8>> CloudSaveTask;
+	UE::Tasks::TTask<TSharedPtr<FLidarCloudSnapshot>> CloudLoadTask;
+	FString CloudSaveSlot;
+	int32 CloudSaveUserIndex = 0;
+	// Live points in the snapshot being encoded, the cloud keeps changing meanwhile
+	int32 CloudSavePointCount = 0;
+	FString CloudLoadSlot;
+	// A save game slot is being written or read
+	bool bCloudSlotBusy = false;
+
+	/** Writes the encoded save to its slot and installs a decoded load, once their tasks are done */
+	void UpdateCloudPersistence();
+	bool InstallCloudSnapshot(const FLidarCloudSnapshot& Snapshot);
+
+	TUniquePtr<FLidarPointExporter> PointExporter;
+	// Next point to hand to the exporter and the end of the export, in PointCloud.GetTotalAppended() terms
+	uint64 ExportCursor = 0;
+	uint64 ExportEndCursor = 0;
+	uint32 ExportGeneration = 0;
+	// Chunk origins already handed to the exporter, and the chunk generation they belong to
+	int32 ExportChunkCount = 0;
+	uint32 ExportChunkGeneration = 0;
+
+	/** Hands the exporter its next batch of at most MaxPoints, and finishes the export once everything is written */
+	void UpdateExport(int32 MaxPoints);
+	// Resolved custom data per hit component for the game thread scan paths, the pipeline has its own
+	FLidarTagCache TagCache;
+	uint32 CustomDataVersion = 0;
+
+	// Baked default colors and what they were baked from
+	TSharedPtr<const FLidarColorRamp> ColorRamp;
+	TArray<FLidarColorStop> ColorRampStops;
+	ELidarColorMode ColorRampMode = ELidarColorMode::Distance;
+	FVector2D ColorRampRange = FVector2D::ZeroVector;
+
+	/** Color settings as the ramp sees them */
+	void GetColorRampSettings(TArray<FLidarColorStop>& OutStops, FVector2D& OutRange) const;
+	void UpdateColorRamp();
+	// PointCloud.GetTotalAppended() at the last upload, everything after it still has to reach Niagara
+	uint64 UploadCursor = 0;
+	// Scratch arrays the pending points are gathered into for upload
+	FLidarScanResultBuffer UploadBuffer;
+
+	// Delta upload bindings, resolved once in InitializeNiagaraSystem
+	TWeakObjectPtr<class UNiagaraDataInterfaceArrayFloat3> PositionsDataInterface;
+	TWeakObjectPtr<class UNiagaraDataInterfaceArrayColor> ColorsDataInterface;
+	TWeakObjectPtr<class UNiagaraDataInterfaceArrayFloat> LifetimesDataInterface;
+	FNiagaraVariable NewPointCountVariable;
+	bool bDeltaUploadPending = false;
+	int32 LastNewPointCount = 0;
+
+	void ResolveNiagaraBindings();
+	void FlushDeltaUpload();
+
+	// Front buffer of the worker pipeline
+	FLidarScanResultBuffer ScanResults;
 
 public:
 	UPROPERTY(EditAnywhere ,Category="Normal Scan")
@@ -112,21 +448,75 @@ public:
 	float ScanRadius = 1.f;
 	UPROPERTY(EditAnywhere ,Category="Normal Scan")
 	float ScanRadiusChangeMultiplier = 1.f;
+	UPROPERTY(EditAnywhere ,Category="Normal Scan")
+	ELidarScanPattern ScanPattern = ELidarScanPattern::UniformDisk;
 
 	UFUNCTION(BlueprintCallable, Category = "Normal Scan")
 	void NormalScan();
+
+	/** Holding fire scans at a steady ContinuousRaysPerSecond instead of one ScanRayAmount burst per input event */
+	UPROPERTY(EditAnywhere ,Category="Normal Scan|Continuous")
+	bool bContinuousFire = false;
+	UPROPERTY(EditAnywhere ,Category="Normal Scan|Continuous", meta = (ClampMin = "1", EditCondition = "bContinuousFire"))
+	float ContinuousRaysPerSecond = 1500.f;
+	/** Rays build up until a batch has at least this many, so high frame rates don't trace lots of tiny scans */
+	UPROPERTY(EditAnywhere ,Category="Normal Scan|Continuous", meta = (ClampMin = "1", EditCondition = "bContinuousFire"))
+	int32 ContinuousMinBatchRays = 16;
+
+	/** Starts scanning every tick at ContinuousRaysPerSecond, bound to the fire press when bContinuousFire is set */
+	UFUNCTION(BlueprintCallable, Category = "Normal Scan|Continuous")
+	void StartContinuousScan();
+	/** Sends whatever rays have built up and stops */
+	UFUNCTION(BlueprintCallable, Category = "Normal Scan|Continuous")
+	void StopContinuousScan();
+	UFUNCTION(BlueprintPure, Category = "Normal Scan|Continuous")
+	bool IsContinuousScanning() const { return bContinuousScanning; }
 	
 	UFUNCTION(BlueprintCallable, Category = "Normal Scan")
 	void AdjustScanRadius(const FInputActionValue& Value);
 
 	UFUNCTION(BlueprintCallable, Category = "Normal Scan")
 	FVector2D GetRandomPointInsideCircle(float Radius);
+
+private:
+	bool bContinuousScanning = false;
+	// Rays owed since the last batch, the fraction carries over between ticks
+	float ContinuousRayAccumulator = 0.f;
+	// Seed and rays so far of the current pass over the continuous pattern table
+	int32 ContinuousPassSeed = 0;
+	int32 ContinuousPassRays = 0;
+
+	void UpdateContinuousScan(float DeltaTime);
+	/**
+	 * One normal scan of RayCount rays. Single scans draw from the ScanRayAmount pattern table, continuous batches
+	 * continue the current pass over the larger continuous table, so batch sizes never rebuild either
+	 */
+	void IssueNormalScan(int32 RayCount);
+	/** Entries of the continuous fire table, a second of rays and never fewer than a single scan */
+	int32 GetContinuousPatternRays() const;
+	void OnFireTriggered();
+	void OnFireStarted();
 	
 public:
+	/** Rays in one row of the full scan */
 	UPROPERTY(EditAnywhere ,Category="Full Scan")
 	int FullScanRayAmount = 40;
+	/** Sweep speed in degrees per second, rows are traced once the sweep passes them. Zero or less traces every row as soon as the budget allows */
 	UPROPERTY(EditAnywhere ,Category="Full Scan")
 	float FullScanRate = 10.f;
+	/** Vertical rows the sweep is split into, every row is traced exactly once whatever the frame rate */
+	UPROPERTY(EditAnywhere ,Category="Full Scan", meta = (ClampMin = "1"))
+	int32 FullScanRowCount = 60;
+	/** Max full scan rays per frame, rows that don't fit carry over to the next frame. 0 means no limit */
+	UPROPERTY(EditAnywhere ,Category="Full Scan", meta = (ClampMin = "0"))
+	int32 FullScanRayBudget = 0;
+	/**
+	 * Max time per frame spent on full scan rays, in microseconds. 0 means no limit.
+	 * In AsyncBatched and WorkerPipeline modes the measured cost of the previous run's full scan rays is charged against it too.
+	 * At least one ray goes out every frame so the sweep always finishes.
+	 */
+	UPROPERTY(EditAnywhere ,Category="Full Scan", meta = (ClampMin = "0", Units = "us"))
+	float FullScanTimeBudgetUs = 0.f;
 	UPROPERTY(EditAnywhere ,Category="Full Scan", meta = (ClampMin = "0.0", ClampMax = "90.0", UIMin = "0.0", UIMax = "90.0"))
 	float FullScanVerticalAngle = 30.f;
 	UPROPERTY(EditAnywhere, Category = "Full Scan", meta = (ClampMin = "0.0", ClampMax = "360.0", UIMin = "0.0", UIMax = "360.0"))
@@ -134,15 +524,178 @@ public:
 
 	UFUNCTION(BlueprintCallable, Category = "Full Scan")
 	void StartFullScan();
+
+	UFUNCTION(BlueprintPure, Category = "Full Scan")
+	bool IsFullScanInProgress() const { return FullScanInProgress; }
+
+	/** Fraction of the rows of the running full scan already traced */
+	UFUNCTION(BlueprintPure, Category = "Full Scan")
+	float GetFullScanProgress() const;
 	
 private:
-	float FullScanCurrentAngle = -FullScanVerticalAngle;
-	bool FullScanInProgress;
+	bool FullScanInProgress = false;
+	float FullScanElapsed = 0.f;
+	// Row being traced, and how many of its rays already went out
+	int32 FullScanNextRow = 0;
+	int32 FullScanRowRay = 0;
+	// Shared by every piece of a row split across frames, so the row looks the same as one traced whole
+	int32 FullScanRowSeed = 0;
+	// Smoothed cost of one ray, sizes the pieces that fit under FullScanTimeBudgetUs
+	double FullScanSecondsPerRay = 0.0;
+	// Cost of full scan rays traced since the last update, measured when their async results or pipeline run came back
+	double FullScanDeferredSeconds = 0.0;
+
 	void UpdateFullScan(float DeltaTime);
-	void PerformFullScan();
+	/** Folds in the measured cost of full scan rays traced off the game thread */
+	void ChargeFullScanWork(double Seconds, int32 RayCount);
+	/** Traces rays [FirstRay, FirstRay + Num) of the row at VerticalAngle */
+	void PerformFullScan(float VerticalAngle, int32 FirstRay, int32 Num);
+	float GetFullScanRowAngle(int32 Row) const;
+	/** Rows the sweep has passed by now */
+	int32 GetFullScanRowsDue() const;
 	FVector GetScanDirection(float VerticalAngle, float HorizontalDegrees, FRotator CameraRotation) const;
 
+	/** Where scans start and which way they face: the player camera, or the component itself without one */
+	void GetScanPose(FVector& OutStart, FRotator& OutRotation) const;
+
+	// Unit disk table of the last pattern and ray count scanned with, rebuilt when either changes
+	TSharedPtr<const FLidarScanPatternTable> ScanPatternTable;
+	const TSharedPtr<const FLidarScanPatternTable>& GetScanPatternTable(ELidarScanPattern Pattern, int32 RaysPerScan);
+
+private:
+	FVector GetTraceEnd(const FLidarScanRay& Ray) const;
+	FCollisionQueryParams GetTraceQueryParams() const;
+	void DrawTraceDebug(const FLidarScanRay& Ray, const FHitResult* Hit) const;
+	/** Debug lines for a batch of rays whose hits were gathered into TraceHits */
+	void DrawTraceDebug(TConstArrayView<FLidarScanRay> Rays) const;
+
+	/** Tag lookup, coloring and storing of a batch of hits, each stage timed on its own */
+	void ResolveHits(TConstArrayView<FHitResult> Hits);
+
+	// Scratch of the game thread trace paths: blocking hits, the ray each came from, and their resolved attributes
+	TArray<FHitResult> TraceHits;
+	TArray<int32> TraceHitRays;
+	TArray<FLinearColor> HitColors;
+	TArray<float> HitLifetimes;
+	TArray<bool> HitHasCustomData;
+
+	/** Traces a whole scan, either right away or by queueing it for async tracing */
+	void TraceRays(const TArray<FLidarScanRay>& Rays);
+
+private:
+	struct FLidarInFlightTrace
+	{
+		FLidarScanRay Ray;
+		FTraceHandle Handle;
+	};
+
+	// Rays waiting for their share of the world's async trace budget, at most MaxPendingAsyncRays
+	TArray<FLidarScanRay> PendingAsyncRays;
+	// Traces submitted last frame, their results are ready this frame
+	TArray<FLidarInFlightTrace> InFlightTraces;
+
+	void SubmitAsyncTraces();
+	void GatherAsyncTraces();
+
 private:
-	bool LineCast(const FVector& Start, const FVector& Direction, FHitResult& Hit) const;
+	FLidarScanPipeline ScanPipeline;
+	// Scans issued this frame, launched together once the pipeline is free
+	TArray<FLidarScanJob> PendingPipelineJobs;
 
+	FLidarPointStyle MakePointStyle() const;
+	void QueuePipelineJob(FLidarScanJob&& Job);
+	void LaunchPipeline();
+	void SwapPipelineResults();
+
+	FRandomStream ScanStream;
+	int32 NextScanSeed();
+
+	/** Records the scan if a recording is running, then traces it the way TraceMode says */
+	void RunScanJob(FLidarScanJob&& Job);
+
+public:
+	/** Starts logging every scan (pose, seed, parameters) until StopScanRecording */
+	UFUNCTION(BlueprintCallable, Category="Tracing|Session")
+	void StartScanRecording();
+	/** Saves the recorded scans, relative paths go to Saved/Lidar/Sessions */
+	UFUNCTION(BlueprintCallable, Category="Tracing|Session")
+	bool StopScanRecording(const FString& File);
+	/** Runs the scans of a recorded session again, live scans are ignored until it ends. Fast runs one recorded frame per tick */
+	UFUNCTION(BlueprintCallable, Category="Tracing|Session")
+	bool StartScanReplay(const FString& File, bool bAsFastAsPossible = false);
+	UFUNCTION(BlueprintCallable, Category="Tracing|Session")
+	void StopScanReplay();
+	UFUNCTION(BlueprintPure, Category="Tracing|Session")
+	bool IsReplayingScans() const { return bReplayingScans; }
+
+private:
+	bool bRecordingScans = false;
+	double RecordingStartTime = 0.0;
+	FLidarScanSession RecordingSession;
+
+	bool bReplayingScans = false;
+	bool bReplayAsFastAsPossible = false;
+	double ReplayStartTime = 0.0;
+	int32 ReplayIndex = 0;
+	FLidarScanSession ReplaySession;
+
+	void UpdateScanReplay();
+
+public:
+	/**
+	 * How this scanner's scans reach the other machines of a multiplayer game. The server is authoritative: clients
+	 * send their scans to it, it traces them and forwards them to the connections near the scanner.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Replication")
+	ELidarReplicationMode ReplicationMode = ELidarReplicationMode::ScanSeeds;
+	/** Position step of replicated points, rounded to whole millimeters */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Replication", meta = (ClampMin = "0.1", Units = "cm", EditCondition = "ReplicationMode == ELidarReplicationMode::Points"))
+	float NetPointQuantization = 1.f;
+	/** Largest point batch the server sends in one RPC */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Replication", meta = (ClampMin = "64", EditCondition = "ReplicationMode == ELidarReplicationMode::Points"))
+	int32 NetPointBatchBytes = 1024;
+	/** Scans a client sends from further than this from where the server has its scanner are rejected */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Replication", meta = (ClampMin = "0", Units = "cm"))
+	float NetMaxPoseError = 500.f;
+
+	/** True if the scanner is held by a player controlled on this machine */
+	UFUNCTION(BlueprintPure, Category="Replication")
+	bool IsLocallyControlled() const;
+
+	/** Scans relayed from the server, traced again from their seed */
+	void ReceiveNetworkScans(TConstArrayView<FLidarNetScan> Scans);
+	/** Points relayed from the server, returns how many the batch held */
+	int32 ReceiveNetworkPoints(TConstArrayView<uint8> Batch);
+
+private:
+	UFUNCTION(Server, Reliable)
+	void ServerRunScan(const FLidarNetScan& Scan);
+
+	// Scans arriving from the network are traced without being sent on again
+	bool bApplyingNetworkScan = false;
+	// Points appended up to here went out as batches
+	uint64 NetPointCursor = 0;
+	uint32 NetPointGeneration = 0;
+
+	bool IsNetworked() const;
+	/** Rounds the job's pose to what goes over the wire and hands the scan to the server or the replication subsystem */
+	void ReplicateScanJob(FLidarScanJob& Job);
+	/** Queues the points the server's scanner appended since last frame, in ELidarReplicationMode::Points */
+	void UpdateNetPoints();
 };
+
+namespace LidarScan
+{
+	/** Calls Function on every scanner of World that has begun play, for console commands */
+	template <typename FunctionType>
+	void ForEachScanner(UWorld* World, FunctionType&& Function)
+	{
+		for (TObjectIterator<ULidarComponent> It; It; ++It)
+		{
+			if (It->GetWorld() == World && It->HasBegunPlay())
+			{
+				Function(**It);
+			}
+		}
+	}
+}
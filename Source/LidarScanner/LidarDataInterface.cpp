@@ -3,6 +3,10 @@
 
 #include "LidarDataInterface.h"
 #include "NiagaraShaderParametersBuilder.h"
+#include "NiagaraRenderer.h"
+#include "NiagaraSystemInstance.h"
+#include "LidarComponent.h"
+#include "LidarPointPool.h"
 
 DEFINE_NDI_DIRECT_FUNC_BINDER(ULidarDataInterface, GetParticlePosition);
 DEFINE_NDI_DIRECT_FUNC_BINDER(ULidarDataInterface, GetParticleColor);
@@ -12,79 +16,296 @@ const FName ULidarDataInterface::GetParticlePositionName(TEXT("GetParticlePositi
 const FName ULidarDataInterface::GetParticleColorName(TEXT("GetParticleColor"));
 const FName ULidarDataInterface::GetParticleLifetimeName(TEXT("GetParticleLifetime"));
 
-const FString ULidarDataInterface::ParticleCountParamName(TEXT("ParticleCount"));
-const FString ULidarDataInterface::PositionsBufferName(TEXT("PositionsBuffer"));
-const FString ULidarDataInterface::ColorsBufferName(TEXT("ColorsBuffer"));
-const FString ULidarDataInterface::LifetimeBufferName(TEXT("LifetimeBuffer"));
+// These have to match the members of FLidarShaderParameters
+const FString ULidarDataInterface::ParticleCountParamName(TEXT("_ParticleCount"));
+const FString ULidarDataInterface::PackedPointsBufferName(TEXT("_PackedPoints"));
+const FString ULidarDataInterface::ChunkOriginsBufferName(TEXT("_ChunkOrigins"));
 
-struct FNDILidarStruct
+// Game thread side of one Niagara system instance, bound to the ULidarComponent or the shared pool that feeds it
+struct FNDILidarInstanceData
 {
-	FVector Position;
-	FVector4 Color;
-	FFloat32 Lifetime;
+	TWeakObjectPtr<ULidarComponent> Source;
+	TWeakObjectPtr<ULidarPointPoolSubsystem> Pool;
+	// Refreshed every PerInstanceTick, the VM reads the cloud through these and never touches the component
+	const FLidarPointCloud* Cloud = nullptr;
+	int32 ParticleCount = 0;
+	// Copy of the cloud's chunk origins for the VM, the game thread may grow the cloud's own table while workers read
+	TArray<FVector> ChunkOrigins;
+	uint32 ChunkOriginsGeneration = 0;
+
+	// Source cloud's GetTotalAppended, GetTotalUpdates, GetGeneration and GetChunkGeneration at the last GPU upload
+	uint64 UploadCursor = 0;
+	uint64 UploadUpdateCursor = 0;
+	uint32 UploadGeneration = 0;
+	uint32 UploadChunkGeneration = 0;
+	TArray<FLidarPointSpan> UpdatedSpans;
+	FLidarGpuUploadPlanner UploadPlanner;
 };
 
-// this proxy is used to safely copy data between game thread and render thread
-struct FNDILidarProxy : public FNiagaraDataInterfaceProxy
+// Render thread buffers of one system instance
+struct FNDILidarGpuBuffers
 {
-	virtual int32 PerInstanceDataPassedToRenderThreadSize() const override { return sizeof(FParticleStruct); }
+	int32 ParticleCount = 0;
+	FRWBuffer  PackedPointsBuffer;
+	FRWBuffer  ChunkOriginsBuffer;
 
-	static void ProvidePerInstanceDataForRenderThread(void* InDataForRenderThread, void* InDataFromGameThread, const FNiagaraSystemInstanceID& SystemInstance)
+	void Release()
 	{
-		// initialize the render thread instance data into the pre-allocated memory
-		FParticleStruct* DataForRenderThread = new (InDataForRenderThread) FParticleStruct();
-
-		// we're just copying the game thread data, but the render thread data can be initialized to anything here and can be another struct entirely
-		const FParticleStruct* DataFromGameThread = static_cast<FParticleStruct*>(InDataFromGameThread);
-		*DataForRenderThread = *DataFromGameThread;
+		PackedPointsBuffer.Release();
+		ChunkOriginsBuffer.Release();
 	}
+};
+
+// this proxy owns the GPU buffers, it only ever receives the ranges that changed
+struct FNDILidarProxy : public FNiagaraDataInterfaceProxy
+{
+	virtual int32 PerInstanceDataPassedToRenderThreadSize() const override { return sizeof(FLidarGpuUploadPacket); }
 
 	virtual void ConsumePerInstanceDataFromGameThread(void* PerInstanceData, const FNiagaraSystemInstanceID& InstanceID) override
 	{
-		FParticleStruct* InstanceDataFromGT = static_cast<FParticleStruct*>(PerInstanceData);
-		FParticleStruct& InstanceData = SystemInstancesToInstanceData_RT.FindOrAdd(InstanceID);
-		InstanceData = *InstanceDataFromGT;
+		FLidarGpuUploadPacket* Packet = static_cast<FLidarGpuUploadPacket*>(PerInstanceData);
+
+		FRHICommandListImmediate& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
+		ApplyUpload(RHICmdList, SystemInstancesToBuffers_RT.FindOrAdd(InstanceID), *Packet);
 
 		// we call the destructor here to clean up the GT data. Without this we could be leaking memory.
-		InstanceDataFromGT->~FParticleStruct();
+		Packet->~FLidarGpuUploadPacket();
 	}
 
-	void InitializeBuffers(int32 Count)
+	static void ApplyUpload(FRHICommandListBase& RHICmdList, FNDILidarGpuBuffers& Buffers, const FLidarGpuUploadPacket& Packet)
 	{
-		ParticleCount = Count;
+		const FLidarGpuUploadPlan& Plan = Packet.Plan;
 
-		// Release existing buffers if already initialized
-		if (PositionsBuffer.Buffer.IsValid())
+		if (Plan.bReallocate)
 		{
-			PositionsBuffer.Release();
+			// Release the old one first, the planner only grows them geometrically
+			Buffers.PackedPointsBuffer.Release();
+			Buffers.PackedPointsBuffer.Initialize(RHICmdList, TEXT("LidarPackedPoints"), sizeof(FLidarPackedPoint), Plan.Capacity, PF_R32G32B32A32_UINT, BUF_Static);
 		}
-		if (ColorsBuffer.Buffer.IsValid())
+
+		if (Plan.bReallocateChunks)
 		{
-			ColorsBuffer.Release();
+			Buffers.ChunkOriginsBuffer.Release();
+			Buffers.ChunkOriginsBuffer.Initialize(RHICmdList, TEXT("LidarChunkOrigins"), sizeof(FVector4f), Plan.ChunkCapacity, PF_A32B32G32R32F, BUF_Static);
 		}
-		if (LifetimesBuffer.Buffer.IsValid())
+
+		int32 PacketOffset = 0;
+		for (const FLidarPointSpan& Span : Plan.UploadSpans)
 		{
-			LifetimesBuffer.Release();
+			UploadRange(RHICmdList, Buffers.PackedPointsBuffer, &Packet.Points[PacketOffset], Span.First, Span.Num, sizeof(FLidarPackedPoint));
+			PacketOffset += Span.Num;
 		}
 
-		// Create and allocate GPU buffers with the required size
-		FRHIResourceCreateInfo CreateInfo(TEXT("LidarBuffer"));
+		if (Plan.ChunkSpan.Num > 0)
+		{
+			UploadRange(RHICmdList, Buffers.ChunkOriginsBuffer, Packet.ChunkOrigins.GetData(), Plan.ChunkSpan.First, Plan.ChunkSpan.Num, sizeof(FVector4f));
+		}
+
+		Buffers.ParticleCount = Plan.ParticleCount;
+	}
+
+	static void UploadRange(FRHICommandListBase& RHICmdList, FRWBuffer& Buffer, const void* Source, int32 First, int32 Num, int32 Stride)
+	{
+		void* Dest = RHICmdList.LockBuffer(Buffer.Buffer, First * Stride, Num * Stride, RLM_WriteOnly);
+		FMemory::Memcpy(Dest, Source, Num * Stride);
+		RHICmdList.UnlockBuffer(Buffer.Buffer);
 	}
-	
-	int ParticleCount;
-	FRWBuffer  PositionsBuffer;
-	FRWBuffer  ColorsBuffer;
-	FRWBuffer  LifetimesBuffer;
-	TMap<FNiagaraSystemInstanceID, FParticleStruct> SystemInstancesToInstanceData_RT;
+
+	TMap<FNiagaraSystemInstanceID, FNDILidarGpuBuffers> SystemInstancesToBuffers_RT;
 
 	virtual ~FNDILidarProxy() override
 	{
-		PositionsBuffer.Release();
-		ColorsBuffer.Release();
-		LifetimesBuffer.Release();
+		for (TPair<FNiagaraSystemInstanceID, FNDILidarGpuBuffers>& Pair : SystemInstancesToBuffers_RT)
+		{
+			Pair.Value.Release();
+		}
 	}
 };
 
+int32 ULidarDataInterface::PerInstanceDataSize() const
+{
+	return sizeof(FNDILidarInstanceData);
+}
+
+ULidarComponent* ULidarDataInterface::FindSourceComponent(FNiagaraSystemInstance* SystemInstance)
+{
+	USceneComponent* AttachComponent = SystemInstance ? SystemInstance->GetAttachComponent() : nullptr;
+	if (AttachComponent == nullptr)
+		return nullptr;
+
+	// The scanner's own Niagara component is created as its subobject
+	if (ULidarComponent* Owner = Cast<ULidarComponent>(AttachComponent->GetOuter()))
+		return Owner;
+
+	// Pooled systems get attached to the scanner (or below it)
+	for (USceneComponent* Parent = AttachComponent; Parent != nullptr; Parent = Parent->GetAttachParent())
+	{
+		if (ULidarComponent* Scanner = Cast<ULidarComponent>(Parent))
+			return Scanner;
+	}
+
+	AActor* Owner = AttachComponent->GetOwner();
+	return Owner ? Owner->FindComponentByClass<ULidarComponent>() : nullptr;
+}
+
+ULidarPointPoolSubsystem* ULidarDataInterface::FindSourcePool(FNiagaraSystemInstance* SystemInstance)
+{
+	USceneComponent* AttachComponent = SystemInstance ? SystemInstance->GetAttachComponent() : nullptr;
+	UWorld* World = AttachComponent ? AttachComponent->GetWorld() : nullptr;
+	ULidarPointPoolSubsystem* PointPool = World ? World->GetSubsystem<ULidarPointPoolSubsystem>() : nullptr;
+	return PointPool && PointPool->GetNiagaraComponent() == AttachComponent ? PointPool : nullptr;
+}
+
+bool ULidarDataInterface::InitPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance)
+{
+	FNDILidarInstanceData* InstanceData = new (PerInstanceData) FNDILidarInstanceData();
+	InstanceData->UploadPlanner.SetMaxDirtyRanges(FLidarGpuUploadPlanner::MaxScatteredRanges);
+	InstanceData->Pool = FindSourcePool(SystemInstance);
+	InstanceData->Source = InstanceData->Pool.IsValid() ? nullptr : FindSourceComponent(SystemInstance);
+	return true;
+}
+
+void ULidarDataInterface::DestroyPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance)
+{
+	FNDILidarInstanceData* InstanceData = static_cast<FNDILidarInstanceData*>(PerInstanceData);
+	InstanceData->~FNDILidarInstanceData();
+
+	ENQUEUE_RENDER_COMMAND(FLidarRemoveInstanceBuffers)(
+		[RT_Proxy = GetProxyAs<FNDILidarProxy>(), InstanceID = SystemInstance->GetId()](FRHICommandListImmediate&)
+		{
+			if (FNDILidarGpuBuffers* Buffers = RT_Proxy->SystemInstancesToBuffers_RT.Find(InstanceID))
+			{
+				Buffers->Release();
+				RT_Proxy->SystemInstancesToBuffers_RT.Remove(InstanceID);
+			}
+		});
+}
+
+bool ULidarDataInterface::PerInstanceTick(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance, float DeltaSeconds)
+{
+	FNDILidarInstanceData* InstanceData = static_cast<FNDILidarInstanceData*>(PerInstanceData);
+
+	if (InstanceData->Source.IsValid() == false && InstanceData->Pool.IsValid() == false)
+	{
+		// Scanner may have been attached after the system spawned, or the pooled system was handed to another one
+		InstanceData->Pool = FindSourcePool(SystemInstance);
+		InstanceData->Source = InstanceData->Pool.IsValid() ? nullptr : FindSourceComponent(SystemInstance);
+		InstanceData->UploadCursor = 0;
+		InstanceData->UploadUpdateCursor = 0;
+		InstanceData->UploadPlanner.Reset();
+	}
+
+	const ULidarComponent* Source = InstanceData->Source.Get();
+	const ULidarPointPoolSubsystem* PointPool = InstanceData->Pool.Get();
+	BindCloud(*InstanceData, PointPool ? &PointPool->GetPointCloud() : Source ? &Source->GetPointCloud() : nullptr);
+	return false;
+}
+
+void ULidarDataInterface::BindCloud(FNDILidarInstanceData& InstanceData, const FLidarPointCloud* Cloud)
+{
+	// Chunks are append only within a chunk generation, so only the new origins are copied
+	if (Cloud != InstanceData.Cloud || (Cloud && Cloud->GetChunkGeneration() != InstanceData.ChunkOriginsGeneration))
+	{
+		InstanceData.ChunkOrigins.Reset();
+		InstanceData.ChunkOriginsGeneration = Cloud ? Cloud->GetChunkGeneration() : 0;
+	}
+	if (Cloud != nullptr)
+	{
+		const TConstArrayView<FVector> Origins = Cloud->GetChunks().GetOrigins();
+		InstanceData.ChunkOrigins.Append(Origins.RightChop(InstanceData.ChunkOrigins.Num()));
+	}
+
+	InstanceData.Cloud = Cloud;
+	InstanceData.ParticleCount = Cloud ? Cloud->Num() : 0;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+void* ULidarDataInterface::CreateDetachedInstanceData(const FLidarPointCloud& Cloud)
+{
+	FNDILidarInstanceData* InstanceData = new FNDILidarInstanceData();
+	BindCloud(*InstanceData, &Cloud);
+	return InstanceData;
+}
+
+void ULidarDataInterface::DestroyDetachedInstanceData(void* InstanceData)
+{
+	delete static_cast<FNDILidarInstanceData*>(InstanceData);
+}
+#endif
+
+static void ResetUploadOnChunkCompaction(FNDILidarInstanceData& InstanceData, const FLidarPointCloud& Cloud)
+{
+	// Every stored point got a new chunk index and the origins moved, both buffers go up whole again
+	if (Cloud.GetChunkGeneration() != InstanceData.UploadChunkGeneration)
+	{
+		InstanceData.UploadChunkGeneration = Cloud.GetChunkGeneration();
+		InstanceData.UploadPlanner.Reset();
+	}
+}
+
+void ULidarDataInterface::ProvidePerInstanceDataForRenderThread(void* DataForRenderThread, void* PerInstanceData, const FNiagaraSystemInstanceID& SystemInstance)
+{
+	FNDILidarInstanceData* InstanceData = static_cast<FNDILidarInstanceData*>(PerInstanceData);
+	FLidarGpuUploadPacket* Packet = new (DataForRenderThread) FLidarGpuUploadPacket();
+
+	// The pool tracks its own scattered writes, every scanner in it goes out in this one packet
+	if (ULidarPointPoolSubsystem* PointPool = InstanceData->Pool.Get())
+	{
+		const FLidarPointCloud& Cloud = PointPool->GetPointCloud();
+		ResetUploadOnChunkCompaction(*InstanceData, Cloud);
+		PointPool->ConsumeDirtySpans(InstanceData->UploadPlanner);
+		{
+			LIDAR_SCOPE(GpuUploadPack);
+			LidarGpuUpload::PackRange(Cloud, InstanceData->UploadPlanner.Plan(Cloud.Num(), Cloud.GetChunks().Num()), *Packet);
+		}
+		PointPool->CountGpuUpload(Packet->Points.Num(), static_cast<int64>(Packet->Points.Num()) * Packet->Points.GetTypeSize() + Packet->ChunkOrigins.Num() * Packet->ChunkOrigins.GetTypeSize());
+		return;
+	}
+
+	ULidarComponent* Source = InstanceData->Source.Get();
+	if (Source == nullptr)
+		return;
+
+	const FLidarPointCloud& Cloud = Source->GetPointCloud();
+
+	// A cleared cloud restarts its append count and chunk table, send everything again
+	if (Cloud.GetGeneration() != InstanceData->UploadGeneration)
+	{
+		InstanceData->UploadGeneration = Cloud.GetGeneration();
+		InstanceData->UploadCursor = 0;
+		InstanceData->UploadUpdateCursor = 0;
+		InstanceData->UploadPlanner.Reset();
+	}
+	ResetUploadOnChunkCompaction(*InstanceData, Cloud);
+
+	// New points plus whatever was updated in place (voxel dedup, expiry), nothing else
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = Cloud.GetSpansSince(InstanceData->UploadCursor, Spans);
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		InstanceData->UploadPlanner.MarkDirty(Spans[i].First, Spans[i].Num);
+	}
+	InstanceData->UploadCursor = Cloud.GetTotalAppended();
+
+	// Every instance reads the log with its own cursor, one falling behind it sends the whole cloud again
+	InstanceData->UpdatedSpans.Reset();
+	if (Cloud.GetUpdatesSince(InstanceData->UploadUpdateCursor, InstanceData->UpdatedSpans) == false)
+	{
+		InstanceData->UpdatedSpans.Add({0, Cloud.Num()});
+	}
+	InstanceData->UploadUpdateCursor = Cloud.GetTotalUpdates();
+	for (const FLidarPointSpan& Span : InstanceData->UpdatedSpans)
+	{
+		InstanceData->UploadPlanner.MarkDirty(Span.First, Span.Num);
+	}
+
+	{
+		LIDAR_SCOPE(GpuUploadPack);
+		LidarGpuUpload::PackRange(Cloud, InstanceData->UploadPlanner.Plan(Cloud.Num(), Cloud.GetChunks().Num()), *Packet);
+	}
+	Source->CountGpuUpload(Packet->Points.Num(), static_cast<int64>(Packet->Points.Num()) * Packet->Points.GetTypeSize() + Packet->ChunkOrigins.Num() * Packet->ChunkOrigins.GetTypeSize());
+}
+
 void ULidarDataInterface::GetFunctions(
 	TArray<FNiagaraFunctionSignature>& OutFunctions)
 {   
@@ -132,35 +353,89 @@ void ULidarDataInterface::GetVMExternalFunction(const FVMExternalFunctionBinding
 	{
 		OutFunc = FVMExternalFunction::CreateLambda([this](FVectorVMExternalFunctionContext& Context) { this->GetParticlePosition(Context); });
 	}
-	else
+	else if (BindingInfo.Name == GetParticleColorName)
 	{
-		UE_LOG(LogTemp, Display, TEXT("Could not find data interface external function in %s. Received Name: %s"), *GetPathNameSafe(this), *BindingInfo.Name.ToString());
+		OutFunc = FVMExternalFunction::CreateLambda([this](FVectorVMExternalFunctionContext& Context) { this->GetParticleColor(Context); });
 	}
-	
-	if (BindingInfo.Name == GetParticleColorName)
+	else if (BindingInfo.Name == GetParticleLifetimeName)
 	{
-		OutFunc = FVMExternalFunction::CreateLambda([this](FVectorVMExternalFunctionContext& Context) { this->GetParticleColor(Context); });
+		OutFunc = FVMExternalFunction::CreateLambda([this](FVectorVMExternalFunctionContext& Context) { this->GetParticleLifetime(Context); });
 	}
 	else
 	{
 		UE_LOG(LogTemp, Display, TEXT("Could not find data interface external function in %s. Received Name: %s"), *GetPathNameSafe(this), *BindingInfo.Name.ToString());
 	}
+}
 
-	if (BindingInfo.Name == GetParticleLifetimeName)
+namespace LidarDataInterfaceVM
+{
+	// Instances are processed four at a time, one VectorRegister4Float per output register
+	constexpr int32 BatchSize = 4;
+
+	/** Raw view of one float output register, unused outputs write into a scratch lane */
+	struct FOutputStream
 	{
-		OutFunc = FVMExternalFunction::CreateLambda([this](FVectorVMExternalFunctionContext& Context) { this->GetParticleLifetime(Context); });
-	}
-	else
+		float* RESTRICT Dest;
+		int32 Stride;
+		float Scratch[BatchSize];
+
+		explicit FOutputStream(FNDIOutputParam<float>& Param)
+		{
+			const bool bValid = Param.IsValid();
+			Dest = bValid ? Param.Data.GetDest() : Scratch;
+			Stride = bValid ? 1 : 0;
+		}
+
+		/** Writes the first Count lanes of Value for the instances starting at First */
+		FORCEINLINE void Store(int32 First, int32 Count, const VectorRegister4Float& Value)
+		{
+			if (Count == BatchSize && Stride == 1)
+			{
+				VectorStore(Value, Dest + First);
+				return;
+			}
+
+			float Lanes[BatchSize];
+			VectorStore(Value, Lanes);
+			for (int32 Lane = 0; Lane < Count; ++Lane)
+			{
+				Dest[(First + Lane) * Stride] = Lanes[Lane];
+			}
+		}
+	};
+
+	/** Resolves a batch of indices into cloud slots, reading the input register directly */
+	struct FIndexStream
 	{
-		UE_LOG(LogTemp, Display, TEXT("Could not find data interface external function in %s. Received Name: %s"), *GetPathNameSafe(this), *BindingInfo.Name.ToString());
-	}
+		const int32* RESTRICT Src;
+		int32 Stride;
+
+		explicit FIndexStream(FNDIInputParam<int32>& Param)
+		{
+			Src = Param.Data.GetDest();
+			Stride = Param.Data.IsConstant() ? 0 : 1;
+		}
+
+		/** Lanes past Count come back as INDEX_NONE */
+		FORCEINLINE void Gather(int32 ParticleCount, int32 First, int32 Count, int32 OutSlots[BatchSize]) const
+		{
+			for (int32 Lane = 0; Lane < BatchSize; ++Lane)
+			{
+				// Unsigned compare catches negative indices too
+				const int32 Index = Lane < Count ? Src[(First + Lane) * Stride] : INDEX_NONE;
+				OutSlots[Lane] = static_cast<uint32>(Index) < static_cast<uint32>(ParticleCount) ? Index : INDEX_NONE;
+			}
+		}
+	};
 }
 
 // Function defined for CPU use, understandable by Niagara
 void ULidarDataInterface::GetParticlePosition(FVectorVMExternalFunctionContext& Context) const
 {
-	// Input is the NDI and Index of the particle
-	VectorVM::FUserPtrHandler<ULidarDataInterface> InstData(Context);
+	using namespace LidarDataInterfaceVM;
+
+	// Input is the instance data and Index of the particle
+	VectorVM::FUserPtrHandler<FNDILidarInstanceData> InstData(Context);
 	
 	FNDIInputParam<int32> IndexParam(Context);
   
@@ -169,96 +444,138 @@ void ULidarDataInterface::GetParticlePosition(FVectorVMExternalFunctionContext&
 	FNDIOutputParam<float> OutPosY(Context);
 	FNDIOutputParam<float> OutPosZ(Context);
 	
-	const auto InstancesCount = Context.GetNumInstances();
+	const int32 InstancesCount = Context.GetNumInstances();
 
-	TArray<FParticleStruct> Particles = InstData.Get()->ParticleDataArray;
-	
-	for(int32 i = 0; i < InstancesCount; ++i)
+	// Points are read in place (their array never reallocates), chunk origins from the instance's own copy
+	const int32 ParticleCount = InstData->Cloud ? InstData->ParticleCount : 0;
+	const FLidarPackedPoint* RESTRICT Points = ParticleCount > 0 ? InstData->Cloud->GetPoints().GetData() : nullptr;
+	const FVector* RESTRICT Origins = InstData->ChunkOrigins.GetData();
+	const int32 OriginCount = InstData->ChunkOrigins.Num();
+
+	const FIndexStream Indices(IndexParam);
+	FOutputStream X(OutPosX), Y(OutPosY), Z(OutPosZ);
+	const VectorRegister4Float Step = VectorSetFloat1(FLidarChunkTable::QuantizationStep);
+
+	int32 Slots[BatchSize];
+	for (int32 First = 0; First < InstancesCount; First += BatchSize)
 	{
-		const int32 Index = IndexParam.GetAndAdvance();
-		
-		if(Particles.IsValidIndex(Index))
-		{
-			const auto& Particle = Particles[Index];
-			OutPosX.SetAndAdvance(Particle.Position.X);
-			OutPosY.SetAndAdvance(Particle.Position.Y);
-			OutPosZ.SetAndAdvance(Particle.Position.Z);
-		}
-		else
+		const int32 Count = FMath::Min(BatchSize, InstancesCount - First);
+		Indices.Gather(ParticleCount, First, Count, Slots);
+
+		// Slots are scattered, so the gather is per lane. Missing points and chunks the copy does not have yet stay at zero
+		float OffsetX[BatchSize] = {}, OffsetY[BatchSize] = {}, OffsetZ[BatchSize] = {};
+		float OriginX[BatchSize] = {}, OriginY[BatchSize] = {}, OriginZ[BatchSize] = {};
+		for (int32 Lane = 0; Lane < BatchSize; ++Lane)
 		{
-			OutPosX.SetAndAdvance(0.0f);
-			OutPosY.SetAndAdvance(0.0f);
-			OutPosZ.SetAndAdvance(0.0f);
+			if (Slots[Lane] == INDEX_NONE || Points[Slots[Lane]].ChunkIndex >= OriginCount)
+				continue;
+
+			const FLidarPackedPoint& Point = Points[Slots[Lane]];
+			const FVector& Origin = Origins[Point.ChunkIndex];
+			OffsetX[Lane] = Point.X;
+			OffsetY[Lane] = Point.Y;
+			OffsetZ[Lane] = Point.Z;
+			OriginX[Lane] = static_cast<float>(Origin.X);
+			OriginY[Lane] = static_cast<float>(Origin.Y);
+			OriginZ[Lane] = static_cast<float>(Origin.Z);
 		}
+
+		// Origin + Offset * Step, four instances per register
+		X.Store(First, Count, VectorMultiplyAdd(VectorLoad(OffsetX), Step, VectorLoad(OriginX)));
+		Y.Store(First, Count, VectorMultiplyAdd(VectorLoad(OffsetY), Step, VectorLoad(OriginY)));
+		Z.Store(First, Count, VectorMultiplyAdd(VectorLoad(OffsetZ), Step, VectorLoad(OriginZ)));
 	}
 }
 
 void ULidarDataInterface::GetParticleColor(FVectorVMExternalFunctionContext& Context) const
 {
-	// Input is the NDI and Index of the particle
-	VectorVM::FUserPtrHandler<ULidarDataInterface> InstData(Context);
+	using namespace LidarDataInterfaceVM;
+
+	// Input is the instance data and Index of the particle
+	VectorVM::FUserPtrHandler<FNDILidarInstanceData> InstData(Context);
 	
 	FNDIInputParam<int32> IndexParam(Context);
   
-	// Output Position
+	// Output Color
 	FNDIOutputParam<float> OutColorR(Context);
 	FNDIOutputParam<float> OutColorG(Context);
 	FNDIOutputParam<float> OutColorB(Context);
 	FNDIOutputParam<float> OutColorA(Context);
 	
-	const auto InstancesCount = Context.GetNumInstances();
+	const int32 InstancesCount = Context.GetNumInstances();
 
-	TArray<FParticleStruct> Particles = InstData.Get()->ParticleDataArray;
-	
-	for(int32 i = 0; i < InstancesCount; ++i)
+	const int32 ParticleCount = InstData->Cloud ? InstData->ParticleCount : 0;
+	const FLidarPackedPoint* RESTRICT Points = ParticleCount > 0 ? InstData->Cloud->GetPoints().GetData() : nullptr;
+
+	const FIndexStream Indices(IndexParam);
+	FOutputStream R(OutColorR), G(OutColorG), B(OutColorB), A(OutColorA);
+	// Same plain divide as LidarPacking::UnpackColor, the bytes are linear
+	const VectorRegister4Float ByteToUnit = VectorSetFloat1(1.f / 255.f);
+
+	int32 Slots[BatchSize];
+	for (int32 First = 0; First < InstancesCount; First += BatchSize)
 	{
-		const int32 Index = IndexParam.GetAndAdvance();
-		
-		if(Particles.IsValidIndex(Index))
-		{
-			const auto& Particle = Particles[Index];
-			OutColorR.SetAndAdvance(Particle.Color.R);
-			OutColorG.SetAndAdvance(Particle.Color.G);
-			OutColorB.SetAndAdvance(Particle.Color.B);
-			OutColorA.SetAndAdvance(Particle.Color.A);
-		}
-		else
+		const int32 Count = FMath::Min(BatchSize, InstancesCount - First);
+		Indices.Gather(ParticleCount, First, Count, Slots);
+
+		// Missing points are fully transparent black
+		float Red[BatchSize] = {}, Green[BatchSize] = {}, Blue[BatchSize] = {}, Alpha[BatchSize] = {};
+		for (int32 Lane = 0; Lane < BatchSize; ++Lane)
 		{
-			OutColorR.SetAndAdvance(0.0f);
-			OutColorG.SetAndAdvance(0.0f);
-			OutColorB.SetAndAdvance(0.0f);
-			OutColorA.SetAndAdvance(0.0f);
+			if (Slots[Lane] == INDEX_NONE)
+				continue;
+
+			const FColor Color = Points[Slots[Lane]].Color;
+			Red[Lane] = Color.R;
+			Green[Lane] = Color.G;
+			Blue[Lane] = Color.B;
+			Alpha[Lane] = Color.A;
 		}
+
+		R.Store(First, Count, VectorMultiply(VectorLoad(Red), ByteToUnit));
+		G.Store(First, Count, VectorMultiply(VectorLoad(Green), ByteToUnit));
+		B.Store(First, Count, VectorMultiply(VectorLoad(Blue), ByteToUnit));
+		A.Store(First, Count, VectorMultiply(VectorLoad(Alpha), ByteToUnit));
 	}
 }
 
 void ULidarDataInterface::GetParticleLifetime(FVectorVMExternalFunctionContext& Context) const
 {
-	// Input is the NDI and Index of the particle
-	VectorVM::FUserPtrHandler<ULidarDataInterface> InstData(Context);
+	using namespace LidarDataInterfaceVM;
+
+	// Input is the instance data and Index of the particle
+	VectorVM::FUserPtrHandler<FNDILidarInstanceData> InstData(Context);
 	
 	FNDIInputParam<int32> IndexParam(Context);
   
-	// Output Position
+	// Output Lifetime
 	FNDIOutputParam<float> OutLifetime(Context);
 	
-	const auto InstancesCount = Context.GetNumInstances();
+	const int32 InstancesCount = Context.GetNumInstances();
 
-	TArray<FParticleStruct> Particles = InstData.Get()->ParticleDataArray;
-	
-	for(int32 i = 0; i < InstancesCount; ++i)
+	const int32 ParticleCount = InstData->Cloud ? InstData->ParticleCount : 0;
+	const FLidarPackedPoint* RESTRICT Points = ParticleCount > 0 ? InstData->Cloud->GetPoints().GetData() : nullptr;
+
+	const FIndexStream Indices(IndexParam);
+	FOutputStream Lifetime(OutLifetime);
+
+	int32 Slots[BatchSize];
+	for (int32 First = 0; First < InstancesCount; First += BatchSize)
 	{
-		const int32 Index = IndexParam.GetAndAdvance();
-		
-		if(Particles.IsValidIndex(Index))
-		{
-			const auto& Particle = Particles[Index];
-			OutLifetime.SetAndAdvance(Particle.Lifetime);
-		}
-		else
+		const int32 Count = FMath::Min(BatchSize, InstancesCount - First);
+		Indices.Gather(ParticleCount, First, Count, Slots);
+
+		// Encoded zero is a lifetime of zero, which is what missing points get
+		uint16 Encoded[BatchSize] = {};
+		for (int32 Lane = 0; Lane < BatchSize; ++Lane)
 		{
-			OutLifetime.SetAndAdvance(0.0f);
+			Encoded[Lane] = Slots[Lane] != INDEX_NONE ? Points[Slots[Lane]].Lifetime.Encoded : 0;
 		}
+
+		// All four half floats converted at once
+		float Lanes[BatchSize];
+		FPlatformMath::VectorLoadHalf(Lanes, Encoded);
+		Lifetime.Store(First, Count, VectorLoad(Lanes));
 	}
 }
 
@@ -272,19 +589,16 @@ void ULidarDataInterface::SetShaderParameters(
 	if(ShaderParameters)
 	{
 		FNDILidarProxy& DIProxy = Context.GetProxy<FNDILidarProxy>();
-		
-		if(!DIProxy.PositionsBuffer.Buffer.IsValid())
-		{
-			// Trigger buffers initialization
-			//DIProxy.InitializeBuffers(Particles.Num());
-		}
-		
+		const FNDILidarGpuBuffers* Buffers = DIProxy.SystemInstancesToBuffers_RT.Find(Context.GetSystemInstanceID());
+
+		// Buffers only exist once the first upload went through, bind dummies until then
+		const bool bHasBuffers = Buffers && Buffers->PackedPointsBuffer.SRV.IsValid() && Buffers->ChunkOriginsBuffer.SRV.IsValid();
+
 		// Constants
-		ShaderParameters->ParticleCount = DIProxy.ParticleCount;
+		ShaderParameters->ParticleCount = bHasBuffers ? Buffers->ParticleCount : 0;
 		// Assign initialized buffers to shader parameters
-		ShaderParameters->Positions = DIProxy.PositionsBuffer.SRV;
-		ShaderParameters->Colors = DIProxy.ColorsBuffer.SRV;
-		ShaderParameters->Lifetimes = DIProxy.LifetimesBuffer.SRV;
+		ShaderParameters->PackedPoints = bHasBuffers ? Buffers->PackedPointsBuffer.SRV.GetReference() : FNiagaraRenderer::GetDummyUInt4Buffer();
+		ShaderParameters->ChunkOrigins = bHasBuffers ? Buffers->ChunkOriginsBuffer.SRV.GetReference() : FNiagaraRenderer::GetDummyFloat4Buffer();
 	}
 }
 
@@ -303,61 +617,72 @@ bool ULidarDataInterface::GetFunctionHLSL(
   
 	if(FunctionInfo.DefinitionName == GetParticlePositionName)
 	{
+		// xy of the packed point hold the int16 offsets and the chunk index, see FLidarPackedPoint
 		static const TCHAR *FormatBounds = TEXT(R"(
       void {FunctionName}(int Index, out float3 OutPosition)
       {
-        OutPosition = {PositionsBuffer}[Index].xyz;
+        OutPosition = float3(0, 0, 0);
+        if (Index >= 0 && Index < {ParticleCount})
+        {
+          uint4 Packed = {PackedPointsBuffer}[Index];
+          int3 Offset = int3(int(Packed.x << 16) >> 16, int(Packed.x) >> 16, int(Packed.y << 16) >> 16);
+          float4 Origin = {ChunkOriginsBuffer}[Packed.y >> 16];
+          OutPosition = Origin.xyz + float3(Offset) * Origin.w;
+        }
       }
     )");
 		const TMap<FString, FStringFormatArg> ArgsBounds =
 		{
 			{TEXT("FunctionName"), FStringFormatArg(FunctionInfo.InstanceName)},
-			{TEXT("PositionsBuffer"),
-			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + "PositionsBuffer")},
+			{TEXT("ParticleCount"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + ParticleCountParamName)},
+			{TEXT("PackedPointsBuffer"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + PackedPointsBufferName)},
+			{TEXT("ChunkOriginsBuffer"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + ChunkOriginsBufferName)},
 		   };
 		OutHLSL += FString::Format(FormatBounds, ArgsBounds);
 	}
-	else
-	{
-		// Return false if the function name does not match any expected.
-		return false;
-	}
-	
-	if(FunctionInfo.DefinitionName == GetParticleColorName)
+	else if(FunctionInfo.DefinitionName == GetParticleColorName)
 	{
+		// z is an FColor, which sits in memory as BGRA
 		static const TCHAR *FormatBounds = TEXT(R"(
       void {FunctionName}(int Index, out float4 OutColor)
       {
-        OutColor = {ColorsBuffer}[Index].xyzw;
+        OutColor = float4(0, 0, 0, 0);
+        if (Index >= 0 && Index < {ParticleCount})
+        {
+          uint Packed = {PackedPointsBuffer}[Index].z;
+          OutColor = float4((Packed >> 16) & 0xFF, (Packed >> 8) & 0xFF, Packed & 0xFF, Packed >> 24) / 255.0f;
+        }
       }
     )");
 		const TMap<FString, FStringFormatArg> ArgsBounds =
 		{
 			{TEXT("FunctionName"), FStringFormatArg(FunctionInfo.InstanceName)},
-			{TEXT("ColorsBuffer"),
-			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + "ColorsBuffer")},
+			{TEXT("ParticleCount"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + ParticleCountParamName)},
+			{TEXT("PackedPointsBuffer"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + PackedPointsBufferName)},
 		   };
 		OutHLSL += FString::Format(FormatBounds, ArgsBounds);
 	}
-	else
-	{
-		// Return false if the function name does not match any expected.
-		return false;
-	}
-
-	if(FunctionInfo.DefinitionName == GetParticleLifetimeName)
+	else if(FunctionInfo.DefinitionName == GetParticleLifetimeName)
 	{
+		// Low half of w is the half float lifetime, the high half the hit count
 		static const TCHAR *FormatBounds = TEXT(R"(
       void {FunctionName}(int Index, out float OutLifetime)
       {
-        OutLifetime = {LifetimeBuffer}[Index];
+        OutLifetime = Index >= 0 && Index < {ParticleCount} ? f16tof32({PackedPointsBuffer}[Index].w & 0xFFFF) : 0.0f;
       }
     )");
 		const TMap<FString, FStringFormatArg> ArgsBounds =
 		{
 			{TEXT("FunctionName"), FStringFormatArg(FunctionInfo.InstanceName)},
-			{TEXT("LifetimeBuffer"),
-			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + "LifetimeBuffer")},
+			{TEXT("ParticleCount"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + ParticleCountParamName)},
+			{TEXT("PackedPointsBuffer"),
+			  FStringFormatArg(ParamInfo.DataInterfaceHLSLSymbol + PackedPointsBufferName)},
 		   };
 		OutHLSL += FString::Format(FormatBounds, ArgsBounds);
 	}
@@ -377,12 +702,10 @@ void ULidarDataInterface::GetParameterDefinitionHLSL(
 
 	OutHLSL.Appendf(TEXT("int %s%s;\n"), 
 	  *ParamInfo.DataInterfaceHLSLSymbol, *ParticleCountParamName);
+	OutHLSL.Appendf(TEXT("Buffer<uint4> %s%s;\n"),
+	  *ParamInfo.DataInterfaceHLSLSymbol, *PackedPointsBufferName);
 	OutHLSL.Appendf(TEXT("Buffer<float4> %s%s;\n"),
-	  *ParamInfo.DataInterfaceHLSLSymbol, *PositionsBufferName);
-	OutHLSL.Appendf(TEXT("Buffer<float4> %s%s;\n"),
-	  *ParamInfo.DataInterfaceHLSLSymbol, *ColorsBufferName);
-	OutHLSL.Appendf(TEXT("Buffer<float> %s%s;\n"),
-	  *ParamInfo.DataInterfaceHLSLSymbol, *LifetimeBufferName);
+	  *ParamInfo.DataInterfaceHLSLSymbol, *ChunkOriginsBufferName);
 }
 
 void ULidarDataInterface::BuildShaderParameters(FNiagaraShaderParametersBuilder& ShaderParametersBuilder) const
@@ -4,11 +4,17 @@
 
 #include "CoreMinimal.h"
 #include "NiagaraDataInterface.h"
-#include "ParticleStruct.h"
+#include "LidarGpuUpload.h"
 #include "LidarDataInterface.generated.h"
 
+class ULidarComponent;
+class ULidarPointPoolSubsystem;
+class FLidarPointCloud;
+struct FNDILidarInstanceData;
+
 /**
- * 
+ * Exposes a ULidarComponent's point cloud to Niagara. Every system instance has its own data,
+ * bound to the scanner it is attached to, so many scanners can share one system asset.
  */
 UCLASS(EditInlineNew, Category = "Lidar", meta = (DisplayName = "Lidar Data Interface"))
 class LIDARSCANNER_API ULidarDataInterface : public UNiagaraDataInterface
@@ -17,9 +23,8 @@ class LIDARSCANNER_API ULidarDataInterface : public UNiagaraDataInterface
 
 	BEGIN_SHADER_PARAMETER_STRUCT(FLidarShaderParameters, )
 	   SHADER_PARAMETER(int, ParticleCount)
-	   SHADER_PARAMETER_SRV(Buffer<float4>, Positions)
-	   SHADER_PARAMETER_SRV(Buffer<float4>, Colors)
-	   SHADER_PARAMETER_SRV(Buffer<float>, Lifetimes)
+	   SHADER_PARAMETER_SRV(Buffer<uint4>, PackedPoints)
+	   SHADER_PARAMETER_SRV(Buffer<float4>, ChunkOrigins)
 	END_SHADER_PARAMETER_STRUCT()
 	
 public:
@@ -33,7 +38,7 @@ public:
 	void GetParticleColor(FVectorVMExternalFunctionContext& Context) const;
 	void GetParticleLifetime(FVectorVMExternalFunctionContext& Context) const;
 
-	virtual bool CanExecuteOnTarget(ENiagaraSimTarget Target) const override { return Target == ENiagaraSimTarget::GPUComputeSim; }
+	virtual bool CanExecuteOnTarget(ENiagaraSimTarget Target) const override { return Target == ENiagaraSimTarget::GPUComputeSim || Target == ENiagaraSimTarget::CPUSim; }
 
 #if WITH_EDITORONLY_DATA
 	virtual bool GetFunctionHLSL(const FNiagaraDataInterfaceGPUParamInfo& ParamInfo, const FNiagaraDataInterfaceGeneratedFunction& FunctionInfo, int FunctionInstanceIndex, FString& OutHLSL) override;
@@ -43,16 +48,36 @@ public:
 	virtual bool UseLegacyShaderBindings() const { return false; }
 	virtual void BuildShaderParameters(FNiagaraShaderParametersBuilder& ShaderParametersBuilder) const override;
 	virtual void SetShaderParameters(const FNiagaraDataInterfaceSetShaderParametersContext& Context) const override;
-	
-	TArray<FParticleStruct> ParticleDataArray;
+	virtual void ProvidePerInstanceDataForRenderThread(void* DataForRenderThread, void* PerInstanceData, const FNiagaraSystemInstanceID& SystemInstance) override;
+
+	// PER INSTANCE DATA
+	virtual int32 PerInstanceDataSize() const override;
+	virtual bool InitPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance) override;
+	virtual void DestroyPerInstanceData(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance) override;
+	virtual bool PerInstanceTick(void* PerInstanceData, FNiagaraSystemInstance* SystemInstance, float DeltaSeconds) override;
+	virtual bool HasPreSimulateTick() const override { return true; }
+
+	/** The scanner feeding a system instance: the Niagara component's outer, an attach parent, or a scanner on the same actor */
+	static ULidarComponent* FindSourceComponent(FNiagaraSystemInstance* SystemInstance);
+
+	/** The world's shared point pool, if the system instance is the one rendering it */
+	static ULidarPointPoolSubsystem* FindSourcePool(FNiagaraSystemInstance* SystemInstance);
+
+#if WITH_DEV_AUTOMATION_TESTS
+	/** Instance data reading Cloud as it is now, so tests can call the VM functions without a system instance */
+	static void* CreateDetachedInstanceData(const FLidarPointCloud& Cloud);
+	static void DestroyDetachedInstanceData(void* InstanceData);
+#endif
 
 private:
+	/** Points the VM side of InstanceData at Cloud and copies the chunk origins it does not have yet */
+	static void BindCloud(FNDILidarInstanceData& InstanceData, const FLidarPointCloud* Cloud);
+
 	static const FName GetParticlePositionName;
 	static const FName GetParticleColorName;
 	static const FName GetParticleLifetimeName;
 
 	static const FString ParticleCountParamName;
-	static const FString LifetimeBufferName;
-	static const FString ColorsBufferName;
-	static const FString PositionsBufferName;
+	static const FString PackedPointsBufferName;
+	static const FString ChunkOriginsBufferName;
 };
@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarGpuUpload.h"
+
+int32 FLidarGpuUploadPlan::GetUploadNum() const
+{
+	int32 Num = 0;
+	for (const FLidarPointSpan& Span : UploadSpans)
+	{
+		Num += Span.Num;
+	}
+	return Num;
+}
+
+int32 FLidarGpuUploadPlanner::ComputeGrownCapacity(int32 CurrentCapacity, int32 RequiredCount)
+{
+	int32 Capacity = FMath::Max(CurrentCapacity, MinCapacity);
+	while (Capacity < RequiredCount)
+	{
+		// Doubling keeps reallocations (and their full re-uploads) logarithmic in the cloud size
+		Capacity = Capacity > MAX_int32 / 2 ? RequiredCount : Capacity * 2;
+	}
+	return Capacity;
+}
+
+void FLidarGpuUploadPlanner::MarkDirty(int32 First, int32 Num)
+{
+	// A ring wrap usually produces exactly two ranges
+	DirtyRanges.Add(First, Num);
+}
+
+FLidarGpuUploadPlan FLidarGpuUploadPlanner::Plan(int32 ParticleCount, int32 ChunkCount)
+{
+	FLidarGpuUploadPlan Plan;
+	Plan.ParticleCount = ParticleCount;
+
+	if (GpuCapacity == 0 || ParticleCount > GpuCapacity)
+	{
+		GpuCapacity = ComputeGrownCapacity(GpuCapacity, ParticleCount);
+		Plan.bReallocate = true;
+		if (ParticleCount > 0)
+		{
+			Plan.UploadSpans.Add({0, ParticleCount});
+		}
+	}
+	else
+	{
+		for (const FLidarDirtyRange& Range : DirtyRanges.GetRanges())
+		{
+			// Anything past the particle count is stale, there is no point sending it
+			const int32 Begin = FMath::Min(Range.Begin, ParticleCount);
+			const int32 End = FMath::Min(Range.End, ParticleCount);
+			if (End > Begin)
+			{
+				Plan.UploadSpans.Add({Begin, End - Begin});
+			}
+		}
+	}
+
+	Plan.Capacity = GpuCapacity;
+	DirtyRanges.Reset();
+
+	Plan.ChunkCount = ChunkCount;
+	if (GpuChunkCapacity == 0 || ChunkCount > GpuChunkCapacity)
+	{
+		// Chunks are few, a small minimum is plenty
+		GpuChunkCapacity = FMath::Max<int32>(64, FMath::RoundUpToPowerOfTwo(ChunkCount));
+		Plan.bReallocateChunks = true;
+		Plan.ChunkSpan = {0, ChunkCount};
+	}
+	else if (ChunkCount > UploadedChunks)
+	{
+		Plan.ChunkSpan = {UploadedChunks, ChunkCount - UploadedChunks};
+	}
+	Plan.ChunkCapacity = GpuChunkCapacity;
+	UploadedChunks = ChunkCount;
+
+	return Plan;
+}
+
+void FLidarGpuUploadPlanner::Reset()
+{
+	DirtyRanges.Reset();
+	GpuCapacity = 0;
+	GpuChunkCapacity = 0;
+	UploadedChunks = 0;
+}
+
+void LidarGpuUpload::PackRange(const FLidarPointCloud& Cloud, const FLidarGpuUploadPlan& Plan, FLidarGpuUploadPacket& OutPacket)
+{
+	OutPacket.Plan = Plan;
+
+	// The cloud already stores the GPU layout, this is a plain copy per span
+	const TConstArrayView<FLidarPackedPoint> Points = Cloud.GetPoints();
+	OutPacket.Points.Reset(Plan.GetUploadNum());
+	for (const FLidarPointSpan& Span : Plan.UploadSpans)
+	{
+		OutPacket.Points.Append(Points.Slice(Span.First, Span.Num));
+	}
+
+	const TConstArrayView<FVector> Origins = Cloud.GetChunks().GetOrigins();
+	OutPacket.ChunkOrigins.SetNumUninitialized(Plan.ChunkSpan.Num);
+	for (int32 i = 0; i < Plan.ChunkSpan.Num; ++i)
+	{
+		OutPacket.ChunkOrigins[i] = FVector4f(FVector3f(Origins[Plan.ChunkSpan.First + i]), FLidarChunkTable::QuantizationStep);
+	}
+}
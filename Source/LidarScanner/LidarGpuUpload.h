@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarPointCloud.h"
+
+/** What the render thread has to do with its buffers for one upload */
+struct FLidarGpuUploadPlan
+{
+	int32 ParticleCount = 0;
+	// Size the GPU buffers must have, in particles
+	int32 Capacity = 0;
+	// Buffers are recreated at Capacity, everything up to ParticleCount is uploaded again
+	bool bReallocate = false;
+	// Slot ranges to write, packed back to back in the upload packet
+	TArray<FLidarPointSpan, TInlineAllocator<4>> UploadSpans;
+
+	// Chunk origins follow the same scheme, they are append only so one span is enough
+	int32 ChunkCount = 0;
+	int32 ChunkCapacity = 0;
+	bool bReallocateChunks = false;
+	FLidarPointSpan ChunkSpan;
+
+	int32 GetUploadNum() const;
+};
+
+/**
+ * Game thread mirror of the GPU buffer sizes. Decides when the buffers grow (geometrically)
+ * and which ranges of particles have to be sent, so the render thread just follows the plan.
+ * No RHI in here, it runs fine under -nullrhi.
+ */
+class LIDARSCANNER_API FLidarGpuUploadPlanner
+{
+public:
+	static constexpr int32 MinCapacity = 1024;
+	// Past this many disjoint ranges the closest ones are merged
+	static constexpr int32 MaxDirtyRanges = 4;
+	// For sources that write many small scattered ranges per frame (in place updates, expiry, the shared pool)
+	static constexpr int32 MaxScatteredRanges = 64;
+
+	static int32 ComputeGrownCapacity(int32 CurrentCapacity, int32 RequiredCount);
+
+	void MarkDirty(int32 First, int32 Num);
+
+	/** More ranges mean fewer clean slots uploaded between them, but one buffer lock per range on the render thread */
+	void SetMaxDirtyRanges(int32 InMaxRanges) { DirtyRanges.SetMaxRanges(InMaxRanges); }
+
+	/** Builds the plan for ParticleCount particles and ChunkCount chunk origins, clears the dirty ranges */
+	FLidarGpuUploadPlan Plan(int32 ParticleCount, int32 ChunkCount);
+
+	/** Forgets the GPU side, the next plan reallocates and uploads everything */
+	void Reset();
+
+	int32 GetGpuCapacity() const { return GpuCapacity; }
+
+private:
+	FLidarDirtyRangeList DirtyRanges{MaxDirtyRanges};
+	int32 GpuCapacity = 0;
+
+	int32 GpuChunkCapacity = 0;
+	int32 UploadedChunks = 0;
+};
+
+/** Payload passed to the render thread, only the planned ranges are packed */
+struct FLidarGpuUploadPacket
+{
+	FLidarGpuUploadPlan Plan;
+	// Straight copies of the cloud's 16 byte points, the GPU reads them as uint4
+	TArray<FLidarPackedPoint> Points;
+	// Chunk center in xyz, quantization step in w
+	TArray<FVector4f> ChunkOrigins;
+};
+
+namespace LidarGpuUpload
+{
+	/** Copies Plan's upload spans of Cloud and the new chunk origins into the packet */
+	LIDARSCANNER_API void PackRange(const FLidarPointCloud& Cloud, const FLidarGpuUploadPlan& Plan, FLidarGpuUploadPacket& OutPacket);
+}
@@ -0,0 +1,614 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarNetReplication.h"
+#include "LidarComponent.h"
+#include "LidarScanPipeline.h"
+#include "Engine/NetSerialization.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/CoreNet.h"
+
+static TAutoConsoleVariable<int32> CVarLidarNetMaxBytesPerSecond(
+	TEXT("Lidar.Net.MaxBytesPerSecond"),
+	32768,
+	TEXT("Lidar scan bytes each connection may be sent per second, the rest waits"));
+
+static TAutoConsoleVariable<float> CVarLidarNetRelevancyDistance(
+	TEXT("Lidar.Net.RelevancyDistance"),
+	30000.f,
+	TEXT("Scans further than this from a connection's view are not sent to it, in cm. 0 sends everything"));
+
+static TAutoConsoleVariable<float> CVarLidarNetMaxBacklogSeconds(
+	TEXT("Lidar.Net.MaxBacklogSeconds"),
+	5.f,
+	TEXT("Scans that waited this long for a connection's bandwidth are dropped for it"));
+
+static TAutoConsoleVariable<int32> CVarLidarNetMaxClientRaysPerSecond(
+	TEXT("Lidar.Net.MaxClientRaysPerSecond"),
+	20000,
+	TEXT("Rays each client may have the server trace per second, scans past it are rejected"));
+
+#pragma region Scan
+
+bool FLidarNetScan::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	// Kind and pattern share a byte
+	uint8 KindAndPattern = static_cast<uint8>((Record.Kind & 1) | (static_cast<uint8>(Record.Pattern) << 1));
+	Ar << KindAndPattern;
+
+	// A tenth of a millimeter, plenty for 100 m rays
+	bOutSuccess = SerializePackedVector<10, 30>(Record.Start, Ar);
+	Record.Rotation.SerializeCompressedShort(Ar);
+	Ar << Record.Seed;
+
+	uint32 RayCount = static_cast<uint32>(FMath::Max(Record.RayCount, 0));
+	Ar.SerializeIntPacked(RayCount);
+
+	if (Ar.IsLoading())
+	{
+		Record.Kind = KindAndPattern & 1;
+		Record.Pattern = static_cast<ELidarScanPattern>(KindAndPattern >> 1);
+		Record.RayCount = static_cast<int32>(RayCount);
+	}
+
+	// Fan row offset of a full scan, pass offset of a continuous fire batch
+	uint32 FirstRay = static_cast<uint32>(FMath::Max(Record.FirstRay, 0));
+	Ar.SerializeIntPacked(FirstRay);
+	Record.FirstRay = static_cast<int32>(FirstRay);
+
+	// Whole centimeters, zero leaves it to the receiving scanner
+	uint32 RaycastLength = static_cast<uint32>(FMath::Max(FMath::RoundToInt32(Record.RaycastLength), 0));
+	Ar.SerializeIntPacked(RaycastLength);
+	Record.RaycastLength = static_cast<float>(RaycastLength);
+
+	if (Record.Kind == static_cast<uint8>(FLidarScanJob::EKind::Normal))
+	{
+		uint32 PatternRayCount = static_cast<uint32>(FMath::Max(Record.PatternRayCount, 0));
+		Ar.SerializeIntPacked(PatternRayCount);
+		Ar << Record.ScanRadius;
+		Record.PatternRayCount = static_cast<int32>(PatternRayCount);
+	}
+	else
+	{
+		uint32 FanRayCount = static_cast<uint32>(FMath::Max(Record.FanRayCount, 0));
+		Ar << Record.VerticalAngle;
+		Ar << Record.HorizontalAngle;
+		Ar.SerializeIntPacked(FanRayCount);
+		Record.FanRayCount = static_cast<int32>(FanRayCount);
+	}
+
+	bOutSuccess &= Ar.IsError() == false;
+	return true;
+}
+
+int32 FLidarNetScan::Quantize(FLidarScanRecord& Record)
+{
+	FLidarNetScan Scan;
+	Scan.Record = Record;
+	bool bSuccess = false;
+
+	FNetBitWriter Writer(nullptr, 0);
+	Scan.NetSerialize(Writer, nullptr, bSuccess);
+
+	FNetBitReader Reader(nullptr, Writer.GetData(), Writer.GetNumBits());
+	Scan.NetSerialize(Reader, nullptr, bSuccess);
+
+	Record.Start = Scan.Record.Start;
+	Record.Rotation = Scan.Record.Rotation;
+	Record.RaycastLength = Scan.Record.RaycastLength;
+	return static_cast<int32>(Writer.GetNumBytes());
+}
+
+#pragma endregion
+
+#pragma region Codec
+
+namespace
+{
+	constexpr uint8 NewColorFlag = 1;
+	constexpr uint8 NewLifetimeFlag = 2;
+
+	// Flags, three offsets and a full color and lifetime
+	constexpr int32 MaxPointBytes = 1 + 3 * 5 + 4 + 2;
+	// Point count and three chunk coordinate deltas
+	constexpr int32 MaxRunHeaderBytes = 4 * 5;
+	// Step and point count of the batch
+	constexpr int32 MaxBatchHeaderBytes = 2 * 5;
+
+	void WriteVarint(TArray<uint8>& Out, uint32 Value)
+	{
+		while (Value >= 0x80)
+		{
+			Out.Add(static_cast<uint8>(Value) | 0x80);
+			Value >>= 7;
+		}
+		Out.Add(static_cast<uint8>(Value));
+	}
+
+	void WriteSigned(TArray<uint8>& Out, int32 Value)
+	{
+		WriteVarint(Out, (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31));
+	}
+
+	bool ReadVarint(TConstArrayView<uint8> In, int32& Offset, uint32& OutValue)
+	{
+		OutValue = 0;
+		for (int32 Shift = 0; Shift < 32; Shift += 7)
+		{
+			if (Offset >= In.Num())
+				return false;
+
+			const uint8 Byte = In[Offset++];
+			OutValue |= static_cast<uint32>(Byte & 0x7F) << Shift;
+			if ((Byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool ReadSigned(TConstArrayView<uint8> In, int32& Offset, int32& OutValue)
+	{
+		uint32 Value = 0;
+		if (ReadVarint(In, Offset, Value) == false)
+			return false;
+
+		OutValue = static_cast<int32>(Value >> 1) ^ -static_cast<int32>(Value & 1);
+		return true;
+	}
+
+	bool ReadSigned(TConstArrayView<uint8> In, int32& Offset, FIntVector& OutValue)
+	{
+		return ReadSigned(In, Offset, OutValue.X) && ReadSigned(In, Offset, OutValue.Y) && ReadSigned(In, Offset, OutValue.Z);
+	}
+}
+
+int32 LidarNetCodec::EncodePoints(TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks, float QuantizationCm, int32 MaxBytes, TArray<uint8>& Out)
+{
+	const int32 StepMm = FMath::Max(1, FMath::RoundToInt(QuantizationCm * 10.f));
+	// Packed offset units per net step
+	const float PackedPerStep = StepMm * 0.1f / FLidarChunkTable::QuantizationStep;
+	const int32 BodyBudget = MaxBytes - MaxBatchHeaderBytes;
+
+	TArray<uint8> Body;
+	TArray<uint8> Run;
+	Body.Reserve(FMath::Max(BodyBudget, 0));
+
+	int32 Count = 0;
+	int32 RunChunk = INDEX_NONE;
+	int32 RunCount = 0;
+	FIntVector PreviousCoord = FIntVector::ZeroValue;
+	FIntVector PreviousOffset = FIntVector::ZeroValue;
+	FColor PreviousColor = FColor::White;
+	uint16 PreviousLifetime = 0;
+
+	auto FlushRun = [&]()
+	{
+		if (RunCount == 0)
+			return;
+
+		const FIntVector Coord = FLidarChunkTable::GetChunkCoord(Chunks.GetOrigin(RunChunk));
+		WriteVarint(Body, RunCount);
+		WriteSigned(Body, Coord.X - PreviousCoord.X);
+		WriteSigned(Body, Coord.Y - PreviousCoord.Y);
+		WriteSigned(Body, Coord.Z - PreviousCoord.Z);
+		Body.Append(Run);
+
+		PreviousCoord = Coord;
+		Run.Reset();
+		RunCount = 0;
+	};
+
+	for (const FLidarPackedPoint& Point : Points)
+	{
+		if (Point.ChunkIndex != RunChunk)
+		{
+			FlushRun();
+			RunChunk = Point.ChunkIndex;
+			PreviousOffset = FIntVector::ZeroValue;
+		}
+
+		if (Body.Num() + MaxRunHeaderBytes + Run.Num() + MaxPointBytes > BodyBudget)
+			break;
+
+		const FIntVector Offset(FMath::RoundToInt(Point.X / PackedPerStep), FMath::RoundToInt(Point.Y / PackedPerStep), FMath::RoundToInt(Point.Z / PackedPerStep));
+		const uint16 Lifetime = Point.Lifetime.Encoded;
+
+		uint8 Flags = 0;
+		Flags |= (Count == 0 || Point.Color != PreviousColor) ? NewColorFlag : 0;
+		Flags |= (Count == 0 || Lifetime != PreviousLifetime) ? NewLifetimeFlag : 0;
+
+		Run.Add(Flags);
+		WriteSigned(Run, Offset.X - PreviousOffset.X);
+		WriteSigned(Run, Offset.Y - PreviousOffset.Y);
+		WriteSigned(Run, Offset.Z - PreviousOffset.Z);
+		if (Flags & NewColorFlag)
+		{
+			Run.Append({Point.Color.R, Point.Color.G, Point.Color.B, Point.Color.A});
+		}
+		if (Flags & NewLifetimeFlag)
+		{
+			Run.Append({static_cast<uint8>(Lifetime & 0xFF), static_cast<uint8>(Lifetime >> 8)});
+		}
+
+		PreviousOffset = Offset;
+		PreviousColor = Point.Color;
+		PreviousLifetime = Lifetime;
+		++RunCount;
+		++Count;
+	}
+	FlushRun();
+
+	if (Count > 0)
+	{
+		WriteVarint(Out, StepMm);
+		WriteVarint(Out, Count);
+		Out.Append(Body);
+	}
+	return Count;
+}
+
+bool LidarNetCodec::DecodePoints(TConstArrayView<uint8> Batch, TFunctionRef<void(const FVector&, const FColor&, float)> Function)
+{
+	int32 Offset = 0;
+	uint32 StepMm = 0;
+	uint32 Count = 0;
+	if (ReadVarint(Batch, Offset, StepMm) == false || ReadVarint(Batch, Offset, Count) == false || StepMm == 0)
+		return false;
+
+	const float Step = StepMm * 0.1f;
+	FIntVector Coord = FIntVector::ZeroValue;
+	FColor Color = FColor::White;
+	float Lifetime = 0.f;
+
+	uint32 Decoded = 0;
+	while (Decoded < Count)
+	{
+		uint32 RunCount = 0;
+		FIntVector CoordDelta;
+		if (ReadVarint(Batch, Offset, RunCount) == false || RunCount == 0 || RunCount > Count - Decoded || ReadSigned(Batch, Offset, CoordDelta) == false)
+			return false;
+
+		Coord += CoordDelta;
+		const FVector Center = FLidarChunkTable::GetChunkCenter(Coord);
+		FIntVector Position = FIntVector::ZeroValue;
+
+		for (uint32 i = 0; i < RunCount; ++i)
+		{
+			if (Offset >= Batch.Num())
+				return false;
+
+			const uint8 Flags = Batch[Offset++];
+			FIntVector Delta;
+			if (ReadSigned(Batch, Offset, Delta) == false)
+				return false;
+			Position += Delta;
+
+			if (Flags & NewColorFlag)
+			{
+				if (Offset + 4 > Batch.Num())
+					return false;
+				Color = FColor(Batch[Offset], Batch[Offset + 1], Batch[Offset + 2], Batch[Offset + 3]);
+				Offset += 4;
+			}
+			if (Flags & NewLifetimeFlag)
+			{
+				if (Offset + 2 > Batch.Num())
+					return false;
+				FFloat16 Half;
+				Half.Encoded = static_cast<uint16>(Batch[Offset] | (Batch[Offset + 1] << 8));
+				Lifetime = Half.GetFloat();
+				Offset += 2;
+			}
+
+			Function(Center + FVector(Position) * Step, Color, Lifetime);
+		}
+		Decoded += RunCount;
+	}
+
+	return Offset == Batch.Num();
+}
+
+#pragma endregion
+
+#pragma region Relay
+
+ULidarNetRelayComponent::ULidarNetRelayComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetIsReplicatedByDefault(true);
+}
+
+bool ULidarNetRelayComponent::ConsumeClientRays(int32 Rays)
+{
+	const double RaysPerSecond = FMath::Max(CVarLidarNetMaxClientRaysPerSecond.GetValueOnGameThread(), 1);
+	const double Now = GetWorld()->GetTimeSeconds();
+
+	// Starts full, a client may scan as soon as it joins
+	RayTokens = RayTokens < 0.0 ? RaysPerSecond : FMath::Min(RayTokens + RaysPerSecond * (Now - RayTokensTime), RaysPerSecond);
+	RayTokensTime = Now;
+
+	if (Rays > RayTokens)
+	{
+		++Stats.RejectedScans;
+		return false;
+	}
+
+	RayTokens -= Rays;
+	return true;
+}
+
+void ULidarNetRelayComponent::ClientReceiveScans_Implementation(ULidarComponent* Scanner, const TArray<FLidarNetScan>& Scans)
+{
+	for (const FLidarNetScan& Scan : Scans)
+	{
+		FLidarScanRecord Record = Scan.Record;
+		Stats.Bytes += FLidarNetScan::Quantize(Record);
+	}
+	Stats.Scans += Scans.Num();
+
+	// The scanner's actor may not have replicated yet, or is already gone
+	if (Scanner != nullptr)
+	{
+		Scanner->ReceiveNetworkScans(Scans);
+	}
+}
+
+void ULidarNetRelayComponent::ClientReceivePoints_Implementation(ULidarComponent* Scanner, const TArray<uint8>& Batch)
+{
+	Stats.Bytes += Batch.Num();
+	++Stats.PointBatches;
+
+	if (Scanner != nullptr)
+	{
+		Stats.BatchPoints += Scanner->ReceiveNetworkPoints(Batch);
+	}
+}
+
+#pragma endregion
+
+#pragma region Subsystem
+
+bool ULidarReplicationSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+TStatId ULidarReplicationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULidarReplicationSubsystem, STATGROUP_Tickables);
+}
+
+bool ULidarReplicationSubsystem::IsServer() const
+{
+	const ENetMode NetMode = GetWorld()->GetNetMode();
+	return NetMode == NM_ListenServer || NetMode == NM_DedicatedServer;
+}
+
+void ULidarReplicationSubsystem::QueueScan(ULidarComponent* Scanner, const FLidarScanRecord& Record, int32 Bytes)
+{
+	FItem& Item = Items.AddDefaulted_GetRef();
+	Item.Scanner = Scanner;
+	Item.Time = GetWorld()->GetTimeSeconds();
+	Item.Origin = Record.Start;
+	Item.Bytes = Bytes;
+	Item.Scan.Record = Record;
+}
+
+void ULidarReplicationSubsystem::QueuePoints(ULidarComponent* Scanner, TArray<uint8>&& Batch, int32 PointCount, const FVector& Origin)
+{
+	FItem& Item = Items.AddDefaulted_GetRef();
+	Item.Scanner = Scanner;
+	Item.Time = GetWorld()->GetTimeSeconds();
+	Item.Origin = Origin;
+	Item.Bytes = Batch.Num();
+	Item.PointCount = PointCount;
+	Item.Batch = MoveTemp(Batch);
+}
+
+void ULidarReplicationSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (IsServer() == false)
+	{
+		Items.Reset();
+		return;
+	}
+
+	EnsureRelays();
+
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		APlayerController* Controller = It->Get();
+		// The listen server's own player sees the server's scans already
+		if (Controller == nullptr || Controller->IsLocalController())
+			continue;
+
+		if (ULidarNetRelayComponent* Relay = Controller->FindComponentByClass<ULidarNetRelayComponent>())
+		{
+			SendItems(*Relay, *Controller, DeltaTime);
+		}
+	}
+
+	TrimItems();
+}
+
+void ULidarReplicationSubsystem::EnsureRelays()
+{
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		APlayerController* Controller = It->Get();
+		if (Controller == nullptr || Controller->IsLocalController() || Controller->FindComponentByClass<ULidarNetRelayComponent>() != nullptr)
+			continue;
+
+		ULidarNetRelayComponent* Relay = NewObject<ULidarNetRelayComponent>(Controller, TEXT("LidarNetRelay"));
+		Relay->RegisterComponent();
+		// New connections start at the end of the log, there is no history to catch up on
+		Relay->NextItem = FirstItem + Items.Num();
+		Relay->Tokens = CVarLidarNetMaxBytesPerSecond.GetValueOnGameThread() * 0.25;
+	}
+}
+
+void ULidarReplicationSubsystem::SendItems(ULidarNetRelayComponent& Relay, APlayerController& Controller, float DeltaTime)
+{
+	const double BytesPerSecond = FMath::Max(CVarLidarNetMaxBytesPerSecond.GetValueOnGameThread(), 1);
+	const float RelevancyDistance = CVarLidarNetRelevancyDistance.GetValueOnGameThread();
+	const double OldestTime = GetWorld()->GetTimeSeconds() - CVarLidarNetMaxBacklogSeconds.GetValueOnGameThread();
+
+	// Up to a quarter second of bandwidth builds up while there is nothing to send
+	const double Burst = BytesPerSecond * 0.25;
+	Relay.Tokens = FMath::Min(Relay.Tokens + BytesPerSecond * DeltaTime, Burst);
+
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	Controller.GetPlayerViewPoint(ViewLocation, ViewRotation);
+
+	// Scans are gathered per scanner so each one goes out in a single RPC
+	TMap<ULidarComponent*, TArray<FLidarNetScan>> Scans;
+
+	uint64 Id = FMath::Max(Relay.NextItem, FirstItem);
+	for (; Id < FirstItem + Items.Num(); ++Id)
+	{
+		const FItem& Item = Items[static_cast<int32>(Id - FirstItem)];
+		ULidarComponent* Scanner = Item.Scanner.Get();
+
+		// The owning client traced its own scans already
+		if (Scanner == nullptr || (Scanner->GetOwner() != nullptr && Scanner->GetOwner()->GetNetOwner() == &Controller))
+			continue;
+
+		if (Item.Time < OldestTime)
+		{
+			++Relay.Stats.Dropped;
+			continue;
+		}
+
+		if (RelevancyDistance > 0.f && FVector::DistSquared(ViewLocation, Item.Origin) > FMath::Square(RelevancyDistance))
+		{
+			++Relay.Stats.Culled;
+			continue;
+		}
+
+		// An item larger than the whole burst goes out once the bucket is full and runs it into debt,
+		// it would block everything behind it until the backlog timeout otherwise
+		if (Item.Bytes > Relay.Tokens && Relay.Tokens < Burst)
+			break;
+
+		Relay.Tokens -= Item.Bytes;
+		Relay.Stats.Bytes += Item.Bytes;
+
+		if (Item.Batch.IsEmpty())
+		{
+			Scans.FindOrAdd(Scanner).Add(Item.Scan);
+			++Relay.Stats.Scans;
+		}
+		else
+		{
+			Relay.ClientReceivePoints(Scanner, Item.Batch);
+			++Relay.Stats.PointBatches;
+			Relay.Stats.BatchPoints += Item.PointCount;
+		}
+	}
+
+	Relay.NextItem = Id;
+	Relay.Stats.Backlog = static_cast<int32>(FirstItem + Items.Num() - Id);
+
+	for (const TPair<ULidarComponent*, TArray<FLidarNetScan>>& Pair : Scans)
+	{
+		Relay.ClientReceiveScans(Pair.Key, Pair.Value);
+	}
+}
+
+void ULidarReplicationSubsystem::TrimItems()
+{
+	uint64 Keep = FirstItem + Items.Num();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		if (const APlayerController* Controller = It->Get())
+		{
+			if (const ULidarNetRelayComponent* Relay = Controller->FindComponentByClass<ULidarNetRelayComponent>())
+			{
+				Keep = FMath::Min(Keep, FMath::Max(Relay->NextItem, FirstItem));
+			}
+		}
+	}
+
+	const int32 TrimCount = static_cast<int32>(Keep - FirstItem);
+	if (TrimCount > 0)
+	{
+		Items.RemoveAt(0, TrimCount, EAllowShrinking::No);
+		FirstItem = Keep;
+	}
+}
+
+void ULidarReplicationSubsystem::DumpStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Lidar replication: %d items queued, cap %d bytes/s per connection, relevancy %.0f cm"),
+		Items.Num(), CVarLidarNetMaxBytesPerSecond.GetValueOnGameThread(), CVarLidarNetRelevancyDistance.GetValueOnGameThread());
+}
+
+#pragma endregion
+
+#pragma region Console
+
+namespace LidarNetCommands
+{
+	using LidarScan::ForEachScanner;
+
+	static FAutoConsoleCommandWithWorldAndArgs DumpCommand(
+		TEXT("Lidar.Net.Dump"),
+		TEXT("Logs what every connection was sent on the server, or what this client received and the bytes per point it cost"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			if (World == nullptr)
+				return;
+
+			if (World->GetNetMode() == NM_ListenServer || World->GetNetMode() == NM_DedicatedServer)
+			{
+				if (const ULidarReplicationSubsystem* Subsystem = World->GetSubsystem<ULidarReplicationSubsystem>())
+				{
+					Subsystem->DumpStats();
+				}
+			}
+
+			for (FConstPlayerControllerIterator It = World->GetPlayerControllerIterator(); It; ++It)
+			{
+				const APlayerController* Controller = It->Get();
+				const ULidarNetRelayComponent* Relay = Controller != nullptr ? Controller->FindComponentByClass<ULidarNetRelayComponent>() : nullptr;
+				if (Relay == nullptr)
+					continue;
+
+				const FLidarNetStats Stats = Relay->GetNetStats();
+				UE_LOG(LogTemp, Log, TEXT("%s: %.1f KB, %lld scans, %lld point batches (%lld points), %lld culled, %lld dropped, %d waiting, %lld client scans rejected"),
+					*Controller->GetName(), Stats.Bytes / 1024.0, Stats.Scans, Stats.PointBatches, Stats.BatchPoints, Stats.Culled, Stats.Dropped, Stats.Backlog, Stats.RejectedScans);
+			}
+
+			// On a client, the scanners of other players only gain points through replication
+			if (World->GetNetMode() == NM_Client)
+			{
+				int64 RemotePoints = 0;
+				ForEachScanner(World, [&RemotePoints](ULidarComponent& Scanner)
+				{
+					if (Scanner.IsLocallyControlled() == false)
+					{
+						RemotePoints += Scanner.GetScanCounters().PointsAdded;
+					}
+				});
+
+				int64 Bytes = 0;
+				for (FConstPlayerControllerIterator It = World->GetPlayerControllerIterator(); It; ++It)
+				{
+					if (const ULidarNetRelayComponent* Relay = It->Get() != nullptr ? It->Get()->FindComponentByClass<ULidarNetRelayComponent>() : nullptr)
+					{
+						Bytes += Relay->GetNetStats().Bytes;
+					}
+				}
+
+				UE_LOG(LogTemp, Log, TEXT("Received %.1f KB for %lld points of remote scanners, %.3f bytes per point"),
+					Bytes / 1024.0, RemotePoints, RemotePoints > 0 ? static_cast<double>(Bytes) / RemotePoints : 0.0);
+			}
+		}));
+}
+
+#pragma endregion
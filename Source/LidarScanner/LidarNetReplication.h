@@ -0,0 +1,190 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LidarScanSession.h"
+#include "LidarPackedPoint.h"
+#include "LidarNetReplication.generated.h"
+
+class ULidarComponent;
+class APlayerController;
+
+UENUM(BlueprintType)
+enum class ELidarReplicationMode : uint8
+{
+	// Scans stay on the machine that made them
+	None,
+	// Scans go out as seed and pose, every machine traces them again. A few dozen bytes per scan
+	ScanSeeds,
+	// The server's points go out as compressed batches, for scans that can't be traced again the same way
+	Points
+};
+
+/**
+ * One scan on the wire. Sends the pose quantized and the scan parameters, the rays are regenerated from the seed.
+ * Scanners quantize their own pose the same way before tracing (see Quantize), so every machine traces the same rays.
+ */
+USTRUCT()
+struct LIDARSCANNER_API FLidarNetScan
+{
+	GENERATED_BODY()
+
+public:
+	FLidarScanRecord Record;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	/** Rounds Record's pose and ray length to what NetSerialize sends and returns the serialized size in bytes */
+	static int32 Quantize(FLidarScanRecord& Record);
+};
+
+template<>
+struct TStructOpsTypeTraits<FLidarNetScan> : public TStructOpsTypeTraitsBase2<FLidarNetScan>
+{
+	enum
+	{
+		WithNetSerializer = true
+	};
+};
+
+/**
+ * Point batches of ELidarReplicationMode::Points. Points are grouped in runs of one chunk, each run sends its chunk
+ * coordinate as a delta to the previous run's and each point its offset as a delta to the previous point's, both
+ * zigzag varints. Color and lifetime only go out when they differ from the previous point's.
+ */
+namespace LidarNetCodec
+{
+	/**
+	 * Encodes points from the start of Points, as many as fit in MaxBytes, at QuantizationCm (rounded to whole
+	 * millimeters). Appends to Out and returns how many points went in.
+	 */
+	LIDARSCANNER_API int32 EncodePoints(TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks, float QuantizationCm, int32 MaxBytes, TArray<uint8>& Out);
+
+	/** Calls Function(Position, Color, Lifetime) for every point of a batch, false if the batch is malformed */
+	LIDARSCANNER_API bool DecodePoints(TConstArrayView<uint8> Batch, TFunctionRef<void(const FVector&, const FColor&, float)> Function);
+}
+
+/** What one connection was sent, or on a client what it received */
+USTRUCT(BlueprintType)
+struct LIDARSCANNER_API FLidarNetStats
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 Bytes = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 Scans = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointBatches = 0;
+
+	/** Points inside the batches, scans regenerate theirs on arrival */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 BatchPoints = 0;
+
+	/** Items skipped because their scanner was too far from the connection's view */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 Culled = 0;
+
+	/** Items that waited for bandwidth longer than Lidar.Net.MaxBacklogSeconds */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 Dropped = 0;
+
+	/** Items waiting for the connection's bandwidth */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int32 Backlog = 0;
+
+	/** Scans the connection's client asked the server for past Lidar.Net.MaxClientRaysPerSecond, not traced */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 RejectedScans = 0;
+};
+
+/**
+ * Carries scans and point batches to one client. The server adds one to every player controller, its client RPCs
+ * run on the owning client only, which is what lets each connection get its own selection of scans.
+ */
+UCLASS(ClassGroup=(Custom))
+class LIDARSCANNER_API ULidarNetRelayComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	ULidarNetRelayComponent();
+
+	UFUNCTION(Client, Reliable)
+	void ClientReceiveScans(ULidarComponent* Scanner, const TArray<FLidarNetScan>& Scans);
+
+	UFUNCTION(Client, Reliable)
+	void ClientReceivePoints(ULidarComponent* Scanner, const TArray<uint8>& Batch);
+
+	/** Sent to this connection on the server, received on the client */
+	UFUNCTION(BlueprintPure, Category = "Stats")
+	FLidarNetStats GetNetStats() const { return Stats; }
+
+	/**
+	 * Server side: takes Rays from the rays this connection's client may have the server trace, false if they are
+	 * used up and the scan has to be rejected. A second of Lidar.Net.MaxClientRaysPerSecond builds up at most.
+	 */
+	bool ConsumeClientRays(int32 Rays);
+
+private:
+	friend class ULidarReplicationSubsystem;
+
+	FLidarNetStats Stats;
+
+	// Server side: next item of the subsystem's log and the bytes this connection may still send
+	uint64 NextItem = 0;
+	double Tokens = 0.0;
+
+	// Server side: rays the client may still request, refilled from the world time of the last request
+	double RayTokens = -1.0;
+	double RayTokensTime = 0.0;
+};
+
+/**
+ * Server side of lidar replication. Scanners queue their scans or point batches in one shared log, and every tick
+ * each connection is sent the items near its view that fit its bandwidth cap (Lidar.Net.MaxBytesPerSecond). The
+ * client's own scans are never sent back, it traced them already.
+ */
+UCLASS()
+class LIDARSCANNER_API ULidarReplicationSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void QueueScan(ULidarComponent* Scanner, const FLidarScanRecord& Record, int32 Bytes);
+	void QueuePoints(ULidarComponent* Scanner, TArray<uint8>&& Batch, int32 PointCount, const FVector& Origin);
+
+	void DumpStats() const;
+
+private:
+	struct FItem
+	{
+		TWeakObjectPtr<ULidarComponent> Scanner;
+		double Time = 0.0;
+		FVector Origin = FVector::ZeroVector;
+		int32 Bytes = 0;
+		int32 PointCount = 0;
+		// A scan unless Batch holds points
+		FLidarNetScan Scan;
+		TArray<uint8> Batch;
+	};
+
+	// Items every relay has moved past are trimmed from the front, FirstItem is the id of Items[0]
+	TArray<FItem> Items;
+	uint64 FirstItem = 0;
+
+	bool IsServer() const;
+	void EnsureRelays();
+	void SendItems(ULidarNetRelayComponent& Relay, APlayerController& Controller, float DeltaTime);
+	void TrimItems();
+};
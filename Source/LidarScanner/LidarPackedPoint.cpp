@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPackedPoint.h"
+
+FIntVector FLidarChunkTable::GetChunkCoord(const FVector& Position)
+{
+	return FIntVector(
+		FMath::FloorToInt32(Position.X / ChunkSize),
+		FMath::FloorToInt32(Position.Y / ChunkSize),
+		FMath::FloorToInt32(Position.Z / ChunkSize));
+}
+
+FVector FLidarChunkTable::GetChunkCenter(const FIntVector& ChunkCoord)
+{
+	return (FVector(ChunkCoord) + 0.5) * ChunkSize;
+}
+
+int32 FLidarChunkTable::FindOrAdd(const FVector& Position)
+{
+	const FIntVector Coord = GetChunkCoord(Position);
+	if (Coord == LastCoord)
+		return LastIndex;
+
+	int32 Index;
+	if (const int32* Found = CoordToIndex.Find(Coord))
+	{
+		Index = *Found;
+	}
+	else
+	{
+		if (Origins.Num() >= MaxChunks)
+			return INDEX_NONE;
+
+		Index = Origins.Add(GetChunkCenter(Coord));
+		CoordToIndex.Add(Coord, Index);
+	}
+
+	LastCoord = Coord;
+	LastIndex = Index;
+	return Index;
+}
+
+void FLidarChunkTable::Reset()
+{
+	CoordToIndex.Reset();
+	Origins.Reset();
+	LastCoord = FIntVector(MAX_int32);
+	LastIndex = INDEX_NONE;
+}
+
+FColor LidarPacking::PackColor(const FLinearColor& Color)
+{
+	// Linear RGBA8, no sRGB curve, so unpacking is a plain divide by 255
+	return Color.QuantizeRound();
+}
+
+FFloat16 LidarPacking::PackLifetime(float Lifetime)
+{
+	return FFloat16(FMath::Clamp(Lifetime, 0.f, MaxLifetime));
+}
+
+bool LidarPacking::Pack(const FVector& Position, const FLinearColor& Color, float Lifetime, FLidarChunkTable& Chunks, FLidarPackedPoint& OutPoint)
+{
+	const int32 ChunkIndex = Chunks.FindOrAdd(Position);
+	if (ChunkIndex == INDEX_NONE)
+		return false;
+
+	const FVector Offset = (Position - Chunks.GetOrigin(ChunkIndex)) / FLidarChunkTable::QuantizationStep;
+
+	OutPoint.X = static_cast<int16>(FMath::Clamp(FMath::RoundToInt32(Offset.X), MIN_int16, MAX_int16));
+	OutPoint.Y = static_cast<int16>(FMath::Clamp(FMath::RoundToInt32(Offset.Y), MIN_int16, MAX_int16));
+	OutPoint.Z = static_cast<int16>(FMath::Clamp(FMath::RoundToInt32(Offset.Z), MIN_int16, MAX_int16));
+	OutPoint.ChunkIndex = static_cast<uint16>(ChunkIndex);
+	OutPoint.Color = PackColor(Color);
+	OutPoint.Lifetime = PackLifetime(Lifetime);
+	OutPoint.HitCount = 1;
+	return true;
+}
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/Float16.h"
+
+/**
+ * 16 byte point used for storage and GPU upload. The position is an int16 offset from the center
+ * of its chunk (see FLidarChunkTable), color is RGBA8 and the lifetime a half float.
+ */
+struct FLidarPackedPoint
+{
+	int16 X = 0;
+	int16 Y = 0;
+	int16 Z = 0;
+	uint16 ChunkIndex = 0;
+	FColor Color = FColor::White;
+	FFloat16 Lifetime;
+	// Voxel dedup hits on this point, 1 for a fresh point
+	uint16 HitCount = 1;
+};
+static_assert(sizeof(FLidarPackedPoint) == 16, "FLidarPackedPoint is uploaded as a uint4, keep it at 16 bytes");
+
+/**
+ * World space grid of 32 m chunks, each packed point is quantized relative to its chunk center.
+ * Chunks are only ever added so indices stay stable for the GPU copy of the origins, until the owning cloud
+ * compacts the table (FLidarPointCloud::CompactChunks) and bumps its chunk generation.
+ */
+class LIDARSCANNER_API FLidarChunkTable
+{
+public:
+	static constexpr float ChunkSize = 3200.f;
+	// An int16 offset covers the whole chunk, about half a millimeter per step
+	static constexpr float QuantizationStep = ChunkSize / 65536.f;
+	static constexpr int32 MaxChunks = MAX_uint16;
+
+	static FIntVector GetChunkCoord(const FVector& Position);
+	static FVector GetChunkCenter(const FIntVector& ChunkCoord);
+
+	/** Index of the chunk holding Position, added if new. INDEX_NONE once MaxChunks are in use, see FLidarPointCloud::CompactChunks */
+	int32 FindOrAdd(const FVector& Position);
+
+	const FVector& GetOrigin(int32 Index) const { return Origins[Index]; }
+	TConstArrayView<FVector> GetOrigins() const { return Origins; }
+	int32 Num() const { return Origins.Num(); }
+
+	void Reset();
+
+private:
+	TMap<FIntVector, int32> CoordToIndex;
+	TArray<FVector> Origins;
+
+	// Consecutive points nearly always land in the same chunk
+	FIntVector LastCoord = FIntVector(MAX_int32);
+	int32 LastIndex = INDEX_NONE;
+};
+
+namespace LidarPacking
+{
+	// Half float saturates here, roughly 18 hours, which is as permanent as a scan point gets
+	constexpr float MaxLifetime = 65504.f;
+
+	/** Returns false if the point's chunk could not be added */
+	LIDARSCANNER_API bool Pack(const FVector& Position, const FLinearColor& Color, float Lifetime, FLidarChunkTable& Chunks, FLidarPackedPoint& OutPoint);
+
+	LIDARSCANNER_API FColor PackColor(const FLinearColor& Color);
+	LIDARSCANNER_API FFloat16 PackLifetime(float Lifetime);
+
+	FORCEINLINE FVector UnpackPosition(const FLidarPackedPoint& Point, const FLidarChunkTable& Chunks)
+	{
+		return Chunks.GetOrigin(Point.ChunkIndex) + FVector(Point.X, Point.Y, Point.Z) * FLidarChunkTable::QuantizationStep;
+	}
+
+	FORCEINLINE FLinearColor UnpackColor(const FLidarPackedPoint& Point)
+	{
+		return Point.Color.ReinterpretAsLinear();
+	}
+
+	FORCEINLINE float UnpackLifetime(const FLidarPackedPoint& Point)
+	{
+		return Point.Lifetime.GetFloat();
+	}
+
+	/** Dead points keep their slot but have no lifetime left and are fully transparent, Niagara shows nothing for them */
+	FORCEINLINE bool IsDead(const FLidarPackedPoint& Point)
+	{
+		return Point.Lifetime.Encoded == 0;
+	}
+
+	FORCEINLINE void MakeDead(FLidarPackedPoint& Point)
+	{
+		Point.Lifetime = FFloat16(0.f);
+		Point.Color = FColor::Transparent;
+	}
+}
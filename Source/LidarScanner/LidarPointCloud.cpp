@@ -0,0 +1,381 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPointCloud.h"
+#include "Algo/BinarySearch.h"
+#include "LidarStats.h"
+
+void FLidarDirtyRange::Add(int32 First, int32 Num)
+{
+	if (Num <= 0)
+		return;
+
+	Begin = FMath::Min(Begin, First);
+	End = FMath::Max(End, First + Num);
+}
+
+void FLidarDirtyRangeList::Add(int32 First, int32 Num)
+{
+	if (Num <= 0)
+		return;
+
+	// First range ending at or after First, everything before it neither overlaps nor touches
+	const int32 Index = Algo::LowerBoundBy(Ranges, First, &FLidarDirtyRange::End);
+
+	FLidarDirtyRange Merged;
+	Merged.Add(First, Num);
+	int32 Last = Index;
+	for (; Last < Ranges.Num() && Ranges[Last].Begin <= Merged.End; ++Last)
+	{
+		Merged.Add(Ranges[Last].Begin, Ranges[Last].Num());
+	}
+
+	if (Last > Index)
+	{
+		Ranges[Index] = Merged;
+		Ranges.RemoveAt(Index + 1, Last - Index - 1, EAllowShrinking::No);
+	}
+	else
+	{
+		Ranges.Insert(Merged, Index);
+	}
+
+	if (Ranges.Num() > MaxRanges)
+	{
+		MergeClosest();
+	}
+}
+
+void FLidarDirtyRangeList::SetMaxRanges(int32 InMaxRanges)
+{
+	MaxRanges = FMath::Max(1, InMaxRanges);
+	while (Ranges.Num() > MaxRanges)
+	{
+		MergeClosest();
+	}
+}
+
+void FLidarDirtyRangeList::MergeClosest()
+{
+	int32 Closest = 0;
+	for (int32 i = 1; i + 1 < Ranges.Num(); ++i)
+	{
+		if (Ranges[i + 1].Begin - Ranges[i].End < Ranges[Closest + 1].Begin - Ranges[Closest].End)
+		{
+			Closest = i;
+		}
+	}
+
+	Ranges[Closest].End = Ranges[Closest + 1].End;
+	Ranges.RemoveAt(Closest + 1, 1, EAllowShrinking::No);
+}
+
+void FLidarPointCloud::SetCapacity(int32 NewCapacity)
+{
+	const int32 OldCapacity = Capacity;
+	Capacity = FMath::Max(0, NewCapacity);
+
+	// Reserved once, the array fills up to the capacity and never reallocates. The same capacity keeps the allocation
+	if (Capacity == OldCapacity && Points.Max() >= Capacity)
+	{
+		Points.Reset();
+	}
+	else
+	{
+		Points.Empty(Capacity);
+	}
+	Chunks.Reset();
+
+	Head = 0;
+	Count = 0;
+	TotalAppended = 0;
+	TotalStored = 0;
+	NextCompactStored = 0;
+	++Generation;
+	++ChunkGeneration;
+	ResetUpdateLog();
+}
+
+void FLidarPointCloud::Reset()
+{
+	Points.Reset();
+	Chunks.Reset();
+
+	Head = 0;
+	Count = 0;
+	TotalAppended = 0;
+	TotalStored = 0;
+	NextCompactStored = 0;
+	++Generation;
+	++ChunkGeneration;
+	ResetUpdateLog();
+}
+
+int32 FLidarPointCloud::Append(const FVector& Position, const FLinearColor& Color, float Lifetime)
+{
+	if (Capacity == 0)
+		return INDEX_NONE;
+
+	FLidarPackedPoint Point;
+	if (LidarPacking::Pack(Position, Color, Lifetime, Chunks, Point) == false)
+	{
+		// The table is full. Chunks only overwritten points used can go, then there is room again
+		if (CompactChunks() == false || LidarPacking::Pack(Position, Color, Lifetime, Chunks, Point) == false)
+		{
+			CountDroppedPoints(1);
+			return INDEX_NONE;
+		}
+	}
+
+	return AppendPacked(Point);
+}
+
+int32 FLidarPointCloud::AppendPacked(const FLidarPackedPoint& Point)
+{
+	if (Capacity == 0)
+		return INDEX_NONE;
+
+	const int32 Slot = Head;
+
+	if (Count < Capacity)
+	{
+		// Still filling up, slots are appended in order
+		Points.Add(Point);
+		++Count;
+	}
+	else
+	{
+		Points[Slot] = Point;
+	}
+
+	Head = (Head + 1) % Capacity;
+	++TotalAppended;
+	++TotalStored;
+	return Slot;
+}
+
+void FLidarPointCloud::Append(TConstArrayView<FVector> InPositions, TConstArrayView<FLinearColor> InColors, TConstArrayView<float> InLifetimes)
+{
+	check(InPositions.Num() == InColors.Num() && InPositions.Num() == InLifetimes.Num());
+
+	if (Capacity == 0)
+		return;
+
+	// Anything older than the last Capacity points would be overwritten in this same call anyway
+	const int32 Skip = FMath::Max(0, InPositions.Num() - Capacity);
+	if (Skip > 0)
+	{
+		TotalAppended += Skip;
+		Head = Count < Capacity ? Head : (Head + Skip) % Capacity;
+	}
+
+	for (int32 i = Skip; i < InPositions.Num(); ++i)
+	{
+		Append(InPositions[i], InColors[i], InLifetimes[i]);
+	}
+}
+
+void FLidarPointCloud::UpdatePoint(int32 Slot, const FLinearColor& Color, float Lifetime)
+{
+	Points[Slot].Color = LidarPacking::PackColor(Color);
+	Points[Slot].Lifetime = LidarPacking::PackLifetime(Lifetime);
+	LogUpdate(Slot, 1);
+}
+
+void FLidarPointCloud::WriteSlots(int32 First, TConstArrayView<FLidarPackedPoint> InPoints)
+{
+	check(First >= 0 && First <= Count && First + InPoints.Num() <= Capacity);
+
+	if (First + InPoints.Num() > Count)
+	{
+		// Still inside the reserved capacity, the array does not move
+		Points.SetNumUninitialized(First + InPoints.Num(), EAllowShrinking::No);
+		Count = Points.Num();
+		Head = Count % Capacity;
+	}
+
+	FMemory::Memcpy(&Points[First], InPoints.GetData(), InPoints.Num() * sizeof(FLidarPackedPoint));
+	TotalStored += InPoints.Num();
+	LogUpdate(First, InPoints.Num());
+}
+
+void FLidarPointCloud::KillPoint(int32 Slot)
+{
+	LidarPacking::MakeDead(Points[Slot]);
+	LogUpdate(Slot, 1);
+}
+
+void FLidarPointCloud::MovePoint(int32 From, int32 To)
+{
+	Points[To] = Points[From];
+	LidarPacking::MakeDead(Points[From]);
+	LogUpdate(From, 1);
+	LogUpdate(To, 1);
+}
+
+uint16 FLidarPointCloud::AddHit(int32 Slot)
+{
+	uint16& Hits = Points[Slot].HitCount;
+	Hits = Hits < MAX_uint16 ? Hits + 1 : Hits;
+	return Hits;
+}
+
+bool FLidarPointCloud::CompactChunks()
+{
+	if (TotalStored < NextCompactStored)
+		return false;
+
+	NextCompactStored = TotalStored + FMath::Max(Count / 4, 1);
+
+	LIDAR_SCOPE(ChunkCompact);
+
+	// Only live points hold on to their chunk, dead ones are never unpacked
+	TBitArray<> Used(false, Chunks.Num());
+	int32 UsedCount = 0;
+	for (int32 Slot = 0; Slot < Count; ++Slot)
+	{
+		const uint16 Index = Points[Slot].ChunkIndex;
+		if (LidarPacking::IsDead(Points[Slot]) == false && Used[Index] == false)
+		{
+			Used[Index] = true;
+			++UsedCount;
+		}
+	}
+
+	if (UsedCount >= Chunks.Num())
+		return false;
+
+	const TArray<FVector> OldOrigins(Chunks.GetOrigins());
+	TArray<int32> Remap;
+	Remap.Init(INDEX_NONE, OldOrigins.Num());
+	Chunks.Reset();
+	for (int32 Index = 0; Index < OldOrigins.Num(); ++Index)
+	{
+		if (Used[Index])
+		{
+			Remap[Index] = Chunks.FindOrAdd(OldOrigins[Index]);
+		}
+	}
+	if (Chunks.Num() == 0 && Count > 0)
+	{
+		// Unpacking a dead point still reads its origin
+		Chunks.FindOrAdd(OldOrigins[0]);
+	}
+
+	for (int32 Slot = 0; Slot < Count; ++Slot)
+	{
+		FLidarPackedPoint& Point = Points[Slot];
+		Point.ChunkIndex = LidarPacking::IsDead(Point) ? 0 : static_cast<uint16>(Remap[Point.ChunkIndex]);
+	}
+
+	++ChunkGeneration;
+	UE_LOG(LogTemp, Log, TEXT("Lidar point cloud compacted its chunk table from %d to %d chunks"), OldOrigins.Num(), Chunks.Num());
+	return true;
+}
+
+void FLidarPointCloud::CountDroppedPoints(int32 Num)
+{
+	if (Num <= 0)
+		return;
+
+	const uint64 Before = DroppedPoints;
+	DroppedPoints += Num;
+
+	// Once at the first drop, then every time the total doubles
+	if (Before == 0 || FMath::FloorLog2_64(Before) != FMath::FloorLog2_64(DroppedPoints))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Lidar point cloud chunk table is full (%d chunks), %llu points dropped so far"), Chunks.Num(), DroppedPoints);
+	}
+}
+
+void FLidarPointCloud::LogUpdate(int32 First, int32 Num)
+{
+	if (Num <= 0)
+		return;
+
+	// Sequential writes (WriteSlots runs, neighbouring dedup hits) grow the newest entry while no reader has seen it
+	if (TotalUpdates > SealedUpdates)
+	{
+		FLidarPointSpan& Newest = UpdateLog[(TotalUpdates - 1) % MaxUpdateLog];
+		if (First <= Newest.First + Newest.Num && First + Num >= Newest.First)
+		{
+			const int32 End = FMath::Max(Newest.First + Newest.Num, First + Num);
+			Newest.First = FMath::Min(Newest.First, First);
+			Newest.Num = End - Newest.First;
+			return;
+		}
+	}
+
+	if (UpdateLog.Num() < MaxUpdateLog)
+	{
+		UpdateLog.Add({First, Num});
+	}
+	else
+	{
+		UpdateLog[TotalUpdates % MaxUpdateLog] = {First, Num};
+	}
+	++TotalUpdates;
+}
+
+void FLidarPointCloud::ResetUpdateLog()
+{
+	UpdateLog.Reset();
+	TotalUpdates = 0;
+	SealedUpdates = 0;
+}
+
+bool FLidarPointCloud::GetUpdatesSince(uint64 UpdateCursor, TArray<FLidarPointSpan>& OutSpans) const
+{
+	// From an older generation, or overwritten in the ring since
+	if (UpdateCursor > TotalUpdates || TotalUpdates - UpdateCursor > static_cast<uint64>(UpdateLog.Num()))
+		return false;
+
+	for (uint64 Entry = UpdateCursor; Entry < TotalUpdates; ++Entry)
+	{
+		OutSpans.Add(UpdateLog[Entry % MaxUpdateLog]);
+	}
+	SealedUpdates = TotalUpdates;
+	return true;
+}
+
+int32 FLidarPointCloud::GetSpansSince(uint64 Cursor, FLidarPointSpan OutSpans[2]) const
+{
+	const uint64 Available = TotalAppended > Cursor ? TotalAppended - Cursor : 0;
+	const int32 NewCount = static_cast<int32>(FMath::Min<uint64>(Available, Count));
+
+	if (NewCount == 0)
+		return 0;
+
+	// The newest point sits right before Head, walk back NewCount slots
+	const int32 First = (Head - NewCount + Capacity) % Capacity;
+
+	if (First + NewCount <= Capacity)
+	{
+		OutSpans[0] = {First, NewCount};
+		return 1;
+	}
+
+	OutSpans[0] = {First, Capacity - First};
+	OutSpans[1] = {0, NewCount - (Capacity - First)};
+	return 2;
+}
+
+void FLidarPointCloud::UnpackSpan(const FLidarPointSpan& Span, TArray<FVector>& OutPositions, TArray<FLinearColor>& OutColors, TArray<float>& OutLifetimes) const
+{
+	OutPositions.Reserve(OutPositions.Num() + Span.Num);
+	OutColors.Reserve(OutColors.Num() + Span.Num);
+	OutLifetimes.Reserve(OutLifetimes.Num() + Span.Num);
+
+	for (int32 Slot = Span.First; Slot < Span.First + Span.Num; ++Slot)
+	{
+		const FLidarPackedPoint& Point = Points[Slot];
+		OutPositions.Add(LidarPacking::UnpackPosition(Point, Chunks));
+		OutColors.Add(LidarPacking::UnpackColor(Point));
+		OutLifetimes.Add(LidarPacking::UnpackLifetime(Point));
+	}
+}
+
+SIZE_T FLidarPointCloud::GetAllocatedSize() const
+{
+	return Points.GetAllocatedSize() + Chunks.Num() * (sizeof(FVector) + sizeof(FIntVector) + sizeof(int32));
+}
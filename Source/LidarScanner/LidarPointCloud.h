@@ -0,0 +1,184 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarPackedPoint.h"
+
+/** Single merged range of slots that changed */
+struct LIDARSCANNER_API FLidarDirtyRange
+{
+	int32 Begin = MAX_int32;
+	int32 End = 0;
+
+	void Add(int32 First, int32 Num);
+	void Reset() { Begin = MAX_int32; End = 0; }
+	bool IsEmpty() const { return Begin >= End; }
+	int32 Num() const { return IsEmpty() ? 0 : End - Begin; }
+};
+
+/**
+ * Sorted, disjoint slot ranges. Ranges that touch are merged, and past MaxRanges the two closest ones are,
+ * so scattered writes never cover many more clean slots than the gaps between their nearest neighbours.
+ */
+class LIDARSCANNER_API FLidarDirtyRangeList
+{
+public:
+	explicit FLidarDirtyRangeList(int32 InMaxRanges = 4) : MaxRanges(FMath::Max(1, InMaxRanges)) {}
+
+	void Add(int32 First, int32 Num);
+	void SetMaxRanges(int32 InMaxRanges);
+	void Reset() { Ranges.Reset(); }
+
+	TConstArrayView<FLidarDirtyRange> GetRanges() const { return Ranges; }
+	int32 GetMaxRanges() const { return MaxRanges; }
+
+private:
+	TArray<FLidarDirtyRange> Ranges;
+	int32 MaxRanges;
+
+	void MergeClosest();
+};
+
+/** Contiguous run of slots inside the point cloud ring */
+struct FLidarPointSpan
+{
+	int32 First = 0;
+	int32 Num = 0;
+};
+
+/**
+ * Fixed capacity point store of 16 byte packed points. Once full, new points overwrite the oldest ones,
+ * so memory never grows past the capacity no matter how long the session runs.
+ * Readers keep a cursor (GetTotalAppended) and ask for the spans appended since then, and another one
+ * (GetTotalUpdates) for the slots changed in place, so any number of renderers can follow the same cloud.
+ * The full capacity is reserved up front, so the array never moves while Niagara workers read it.
+ */
+class LIDARSCANNER_API FLidarPointCloud
+{
+public:
+	// Entries kept in the update log, writes next to the newest entry extend it instead of adding one
+	static constexpr int32 MaxUpdateLog = 16384;
+
+	/**
+	 * Drops all points and sets the new point cap. A different cap reallocates, so no Niagara instance may be reading
+	 * the cloud then (see ULidarComponent::ResizePointCloud)
+	 */
+	void SetCapacity(int32 NewCapacity);
+
+	/** Drops all points and chunks, keeps the capacity and allocations */
+	void Reset();
+
+	/** Packs and stores one point, returns the slot it was written to or INDEX_NONE if it could not be stored */
+	int32 Append(const FVector& Position, const FLinearColor& Color, float Lifetime);
+
+	/** Stores an already packed point, its ChunkIndex must refer to this cloud's chunk table */
+	int32 AppendPacked(const FLidarPackedPoint& Point);
+
+	/** Bulk version of Append, the views must have the same length */
+	void Append(TConstArrayView<FVector> InPositions, TConstArrayView<FLinearColor> InColors, TConstArrayView<float> InLifetimes);
+
+	/** Overwrites the attributes of a stored point in place, it is not reported as appended again but lands in the update log */
+	void UpdatePoint(int32 Slot, const FLinearColor& Color, float Lifetime);
+
+	/**
+	 * Overwrites the slots starting at First, for owners that place points themselves instead of appending.
+	 * First may be at most Num(), writing past the end grows the cloud. Lands in the update log, not in the appended spans.
+	 */
+	void WriteSlots(int32 First, TConstArrayView<FLidarPackedPoint> InPoints);
+
+	/** Chunk table of the cloud, for owners packing points for WriteSlots */
+	FLidarChunkTable& GetMutableChunks() { return Chunks; }
+
+	/**
+	 * Rebuilds the chunk table from the chunks stored points still use, dropping the ones the ring overwrote.
+	 * Append does this itself once the table is full, owners packing for WriteSlots call it when Pack fails and pack again.
+	 * Bumps the chunk generation. Returns false if no chunk could be freed, or if the last compaction was too recent
+	 */
+	bool CompactChunks();
+
+	/** Bumped by every Reset and CompactChunks, readers holding chunk indices or a copy of the origins must start over */
+	uint32 GetChunkGeneration() const { return ChunkGeneration; }
+
+	/** Counts points that could not be stored because their chunk did not fit in the table, warns as the count grows */
+	void CountDroppedPoints(int32 Num);
+	uint64 GetDroppedPoints() const { return DroppedPoints; }
+
+	/** Turns the point in Slot into a dead one (see LidarPacking::IsDead), it lands in the update log */
+	void KillPoint(int32 Slot);
+
+	/** Copies the point in From over To and kills From, both land in the update log */
+	void MovePoint(int32 From, int32 To);
+
+	/** Counts another voxel hit on the point in Slot and returns the new total */
+	uint16 AddHit(int32 Slot);
+
+	/** Entries of the update log so far, used as a cursor by readers the same way GetTotalAppended is */
+	uint64 GetTotalUpdates() const { return TotalUpdates; }
+
+	/**
+	 * Appends the slot spans changed in place after UpdateCursor, oldest first. Returns false if the cursor fell out
+	 * of the log (more than MaxUpdateLog entries behind), then the reader has to treat every slot as changed.
+	 */
+	bool GetUpdatesSince(uint64 UpdateCursor, TArray<FLidarPointSpan>& OutSpans) const;
+
+	int32 Num() const { return Count; }
+	int32 GetCapacity() const { return Capacity; }
+	bool IsFull() const { return Count == Capacity; }
+
+	/** Slot the next Append will write to */
+	int32 GetNextSlot() const { return Head; }
+
+	/** Monotonic count of every point ever appended, used as a cursor by readers */
+	uint64 GetTotalAppended() const { return TotalAppended; }
+
+	/** Bumped by every Reset, readers holding a cursor or chunk indices from an older generation must start over */
+	uint32 GetGeneration() const { return Generation; }
+
+	/**
+	 * Slots appended after Cursor, oldest first. Points that were already overwritten are skipped.
+	 * Returns how many of the two spans were filled.
+	 */
+	int32 GetSpansSince(uint64 Cursor, FLidarPointSpan OutSpans[2]) const;
+
+	/** Every stored point, oldest first */
+	int32 GetAllSpans(FLidarPointSpan OutSpans[2]) const { return GetSpansSince(TotalAppended - Count, OutSpans); }
+
+	const FLidarPackedPoint& GetPoint(int32 Slot) const { return Points[Slot]; }
+	TConstArrayView<FLidarPackedPoint> GetPoints() const { return Points; }
+	const FLidarChunkTable& GetChunks() const { return Chunks; }
+
+	FVector GetPosition(int32 Slot) const { return LidarPacking::UnpackPosition(Points[Slot], Chunks); }
+	FLinearColor GetColor(int32 Slot) const { return LidarPacking::UnpackColor(Points[Slot]); }
+	float GetLifetime(int32 Slot) const { return LidarPacking::UnpackLifetime(Points[Slot]); }
+
+	/** Unpacks a span and appends it to the given arrays, for consumers that need full precision types */
+	void UnpackSpan(const FLidarPointSpan& Span, TArray<FVector>& OutPositions, TArray<FLinearColor>& OutColors, TArray<float>& OutLifetimes) const;
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	TArray<FLidarPackedPoint> Points;
+	FLidarChunkTable Chunks;
+
+	int32 Capacity = 0;
+	// Next slot to write
+	int32 Head = 0;
+	int32 Count = 0;
+	uint64 TotalAppended = 0;
+	uint32 Generation = 0;
+	uint32 ChunkGeneration = 0;
+	uint64 DroppedPoints = 0;
+	// Points appended or written, a compaction is a pass over every point so the next one waits until a good part was replaced
+	uint64 TotalStored = 0;
+	uint64 NextCompactStored = 0;
+
+	// Ring of the last MaxUpdateLog in place changes, entry N sits at N % MaxUpdateLog
+	TArray<FLidarPointSpan> UpdateLog;
+	uint64 TotalUpdates = 0;
+	// Entries a reader has already seen, those are never extended again
+	mutable uint64 SealedUpdates = 0;
+
+	void LogUpdate(int32 First, int32 Num);
+	void ResetUpdateLog();
+};
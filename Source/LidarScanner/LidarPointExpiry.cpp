@@ -0,0 +1,219 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPointExpiry.h"
+#include "LidarPointCloud.h"
+#include "LidarVoxelHash.h"
+#include "Algo/Unique.h"
+
+void FLidarPointExpiry::Reset(int32 SlotCapacity, float InBucketSeconds, float InMaxLifetime)
+{
+	BucketSeconds = FMath::Max(InBucketSeconds, 0.01f);
+	MaxLifetime = FMath::Max(InMaxLifetime, 0.f);
+
+	// Every tracked point expires within MaxLifetime of the first attached bucket
+	Buckets.Reset();
+	Buckets.SetNum(FMath::CeilToInt32(MaxLifetime / BucketSeconds) + 2);
+	FirstBucket = 1;
+	SlotBuckets.Init(0, FMath::Max(SlotCapacity, 0));
+
+	Expired.Reset();
+	ExpiredCursor = 0;
+	FreeSlots.Reset();
+	CompactCursor = 0;
+	Stats = FLidarPointExpiryStats();
+}
+
+uint32 FLidarPointExpiry::GetBucketIndex(double Time) const
+{
+	return static_cast<uint32>(FMath::Max(0.0, FMath::FloorToDouble(Time / BucketSeconds))) + 1;
+}
+
+void FLidarPointExpiry::Track(int32 Slot, float Lifetime, double Now)
+{
+	if (SlotBuckets.IsValidIndex(Slot) == false)
+		return;
+
+	if (Lifetime >= MaxLifetime || Buckets.Num() == 0)
+	{
+		SlotBuckets[Slot] = 0;
+		return;
+	}
+
+	DetachBuckets(Now);
+
+	// Points that are already expired go to the oldest attached bucket
+	AddToBucket(FMath::Max(GetBucketIndex(Now + FMath::Max(Lifetime, 0.f)), FirstBucket), Slot);
+}
+
+void FLidarPointExpiry::AddToBucket(uint32 Index, int32 Slot)
+{
+	TArray<int32>& Bucket = Buckets[Index % Buckets.Num()];
+	if (Bucket.Max() == 0 && SpareBuckets.Num() > 0)
+	{
+		Bucket = SpareBuckets.Pop(EAllowShrinking::No);
+	}
+
+	// A slot written again keeps its entry in the old bucket, SlotBuckets tells which one is current
+	Bucket.Add(Slot);
+	SlotBuckets[Slot] = Index;
+	++Stats.TrackedPoints;
+}
+
+void FLidarPointExpiry::DetachBuckets(double Now)
+{
+	// Buckets before the one Now falls in have all expired
+	const uint32 NowBucket = GetBucketIndex(Now);
+	if (NowBucket <= FirstBucket || Buckets.Num() == 0)
+		return;
+
+	// After a long pause the whole ring has expired, no bucket holds more than one index at a time
+	const uint32 End = FMath::Min(NowBucket, FirstBucket + static_cast<uint32>(Buckets.Num()));
+	for (uint32 Index = FirstBucket; Index < End; ++Index)
+	{
+		TArray<int32>& Bucket = Buckets[Index % Buckets.Num()];
+		if (Bucket.Num() == 0)
+			continue;
+
+		// The slot list moves as a whole, its points are killed later under the time budget
+		Stats.TrackedPoints -= Bucket.Num();
+		FExpiredBucket& Detached = Expired.AddDefaulted_GetRef();
+		Detached.Index = Index;
+		Detached.Slots = MoveTemp(Bucket);
+	}
+
+	FirstBucket = NowBucket;
+}
+
+void FLidarPointExpiry::Update(double Now, FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double TimeBudgetSeconds, int32 CompactionZone, int32 MaxChangedSlots)
+{
+	DetachBuckets(Now);
+
+	// Every slot written here goes to the renderers again, so their cost is budgeted too, not only the time
+	const double EndTime = FPlatformTime::Seconds() + TimeBudgetSeconds;
+	int32 SlotBudget = FMath::Max(MaxChangedSlots, 0);
+	if (KillExpired(Cloud, VoxelHash, EndTime, SlotBudget) && CompactionZone > 0)
+	{
+		Compact(Cloud, VoxelHash, EndTime, CompactionZone, SlotBudget);
+	}
+
+	// Slots freed more than once, or overwritten before compaction needed them
+	if (FreeSlots.Num() > SlotBuckets.Num())
+	{
+		FreeSlots.RemoveAll([&Cloud](int32 Slot) { return Slot >= Cloud.Num() || LidarPacking::IsDead(Cloud.GetPoint(Slot)) == false; });
+		FreeSlots.Sort();
+		FreeSlots.SetNum(Algo::Unique(FreeSlots), EAllowShrinking::No);
+	}
+}
+
+bool FLidarPointExpiry::KillExpired(FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double EndTime, int32& SlotBudget)
+{
+	int32 Processed = 0;
+	while (Expired.Num() > 0)
+	{
+		FExpiredBucket& Bucket = Expired[0];
+		for (; ExpiredCursor < Bucket.Slots.Num(); ++ExpiredCursor)
+		{
+			// Reading the clock costs more than a kill, check it every so often
+			if ((++Processed & 255) == 0 && FPlatformTime::Seconds() > EndTime)
+				return false;
+
+			// Overwritten, moved or refreshed since it was tracked here
+			const int32 Slot = Bucket.Slots[ExpiredCursor];
+			if (Slot >= Cloud.Num() || SlotBuckets[Slot] != Bucket.Index)
+				continue;
+
+			if (SlotBudget <= 0)
+				return false;
+
+			SlotBuckets[Slot] = 0;
+			Cloud.KillPoint(Slot);
+			--SlotBudget;
+			if (VoxelHash != nullptr)
+			{
+				VoxelHash->Remove(Slot);
+			}
+			FreeSlots.Add(Slot);
+			++Stats.ExpiredPoints;
+		}
+
+		Bucket.Slots.Reset();
+		SpareBuckets.Add(MoveTemp(Bucket.Slots));
+		Expired.RemoveAt(0, 1, EAllowShrinking::No);
+		ExpiredCursor = 0;
+	}
+	return true;
+}
+
+void FLidarPointExpiry::Compact(FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double EndTime, int32 CompactionZone, int32& SlotBudget)
+{
+	// Until the ring is full no append overwrites anything
+	if (Cloud.IsFull() == false || FreeSlots.Num() == 0)
+		return;
+
+	const int32 Capacity = Cloud.GetCapacity();
+	const int32 Zone = FMath::Min(CompactionZone, Capacity / 2);
+	const uint64 Oldest = Cloud.GetTotalAppended() - Capacity;
+	CompactCursor = FMath::Max(CompactCursor, Oldest);
+
+	int32 Processed = 0;
+	for (; CompactCursor < Oldest + Zone; ++CompactCursor)
+	{
+		if ((++Processed & 63) == 0 && FPlatformTime::Seconds() > EndTime)
+			return;
+
+		// A full ring keeps its oldest point at the head
+		const int32 Slot = static_cast<int32>((Cloud.GetNextSlot() + (CompactCursor - Oldest)) % Capacity);
+		if (LidarPacking::IsDead(Cloud.GetPoint(Slot)))
+			continue;
+
+		if (SlotBudget < 2)
+			return;
+
+		const int32 Free = PopFreeSlot(Cloud, Zone);
+		if (Free == INDEX_NONE)
+			return;
+
+		Cloud.MovePoint(Slot, Free);
+		SlotBudget -= 2;
+		if (VoxelHash != nullptr)
+		{
+			VoxelHash->Move(Slot, Free);
+		}
+
+		// Compaction only runs once every detached bucket is killed, so a tracked point still has its bucket attached
+		const uint32 Index = SlotBuckets[Slot];
+		SlotBuckets[Slot] = 0;
+		if (Index != 0)
+		{
+			AddToBucket(Index, Free);
+		}
+
+		++Stats.RelocatedPoints;
+	}
+}
+
+int32 FLidarPointExpiry::PopFreeSlot(const FLidarPointCloud& Cloud, int32 CompactionZone)
+{
+	const int32 Capacity = Cloud.GetCapacity();
+	while (FreeSlots.Num() > 0)
+	{
+		const int32 Slot = FreeSlots.Pop(EAllowShrinking::No);
+		const bool bInZone = (Slot - Cloud.GetNextSlot() + Capacity) % Capacity < CompactionZone;
+		if (bInZone == false && Slot < Cloud.Num() && LidarPacking::IsDead(Cloud.GetPoint(Slot)))
+			return Slot;
+	}
+	return INDEX_NONE;
+}
+
+FLidarPointExpiryStats FLidarPointExpiry::GetStats() const
+{
+	FLidarPointExpiryStats Result = Stats;
+	for (const FExpiredBucket& Bucket : Expired)
+	{
+		Result.PendingPoints += Bucket.Slots.Num();
+	}
+	Result.PendingPoints -= Expired.Num() > 0 ? ExpiredCursor : 0;
+	Result.FreeSlots = FreeSlots.Num();
+	return Result;
+}
@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FLidarPointCloud;
+class FLidarVoxelHash;
+
+struct FLidarPointExpiryStats
+{
+	// Entries waiting in a bucket for their expiry time, including those of slots written again since
+	int64 TrackedPoints = 0;
+	// Points of dropped buckets the budget has not reached yet
+	int64 PendingPoints = 0;
+	int64 ExpiredPoints = 0;
+	// Live points moved out of the ring's overwrite zone into freed slots
+	int64 RelocatedPoints = 0;
+	int32 FreeSlots = 0;
+};
+
+/**
+ * CPU side expiry of point cloud lifetimes. Points are grouped into buckets of BucketSeconds by the time they expire,
+ * a bucket whose time has passed is detached in one step, then its points are killed in place over as many frames as
+ * the time budget needs. The slots they free take live points from just ahead of the ring's head, which the next
+ * appends would overwrite, so long lived points outlast the short lived ones instead of being pushed out by them.
+ * Lifetimes of MaxLifetime or more are treated as permanent and never tracked.
+ */
+class LIDARSCANNER_API FLidarPointExpiry
+{
+public:
+	/** Drops everything tracked, SlotCapacity must match the point cloud capacity */
+	void Reset(int32 SlotCapacity, float InBucketSeconds, float InMaxLifetime);
+
+	/** Tracks the point just written to Slot, expiring Lifetime seconds after Now. Untracks the slot for permanent points */
+	void Track(int32 Slot, float Lifetime, double Now);
+
+	/**
+	 * Detaches the buckets that expired by Now, kills their points and then refills the freed slots from the
+	 * CompactionZone slots ahead of the cloud's head, until TimeBudgetSeconds is spent or MaxChangedSlots slots
+	 * were written (a move writes two). VoxelHash may be null. A CompactionZone of 0 only kills.
+	 */
+	void Update(double Now, FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double TimeBudgetSeconds, int32 CompactionZone, int32 MaxChangedSlots = MAX_int32);
+
+	FLidarPointExpiryStats GetStats() const;
+
+	/** Lifetime of MaxLifetime or more never expires */
+	float GetMaxLifetime() const { return MaxLifetime; }
+
+private:
+	struct FExpiredBucket
+	{
+		uint32 Index = 0;
+		TArray<int32> Slots;
+	};
+
+	float BucketSeconds = 0.5f;
+	float MaxLifetime = 600.f;
+
+	// Bucket Index holds points expiring in [(Index - 1) * BucketSeconds, Index * BucketSeconds), at Buckets[Index % Num]
+	TArray<TArray<int32>> Buckets;
+	// Buckets before this one are detached
+	uint32 FirstBucket = 1;
+	// Bucket index of the point in each slot, 0 if it does not expire
+	TArray<uint32> SlotBuckets;
+
+	// Detached buckets oldest first, ExpiredCursor points into the first one
+	TArray<FExpiredBucket> Expired;
+	int32 ExpiredCursor = 0;
+	// Allocations of processed buckets, handed to buckets that fill again
+	TArray<TArray<int32>> SpareBuckets;
+
+	// Killed slots, possibly overwritten again since
+	TArray<int32> FreeSlots;
+	// Append count up to which the overwrite zone was already compacted
+	uint64 CompactCursor = 0;
+
+	FLidarPointExpiryStats Stats;
+
+	uint32 GetBucketIndex(double Time) const;
+	void AddToBucket(uint32 Index, int32 Slot);
+	/** Detaches every bucket that expired by Now */
+	void DetachBuckets(double Now);
+	/** Both count the slots they write down from SlotBudget and stop at 0, KillExpired returns true once nothing is left to kill */
+	bool KillExpired(FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double EndTime, int32& SlotBudget);
+	void Compact(FLidarPointCloud& Cloud, FLidarVoxelHash* VoxelHash, double EndTime, int32 CompactionZone, int32& SlotBudget);
+	/** A freed slot still dead and outside the overwrite zone, INDEX_NONE once there is none */
+	int32 PopFreeSlot(const FLidarPointCloud& Cloud, int32 CompactionZone);
+};
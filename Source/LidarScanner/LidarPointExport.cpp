@@ -0,0 +1,362 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPointExport.h"
+#include "LidarComponent.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Paths.h"
+
+static_assert(PLATFORM_LITTLE_ENDIAN, "Export writes native values, all three formats are little endian");
+
+namespace LidarExport
+{
+	// Wide enough for any count, zero padded so the header keeps its size when the real count is patched in
+	constexpr const TCHAR* CountFormat = TEXT("%012lld");
+
+	constexpr uint16 LasHeaderSize = 227;
+	constexpr uint16 LasRecordSize = 26;
+
+	template <typename T>
+	void Put(TArray<uint8>& Out, const T& Value)
+	{
+		Out.Append(reinterpret_cast<const uint8*>(&Value), sizeof(T));
+	}
+
+	void PutText(TArray<uint8>& Out, const FString& Text)
+	{
+		const FTCHARToUTF8 Utf8(*Text);
+		Out.Append(reinterpret_cast<const uint8*>(Utf8.Get()), Utf8.Length());
+	}
+
+	void PutFixedString(TArray<uint8>& Out, const char* Text, int32 Size)
+	{
+		const int32 Length = FMath::Min(static_cast<int32>(FCStringAnsi::Strlen(Text)), Size);
+		Out.Append(reinterpret_cast<const uint8*>(Text), Length);
+		Out.AddZeroed(Size - Length);
+	}
+}
+
+FString FLidarPointExporter::ResolvePath(const FString& Path, ELidarExportFormat Format)
+{
+	FString Result = FPaths::IsRelative(Path) ? FPaths::ProjectSavedDir() / TEXT("Lidar/Exports") / Path : Path;
+	if (FPaths::GetExtension(Result).IsEmpty())
+	{
+		Result += GetExtension(Format);
+	}
+	return Result;
+}
+
+const TCHAR* FLidarPointExporter::GetExtension(ELidarExportFormat Format)
+{
+	switch (Format)
+	{
+	case ELidarExportFormat::Pcd:
+		return TEXT(".pcd");
+	case ELidarExportFormat::Las:
+		return TEXT(".las");
+	default:
+		return TEXT(".ply");
+	}
+}
+
+bool FLidarPointExporter::ParseFormat(const FString& Name, ELidarExportFormat& OutFormat)
+{
+	const FString Trimmed = Name.TrimStartAndEnd().Replace(TEXT("."), TEXT(""));
+	if (Trimmed.Equals(TEXT("ply"), ESearchCase::IgnoreCase))
+	{
+		OutFormat = ELidarExportFormat::Ply;
+		return true;
+	}
+	if (Trimmed.Equals(TEXT("pcd"), ESearchCase::IgnoreCase))
+	{
+		OutFormat = ELidarExportFormat::Pcd;
+		return true;
+	}
+	if (Trimmed.Equals(TEXT("las"), ESearchCase::IgnoreCase))
+	{
+		OutFormat = ELidarExportFormat::Las;
+		return true;
+	}
+	return false;
+}
+
+FLidarPointExporter::FLidarPointExporter(const FString& Path, ELidarExportFormat InFormat)
+	: FilePath(ResolvePath(Path, InFormat))
+	, Format(InFormat)
+	, Pipe(UE_SOURCE_LOCATION)
+{
+	LastTask = Pipe.Launch(UE_SOURCE_LOCATION, [this]() { Open(); });
+}
+
+FLidarPointExporter::~FLidarPointExporter()
+{
+	Finish();
+	Wait();
+}
+
+void FLidarPointExporter::Enqueue(TSharedRef<const FLidarExportBatch> Batch)
+{
+	if (bFinishing)
+		return;
+
+	LastTask = Pipe.Launch(UE_SOURCE_LOCATION, [this, Batch]() { WriteBatch(*Batch); });
+}
+
+void FLidarPointExporter::Finish()
+{
+	if (bFinishing)
+		return;
+
+	bFinishing = true;
+	LastTask = Pipe.Launch(UE_SOURCE_LOCATION, [this]() { Close(); });
+}
+
+void FLidarPointExporter::Wait()
+{
+	if (LastTask.IsValid())
+	{
+		LastTask.Wait();
+	}
+}
+
+void FLidarPointExporter::Open()
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(FilePath));
+
+	File.Reset(PlatformFile.OpenWrite(*FilePath));
+	if (File.IsValid() == false)
+	{
+		bFailed = true;
+		return;
+	}
+
+	Scratch.Reserve(WriteChunkBytes);
+	WriteHeader();
+	FlushScratch();
+}
+
+void FLidarPointExporter::WriteBatch(const FLidarExportBatch& Batch)
+{
+	if (File.IsValid() == false)
+		return;
+
+	// The cloud's chunk table is append only between compactions, batches arrive in order
+	if (Batch.bResetChunkOrigins)
+	{
+		ChunkOrigins.Reset();
+	}
+	ChunkOrigins.Append(Batch.NewChunkOrigins);
+
+	for (const FLidarPackedPoint& Point : Batch.Points)
+	{
+		if (ChunkOrigins.IsValidIndex(Point.ChunkIndex) == false)
+			continue;
+
+		// Unreal units are centimeters
+		const FVector Meters = (ChunkOrigins[Point.ChunkIndex] + FVector(Point.X, Point.Y, Point.Z) * FLidarChunkTable::QuantizationStep) * 0.01;
+		EncodePoint(Meters, Point.Color);
+
+		if (Scratch.Num() >= WriteChunkBytes)
+		{
+			FlushScratch();
+		}
+	}
+
+	FlushScratch();
+	PointsWritten.store(PointCount, std::memory_order_relaxed);
+}
+
+void FLidarPointExporter::Close()
+{
+	if (File.IsValid())
+	{
+		// Same size as the placeholder written by Open, only the counts and bounds change
+		FlushScratch();
+		if (File->Seek(0))
+		{
+			WriteHeader();
+			FlushScratch();
+		}
+		else
+		{
+			bFailed = true;
+		}
+
+		File->Flush();
+		File.Reset();
+	}
+
+	Scratch.Empty();
+	bClosed.store(true, std::memory_order_release);
+}
+
+void FLidarPointExporter::WriteHeader()
+{
+	using namespace LidarExport;
+
+	const FString Count = FString::Printf(CountFormat, PointCount);
+
+	switch (Format)
+	{
+	case ELidarExportFormat::Ply:
+		PutText(Scratch, FString::Printf(TEXT(
+			"ply\n"
+			"format binary_little_endian 1.0\n"
+			"comment LidarScanner export, meters\n"
+			"element vertex %s\n"
+			"property float x\n"
+			"property float y\n"
+			"property float z\n"
+			"property uchar red\n"
+			"property uchar green\n"
+			"property uchar blue\n"
+			"end_header\n"), *Count));
+		break;
+
+	case ELidarExportFormat::Pcd:
+		PutText(Scratch, FString::Printf(TEXT(
+			"# .PCD v0.7 - Point Cloud Data file format\n"
+			"VERSION 0.7\n"
+			"FIELDS x y z rgb\n"
+			"SIZE 4 4 4 4\n"
+			"TYPE F F F U\n"
+			"COUNT 1 1 1 1\n"
+			"WIDTH %s\n"
+			"HEIGHT 1\n"
+			"VIEWPOINT 0 0 0 1 0 0 0\n"
+			"POINTS %s\n"
+			"DATA binary\n"), *Count, *Count));
+		break;
+
+	case ELidarExportFormat::Las:
+	{
+		const int32 Start = Scratch.Num();
+		const FDateTime Now = FDateTime::UtcNow();
+		const FBox Box = Bounds.IsValid ? Bounds : FBox(FVector::ZeroVector, FVector::ZeroVector);
+
+		PutFixedString(Scratch, "LASF", 4);
+		Put<uint16>(Scratch, 0); // file source id
+		Put<uint16>(Scratch, 0); // global encoding
+		Scratch.AddZeroed(16); // project guid
+		Put<uint8>(Scratch, 1);
+		Put<uint8>(Scratch, 2);
+		PutFixedString(Scratch, "LidarScanner", 32);
+		PutFixedString(Scratch, "LidarScanner export", 32);
+		Put<uint16>(Scratch, static_cast<uint16>(Now.GetDayOfYear()));
+		Put<uint16>(Scratch, static_cast<uint16>(Now.GetYear()));
+		Put<uint16>(Scratch, LasHeaderSize);
+		Put<uint32>(Scratch, uint32(LasHeaderSize)); // offset to the points, no variable length records
+		Put<uint32>(Scratch, 0);
+		Put<uint8>(Scratch, 2); // point format, xyz + rgb
+		Put<uint16>(Scratch, LasRecordSize);
+		Put<uint32>(Scratch, static_cast<uint32>(FMath::Min<int64>(PointCount, MAX_uint32)));
+		// Points by return, every point is a single first return
+		Put<uint32>(Scratch, static_cast<uint32>(FMath::Min<int64>(PointCount, MAX_uint32)));
+		Scratch.AddZeroed(4 * sizeof(uint32));
+		Put<double>(Scratch, LasScale);
+		Put<double>(Scratch, LasScale);
+		Put<double>(Scratch, LasScale);
+		Scratch.AddZeroed(3 * sizeof(double)); // offsets
+		Put<double>(Scratch, Box.Max.X);
+		Put<double>(Scratch, Box.Min.X);
+		Put<double>(Scratch, Box.Max.Y);
+		Put<double>(Scratch, Box.Min.Y);
+		Put<double>(Scratch, Box.Max.Z);
+		Put<double>(Scratch, Box.Min.Z);
+		check(Scratch.Num() - Start == LasHeaderSize);
+		break;
+	}
+	}
+}
+
+void FLidarPointExporter::EncodePoint(const FVector& Meters, const FColor& Color)
+{
+	using namespace LidarExport;
+
+	switch (Format)
+	{
+	case ELidarExportFormat::Ply:
+		Put<float>(Scratch, static_cast<float>(Meters.X));
+		Put<float>(Scratch, static_cast<float>(Meters.Y));
+		Put<float>(Scratch, static_cast<float>(Meters.Z));
+		Put<uint8>(Scratch, Color.R);
+		Put<uint8>(Scratch, Color.G);
+		Put<uint8>(Scratch, Color.B);
+		break;
+
+	case ELidarExportFormat::Pcd:
+		Put<float>(Scratch, static_cast<float>(Meters.X));
+		Put<float>(Scratch, static_cast<float>(Meters.Y));
+		Put<float>(Scratch, static_cast<float>(Meters.Z));
+		Put<uint32>(Scratch, (uint32(Color.R) << 16) | (uint32(Color.G) << 8) | uint32(Color.B));
+		break;
+
+	case ELidarExportFormat::Las:
+	{
+		auto ToLas = [](double Value)
+		{
+			return static_cast<int32>(FMath::Clamp<double>(FMath::RoundToDouble(Value / LasScale), MIN_int32, MAX_int32));
+		};
+		Put<int32>(Scratch, ToLas(Meters.X));
+		Put<int32>(Scratch, ToLas(Meters.Y));
+		Put<int32>(Scratch, ToLas(Meters.Z));
+		Put<uint16>(Scratch, 0); // intensity
+		Put<uint8>(Scratch, 0b00001001); // return 1 of 1
+		Put<uint8>(Scratch, 1); // unclassified
+		Put<int8>(Scratch, 0); // scan angle
+		Put<uint8>(Scratch, 0); // user data
+		Put<uint16>(Scratch, 0); // point source
+		// 16 bit colors, 255 maps to 65535
+		Put<uint16>(Scratch, static_cast<uint16>(Color.R * 257));
+		Put<uint16>(Scratch, static_cast<uint16>(Color.G * 257));
+		Put<uint16>(Scratch, static_cast<uint16>(Color.B * 257));
+		break;
+	}
+	}
+
+	Bounds += Meters;
+	++PointCount;
+}
+
+void FLidarPointExporter::FlushScratch()
+{
+	if (Scratch.Num() == 0 || File.IsValid() == false)
+		return;
+
+	if (File->Write(Scratch.GetData(), Scratch.Num()) == false)
+	{
+		bFailed = true;
+		File.Reset();
+	}
+	Scratch.Reset();
+}
+
+#pragma region Console
+
+namespace LidarExportCommands
+{
+	static FAutoConsoleCommandWithWorldAndArgs ExportCommand(
+		TEXT("Lidar.Export"),
+		TEXT("Lidar.Export <File> [ply|pcd|las] - exports the points of every lidar scanner in this world, one file per scanner past the first"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			const FString File = Args.Num() > 0 ? Args[0] : TEXT("PointCloud");
+			ELidarExportFormat Format = ELidarExportFormat::Ply;
+			if (Args.Num() > 1 && FLidarPointExporter::ParseFormat(Args[1], Format) == false)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Unknown export format %s, use ply, pcd or las"), *Args[1]);
+				return;
+			}
+
+			int32 Index = 0;
+			LidarScan::ForEachScanner(World, [&](ULidarComponent& Scanner)
+			{
+				Scanner.ExportPointCloud(Index == 0 ? File : FString::Printf(TEXT("%s_%d"), *File, Index), Format);
+				++Index;
+			});
+		}));
+}
+
+#pragma endregion
@@ -0,0 +1,106 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tasks/Pipe.h"
+#include "LidarPackedPoint.h"
+#include <atomic>
+#include "LidarPointExport.generated.h"
+
+class IFileHandle;
+
+/** File formats the scanner can write its points to */
+UENUM(BlueprintType)
+enum class ELidarExportFormat : uint8
+{
+	// Binary little endian PLY, float xyz and uchar rgb
+	Ply,
+	// Binary PCD v0.7, float xyz and a packed rgb uint
+	Pcd,
+	// LAS 1.2, point format 2
+	Las
+};
+
+/** Points handed from the game thread to the export worker, never changed after Enqueue */
+struct FLidarExportBatch
+{
+	TArray<FLidarPackedPoint> Points;
+	// Chunk origins the cloud added since the previous batch, the exporter keeps the whole table.
+	// ChunkIndex of the points refers to that table
+	TArray<FVector> NewChunkOrigins;
+	// The cloud compacted its table, NewChunkOrigins starts a new one
+	bool bResetChunkOrigins = false;
+};
+
+/**
+ * Streams points to one file on a background pipe. Batches are written in the order they were
+ * enqueued, encoded into a fixed size buffer and flushed to disk a chunk at a time.
+ * The point count is not known up front, the header is written with room for it and patched on Finish.
+ * Positions are written in meters, colors are the stored 8 bit values.
+ */
+class LIDARSCANNER_API FLidarPointExporter
+{
+public:
+	// Encoded points are flushed to the file in writes of about this size
+	static constexpr int32 WriteChunkBytes = 1 << 20;
+	// LAS stores positions as integers of this many meters
+	static constexpr double LasScale = 0.0001;
+
+	/** Relative paths land in Saved/Lidar/Exports, the format's extension is added if missing */
+	static FString ResolvePath(const FString& Path, ELidarExportFormat Format);
+	static const TCHAR* GetExtension(ELidarExportFormat Format);
+	/** ply, pcd or las, case insensitive */
+	static bool ParseFormat(const FString& Name, ELidarExportFormat& OutFormat);
+
+	/** Opens the file on the worker, check HasFailed once done */
+	FLidarPointExporter(const FString& Path, ELidarExportFormat InFormat);
+	~FLidarPointExporter();
+
+	FLidarPointExporter(const FLidarPointExporter&) = delete;
+	FLidarPointExporter& operator=(const FLidarPointExporter&) = delete;
+
+	/** Queues a batch behind the ones already queued, ignored after Finish */
+	void Enqueue(TSharedRef<const FLidarExportBatch> Batch);
+
+	/** Writes the final header and closes the file once every queued batch is written */
+	void Finish();
+
+	/** Blocks until everything queued so far is written */
+	void Wait();
+
+	bool IsFinishing() const { return bFinishing; }
+	/** Finished and closed, successfully or not */
+	bool IsDone() const { return bClosed.load(std::memory_order_acquire); }
+	bool HasFailed() const { return bFailed.load(std::memory_order_acquire); }
+	int64 GetPointsWritten() const { return PointsWritten.load(std::memory_order_relaxed); }
+	const FString& GetPath() const { return FilePath; }
+	ELidarExportFormat GetFormat() const { return Format; }
+
+private:
+	void Open();
+	void WriteBatch(const FLidarExportBatch& Batch);
+	void Close();
+
+	void WriteHeader();
+	void EncodePoint(const FVector& Meters, const FColor& Color);
+	void FlushScratch();
+
+	FString FilePath;
+	ELidarExportFormat Format;
+
+	UE::Tasks::FPipe Pipe;
+	UE::Tasks::FTask LastTask;
+	bool bFinishing = false;
+
+	// Everything below is only touched by tasks on the pipe, which never run at the same time
+	TUniquePtr<IFileHandle> File;
+	TArray<uint8> Scratch;
+	int64 PointCount = 0;
+	FBox Bounds = FBox(ForceInit);
+	TArray<FVector> ChunkOrigins;
+
+	std::atomic<int64> PointsWritten{0};
+	std::atomic<bool> bFailed{false};
+	std::atomic<bool> bClosed{false};
+};
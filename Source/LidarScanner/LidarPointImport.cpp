@@ -0,0 +1,401 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPointImport.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Hash/xxhash.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+static_assert(PLATFORM_LITTLE_ENDIAN, "Import reads binary little endian files straight from the mapping");
+
+namespace LidarImport
+{
+	// Headers are small, anything not ending within this many bytes is not a point file we can read
+	constexpr int64 MaxHeaderSize = 16 * 1024;
+
+	/** Byte size of a PLY scalar type, 0 if unknown */
+	int32 GetPlyTypeSize(const FString& Type)
+	{
+		if (Type == TEXT("char") || Type == TEXT("uchar") || Type == TEXT("int8") || Type == TEXT("uint8"))
+			return 1;
+		if (Type == TEXT("short") || Type == TEXT("ushort") || Type == TEXT("int16") || Type == TEXT("uint16"))
+			return 2;
+		if (Type == TEXT("int") || Type == TEXT("uint") || Type == TEXT("int32") || Type == TEXT("uint32") || Type == TEXT("float") || Type == TEXT("float32"))
+			return 4;
+		if (Type == TEXT("double") || Type == TEXT("float64"))
+			return 8;
+		return 0;
+	}
+
+	template <typename T>
+	FORCEINLINE T Read(const uint8* Data)
+	{
+		T Value;
+		FMemory::Memcpy(&Value, Data, sizeof(T));
+		return Value;
+	}
+
+	/** Whether a field of Size bytes at Offset lies inside a record, a missing field (INDEX_NONE) always does */
+	bool FieldFits(int32 Offset, int32 Size, int32 Stride)
+	{
+		return Offset == INDEX_NONE || (Offset >= 0 && static_cast<int64>(Offset) + Size <= Stride);
+	}
+
+	/** Every field ReadBlock touches lies inside the record, and all records lie inside the file */
+	bool IsLayoutValid(const FLidarPointFileLayout& Layout, int64 FileSize)
+	{
+		if (Layout.Stride <= 0 || Layout.PointCount < 0 || Layout.DataOffset < 0 || Layout.DataOffset > FileSize)
+			return false;
+
+		const int32 PositionSize = Layout.bDoublePositions ? 8 : 4;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			if (Layout.PositionOffsets[Axis] == INDEX_NONE || FieldFits(Layout.PositionOffsets[Axis], PositionSize, Layout.Stride) == false)
+				return false;
+			if (FieldFits(Layout.ColorOffsets[Axis], 1, Layout.Stride) == false)
+				return false;
+		}
+		if (FieldFits(Layout.PackedColorOffset, 4, Layout.Stride) == false)
+			return false;
+
+		// Divided rather than multiplied, a made up point count can't overflow
+		return Layout.PointCount <= (FileSize - Layout.DataOffset) / Layout.Stride;
+	}
+
+	/** Index of the first byte after the line starting with Token, INDEX_NONE if the header does not have one */
+	int64 FindHeaderEnd(const uint8* Data, int64 Size, const ANSICHAR* Token)
+	{
+		const int32 TokenLength = FCStringAnsi::Strlen(Token);
+		for (int64 i = 0; i + TokenLength <= Size; ++i)
+		{
+			if ((i == 0 || Data[i - 1] == '\n') && FMemory::Memcmp(Data + i, Token, TokenLength) == 0)
+			{
+				for (int64 End = i + TokenLength; End < Size; ++End)
+				{
+					if (Data[End] == '\n')
+						return End + 1;
+				}
+				return INDEX_NONE;
+			}
+		}
+		return INDEX_NONE;
+	}
+}
+
+FLidarPointFile::~FLidarPointFile() = default;
+
+TSharedPtr<FLidarPointFile> FLidarPointFile::Open(const FString& InPath, float InUnitsToCentimeters)
+{
+	using namespace LidarImport;
+
+	IPlatformFile::FOpenMappedResult Result = FPlatformFileManager::Get().GetPlatformFile().OpenMappedEx(*InPath);
+	if (Result.HasError())
+		return nullptr;
+
+	TSharedPtr<FLidarPointFile> File = MakeShareable(new FLidarPointFile());
+	File->Path = InPath;
+	File->UnitsToCentimeters = InUnitsToCentimeters;
+	File->MappedFile = Result.StealValue();
+	File->FileSize = File->MappedFile->GetFileSize();
+
+	// Only the header pages are touched here
+	TUniquePtr<IMappedFileRegion> HeaderRegion(File->MappedFile->MapRegion(0, FMath::Min(File->FileSize, MaxHeaderSize)));
+	if (HeaderRegion.IsValid() == false)
+		return nullptr;
+
+	const uint8* Data = HeaderRegion->GetMappedPtr();
+	const int64 Size = HeaderRegion->GetMappedSize();
+
+	bool bParsed = false;
+	if (Size >= 3 && FMemory::Memcmp(Data, "ply", 3) == 0)
+	{
+		const int64 HeaderSize = FindHeaderEnd(Data, Size, "end_header");
+		bParsed = HeaderSize != INDEX_NONE && ParsePly(FString(static_cast<int32>(HeaderSize), reinterpret_cast<const ANSICHAR*>(Data)), HeaderSize, File->Layout);
+	}
+	else
+	{
+		const int64 HeaderSize = FindHeaderEnd(Data, Size, "DATA");
+		bParsed = HeaderSize != INDEX_NONE && ParsePcd(FString(static_cast<int32>(HeaderSize), reinterpret_cast<const ANSICHAR*>(Data)), HeaderSize, File->Layout);
+	}
+
+	const FLidarPointFileLayout& Layout = File->Layout;
+	if (bParsed == false || IsLayoutValid(Layout, File->FileSize) == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s is not a binary little endian PLY or PCD point file, or is malformed or truncated"), *InPath);
+		return nullptr;
+	}
+
+	// Cheap enough for a file of any size: the same file moved elsewhere keeps its index, an edited one gets a new one
+	FXxHash64Builder Hasher;
+	const int64 Modified = IFileManager::Get().GetTimeStamp(*InPath).GetTicks();
+	Hasher.Update(&File->FileSize, sizeof(File->FileSize));
+	Hasher.Update(&Modified, sizeof(Modified));
+	Hasher.Update(Data, Size);
+	File->IndexKey = FString::Printf(TEXT("%016llx"), Hasher.Finalize().Hash);
+
+	File->BlockBounds.SetNum(File->GetBlockCount());
+	return File;
+}
+
+FString FLidarPointFile::GetIndexPath() const
+{
+	return FPaths::ProjectSavedDir() / TEXT("Lidar/Index") / IndexKey + TEXT(".lidarindex");
+}
+
+bool FLidarPointFile::ParsePly(const FString& Header, int64 HeaderSize, FLidarPointFileLayout& OutLayout)
+{
+	TArray<FString> Lines;
+	Header.ParseIntoArrayLines(Lines);
+
+	bool bInVertex = false;
+	bool bBinary = false;
+	int64 Offset = 0;
+	int32 PositionSize = 0;
+	for (const FString& Line : Lines)
+	{
+		TArray<FString> Words;
+		Line.ParseIntoArrayWS(Words);
+		if (Words.Num() == 0)
+			continue;
+
+		if (Words[0] == TEXT("format"))
+		{
+			bBinary = Words.Num() > 1 && Words[1] == TEXT("binary_little_endian");
+		}
+		else if (Words[0] == TEXT("element") && Words.Num() > 2)
+		{
+			// Elements after the vertices don't matter
+			if (bInVertex)
+				break;
+
+			if (Words[1] == TEXT("vertex"))
+			{
+				bInVertex = true;
+				OutLayout.PointCount = FCString::Atoi64(*Words[2]);
+			}
+			else if (FCString::Atoi64(*Words[2]) > 0)
+			{
+				// Points are read from the start of the data, so the vertices have to come first
+				return false;
+			}
+		}
+		else if (Words[0] == TEXT("property") && bInVertex)
+		{
+			const int32 TypeSize = Words.Num() > 2 ? LidarImport::GetPlyTypeSize(Words[1]) : 0;
+			if (TypeSize == 0)
+				return false;
+
+			const FString& Name = Words[2];
+			if (Name == TEXT("x") || Name == TEXT("y") || Name == TEXT("z"))
+			{
+				// All three are read with the same type
+				if ((TypeSize != 4 && TypeSize != 8) || (PositionSize != 0 && TypeSize != PositionSize))
+					return false;
+				OutLayout.PositionOffsets[Name[0] - TEXT('x')] = static_cast<int32>(Offset);
+				OutLayout.bDoublePositions = TypeSize == 8;
+				PositionSize = TypeSize;
+			}
+			else if (TypeSize == 1 && (Name == TEXT("red") || Name == TEXT("green") || Name == TEXT("blue")))
+			{
+				OutLayout.ColorOffsets[Name == TEXT("red") ? 0 : Name == TEXT("green") ? 1 : 2] = static_cast<int32>(Offset);
+			}
+			Offset += TypeSize;
+			if (Offset > MAX_int32)
+				return false;
+		}
+	}
+
+	OutLayout.Stride = static_cast<int32>(Offset);
+	OutLayout.DataOffset = HeaderSize;
+	return bBinary && OutLayout.PositionOffsets[0] != INDEX_NONE && OutLayout.PositionOffsets[1] != INDEX_NONE && OutLayout.PositionOffsets[2] != INDEX_NONE;
+}
+
+bool FLidarPointFile::ParsePcd(const FString& Header, int64 HeaderSize, FLidarPointFileLayout& OutLayout)
+{
+	TArray<FString> Lines;
+	Header.ParseIntoArrayLines(Lines);
+
+	TArray<FString> Fields, Sizes, Types, Counts;
+	bool bBinary = false;
+	for (const FString& Line : Lines)
+	{
+		TArray<FString> Words;
+		Line.ParseIntoArrayWS(Words);
+		if (Words.Num() == 0 || Words[0].StartsWith(TEXT("#")))
+			continue;
+
+		const FString Key = Words[0];
+		Words.RemoveAt(0);
+		if (Key == TEXT("FIELDS"))
+			Fields = Words;
+		else if (Key == TEXT("SIZE"))
+			Sizes = Words;
+		else if (Key == TEXT("TYPE"))
+			Types = Words;
+		else if (Key == TEXT("COUNT"))
+			Counts = Words;
+		else if (Key == TEXT("POINTS") && Words.Num() > 0)
+			OutLayout.PointCount = FCString::Atoi64(*Words[0]);
+		else if (Key == TEXT("DATA"))
+			bBinary = Words.Num() > 0 && Words[0] == TEXT("binary");
+	}
+
+	if (bBinary == false || Fields.Num() == 0 || Sizes.Num() != Fields.Num() || Types.Num() != Fields.Num())
+		return false;
+
+	int64 Offset = 0;
+	int32 PositionSize = 0;
+	for (int32 i = 0; i < Fields.Num(); ++i)
+	{
+		const int64 Size = FCString::Atoi64(*Sizes[i]);
+		const int64 Count = Counts.IsValidIndex(i) ? FCString::Atoi64(*Counts[i]) : 1;
+		if (Size <= 0 || Count <= 0)
+			return false;
+
+		if (Fields[i] == TEXT("x") || Fields[i] == TEXT("y") || Fields[i] == TEXT("z"))
+		{
+			// All three are read with the same type
+			if (Types[i] != TEXT("F") || (Size != 4 && Size != 8) || (PositionSize != 0 && Size != PositionSize))
+				return false;
+			OutLayout.PositionOffsets[Fields[i][0] - TEXT('x')] = static_cast<int32>(Offset);
+			OutLayout.bDoublePositions = Size == 8;
+			PositionSize = static_cast<int32>(Size);
+		}
+		else if ((Fields[i] == TEXT("rgb") || Fields[i] == TEXT("rgba")) && Size == 4)
+		{
+			// Stored as a float or an uint, the bits are 0x00RRGGBB either way
+			OutLayout.PackedColorOffset = static_cast<int32>(Offset);
+		}
+
+		// Checked before multiplying, a made up SIZE or COUNT can't overflow
+		if (Count > MAX_int32 / Size)
+			return false;
+		Offset += Size * Count;
+		if (Offset > MAX_int32)
+			return false;
+	}
+
+	OutLayout.Stride = static_cast<int32>(Offset);
+	OutLayout.DataOffset = HeaderSize;
+	return OutLayout.PositionOffsets[0] != INDEX_NONE && OutLayout.PositionOffsets[1] != INDEX_NONE && OutLayout.PositionOffsets[2] != INDEX_NONE;
+}
+
+int32 FLidarPointFile::GetBlockNum(int32 Block) const
+{
+	return static_cast<int32>(FMath::Min<int64>(BlockPoints, Layout.PointCount - static_cast<int64>(Block) * BlockPoints));
+}
+
+void FLidarPointFile::ReadBlock(int32 Block, TArray<FVector>& OutPositions, TArray<FColor>& OutColors) const
+{
+	using LidarImport::Read;
+
+	const int32 Num = GetBlockNum(Block);
+	OutPositions.SetNumUninitialized(Num);
+	OutColors.SetNumUninitialized(Num);
+	if (Num <= 0)
+		return;
+
+	// Each block maps and unmaps only its own bytes
+	const int64 Offset = Layout.DataOffset + static_cast<int64>(Block) * BlockPoints * Layout.Stride;
+	TUniquePtr<IMappedFileRegion> Region(MappedFile->MapRegion(Offset, static_cast<int64>(Num) * Layout.Stride));
+	if (Region.IsValid() == false)
+	{
+		OutPositions.Reset();
+		OutColors.Reset();
+		return;
+	}
+
+	const uint8* Record = Region->GetMappedPtr();
+	const bool bSeparateColors = Layout.ColorOffsets[0] != INDEX_NONE && Layout.ColorOffsets[1] != INDEX_NONE && Layout.ColorOffsets[2] != INDEX_NONE;
+
+	for (int32 i = 0; i < Num; ++i, Record += Layout.Stride)
+	{
+		FVector Position;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			const uint8* Field = Record + Layout.PositionOffsets[Axis];
+			Position[Axis] = Layout.bDoublePositions ? Read<double>(Field) : Read<float>(Field);
+		}
+		OutPositions[i] = Position * UnitsToCentimeters;
+
+		if (bSeparateColors)
+		{
+			OutColors[i] = FColor(Record[Layout.ColorOffsets[0]], Record[Layout.ColorOffsets[1]], Record[Layout.ColorOffsets[2]]);
+		}
+		else if (Layout.PackedColorOffset != INDEX_NONE)
+		{
+			const uint32 Rgb = Read<uint32>(Record + Layout.PackedColorOffset);
+			OutColors[i] = FColor((Rgb >> 16) & 0xFF, (Rgb >> 8) & 0xFF, Rgb & 0xFF);
+		}
+		else
+		{
+			OutColors[i] = FColor::White;
+		}
+	}
+}
+
+bool FLidarPointFile::LoadIndex()
+{
+	TArray<uint8> Bytes;
+	if (FFileHelper::LoadFileToArray(Bytes, *GetIndexPath(), FILEREAD_Silent) == false)
+		return false;
+
+	FMemoryReader Reader(Bytes);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	int64 IndexedFileSize = 0;
+	int64 IndexedPointCount = 0;
+	float IndexedUnits = 0.f;
+	Reader << Magic << Version << IndexedFileSize << IndexedPointCount << IndexedUnits;
+
+	// Any change to the point file or the import scale makes the bounds useless
+	if (Reader.IsError() || Magic != IndexMagic || Version != IndexVersion || IndexedFileSize != FileSize
+		|| IndexedPointCount != Layout.PointCount || IndexedUnits != UnitsToCentimeters)
+		return false;
+
+	TArray<FBox> Bounds;
+	Reader << Bounds;
+	if (Reader.IsError() || Bounds.Num() != GetBlockCount())
+		return false;
+
+	// Copied in place, readers may already hold a view of the array
+	FMemory::Memcpy(BlockBounds.GetData(), Bounds.GetData(), Bounds.Num() * sizeof(FBox));
+	IndexedBlocks.store(Bounds.Num(), std::memory_order_release);
+	return true;
+}
+
+void FLidarPointFile::BuildIndex()
+{
+	TArray<FVector> Positions;
+	TArray<FColor> Colors;
+	for (int32 Block = GetIndexedBlockCount(); Block < GetBlockCount(); ++Block)
+	{
+		if (bIndexCanceled.load(std::memory_order_relaxed))
+			return;
+
+		ReadBlock(Block, Positions, Colors);
+		BlockBounds[Block] = FBox(Positions);
+
+		// Usable from here on, the layer can page it in while the rest is still being read
+		IndexedBlocks.store(Block + 1, std::memory_order_release);
+	}
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	uint32 Magic = IndexMagic;
+	int32 Version = IndexVersion;
+	int64 IndexedFileSize = FileSize;
+	int64 IndexedPointCount = Layout.PointCount;
+	float IndexedUnits = UnitsToCentimeters;
+	Writer << Magic << Version << IndexedFileSize << IndexedPointCount << IndexedUnits << BlockBounds;
+
+	if (FFileHelper::SaveArrayToFile(Bytes, *GetIndexPath()) == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not save the block index of %s to %s, it is built again next time"), *Path, *GetIndexPath());
+	}
+}
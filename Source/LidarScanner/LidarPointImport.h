@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+class IMappedFileHandle;
+
+/** Where the fields of one point sit inside a record of a binary PLY or PCD file */
+struct FLidarPointFileLayout
+{
+	int64 DataOffset = 0;
+	int64 PointCount = 0;
+	int32 Stride = 0;
+
+	int32 PositionOffsets[3] = {INDEX_NONE, INDEX_NONE, INDEX_NONE};
+	bool bDoublePositions = false;
+
+	// Separate 8 bit channels (PLY) or one packed 0x00RRGGBB value (PCD rgb/rgba), INDEX_NONE without color
+	int32 ColorOffsets[3] = {INDEX_NONE, INDEX_NONE, INDEX_NONE};
+	int32 PackedColorOffset = INDEX_NONE;
+};
+
+/**
+ * Read only, memory mapped PLY or PCD point file (binary little endian only). Only the header is parsed up front,
+ * points are decoded a block at a time by mapping just that block's bytes, so a huge file costs next to no
+ * resident memory. Per block bounds come from a small .lidarindex file under Saved/Lidar/Index, named after a hash
+ * of the point file. It is built on a worker on first use, and the blocks it has reached can be used meanwhile.
+ */
+class LIDARSCANNER_API FLidarPointFile
+{
+public:
+	static constexpr int32 BlockPoints = 65536;
+	static constexpr uint32 IndexMagic = 0x58444C4C; // "LLDX"
+	static constexpr int32 IndexVersion = 1;
+
+	~FLidarPointFile();
+
+	/** Maps the file and parses its header, null if it is missing or not a supported format */
+	static TSharedPtr<FLidarPointFile> Open(const FString& Path, float InUnitsToCentimeters);
+
+	int64 Num() const { return Layout.PointCount; }
+	int32 GetBlockCount() const { return static_cast<int32>(FMath::DivideAndRoundUp<int64>(Layout.PointCount, BlockPoints)); }
+	int32 GetBlockNum(int32 Block) const;
+	const FString& GetPath() const { return Path; }
+
+	/** Decodes one block into world positions (cm) and colors. Safe from several threads */
+	void ReadBlock(int32 Block, TArray<FVector>& OutPositions, TArray<FColor>& OutColors) const;
+
+	/** Loads the block bounds from the index file, false if there is none or it is stale. Meant for a worker thread */
+	bool LoadIndex();
+	/** Reads every block once to compute its bounds, publishing each as it goes, then saves the index file. Meant for a worker thread */
+	void BuildIndex();
+	/** A running BuildIndex stops after its current block and saves nothing */
+	void CancelIndex() { bIndexCanceled.store(true, std::memory_order_relaxed); }
+
+	/** Blocks whose bounds are known so far, always the first ones of the file */
+	int32 GetIndexedBlockCount() const { return IndexedBlocks.load(std::memory_order_acquire); }
+	/** Bounds of the blocks indexed so far, safe to read while a worker builds the rest */
+	TConstArrayView<FBox> GetBlockBounds() const { return TConstArrayView<FBox>(BlockBounds.GetData(), GetIndexedBlockCount()); }
+
+private:
+	FLidarPointFile() = default;
+
+	static bool ParsePly(const FString& Header, int64 HeaderSize, FLidarPointFileLayout& OutLayout);
+	static bool ParsePcd(const FString& Header, int64 HeaderSize, FLidarPointFileLayout& OutLayout);
+	FString GetIndexPath() const;
+
+	FString Path;
+	// Hash of the file's size, modification time and first bytes, names its index
+	FString IndexKey;
+	int64 FileSize = 0;
+	float UnitsToCentimeters = 100.f;
+	FLidarPointFileLayout Layout;
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	// Sized in Open and never reallocated, entries below IndexedBlocks are final
+	TArray<FBox> BlockBounds;
+	std::atomic<int32> IndexedBlocks{0};
+	std::atomic<bool> bIndexCanceled{false};
+};
@@ -0,0 +1,327 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarPointPool.h"
+#include "LidarComponent.h"
+#include "NiagaraComponent.h"
+#include "NiagaraFunctionLibrary.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/World.h"
+
+static TAutoConsoleVariable<int32> CVarLidarPoolCapacity(
+	TEXT("Lidar.Pool.Capacity"),
+	2000000,
+	TEXT("Points held by a world's shared lidar point pool, read when the first scanner joins it"));
+
+void ULidarPointPoolSubsystem::Deinitialize()
+{
+	Release();
+	Super::Deinitialize();
+}
+
+void ULidarPointPoolSubsystem::Release()
+{
+	// The renderer goes with the points, a new one starts its GPU copy from scratch
+	if (NiagaraComponent != nullptr)
+	{
+		NiagaraComponent->DestroyComponent();
+		NiagaraComponent = nullptr;
+	}
+
+	Regions.Reset();
+	NextBase = 0;
+	DirtyRanges.Reset();
+	// Destroying the component completed its system instance, no worker tick reads the pool anymore
+	Pool.SetCapacity(0);
+}
+
+bool ULidarPointPoolSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+int32 ULidarPointPoolSubsystem::RegisterScanner(ULidarComponent* Scanner, int32 Quota, UNiagaraSystem* System)
+{
+	if (Scanner == nullptr || Quota <= 0)
+		return INDEX_NONE;
+
+	// Allocated for the first scanner that opts in, reserved once so it never reallocates under the Niagara workers
+	if (Pool.GetCapacity() == 0)
+	{
+		// Only ever after Release, which took the pool's system down with the old points
+		check(NiagaraComponent == nullptr);
+		Pool.SetCapacity(CVarLidarPoolCapacity.GetValueOnGameThread());
+	}
+
+	// Reuse a freed region that is big enough, otherwise carve a new one off the end
+	int32 Handle = Regions.IndexOfByPredicate([Quota](const FRegion& Region) { return Region.bInUse == false && Region.Quota >= Quota; });
+	if (Handle == INDEX_NONE)
+	{
+		if (NextBase + Quota > Pool.GetCapacity())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Lidar point pool is full (%d of %d slots), %s keeps its own system"), NextBase, Pool.GetCapacity(), *Scanner->GetName());
+			return INDEX_NONE;
+		}
+
+		Handle = Regions.AddDefaulted();
+		Regions[Handle].Base = NextBase;
+		Regions[Handle].Quota = Quota;
+		NextBase += Quota;
+	}
+
+	FRegion& Region = Regions[Handle];
+	const int32 RegionQuota = Region.Quota;
+	const int32 RegionBase = Region.Base;
+	Region = FRegion();
+	Region.Scanner = Scanner;
+	Region.bInUse = true;
+	Region.Base = RegionBase;
+	Region.Quota = RegionQuota;
+	Region.Stats.Quota = RegionQuota;
+	ClearRegion(Region);
+
+	if (NiagaraComponent == nullptr && System != nullptr)
+	{
+		// Points are in world space, the system itself stays at the origin
+		NiagaraComponent = UNiagaraFunctionLibrary::SpawnSystemAtLocation(GetWorld(), System, FVector::ZeroVector, FRotator::ZeroRotator,
+			FVector::OneVector, false, true, ENCPoolMethod::None);
+	}
+
+	return Handle;
+}
+
+void ULidarPointPoolSubsystem::UnregisterScanner(int32 Handle)
+{
+	if (Regions.IsValidIndex(Handle) == false || Regions[Handle].bInUse == false)
+		return;
+
+	FRegion& Region = Regions[Handle];
+	Region.bInUse = false;
+	Region.Scanner.Reset();
+	Region.ChunkRemap.Empty();
+	ClearRegion(Region);
+
+	// Worlds without pooled scanners don't keep the pool's memory around
+	if (Regions.ContainsByPredicate([](const FRegion& Other) { return Other.bInUse; }) == false)
+	{
+		Release();
+	}
+}
+
+void ULidarPointPoolSubsystem::Submit(int32 Handle, const FLidarPointCloud& Cloud, int32 MaxPoints)
+{
+	if (Regions.IsValidIndex(Handle) == false || Regions[Handle].bInUse == false)
+		return;
+
+	FRegion& Region = Regions[Handle];
+
+	// A cleared scanner starts over with its append count and chunk table
+	if (Region.Generation != Cloud.GetGeneration())
+	{
+		Region.Generation = Cloud.GetGeneration();
+		Region.Cursor = 0;
+		Region.UpdateCursor = 0;
+		Region.ChunkRemap.Reset();
+		Region.Stats.Resident = 0;
+		ClearRegion(Region);
+	}
+
+	// A compacted scanner table renumbered its chunks, the points already in the region keep the pool's own
+	if (Region.ChunkGeneration != Cloud.GetChunkGeneration())
+	{
+		Region.ChunkGeneration = Cloud.GetChunkGeneration();
+		Region.ChunkRemap.Reset();
+	}
+
+	// Only what the scanner still holds, and only the newest quota of it, can end up in the region
+	const uint64 Total = Cloud.GetTotalAppended();
+	const uint64 Oldest = Total - FMath::Min<uint64>(Total, static_cast<uint64>(FMath::Min(Cloud.Num(), Region.Quota)));
+	if (Region.Cursor < Oldest)
+	{
+		Region.Stats.PointsSkipped += static_cast<int64>(Oldest - Region.Cursor);
+		Region.Cursor = Oldest;
+	}
+
+	int32 Remaining = static_cast<int32>(FMath::Min<uint64>(Total - Region.Cursor, static_cast<uint64>(FMath::Max(0, MaxPoints))));
+	const int32 Submitted = Remaining;
+
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = Cloud.GetSpansSince(Region.Cursor, Spans);
+	for (int32 i = 0; i < SpanCount && Remaining > 0; ++i)
+	{
+		const int32 SpanNum = FMath::Min(Spans[i].Num, Remaining);
+		TConstArrayView<FLidarPackedPoint> Points = Cloud.GetPoints().Slice(Spans[i].First, SpanNum);
+
+		// The region is a ring indexed by append count, split where it wraps
+		while (Points.Num() > 0)
+		{
+			const int32 Offset = static_cast<int32>(Region.Cursor % static_cast<uint64>(Region.Quota));
+			const int32 Run = FMath::Min(Points.Num(), Region.Quota - Offset);
+			WriteRegion(Region, Offset, Points.Left(Run), Cloud.GetChunks());
+			Points = Points.RightChop(Run);
+			Region.Cursor += Run;
+		}
+		Remaining -= SpanNum;
+	}
+
+	// In place updates of points that already made it into the region, every slot if the log moved on without us
+	UpdatedSpans.Reset();
+	if (Cloud.GetUpdatesSince(Region.UpdateCursor, UpdatedSpans) == false)
+	{
+		UpdatedSpans.Add({0, Cloud.Num()});
+	}
+	Region.UpdateCursor = Cloud.GetTotalUpdates();
+
+	for (const FLidarPointSpan& Span : UpdatedSpans)
+	{
+		for (int32 Slot = Span.First; Slot < Span.First + Span.Num && Slot < Cloud.Num(); ++Slot)
+		{
+			// Append count of whatever the slot holds now, from its age behind the ring head
+			const int32 Age = (Cloud.GetNextSlot() - 1 - Slot + Cloud.GetCapacity()) % Cloud.GetCapacity();
+			const uint64 Appended = Total - 1 - Age;
+			if (Appended >= Region.Cursor || Region.Cursor - Appended > static_cast<uint64>(Region.Quota))
+				continue;
+
+			WriteRegion(Region, static_cast<int32>(Appended % static_cast<uint64>(Region.Quota)), MakeArrayView(&Cloud.GetPoint(Slot), 1), Cloud.GetChunks());
+			++Region.Stats.PointsUpdated;
+		}
+	}
+
+	Region.Stats.PointsSubmitted += Submitted;
+	Region.Stats.Resident = FMath::Min(Region.Quota, Region.Stats.Resident + Submitted);
+	Region.Stats.Backlog = static_cast<int32>(Total - Region.Cursor);
+}
+
+void ULidarPointPoolSubsystem::WriteRegion(FRegion& Region, int32 Offset, TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks)
+{
+	int32 Dropped = RemapChunks(Region, Points, Chunks);
+	if (Dropped > 0 && Pool.CompactChunks())
+	{
+		// The pool's table was full. Compacting renumbered its chunks, so every region maps its chunks again
+		for (FRegion& Other : Regions)
+		{
+			Other.ChunkRemap.Reset();
+		}
+		Dropped = RemapChunks(Region, Points, Chunks);
+	}
+	Pool.CountDroppedPoints(Dropped);
+
+	Pool.WriteSlots(Region.Base + Offset, Scratch);
+	AddDirtySpan(Region.Base + Offset, Scratch.Num());
+}
+
+int32 ULidarPointPoolSubsystem::RemapChunks(FRegion& Region, TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks)
+{
+	FLidarChunkTable& PoolChunks = Pool.GetMutableChunks();
+	int32 Dropped = 0;
+
+	Scratch.Reset();
+	Scratch.Append(Points.GetData(), Points.Num());
+	for (FLidarPackedPoint& Point : Scratch)
+	{
+		if (Point.ChunkIndex >= Region.ChunkRemap.Num())
+		{
+			const int32 Known = Region.ChunkRemap.Num();
+			Region.ChunkRemap.SetNumUninitialized(Chunks.Num());
+			for (int32 i = Known; i < Region.ChunkRemap.Num(); ++i)
+			{
+				Region.ChunkRemap[i] = INDEX_NONE;
+			}
+		}
+
+		int32& PoolChunk = Region.ChunkRemap[Point.ChunkIndex];
+		if (PoolChunk == INDEX_NONE)
+		{
+			// Same 32 m grid, the offsets stay valid against the pool's copy of the chunk
+			PoolChunk = PoolChunks.FindOrAdd(Chunks.GetOrigin(Point.ChunkIndex));
+		}
+
+		if (PoolChunk == INDEX_NONE)
+		{
+			LidarPacking::MakeDead(Point);
+			Point.ChunkIndex = 0;
+			++Dropped;
+			continue;
+		}
+		Point.ChunkIndex = static_cast<uint16>(PoolChunk);
+	}
+	return Dropped;
+}
+
+void ULidarPointPoolSubsystem::ClearRegion(const FRegion& Region)
+{
+	FLidarPackedPoint Dead;
+	LidarPacking::MakeDead(Dead);
+
+	// Regions are carved off in order, so the write always starts at or below the pool's end
+	Scratch.Init(Dead, Region.Quota);
+	Pool.WriteSlots(Region.Base, Scratch);
+	AddDirtySpan(Region.Base, Region.Quota);
+}
+
+void ULidarPointPoolSubsystem::AddDirtySpan(int32 First, int32 Num)
+{
+	// Consecutive submits of one scanner continue the previous span, and nothing consuming them for a while
+	// (no renderer yet) only merges the closest ones
+	DirtyRanges.Add(First, Num);
+}
+
+void ULidarPointPoolSubsystem::ConsumeDirtySpans(FLidarGpuUploadPlanner& Planner)
+{
+	Planner.SetMaxDirtyRanges(MaxDirtySpans);
+	for (const FLidarDirtyRange& Range : DirtyRanges.GetRanges())
+	{
+		Planner.MarkDirty(Range.Begin, Range.Num());
+	}
+	DirtyRanges.Reset();
+}
+
+void ULidarPointPoolSubsystem::CountGpuUpload(int32 Points, int64 Bytes)
+{
+	UploadedPoints += Points;
+	UploadedBytes += Bytes;
+	LidarStats::CountUpload(Points, Bytes);
+}
+
+FLidarPoolScannerStats ULidarPointPoolSubsystem::GetScannerStats(int32 Handle) const
+{
+	return Regions.IsValidIndex(Handle) ? Regions[Handle].Stats : FLidarPoolScannerStats();
+}
+
+void ULidarPointPoolSubsystem::DumpStats() const
+{
+	int32 ScannerCount = 0;
+	for (const FRegion& Region : Regions)
+	{
+		if (Region.bInUse == false)
+			continue;
+
+		const ULidarComponent* Scanner = Region.Scanner.Get();
+		const FLidarPoolScannerStats& Stats = Region.Stats;
+		UE_LOG(LogTemp, Log, TEXT("%s: %d / %d slots | submitted %lld | updated %lld | skipped %lld | backlog %d"),
+			Scanner ? *Scanner->GetReadableName() : TEXT("(gone)"), Stats.Resident, Stats.Quota, Stats.PointsSubmitted,
+			Stats.PointsUpdated, Stats.PointsSkipped, Stats.Backlog);
+		++ScannerCount;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Lidar point pool: %d scanners, %d / %d slots handed out, %d chunks | uploaded %lld points, %.2f MB"),
+		ScannerCount, NextBase, Pool.GetCapacity(), Pool.GetChunks().Num(), UploadedPoints, UploadedBytes / (1024.0 * 1024.0));
+}
+
+#pragma region Console
+
+namespace LidarPointPoolCommands
+{
+	static FAutoConsoleCommandWithWorldAndArgs DumpCommand(
+		TEXT("Lidar.Pool.Dump"),
+		TEXT("Logs the shared lidar point pool of this world, per scanner and in total"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			if (const ULidarPointPoolSubsystem* PointPool = World ? World->GetSubsystem<ULidarPointPoolSubsystem>() : nullptr)
+			{
+				PointPool->DumpStats();
+			}
+		}));
+}
+
+#pragma endregion
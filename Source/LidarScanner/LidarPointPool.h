@@ -0,0 +1,129 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LidarPointCloud.h"
+#include "LidarGpuUpload.h"
+#include "LidarPointPool.generated.h"
+
+class ULidarComponent;
+class UNiagaraComponent;
+class UNiagaraSystem;
+
+/** What one scanner has put into the shared pool */
+USTRUCT(BlueprintType)
+struct LIDARSCANNER_API FLidarPoolScannerStats
+{
+	GENERATED_BODY()
+
+public:
+	/** Slots the scanner owns in the pool */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int32 Quota = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int32 Resident = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointsSubmitted = 0;
+
+	/** Voxel dedup updates passed on to points already in the pool */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointsUpdated = 0;
+
+	/** Points that fell out of the scanner's cloud, or past its quota, before the per frame budget reached them */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointsSkipped = 0;
+
+	/** Points waiting for a later frame's budget */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int32 Backlog = 0;
+};
+
+/**
+ * One point pool and one Niagara system for every scanner in the world that opts in. Each scanner owns a fixed
+ * region of the pool as its own small ring, and forwards its new points there a bounded number per frame.
+ * The pool's single Lidar data interface instance then uploads every scanner's changes in one packet per frame.
+ */
+UCLASS()
+class LIDARSCANNER_API ULidarPointPoolSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// Scattered writes of many scanners, the upload planner merges past this many ranges
+	static constexpr int32 MaxDirtySpans = 64;
+
+	virtual void Deinitialize() override;
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	/**
+	 * Gives Scanner a region of Quota slots and returns its handle, INDEX_NONE once the pool is full. The pool is
+	 * allocated (Lidar.Pool.Capacity points) when the first scanner registers and freed when the last one leaves.
+	 * The first System passed renders the pool, it has to read its points through the Lidar data interface.
+	 */
+	int32 RegisterScanner(ULidarComponent* Scanner, int32 Quota, UNiagaraSystem* System);
+	void UnregisterScanner(int32 Handle);
+
+	/**
+	 * Copies up to MaxPoints of the points Cloud appended since the last submit into the scanner's region, newest
+	 * quota's worth only, along with the points Cloud logged as updated in place since then.
+	 */
+	void Submit(int32 Handle, const FLidarPointCloud& Cloud, int32 MaxPoints);
+
+	const FLidarPointCloud& GetPointCloud() const { return Pool; }
+	UNiagaraComponent* GetNiagaraComponent() const { return NiagaraComponent; }
+
+	/** Hands everything written since the last call to Planner, for the one data interface instance rendering the pool */
+	void ConsumeDirtySpans(FLidarGpuUploadPlanner& Planner);
+	void CountGpuUpload(int32 Points, int64 Bytes);
+
+	FLidarPoolScannerStats GetScannerStats(int32 Handle) const;
+	void DumpStats() const;
+
+private:
+	struct FRegion
+	{
+		TWeakObjectPtr<ULidarComponent> Scanner;
+		bool bInUse = false;
+		int32 Base = 0;
+		int32 Quota = 0;
+
+		// Scanner cloud's GetTotalAppended, GetTotalUpdates, GetGeneration and GetChunkGeneration up to the last submit
+		uint64 Cursor = 0;
+		uint64 UpdateCursor = 0;
+		uint32 Generation = 0;
+		uint32 ChunkGeneration = 0;
+		// Scanner chunk index to pool chunk index, INDEX_NONE until first seen
+		TArray<int32> ChunkRemap;
+
+		FLidarPoolScannerStats Stats;
+	};
+
+	FLidarPointCloud Pool;
+	TArray<FRegion> Regions;
+	// Slots past this were never handed to a region
+	int32 NextBase = 0;
+
+	FLidarDirtyRangeList DirtyRanges{MaxDirtySpans * 4};
+	TArray<FLidarPackedPoint> Scratch;
+	TArray<FLidarPointSpan> UpdatedSpans;
+
+	UPROPERTY()
+	TObjectPtr<UNiagaraComponent> NiagaraComponent;
+
+	int64 UploadedPoints = 0;
+	int64 UploadedBytes = 0;
+
+	/** Frees the pool's points and its Niagara system, the next RegisterScanner allocates them again */
+	void Release();
+	/** Fills a region with points Niagara treats as dead, so unused slots never show */
+	void ClearRegion(const FRegion& Region);
+	/** Writes Points at Region's slot Offset, mapping their chunk indices from the scanner's table to the pool's */
+	void WriteRegion(FRegion& Region, int32 Offset, TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks);
+	/** Copies Points into Scratch with pool chunk indices, returns how many found no room in the pool's table and were killed */
+	int32 RemapChunks(FRegion& Region, TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks);
+	void AddDirtySpan(int32 First, int32 Num);
+};
@@ -0,0 +1,159 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarScanPattern.h"
+
+namespace
+{
+	// Fixed so a table is the same every time it is built
+	constexpr int32 TableSeed = 0x11DA5;
+	constexpr int32 MinRandomPool = 1024;
+	constexpr float GoldenAngle = 2.39996323f;
+}
+
+TSharedRef<const FLidarScanPatternTable> FLidarScanPatternTable::Build(ELidarScanPattern InPattern, int32 InRaysPerScan)
+{
+	TSharedRef<FLidarScanPatternTable> Table = MakeShared<FLidarScanPatternTable>();
+	Table->Pattern = InPattern;
+	Table->RaysPerScan = FMath::Max(1, InRaysPerScan);
+
+	const int32 RayCount = Table->RaysPerScan;
+	FRandomStream Stream(TableSeed);
+	TArray<FVector2f>& Offsets = Table->UnitOffsets;
+
+	switch (InPattern)
+	{
+	case ELidarScanPattern::GoldenAngle:
+		Offsets.SetNumUninitialized(RayCount);
+		for (int32 i = 0; i < RayCount; ++i)
+		{
+			const float R = FMath::Sqrt((i + 0.5f) / RayCount);
+			float S, C;
+			FMath::SinCos(&S, &C, i * GoldenAngle);
+			Offsets[i] = FVector2f(R * C, R * S);
+		}
+		break;
+
+	case ELidarScanPattern::StratifiedJitter:
+		{
+			// Equal area rings, so every cell covers the same part of the disk
+			const int32 Rings = FMath::Max(1, FMath::FloorToInt32(FMath::Sqrt(static_cast<float>(RayCount))));
+			const int32 Sectors = FMath::DivideAndRoundUp(RayCount, Rings);
+			Offsets.SetNumUninitialized(RayCount);
+			for (int32 i = 0; i < RayCount; ++i)
+			{
+				const float R = FMath::Sqrt((i / Sectors + Stream.FRand()) / Rings);
+				float S, C;
+				FMath::SinCos(&S, &C, 2.f * PI * (i % Sectors + Stream.FRand()) / Sectors);
+				Offsets[i] = FVector2f(R * C, R * S);
+			}
+		}
+		break;
+
+	default:
+		{
+			// Same distribution as the old RandomPointInsideCircle, drawn once into a pool larger than a scan
+			const int32 PoolSize = FMath::Max(RayCount * 4, MinRandomPool);
+			Offsets.SetNumUninitialized(PoolSize);
+			for (int32 i = 0; i < PoolSize; ++i)
+			{
+				const float R = FMath::Sqrt(Stream.FRand());
+				float S, C;
+				FMath::SinCos(&S, &C, Stream.FRandRange(0.f, 2.f * PI));
+				Offsets[i] = FVector2f(R * C, R * S);
+			}
+		}
+		break;
+	}
+
+	return Table;
+}
+
+FLidarDiskTransform FLidarDiskTransform::Make(const FLidarScanPatternTable& Table, const FRotator& Rotation, float Radius, int32 Seed)
+{
+	const FRotationMatrix Matrix(Rotation);
+	FRandomStream Stream(Seed);
+
+	FLidarDiskTransform Transform;
+	Transform.Forward = FVector3f(Matrix.GetUnitAxis(EAxis::X));
+	Transform.Right = FVector3f(Matrix.GetUnitAxis(EAxis::Y));
+	Transform.Up = FVector3f(Matrix.GetUnitAxis(EAxis::Z));
+	Transform.Radius = Radius;
+	FMath::SinCos(&Transform.Sin, &Transform.Cos, Stream.FRandRange(0.f, 2.f * PI));
+	Transform.Start = Stream.RandHelper(Table.UnitOffsets.Num());
+	Transform.Stride = GetGoldenStride(Table.UnitOffsets.Num());
+	return Transform;
+}
+
+int32 FLidarDiskTransform::GetGoldenStride(int32 TableNum)
+{
+	if (TableNum <= 2)
+		return 1;
+
+	int32 Stride = FMath::Max(1, FMath::RoundToInt32(TableNum * 0.381966f));
+	while (FMath::GreatestCommonDivisor(Stride, TableNum) != 1)
+	{
+		++Stride;
+	}
+	return Stride;
+}
+
+FLidarFanTransform FLidarFanTransform::Make(const FRotator& Rotation, float VerticalAngle, float HorizontalAngle, int32 RayCount, int32 Seed)
+{
+	const FVector Forward = FRotationMatrix(Rotation).GetUnitAxis(EAxis::X);
+
+	// FRotator applies pitch before yaw, so the pitch can be done once for the whole fan
+	FLidarFanTransform Transform;
+	Transform.Pitched = FVector3f(FRotator(VerticalAngle, 0.f, 0.f).RotateVector(Forward));
+	Transform.YawStep = FMath::DegreesToRadians(HorizontalAngle / FMath::Max(1, RayCount));
+	Transform.FirstYaw = FMath::DegreesToRadians(-HorizontalAngle / 2);
+	Transform.Seed = Seed;
+	return Transform;
+}
+
+void LidarScanPattern::TransformDisk(const FLidarScanPatternTable& Table, const FLidarDiskTransform& Transform, int32 FirstRay, int32 Num, FVector* RESTRICT OutDirections)
+{
+	const FVector2f* RESTRICT Offsets = Table.UnitOffsets.GetData();
+	const int32 TableNum = Table.UnitOffsets.Num();
+
+	// Fold the spin and the radius into the right/up axes, each ray is then two multiply-adds per component
+	const float Cos = Transform.Cos * Transform.Radius;
+	const float Sin = Transform.Sin * Transform.Radius;
+	const FVector3f AxisX = Transform.Right * Cos + Transform.Up * Sin;
+	const FVector3f AxisY = Transform.Up * Cos - Transform.Right * Sin;
+	const FVector3f Forward = Transform.Forward;
+
+	const int32 Stride = Transform.Stride % TableNum;
+	int32 Index = static_cast<int32>((Transform.Start + static_cast<int64>(FirstRay) * Stride) % TableNum);
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const FVector2f Offset = Offsets[Index];
+		Index = Index + Stride >= TableNum ? Index + Stride - TableNum : Index + Stride;
+
+		const float X = Forward.X + AxisX.X * Offset.X + AxisY.X * Offset.Y;
+		const float Y = Forward.Y + AxisX.Y * Offset.X + AxisY.Y * Offset.Y;
+		const float Z = Forward.Z + AxisX.Z * Offset.X + AxisY.Z * Offset.Y;
+		// Never zero, the forward component always dominates the length
+		const float InvLength = FMath::InvSqrt(X * X + Y * Y + Z * Z);
+		OutDirections[i] = FVector(X * InvLength, Y * InvLength, Z * InvLength);
+	}
+}
+
+void LidarScanPattern::TransformFan(const FLidarFanTransform& Transform, int32 FirstRay, int32 Num, FVector* RESTRICT OutDirections)
+{
+	const FVector3f P = Transform.Pitched;
+	const float HalfStep = Transform.YawStep / 2;
+
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const int32 RayIndex = FirstRay + i;
+
+		// One stream per ray keeps the fan the same however the rays are split up
+		FRandomStream Stream(HashCombine(static_cast<uint32>(Transform.Seed), static_cast<uint32>(RayIndex)));
+		const float Yaw = Transform.FirstYaw + RayIndex * Transform.YawStep + Stream.FRandRange(-HalfStep, HalfStep);
+
+		float S, C;
+		FMath::SinCos(&S, &C, Yaw);
+		OutDirections[i] = FVector(P.X * C - P.Y * S, P.X * S + P.Y * C, P.Z);
+	}
+}
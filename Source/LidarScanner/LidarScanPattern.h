@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarScanPattern.generated.h"
+
+/** How the rays of a normal scan are spread over the scan disk */
+UENUM(BlueprintType)
+enum class ELidarScanPattern : uint8
+{
+	// Independent random points, the original look
+	UniformDisk,
+	// Golden angle spiral, even coverage without clumps or gaps
+	GoldenAngle,
+	// One jittered point per cell of a polar grid
+	StratifiedJitter
+};
+
+/**
+ * Unit disk offsets for one pattern and ray count, built once and shared (also with pipeline workers).
+ * Every scan picks a random rotation and start offset, so successive scans don't repeat.
+ */
+struct LIDARSCANNER_API FLidarScanPatternTable
+{
+	ELidarScanPattern Pattern = ELidarScanPattern::UniformDisk;
+	int32 RaysPerScan = 0;
+	// At least RaysPerScan entries, the random pattern keeps a larger pool
+	TArray<FVector2f> UnitOffsets;
+
+	static TSharedRef<const FLidarScanPatternTable> Build(ELidarScanPattern InPattern, int32 InRaysPerScan);
+};
+
+/** Per scan placement of a disk table in world space */
+struct LIDARSCANNER_API FLidarDiskTransform
+{
+	FVector3f Forward;
+	FVector3f Right;
+	FVector3f Up;
+	float Radius = 1.f;
+	// Random spin of the whole pattern
+	float Cos = 1.f;
+	float Sin = 0.f;
+	int32 Start = 0;
+	// Table step between consecutive rays, coprime to the table size so a pass still visits every entry once.
+	// Tables are ordered by radius, a golden ratio step spreads any run of rays over the whole disk
+	int32 Stride = 1;
+
+	static FLidarDiskTransform Make(const FLidarScanPatternTable& Table, const FRotator& Rotation, float Radius, int32 Seed);
+
+	/** Step close to TableNum / golden ratio squared that shares no divisor with TableNum */
+	static int32 GetGoldenStride(int32 TableNum);
+};
+
+/** Per scan placement of the full scan's horizontal fan */
+struct LIDARSCANNER_API FLidarFanTransform
+{
+	// Camera forward pitched by the current vertical angle, only the yaw changes per ray
+	FVector3f Pitched;
+	float FirstYaw = 0.f;
+	float YawStep = 0.f;
+	int32 Seed = 0;
+
+	static FLidarFanTransform Make(const FRotator& Rotation, float VerticalAngle, float HorizontalAngle, int32 RayCount, int32 Seed);
+};
+
+namespace LidarScanPattern
+{
+	/** Directions for rays [FirstRay, FirstRay + Num) of a disk scan */
+	LIDARSCANNER_API void TransformDisk(const FLidarScanPatternTable& Table, const FLidarDiskTransform& Transform, int32 FirstRay, int32 Num, FVector* RESTRICT OutDirections);
+
+	/** Directions for rays [FirstRay, FirstRay + Num) of a fan scan, each ray jitters inside its own yaw step */
+	LIDARSCANNER_API void TransformFan(const FLidarFanTransform& Transform, int32 FirstRay, int32 Num, FVector* RESTRICT OutDirections);
+}
@@ -0,0 +1,293 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarScanPipeline.h"
+#include "LidarStats.h"
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+#include "Tasks/Task.h"
+#include "UObject/GarbageCollection.h"
+
+#pragma region Helpers
+
+FVector LidarScan::ScanDirection(float VerticalAngle, float HorizontalDegrees, const FRotator& CameraRotation)
+{
+	const FRotator NewRotation(VerticalAngle, HorizontalDegrees, 0);
+
+	return NewRotation.RotateVector(FRotationMatrix(CameraRotation).GetUnitAxis(EAxis::X));
+}
+
+FVector LidarScan::TraceEnd(const FVector& Start, const FVector& Direction, float RaycastLength)
+{
+	return Start + Direction * RaycastLength;
+}
+
+FLinearColor LidarScan::LerpColors(const FLinearColor& Close, const FLinearColor& Far, float MaxDistance, float Distance)
+{
+	// Clamp Alpha to ensure it is between 0.0 and 1.0. No range means the close color, same as an empty ramp range
+	const float Alpha = MaxDistance > 0.f ? FMath::Clamp(Distance / MaxDistance, 0.0f, 1.0f) : 0.f;
+	return FLinearColor::LerpUsingHSV(Close, Far, Alpha);
+}
+
+const FCustomParticleData* LidarScan::FindCustomData(const TMap<FName, FCustomParticleData>& Dictionary, const TArray<FName>& Tags)
+{
+	for (const FName& Tag : Tags)
+	{
+		if (const FCustomParticleData* Data = Dictionary.Find(Tag))
+		{
+			return Data;
+		}
+	}
+	return nullptr;
+}
+
+#pragma endregion
+
+FLidarScanPipeline::~FLidarScanPipeline()
+{
+	Wait();
+}
+
+bool FLidarScanPipeline::IsBusy() const
+{
+	return Task.IsValid() && Task.IsCompleted() == false;
+}
+
+void FLidarScanPipeline::Launch(TArray<FLidarScanJob>&& InJobs, FSettings&& InSettings)
+{
+	check(IsInGameThread());
+	check(IsBusy() == false);
+
+	Jobs = MoveTemp(InJobs);
+	Settings = MoveTemp(InSettings);
+	Settings.RaysPerTask = FMath::Max(1, Settings.RaysPerTask);
+
+	Task = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this]() { Run(); });
+}
+
+bool FLidarScanPipeline::TrySwap(FLidarScanResultBuffer& Front)
+{
+	check(IsInGameThread());
+
+	if (IsBusy() || bResultPending == false)
+		return false;
+
+	// The old front keeps its allocations and becomes the next back buffer
+	Swap(Front, BackBuffer);
+	BackBuffer.Reset();
+	Stats = RunStats;
+	bResultPending = false;
+	return true;
+}
+
+void FLidarScanPipeline::Wait()
+{
+	if (Task.IsValid())
+	{
+		Task.Wait();
+	}
+}
+
+void FLidarScanPipeline::Run()
+{
+	// Runs across the end of the frame. Scene queries touch the world and its components, GC has to wait for us
+	FGCScopeGuard GCGuard;
+
+	LIDAR_SCOPE(PipelineRun);
+	const uint64 RunStart = FPlatformTime::Cycles64();
+
+	uint64 StageStart = RunStart;
+	auto EndStage = [&StageStart]()
+	{
+		const uint64 Now = FPlatformTime::Cycles64();
+		const float Ms = static_cast<float>(FPlatformTime::ToMilliseconds64(Now - StageStart));
+		StageStart = Now;
+		return Ms;
+	};
+
+	GenerateDirections();
+	RunStats.DirectionsMs = EndStage();
+
+	TraceRays();
+	RunStats.TraceMs = EndStage();
+
+	ResolvePoints();
+	RunStats.ResolveMs = EndStage();
+
+	PackPoints();
+	RunStats.PackMs = EndStage();
+
+	RunStats.TotalMs = static_cast<float>(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - RunStart));
+	RunStats.RayCount = RayDirections.Num();
+	RunStats.FullScanRayCount = 0;
+	for (const FLidarScanJob& Job : Jobs)
+	{
+		RunStats.FullScanRayCount += Job.Kind == FLidarScanJob::EKind::Full ? Job.RayCount : 0;
+	}
+	RunStats.HitCount = BackBuffer.Num();
+	RunStats.TaskCount = FMath::DivideAndRoundUp(RayDirections.Num(), Settings.RaysPerTask);
+
+	bResultPending = true;
+}
+
+void FLidarScanPipeline::GenerateDirections()
+{
+	LIDAR_SCOPE(Directions);
+
+	// Flatten the jobs so the later stages can split work by ray instead of by scan
+	RayJobIndices.Reset();
+	for (int32 JobIndex = 0; JobIndex < Jobs.Num(); ++JobIndex)
+	{
+		for (int32 i = 0; i < Jobs[JobIndex].RayCount; ++i)
+		{
+			RayJobIndices.Add(JobIndex);
+		}
+	}
+
+	const int32 RayCount = RayJobIndices.Num();
+	RayStarts.SetNumUninitialized(RayCount);
+	RayDirections.SetNumUninitialized(RayCount);
+
+	// First ray of every job and its per scan transform, set up once so the workers only run the batched transforms
+	TArray<int32> JobFirstRay;
+	TArray<FLidarDiskTransform> JobDisks;
+	TArray<FLidarFanTransform> JobFans;
+	JobFirstRay.SetNumUninitialized(Jobs.Num());
+	JobDisks.SetNum(Jobs.Num());
+	JobFans.SetNum(Jobs.Num());
+	for (int32 JobIndex = 0, First = 0; JobIndex < Jobs.Num(); ++JobIndex)
+	{
+		const FLidarScanJob& Job = Jobs[JobIndex];
+		JobFirstRay[JobIndex] = First;
+		First += Job.RayCount;
+
+		if (Job.Kind == FLidarScanJob::EKind::Normal)
+		{
+			check(Job.PatternTable.IsValid());
+			JobDisks[JobIndex] = FLidarDiskTransform::Make(*Job.PatternTable, Job.CameraRotation, Job.ScanRadius, Job.Seed);
+		}
+		else
+		{
+			JobFans[JobIndex] = FLidarFanTransform::Make(Job.CameraRotation, Job.VerticalAngle, Job.HorizontalAngle, Job.GetFanRayCount(), Job.Seed);
+		}
+	}
+
+	const int32 TaskCount = FMath::DivideAndRoundUp(RayCount, Settings.RaysPerTask);
+	ParallelFor(TaskCount, [&](int32 TaskIndex)
+	{
+		const int32 First = TaskIndex * Settings.RaysPerTask;
+		const int32 Last = FMath::Min(First + Settings.RaysPerTask, RayCount);
+
+		// A task can straddle jobs, transform it one job's run at a time
+		for (int32 RayIndex = First; RayIndex < Last;)
+		{
+			const int32 JobIndex = RayJobIndices[RayIndex];
+			const FLidarScanJob& Job = Jobs[JobIndex];
+			const int32 LocalIndex = RayIndex - JobFirstRay[JobIndex];
+			const int32 RunEnd = FMath::Min(Last, JobFirstRay[JobIndex] + Job.RayCount);
+			const int32 RunNum = RunEnd - RayIndex;
+
+			for (int32 i = RayIndex; i < RunEnd; ++i)
+			{
+				RayStarts[i] = Job.Start;
+			}
+
+			if (Job.Kind == FLidarScanJob::EKind::Normal)
+			{
+				LidarScanPattern::TransformDisk(*Job.PatternTable, JobDisks[JobIndex], Job.FirstRay + LocalIndex, RunNum, &RayDirections[RayIndex]);
+			}
+			else
+			{
+				LidarScanPattern::TransformFan(JobFans[JobIndex], Job.FirstRay + LocalIndex, RunNum, &RayDirections[RayIndex]);
+			}
+
+			RayIndex = RunEnd;
+		}
+	});
+}
+
+void FLidarScanPipeline::TraceRays()
+{
+	LIDAR_SCOPE(Trace);
+	const int32 RayCount = RayDirections.Num();
+	RayHits.SetNum(RayCount);
+	RayHitFlags.SetNumUninitialized(RayCount);
+
+	UWorld* World = Settings.World.Get();
+	if (World == nullptr)
+	{
+		FMemory::Memzero(RayHitFlags.GetData(), RayCount * sizeof(bool));
+		return;
+	}
+
+	const int32 TaskCount = FMath::DivideAndRoundUp(RayCount, Settings.RaysPerTask);
+	ParallelFor(TaskCount, [&](int32 TaskIndex)
+	{
+		const int32 First = TaskIndex * Settings.RaysPerTask;
+		const int32 Last = FMath::Min(First + Settings.RaysPerTask, RayCount);
+
+		for (int32 RayIndex = First; RayIndex < Last; ++RayIndex)
+		{
+			const FVector End = LidarScan::TraceEnd(RayStarts[RayIndex], RayDirections[RayIndex], Jobs[RayJobIndices[RayIndex]].RaycastLength);
+			RayHitFlags[RayIndex] = World->LineTraceSingleByChannel(RayHits[RayIndex], RayStarts[RayIndex], End, ECC_Camera, Settings.QueryParams);
+		}
+	});
+}
+
+void FLidarScanPipeline::ResolvePoints()
+{
+	const int32 RayCount = RayDirections.Num();
+	RayRampInputs.SetNumUninitialized(RayCount);
+	RayColors.SetNumUninitialized(RayCount);
+	RayLifetimes.SetNumUninitialized(RayCount);
+
+	const FLidarPointStyle& Style = Settings.Style;
+	check(Style.ColorRamp.IsValid());
+	const FLidarColorRamp& Ramp = *Style.ColorRamp;
+
+	const int32 TaskCount = FMath::DivideAndRoundUp(RayCount, Settings.RaysPerTask);
+	ParallelFor(TaskCount, [&](int32 TaskIndex)
+	{
+		const int32 First = TaskIndex * Settings.RaysPerTask;
+		const int32 Last = FMath::Min(First + Settings.RaysPerTask, RayCount);
+
+		// Default colors only, the whole chunk goes through the ramp in one pass. Tagged hits are recolored on the game thread
+		LIDAR_SCOPE(Color);
+		for (int32 RayIndex = First; RayIndex < Last; ++RayIndex)
+		{
+			const FHitResult& Hit = RayHits[RayIndex];
+			RayRampInputs[RayIndex] = RayHitFlags[RayIndex] ? Ramp.GetInput(Hit.Location, Hit.ImpactNormal, RayDirections[RayIndex], Hit.Distance) : 0.f;
+			RayLifetimes[RayIndex] = Style.DefaultLifetime;
+		}
+		Ramp.SampleBatch(MakeArrayView(RayRampInputs).Slice(First, Last - First), MakeArrayView(RayColors).Slice(First, Last - First));
+	});
+}
+
+void FLidarScanPipeline::PackPoints()
+{
+	LIDAR_SCOPE(Pack);
+
+	// Serial on purpose, it is a straight compaction and keeps the points in ray order
+	const int32 RayCount = RayDirections.Num();
+
+	BackBuffer.Reset();
+	BackBuffer.Positions.Reserve(RayCount);
+	BackBuffer.Colors.Reserve(RayCount);
+	BackBuffer.Lifetimes.Reserve(RayCount);
+	BackBuffer.HitComponents.Reserve(RayCount);
+
+	for (int32 RayIndex = 0; RayIndex < RayCount; ++RayIndex)
+	{
+		if (Settings.bRecordDebugTraces)
+		{
+			const FVector End = RayHitFlags[RayIndex] ? RayHits[RayIndex].Location : RayStarts[RayIndex] + RayDirections[RayIndex] * Jobs[RayJobIndices[RayIndex]].RaycastLength;
+			BackBuffer.DebugTraces.Add({RayStarts[RayIndex], End, RayHitFlags[RayIndex]});
+		}
+
+		if (RayHitFlags[RayIndex])
+		{
+			BackBuffer.Add(RayHits[RayIndex].Location, RayColors[RayIndex], RayLifetimes[RayIndex]);
+			BackBuffer.HitComponents.Add(RayHits[RayIndex].Component);
+		}
+	}
+}
@@ -0,0 +1,199 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CollisionQueryParams.h"
+#include "Tasks/Task.h"
+#include "Public/CustomParticleData.h"
+#include "LidarColorRamp.h"
+#include "LidarScanPattern.h"
+#include "LidarScanPipeline.generated.h"
+
+/** Timings of the last finished pipeline run, each stage is wall time across all workers */
+USTRUCT(BlueprintType)
+struct LIDARSCANNER_API FLidarPipelineStats
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	float DirectionsMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	float TraceMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	float ResolveMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	float PackMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	float TotalMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	int32 RayCount = 0;
+
+	/** Rays of the run that belong to full scans */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	int32 FullScanRayCount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	int32 HitCount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Pipeline")
+	int32 TaskCount = 0;
+};
+
+// Pure helpers shared by the game thread scan path and the worker pipeline
+namespace LidarScan
+{
+	LIDARSCANNER_API FVector ScanDirection(float VerticalAngle, float HorizontalDegrees, const FRotator& CameraRotation);
+	LIDARSCANNER_API FVector TraceEnd(const FVector& Start, const FVector& Direction, float RaycastLength);
+	LIDARSCANNER_API FLinearColor LerpColors(const FLinearColor& Close, const FLinearColor& Far, float MaxDistance, float Distance);
+	LIDARSCANNER_API const FCustomParticleData* FindCustomData(const TMap<FName, FCustomParticleData>& Dictionary, const TArray<FName>& Tags);
+}
+
+/**
+ * Copy of the component's default coloring so workers never read the component. Tag colors need the hit
+ * component's tags, those are resolved on the game thread when the results are swapped in
+ */
+struct FLidarPointStyle
+{
+	// Shared with the component, a rebuild swaps in a new ramp so a running pipeline keeps its own
+	TSharedPtr<const FLidarColorRamp> ColorRamp;
+	float DefaultLifetime = 99999.f;
+};
+
+/** Parameters of one NormalScan or PerformFullScan call, directions are generated on the workers */
+struct FLidarScanJob
+{
+	enum class EKind : uint8
+	{
+		Normal,
+		Full
+	};
+
+	EKind Kind = EKind::Normal;
+	FVector Start = FVector::ZeroVector;
+	FRotator CameraRotation = FRotator::ZeroRotator;
+	int32 RayCount = 0;
+	int32 Seed = 0;
+	// How far the rays reach, RunScanJob fills in the scanner's RaycastLength when zero
+	float RaycastLength = 0.f;
+
+	// Normal scan
+	float ScanRadius = 1.f;
+	TSharedPtr<const FLidarScanPatternTable> PatternTable;
+
+	// Full scan, rays [FirstRay, FirstRay + RayCount) of a row of FanRayCount rays.
+	// Normal scans use FirstRay too, as the offset of a continuous fire batch into its pass over the pattern table
+	float VerticalAngle = 0.f;
+	float HorizontalAngle = 0.f;
+	int32 FirstRay = 0;
+	int32 FanRayCount = 0;
+
+	int32 GetFanRayCount() const { return FanRayCount > 0 ? FanRayCount : RayCount; }
+};
+
+struct FLidarDebugTrace
+{
+	FVector Start;
+	FVector End;
+	bool bHit;
+};
+
+/** Points produced by one scan (or one pipeline run), ready to upload */
+struct FLidarScanResultBuffer
+{
+	TArray<FVector> Positions;
+	TArray<FLinearColor> Colors;
+	TArray<float> Lifetimes;
+	// Pipeline results only, the component each point hit. Copied as a weak pointer, never dereferenced on a worker
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> HitComponents;
+	TArray<FLidarDebugTrace> DebugTraces;
+
+	void Add(const FVector& Position, const FLinearColor& Color, float Lifetime)
+	{
+		Positions.Add(Position);
+		Colors.Add(Color);
+		Lifetimes.Add(Lifetime);
+	}
+
+	void Reset()
+	{
+		Positions.Reset();
+		Colors.Reset();
+		Lifetimes.Reset();
+		HitComponents.Reset();
+		DebugTraces.Reset();
+	}
+
+	int32 Num() const { return Positions.Num(); }
+};
+
+/**
+ * Runs scans on worker threads in four stages (directions, traces, tag/color resolve, packing)
+ * and writes into a back buffer. The game thread only launches runs and swaps finished buffers.
+ */
+class LIDARSCANNER_API FLidarScanPipeline
+{
+public:
+	struct FSettings
+	{
+		TWeakObjectPtr<UWorld> World;
+		FCollisionQueryParams QueryParams;
+		int32 RaysPerTask = 64;
+		bool bRecordDebugTraces = false;
+		FLidarPointStyle Style;
+	};
+
+	FLidarScanPipeline() = default;
+	~FLidarScanPipeline();
+
+	FLidarScanPipeline(const FLidarScanPipeline&) = delete;
+	FLidarScanPipeline& operator=(const FLidarScanPipeline&) = delete;
+
+	bool IsBusy() const;
+
+	/** Starts a run over every job, the pipeline must not be busy */
+	void Launch(TArray<FLidarScanJob>&& InJobs, FSettings&& InSettings);
+
+	/** If a run finished since the last call, swaps its back buffer into Front, publishes its stats and returns true */
+	bool TrySwap(FLidarScanResultBuffer& Front);
+
+	/** Blocks until the current run is done */
+	void Wait();
+
+	/** Stats of the last run swapped in, game thread only */
+	const FLidarPipelineStats& GetStats() const { return Stats; }
+
+private:
+	void Run();
+	void GenerateDirections();
+	void TraceRays();
+	void ResolvePoints();
+	void PackPoints();
+
+	UE::Tasks::FTask Task;
+	bool bResultPending = false;
+
+	TArray<FLidarScanJob> Jobs;
+	FSettings Settings;
+
+	// Per ray stage outputs, kept between runs so their allocations are reused
+	TArray<int32> RayJobIndices;
+	TArray<FVector> RayStarts;
+	TArray<FVector> RayDirections;
+	TArray<FHitResult> RayHits;
+	TArray<bool> RayHitFlags;
+	TArray<float> RayRampInputs;
+	TArray<FLinearColor> RayColors;
+	TArray<float> RayLifetimes;
+
+	FLidarScanResultBuffer BackBuffer;
+	// Written by the run, copied to Stats by TrySwap once the run is done
+	FLidarPipelineStats RunStats;
+	FLidarPipelineStats Stats;
+};
@@ -0,0 +1,165 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarScanSession.h"
+#include "LidarScanPipeline.h"
+#include "LidarComponent.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Engine/World.h"
+
+FLidarScanRecord FLidarScanRecord::FromJob(const FLidarScanJob& Job, float InTime)
+{
+	FLidarScanRecord Record;
+	Record.Time = InTime;
+	Record.Kind = static_cast<uint8>(Job.Kind);
+	Record.Pattern = Job.PatternTable.IsValid() ? Job.PatternTable->Pattern : ELidarScanPattern::UniformDisk;
+	Record.Start = Job.Start;
+	Record.Rotation = Job.CameraRotation;
+	Record.Seed = Job.Seed;
+	Record.RayCount = Job.RayCount;
+	Record.PatternRayCount = Job.PatternTable.IsValid() ? Job.PatternTable->RaysPerScan : 0;
+	Record.ScanRadius = Job.ScanRadius;
+	Record.VerticalAngle = Job.VerticalAngle;
+	Record.HorizontalAngle = Job.HorizontalAngle;
+	Record.FirstRay = Job.FirstRay;
+	Record.FanRayCount = Job.FanRayCount;
+	Record.RaycastLength = Job.RaycastLength;
+	return Record;
+}
+
+FLidarScanJob FLidarScanRecord::ToJob() const
+{
+	FLidarScanJob Job;
+	Job.Kind = static_cast<FLidarScanJob::EKind>(Kind);
+	Job.Start = Start;
+	Job.CameraRotation = Rotation;
+	Job.Seed = Seed;
+	Job.RayCount = RayCount;
+	Job.ScanRadius = ScanRadius;
+	Job.VerticalAngle = VerticalAngle;
+	Job.HorizontalAngle = HorizontalAngle;
+	Job.FirstRay = FirstRay;
+	Job.FanRayCount = FanRayCount;
+	Job.RaycastLength = RaycastLength;
+	return Job;
+}
+
+FArchive& operator<<(FArchive& Ar, FLidarScanRecord& Record)
+{
+	Ar << Record.Time;
+	Ar << Record.Kind;
+	Ar << Record.Pattern;
+	Ar << Record.Start;
+	Ar << Record.Rotation;
+	Ar << Record.Seed;
+	Ar << Record.RayCount;
+	Ar << Record.PatternRayCount;
+	Ar << Record.ScanRadius;
+	Ar << Record.VerticalAngle;
+	Ar << Record.HorizontalAngle;
+	Ar << Record.FirstRay;
+	Ar << Record.FanRayCount;
+	Ar << Record.RaycastLength;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FLidarScanSession& Session)
+{
+	uint32 Magic = FLidarScanSession::FileMagic;
+	int32 Version = FLidarScanSession::FileVersion;
+	Ar << Magic;
+	Ar << Version;
+
+	if (Ar.IsLoading() && (Magic != FLidarScanSession::FileMagic || Version != FLidarScanSession::FileVersion))
+	{
+		Ar.SetError();
+		return Ar;
+	}
+
+	Ar << Session.MapName;
+	Ar << Session.Records;
+	return Ar;
+}
+
+FString FLidarScanSession::ResolvePath(const FString& Path)
+{
+	FString Result = FPaths::IsRelative(Path) ? FPaths::ProjectSavedDir() / TEXT("Lidar/Sessions") / Path : Path;
+	if (FPaths::GetExtension(Result).IsEmpty())
+	{
+		Result += TEXT(".lidarscan");
+	}
+	return Result;
+}
+
+bool FLidarScanSession::SaveToFile(const FString& Path) const
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	Writer << const_cast<FLidarScanSession&>(*this);
+
+	return FFileHelper::SaveArrayToFile(Bytes, *ResolvePath(Path));
+}
+
+bool FLidarScanSession::LoadFromFile(const FString& Path)
+{
+	TArray<uint8> Bytes;
+	if (FFileHelper::LoadFileToArray(Bytes, *ResolvePath(Path)) == false)
+		return false;
+
+	FMemoryReader Reader(Bytes);
+	Reader << *this;
+	return Reader.IsError() == false;
+}
+
+#pragma region Console
+
+namespace LidarScanSessionCommands
+{
+	using LidarScan::ForEachScanner;
+
+	static FAutoConsoleCommandWithWorldAndArgs StartRecordingCommand(
+		TEXT("Lidar.Record.Start"),
+		TEXT("Starts recording every scan of the lidar scanners in this world"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			ForEachScanner(World, [](ULidarComponent& Scanner) { Scanner.StartScanRecording(); });
+		}));
+
+	static FAutoConsoleCommandWithWorldAndArgs StopRecordingCommand(
+		TEXT("Lidar.Record.Stop"),
+		TEXT("Lidar.Record.Stop <File> - stops recording and saves the session, one file per scanner past the first"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			const FString File = Args.Num() > 0 ? Args[0] : TEXT("Session");
+			int32 Index = 0;
+			ForEachScanner(World, [&File, &Index](ULidarComponent& Scanner)
+			{
+				Scanner.StopScanRecording(Index == 0 ? File : FString::Printf(TEXT("%s_%d"), *File, Index));
+				++Index;
+			});
+		}));
+
+	static FAutoConsoleCommandWithWorldAndArgs ReplayCommand(
+		TEXT("Lidar.Replay"),
+		TEXT("Lidar.Replay <File> [fast] - replays a recorded session on the first lidar scanner, fast ignores the recorded timing"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			if (Args.Num() == 0)
+				return;
+
+			const bool bAsFastAsPossible = Args.Num() > 1 && Args[1] == TEXT("fast");
+			bool bStarted = false;
+			ForEachScanner(World, [&](ULidarComponent& Scanner)
+			{
+				if (bStarted == false)
+				{
+					bStarted = Scanner.StartScanReplay(Args[0], bAsFastAsPossible);
+				}
+			});
+		}));
+}
+
+#pragma endregion
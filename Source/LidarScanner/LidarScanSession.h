@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LidarScanPattern.h"
+
+struct FLidarScanJob;
+
+/** Everything needed to run one scan again: pose, seed and the scan parameters */
+struct LIDARSCANNER_API FLidarScanRecord
+{
+	// Seconds since the recording started
+	float Time = 0.f;
+	uint8 Kind = 0;
+	ELidarScanPattern Pattern = ELidarScanPattern::UniformDisk;
+	FVector Start = FVector::ZeroVector;
+	FRotator Rotation = FRotator::ZeroRotator;
+	int32 Seed = 0;
+	int32 RayCount = 0;
+	// Size of the pattern table the rays were drawn from, continuous fire batches differ from it
+	int32 PatternRayCount = 0;
+	float ScanRadius = 0.f;
+	float VerticalAngle = 0.f;
+	float HorizontalAngle = 0.f;
+	int32 FirstRay = 0;
+	int32 FanRayCount = 0;
+	// Zero traces as far as the scanner running it
+	float RaycastLength = 0.f;
+
+	static FLidarScanRecord FromJob(const FLidarScanJob& Job, float InTime);
+
+	/** The job this record describes, without a pattern table */
+	FLidarScanJob ToJob() const;
+
+	friend FArchive& operator<<(FArchive& Ar, FLidarScanRecord& Record);
+};
+
+/** A recorded sequence of scans, saved as a small binary file */
+struct LIDARSCANNER_API FLidarScanSession
+{
+	static constexpr uint32 FileMagic = 0x4E43534C; // "LSCN"
+	static constexpr int32 FileVersion = 4;
+
+	FString MapName;
+	TArray<FLidarScanRecord> Records;
+
+	/** Relative paths land in Saved/Lidar/Sessions, with the .lidarscan extension added if missing */
+	static FString ResolvePath(const FString& Path);
+
+	bool SaveToFile(const FString& Path) const;
+	bool LoadFromFile(const FString& Path);
+
+	friend FArchive& operator<<(FArchive& Ar, FLidarScanSession& Session);
+};
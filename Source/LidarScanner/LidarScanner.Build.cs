@@ -18,5 +18,11 @@ public class LidarScanner : ModuleRules
 			// Data interface dependencies
 			"Niagara", "NiagaraCore", "VectorVM", "RenderCore", "RHI"
 		});
+
+		// The multiplayer automation test starts its own PIE session
+		if (Target.bBuildEditor)
+		{
+			PrivateDependencyModuleNames.Add("UnrealEd");
+		}
 	}
 }
@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "LidarStats.h"
+#include "LidarComponent.h"
+#include "HAL/IConsoleManager.h"
+
+DEFINE_STAT(STAT_Lidar_Tick);
+DEFINE_STAT(STAT_Lidar_Directions);
+DEFINE_STAT(STAT_Lidar_Trace);
+DEFINE_STAT(STAT_Lidar_TagLookup);
+DEFINE_STAT(STAT_Lidar_Color);
+DEFINE_STAT(STAT_Lidar_AddPoints);
+DEFINE_STAT(STAT_Lidar_DebugDraw);
+DEFINE_STAT(STAT_Lidar_NiagaraUpload);
+DEFINE_STAT(STAT_Lidar_GpuUploadPack);
+DEFINE_STAT(STAT_Lidar_PipelineRun);
+DEFINE_STAT(STAT_Lidar_Pack);
+DEFINE_STAT(STAT_Lidar_ExportHandOff);
+DEFINE_STAT(STAT_Lidar_LayerInstall);
+DEFINE_STAT(STAT_Lidar_WorldStore);
+DEFINE_STAT(STAT_Lidar_PoolSubmit);
+DEFINE_STAT(STAT_Lidar_PointExpiry);
+DEFINE_STAT(STAT_Lidar_ChunkCompact);
+
+DEFINE_STAT(STAT_Lidar_RaysCast);
+DEFINE_STAT(STAT_Lidar_RaysDropped);
+DEFINE_STAT(STAT_Lidar_Hits);
+DEFINE_STAT(STAT_Lidar_PointsAdded);
+DEFINE_STAT(STAT_Lidar_PointsUploaded);
+DEFINE_STAT(STAT_Lidar_BytesUploaded);
+
+CSV_DEFINE_CATEGORY_MODULE(LIDARSCANNER_API, Lidar, true);
+
+void LidarStats::CountUpload(int32 Points, int64 Bytes)
+{
+	INC_DWORD_STAT_BY(STAT_Lidar_PointsUploaded, Points);
+	INC_DWORD_STAT_BY(STAT_Lidar_BytesUploaded, Bytes);
+	CSV_CUSTOM_STAT(Lidar, PointsUploaded, Points, ECsvCustomStatOp::Accumulate);
+	CSV_CUSTOM_STAT(Lidar, KBUploaded, static_cast<float>(Bytes / 1024.0), ECsvCustomStatOp::Accumulate);
+}
+
+void FLidarScanCounters::AddRays(int32 Num)
+{
+	RaysCast += Num;
+	INC_DWORD_STAT_BY(STAT_Lidar_RaysCast, Num);
+	CSV_CUSTOM_STAT(Lidar, RaysCast, Num, ECsvCustomStatOp::Accumulate);
+}
+
+void FLidarScanCounters::AddDroppedRays(int32 Num)
+{
+	RaysDropped += Num;
+	INC_DWORD_STAT_BY(STAT_Lidar_RaysDropped, Num);
+	CSV_CUSTOM_STAT(Lidar, RaysDropped, Num, ECsvCustomStatOp::Accumulate);
+}
+
+void FLidarScanCounters::AddHits(int32 Num)
+{
+	Hits += Num;
+	INC_DWORD_STAT_BY(STAT_Lidar_Hits, Num);
+	CSV_CUSTOM_STAT(Lidar, Hits, Num, ECsvCustomStatOp::Accumulate);
+}
+
+void FLidarScanCounters::AddPoints(int32 Num)
+{
+	PointsAdded += Num;
+	INC_DWORD_STAT_BY(STAT_Lidar_PointsAdded, Num);
+	CSV_CUSTOM_STAT(Lidar, PointsAdded, Num, ECsvCustomStatOp::Accumulate);
+}
+
+void FLidarScanCounters::AddUpload(int32 Points, int64 Bytes)
+{
+	PointsUploaded += Points;
+	BytesUploaded += Bytes;
+	LidarStats::CountUpload(Points, Bytes);
+}
+
+FString FLidarScanCounters::ToString() const
+{
+	const double HitRate = RaysCast > 0 ? 100.0 * Hits / RaysCast : 0.0;
+	return FString::Printf(TEXT("rays %lld (%lld dropped) | hits %lld (%.1f%%) | points added %lld | uploaded %lld points, %.2f MB"),
+		RaysCast, RaysDropped, Hits, HitRate, PointsAdded, PointsUploaded, BytesUploaded / (1024.0 * 1024.0));
+}
+
+#pragma region Console
+
+namespace LidarStatsCommands
+{
+	using LidarScan::ForEachScanner;
+
+	static FAutoConsoleCommandWithWorldAndArgs DumpCommand(
+		TEXT("Lidar.Stats.Dump"),
+		TEXT("Logs the totals of every lidar scanner in this world since BeginPlay or Lidar.Stats.Reset"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			FLidarScanCounters Total;
+			int32 ScannerCount = 0;
+			ForEachScanner(World, [&Total, &ScannerCount](ULidarComponent& Scanner)
+			{
+				const FLidarScanCounters Counters = Scanner.GetScanCounters();
+				UE_LOG(LogTemp, Log, TEXT("%s: %s | stored %d / %d points, %.2f MB, %llu dropped with the chunk table full"), *Scanner.GetReadableName(), *Counters.ToString(),
+					Scanner.GetPointCount(), Scanner.MaxPointCount, Scanner.GetPointCloud().GetAllocatedSize() / (1024.0 * 1024.0), Scanner.GetPointCloud().GetDroppedPoints());
+
+				if (Scanner.bEnablePointExpiry)
+				{
+					const FLidarPointExpiryStats Stats = Scanner.GetPointExpiryStats();
+					UE_LOG(LogTemp, Log, TEXT("%s expiry: %lld tracked, %lld waiting, %lld expired, %lld relocated, %d free slots"),
+						*Scanner.GetReadableName(), Stats.TrackedPoints, Stats.PendingPoints, Stats.ExpiredPoints, Stats.RelocatedPoints, Stats.FreeSlots);
+				}
+
+				if (const FLidarWorldStore* Store = Scanner.GetWorldStore())
+				{
+					const FLidarWorldStoreStats Stats = Store->GetStats();
+					UE_LOG(LogTemp, Log, TEXT("%s world store: %d cells resident, %lld points, %.2f MB | %d cells paged, %lld points, %.2f MB on disk"),
+						*Scanner.GetReadableName(), Stats.ResidentCells, Stats.ResidentPoints, Stats.ResidentBytes / (1024.0 * 1024.0),
+						Stats.PagedCells, Stats.PagedPoints, Stats.CacheFileBytes / (1024.0 * 1024.0));
+				}
+
+				Total.RaysCast += Counters.RaysCast;
+				Total.RaysDropped += Counters.RaysDropped;
+				Total.Hits += Counters.Hits;
+				Total.PointsAdded += Counters.PointsAdded;
+				Total.PointsUploaded += Counters.PointsUploaded;
+				Total.BytesUploaded += Counters.BytesUploaded;
+				++ScannerCount;
+			});
+
+			UE_LOG(LogTemp, Log, TEXT("%d lidar scanners: %s"), ScannerCount, *Total.ToString());
+		}));
+
+	static FAutoConsoleCommandWithWorldAndArgs ResetCommand(
+		TEXT("Lidar.Stats.Reset"),
+		TEXT("Zeroes the totals of every lidar scanner in this world"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			ForEachScanner(World, [](ULidarComponent& Scanner) { Scanner.ResetScanCounters(); });
+		}));
+}
+
+#pragma endregion
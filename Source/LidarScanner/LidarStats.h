@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "LidarStats.generated.h"
+
+// "stat Lidar", cycle counters per scan stage plus per frame counters of the work done
+DECLARE_STATS_GROUP(TEXT("Lidar"), STATGROUP_Lidar, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Tick"), STAT_Lidar_Tick, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Directions"), STAT_Lidar_Directions, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Trace"), STAT_Lidar_Trace, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Tag Lookup"), STAT_Lidar_TagLookup, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Color"), STAT_Lidar_Color, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Add Points"), STAT_Lidar_AddPoints, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Debug Draw"), STAT_Lidar_DebugDraw, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Niagara Upload"), STAT_Lidar_NiagaraUpload, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("GPU Upload Pack"), STAT_Lidar_GpuUploadPack, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Pipeline Run"), STAT_Lidar_PipelineRun, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Pipeline Pack"), STAT_Lidar_Pack, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Export Hand Off"), STAT_Lidar_ExportHandOff, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Layer Install"), STAT_Lidar_LayerInstall, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("World Store"), STAT_Lidar_WorldStore, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Pool Submit"), STAT_Lidar_PoolSubmit, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Point Expiry"), STAT_Lidar_PointExpiry, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Chunk Compact"), STAT_Lidar_ChunkCompact, STATGROUP_Lidar, LIDARSCANNER_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Rays Cast"), STAT_Lidar_RaysCast, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Rays Dropped"), STAT_Lidar_RaysDropped, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Hits"), STAT_Lidar_Hits, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Points Added"), STAT_Lidar_PointsAdded, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Points Uploaded"), STAT_Lidar_PointsUploaded, STATGROUP_Lidar, LIDARSCANNER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Bytes Uploaded"), STAT_Lidar_BytesUploaded, STATGROUP_Lidar, LIDARSCANNER_API);
+
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(LIDARSCANNER_API, Lidar);
+
+/**
+ * One scan stage in every profiler at once: a stat cycle counter, a CSV timing stat and a named Insights scope.
+ * Name is the suffix of one of the STAT_Lidar_ cycle stats above.
+ */
+#define LIDAR_SCOPE(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_Lidar_##Name); \
+	CSV_SCOPED_TIMING_STAT(Lidar, Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(Lidar_##Name)
+
+namespace LidarStats
+{
+	/** Frame counters of an upload, safe from any thread */
+	LIDARSCANNER_API void CountUpload(int32 Points, int64 Bytes);
+}
+
+/** Running totals of one scanner since BeginPlay or the last reset */
+USTRUCT(BlueprintType)
+struct LIDARSCANNER_API FLidarScanCounters
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 RaysCast = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 RaysDropped = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 Hits = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointsAdded = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 PointsUploaded = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Stats")
+	int64 BytesUploaded = 0;
+
+	// These also feed the frame counters of STATGROUP_Lidar and the Lidar CSV category
+	void AddRays(int32 Num);
+	void AddDroppedRays(int32 Num);
+	void AddHits(int32 Num);
+	void AddPoints(int32 Num);
+	void AddUpload(int32 Points, int64 Bytes);
+
+	FString ToString() const;
+};
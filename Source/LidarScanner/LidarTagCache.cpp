@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarTagCache.h"
+#include "Components/PrimitiveComponent.h"
+#include "LidarScanPipeline.h"
+
+void FLidarTagCache::SetDictionary(const TMap<FName, FCustomParticleData>& InDictionary, uint32 InVersion)
+{
+	// Edits made straight on the map (Blueprint) don't bump the version, at least catch adds and removes
+	if (bHasDictionary && Version == InVersion && Dictionary.Num() == InDictionary.Num())
+		return;
+
+	FWriteScopeLock WriteLock(Lock);
+	Dictionary = InDictionary;
+	Version = InVersion;
+	bHasDictionary = true;
+	Entries.Reset();
+}
+
+bool FLidarTagCache::Resolve(const UPrimitiveComponent* Component, FCustomParticleData& OutData)
+{
+	if (Component == nullptr)
+		return false;
+
+	const TObjectKey<UPrimitiveComponent> Key(Component);
+	const int32 TagCount = Component->ComponentTags.Num();
+
+	{
+		FReadScopeLock ReadLock(Lock);
+		if (const FEntry* Entry = Entries.Find(Key); Entry && Entry->TagCount == TagCount)
+		{
+			OutData = Entry->Data;
+			return Entry->bHasData;
+		}
+	}
+
+	// Miss, walk the tags once and remember the answer
+	FEntry NewEntry;
+	NewEntry.TagCount = TagCount;
+	if (const FCustomParticleData* Found = LidarScan::FindCustomData(Dictionary, Component->ComponentTags))
+	{
+		NewEntry.Data = *Found;
+		NewEntry.bHasData = true;
+	}
+
+	{
+		FWriteScopeLock WriteLock(Lock);
+		if (Entries.Num() >= MaxEntries)
+		{
+			Entries.Reset();
+		}
+		Entries.Add(Key, NewEntry);
+	}
+
+	OutData = NewEntry.Data;
+	return NewEntry.bHasData;
+}
+
+void FLidarTagCache::Invalidate(const UPrimitiveComponent* Component)
+{
+	FWriteScopeLock WriteLock(Lock);
+	Entries.Remove(TObjectKey<UPrimitiveComponent>(Component));
+}
+
+void FLidarTagCache::Reset()
+{
+	FWriteScopeLock WriteLock(Lock);
+	Entries.Reset();
+}
+
+int32 FLidarTagCache::Num() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return Entries.Num();
+}
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectKey.h"
+#include "Public/CustomParticleData.h"
+
+class UPrimitiveComponent;
+
+/**
+ * Remembers which custom particle data each hit component resolved to (or that it has none),
+ * so repeated hits on the same mesh cost one pointer keyed lookup instead of a tag walk.
+ * Lookups and invalidation are safe from several worker threads, SetDictionary is not.
+ */
+class LIDARSCANNER_API FLidarTagCache
+{
+public:
+	// Past this many components the cache starts over, keeps destroyed components from piling up
+	static constexpr int32 MaxEntries = 4096;
+
+	/** Copies the dictionary if Version or its size changed since the last call, dropping every cached entry */
+	void SetDictionary(const TMap<FName, FCustomParticleData>& InDictionary, uint32 InVersion);
+
+	/** Custom data for the component's tags, false if none of them are in the dictionary */
+	bool Resolve(const UPrimitiveComponent* Component, FCustomParticleData& OutData);
+
+	/** Forgets one component, call it after changing its tags. Tag additions and removals are also caught on their own */
+	void Invalidate(const UPrimitiveComponent* Component);
+
+	void Reset();
+
+	int32 Num() const;
+
+private:
+	struct FEntry
+	{
+		FCustomParticleData Data;
+		// Tag count at resolve time, a cheap check against tags changing under us
+		int32 TagCount = 0;
+		bool bHasData = false;
+	};
+
+	TMap<FName, FCustomParticleData> Dictionary;
+	uint32 Version = 0;
+	bool bHasDictionary = false;
+
+	TMap<TObjectKey<UPrimitiveComponent>, FEntry> Entries;
+	mutable FRWLock Lock;
+};
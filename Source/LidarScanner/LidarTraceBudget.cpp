@@ -0,0 +1,84 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarTraceBudget.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarLidarTraceMaxAsyncRaysPerFrame(
+	TEXT("Lidar.Trace.MaxAsyncRaysPerFrame"),
+	1024,
+	TEXT("Async traces every lidar scanner of a world submits per frame together, the rest waits for the next frame"));
+
+void ULidarTraceBudgetSubsystem::BeginFrame()
+{
+	Frame = GFrameCounter;
+	Quotas.Reset();
+
+	const TArray<FDemand> LastDemands = MoveTemp(Demands);
+	Demands.Reset();
+
+	int32 Left = FMath::Max(CVarLidarTraceMaxAsyncRaysPerFrame.GetValueOnGameThread(), 1);
+	const int32 Count = LastDemands.Num();
+	if (Count > 0)
+	{
+		// Last frame's requesters in turn order, starting with the one whose turn it is
+		FirstTurn = (FirstTurn + 1) % Count;
+		TArray<int32, TInlineAllocator<16>> Open;
+		TArray<int32, TInlineAllocator<16>> Granted;
+		Granted.SetNumZeroed(Count);
+		for (int32 i = 0; i < Count; ++i)
+		{
+			Open.Add((FirstTurn + i) % Count);
+		}
+
+		// Even shares, whatever a scanner doesn't want is split again between the rest
+		while (Left > 0 && Open.Num() > 0)
+		{
+			const int32 Share = Left / Open.Num();
+			const int32 Extra = Left % Open.Num();
+			for (int32 i = 0; i < Open.Num(); ++i)
+			{
+				const int32 Index = Open[i];
+				const int32 Give = FMath::Min(Share + (i < Extra ? 1 : 0), LastDemands[Index].Wanted - Granted[Index]);
+				Granted[Index] += Give;
+				Left -= Give;
+			}
+			Open.RemoveAll([&](int32 Index) { return Granted[Index] >= LastDemands[Index].Wanted; });
+		}
+
+		for (int32 i = 0; i < Count; ++i)
+		{
+			if (Granted[i] > 0)
+			{
+				Quotas.FindOrAdd(LastDemands[i].Requester) += Granted[i];
+			}
+		}
+	}
+	Unassigned = Left;
+}
+
+int32 ULidarTraceBudgetSubsystem::RequestRays(const UObject* Requester, int32 Wanted)
+{
+	if (Frame != GFrameCounter)
+	{
+		BeginFrame();
+	}
+
+	if (Wanted <= 0)
+		return 0;
+
+	// Remembered for next frame's split, the quota this frame came from last frame's demand
+	const TObjectKey<UObject> Key(Requester);
+	Demands.Add({Key, Wanted});
+
+	int32 Granted = 0;
+	if (int32* Quota = Quotas.Find(Key))
+	{
+		Granted = FMath::Min(Wanted, *Quota);
+		*Quota -= Granted;
+	}
+
+	const int32 FromUnassigned = FMath::Min(Wanted - Granted, Unassigned);
+	Unassigned -= FromUnassigned;
+	return Granted + FromUnassigned;
+}
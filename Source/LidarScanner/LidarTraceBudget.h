@@ -0,0 +1,41 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/ObjectKey.h"
+#include "LidarTraceBudget.generated.h"
+
+/**
+ * One async trace budget per world, shared by every scanner tracing in AsyncBatched mode. Each frame the
+ * Lidar.Trace.MaxAsyncRaysPerFrame rays are split up front between the scanners that asked last frame, evenly and
+ * round-robin from a starting scanner that moves on every frame, so a tight budget doesn't starve the same ones.
+ * What a scanner doesn't need goes to the others, scanners new this frame share what nobody was given.
+ */
+UCLASS()
+class LIDARSCANNER_API ULidarTraceBudgetSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** How many of Wanted rays Requester may submit this frame */
+	int32 RequestRays(const UObject* Requester, int32 Wanted);
+
+private:
+	struct FDemand
+	{
+		TObjectKey<UObject> Requester;
+		int32 Wanted = 0;
+	};
+
+	void BeginFrame();
+
+	uint64 Frame = 0;
+	// Scanner whose turn it is to get the first of the rays an even split leaves over
+	int32 FirstTurn = 0;
+	TArray<FDemand> Demands;
+	TMap<TObjectKey<UObject>, int32> Quotas;
+	// Budget no scanner was given this frame
+	int32 Unassigned = 0;
+};
@@ -0,0 +1,63 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarVoxelHash.h"
+
+void FLidarVoxelHash::Reset(float InVoxelSize, int32 SlotCapacity)
+{
+	VoxelSize = FMath::Max(InVoxelSize, UE_KINDA_SMALL_NUMBER);
+	InvVoxelSize = 1.f / VoxelSize;
+
+	VoxelToSlot.Reset();
+	SlotVoxels.SetNumUninitialized(SlotCapacity);
+	SlotHasVoxel.Init(false, SlotCapacity);
+}
+
+FIntVector FLidarVoxelHash::GetVoxel(const FVector& Position) const
+{
+	return FIntVector(
+		FMath::FloorToInt32(Position.X * InvVoxelSize),
+		FMath::FloorToInt32(Position.Y * InvVoxelSize),
+		FMath::FloorToInt32(Position.Z * InvVoxelSize));
+}
+
+int32 FLidarVoxelHash::FindSlot(const FIntVector& Voxel) const
+{
+	const int32* Slot = VoxelToSlot.Find(Voxel);
+	return Slot ? *Slot : INDEX_NONE;
+}
+
+void FLidarVoxelHash::Assign(const FIntVector& Voxel, int32 Slot)
+{
+	if (SlotVoxels.IsValidIndex(Slot) == false)
+		return;
+
+	if (SlotHasVoxel[Slot])
+	{
+		// The ring overwrote this slot, the old point and its voxel are gone
+		VoxelToSlot.Remove(SlotVoxels[Slot]);
+	}
+
+	VoxelToSlot.Add(Voxel, Slot);
+	SlotVoxels[Slot] = Voxel;
+	SlotHasVoxel[Slot] = true;
+}
+
+void FLidarVoxelHash::Remove(int32 Slot)
+{
+	if (SlotVoxels.IsValidIndex(Slot) == false || SlotHasVoxel[Slot] == false)
+		return;
+
+	VoxelToSlot.Remove(SlotVoxels[Slot]);
+	SlotHasVoxel[Slot] = false;
+}
+
+void FLidarVoxelHash::Move(int32 From, int32 To)
+{
+	if (SlotVoxels.IsValidIndex(From) == false || SlotHasVoxel[From] == false)
+		return;
+
+	const FIntVector Voxel = SlotVoxels[From];
+	Remove(From);
+	Assign(Voxel, To);
+}
@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Sparse voxel grid over the point cloud slots. Each occupied voxel maps to the one slot holding its point,
+ * so repeated hits on the same surface update that point instead of adding new ones.
+ */
+class LIDARSCANNER_API FLidarVoxelHash
+{
+public:
+	/** Clears the grid, SlotCapacity must match the point cloud capacity */
+	void Reset(float InVoxelSize, int32 SlotCapacity);
+
+	FIntVector GetVoxel(const FVector& Position) const;
+
+	/** Slot of the point already stored in Voxel, INDEX_NONE if the voxel is empty */
+	int32 FindSlot(const FIntVector& Voxel) const;
+
+	/** Links Voxel to Slot. If the slot was recycled by the ring, the voxel it held before is dropped */
+	void Assign(const FIntVector& Voxel, int32 Slot);
+
+	/** Frees the voxel of the point in Slot, for points that were removed */
+	void Remove(int32 Slot);
+
+	/** Links the voxel of the point in From to To instead, for points that were moved */
+	void Move(int32 From, int32 To);
+
+	int32 Num() const { return VoxelToSlot.Num(); }
+	float GetVoxelSize() const { return VoxelSize; }
+
+private:
+	float VoxelSize = 5.f;
+	float InvVoxelSize = 0.2f;
+
+	TMap<FIntVector, int32> VoxelToSlot;
+	// Reverse lookup, the voxel each slot currently represents
+	TArray<FIntVector> SlotVoxels;
+	TBitArray<> SlotHasVoxel;
+};
@@ -0,0 +1,575 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarWorldStore.h"
+#include "LidarStats.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Algo/BinarySearch.h"
+#include "Misc/Compression.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace LidarWorldStore
+{
+	// Small deltas of either sign become small unsigned values, so their high bytes are mostly zero
+	FORCEINLINE uint16 ZigZag(int16 Value)
+	{
+		return static_cast<uint16>((static_cast<uint16>(Value) << 1) ^ static_cast<uint16>(Value >> 15));
+	}
+
+	FORCEINLINE int16 UnZigZag(uint16 Value)
+	{
+		return static_cast<int16>((Value >> 1) ^ static_cast<uint16>(0 - (Value & 1)));
+	}
+
+	// Planes: low and high bytes of the X, Y, Z and lifetime deltas, then the R, G, B, A deltas
+	constexpr int32 WordCount = 4;
+	constexpr int32 ColorPlane = WordCount * 2;
+	constexpr int32 PlaneCount = ColorPlane + 4;
+	static_assert(PlaneCount == sizeof(FLidarStoredPoint), "One byte per plane per point");
+
+	// Flush has no viewer to show cells to, whatever pages in is only merged back
+	void IgnorePagedIn(const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)
+	{
+	}
+}
+
+FLidarWorldStore::FLidarWorldStore(const FString& InCachePath)
+	: CachePath(InCachePath)
+	, Pipe(UE_SOURCE_LOCATION)
+{
+	if (LoadIndex())
+	{
+		UE_LOG(LogTemp, Log, TEXT("Lidar world store picked up %d cells from %s"), Cells.Num(), *CachePath);
+	}
+}
+
+FLidarWorldStore::~FLidarWorldStore()
+{
+	Wait();
+	CacheFile.Reset();
+}
+
+bool FLidarWorldStore::LoadIndex()
+{
+	TArray<uint8> Bytes;
+	if (FFileHelper::LoadFileToArray(Bytes, *GetIndexPath(), FILEREAD_Silent) == false)
+		return false;
+
+	FMemoryReader Reader(Bytes);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	int64 FileEnd = 0;
+	int32 CellCount = 0;
+	Reader << Magic << Version << FileEnd << CellCount;
+
+	// A file shorter than the index says was touched since, none of its offsets can be trusted
+	if (Reader.IsError() || Magic != IndexMagic || Version != IndexVersion || CellCount < 0 || IFileManager::Get().FileSize(*CachePath) < FileEnd)
+		return false;
+
+	TMap<FIntVector, FCell> LoadedCells;
+	LoadedCells.Reserve(CellCount);
+	for (int32 i = 0; i < CellCount && Reader.IsError() == false; ++i)
+	{
+		FIntVector Coord;
+		FCell Cell;
+		Reader << Coord.X << Coord.Y << Coord.Z << Cell.FileOffset << Cell.FileSize << Cell.PagedNum;
+		Cell.State = ECellState::PagedOut;
+		if (Cell.FileOffset < 0 || Cell.FileSize <= 0 || Cell.FileOffset + Cell.FileSize > FileEnd || Cell.PagedNum < 0)
+			return false;
+		LoadedCells.Add(Coord, MoveTemp(Cell));
+	}
+
+	TArray<FFileRegion> Free;
+	int32 FreeCount = 0;
+	Reader << FreeCount;
+	for (int32 i = 0; i < FreeCount && Reader.IsError() == false; ++i)
+	{
+		FFileRegion& Region = Free.AddDefaulted_GetRef();
+		Reader << Region.Offset << Region.Size;
+	}
+	if (Reader.IsError())
+		return false;
+
+	Cells = MoveTemp(LoadedCells);
+	FreeRegions = MoveTemp(Free);
+	CacheFileEnd = FileEnd;
+	CacheFileBytes.store(CacheFileEnd, std::memory_order_relaxed);
+	return true;
+}
+
+void FLidarWorldStore::Add(TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks)
+{
+	int32 LastChunkIndex = INDEX_NONE;
+	FCell* Cell = nullptr;
+
+	for (const FLidarPackedPoint& Point : Points)
+	{
+		if (Cell == nullptr || Point.ChunkIndex != LastChunkIndex)
+		{
+			// The chunk origin is the cell center, the packed offsets carry over unchanged
+			LastChunkIndex = Point.ChunkIndex;
+			Cell = &Cells.FindOrAdd(FLidarChunkTable::GetChunkCoord(Chunks.GetOrigin(Point.ChunkIndex)));
+		}
+
+		FLidarStoredPoint& Stored = Cell->Points.AddDefaulted_GetRef();
+		Stored.X = Point.X;
+		Stored.Y = Point.Y;
+		Stored.Z = Point.Z;
+		Stored.Lifetime = Point.Lifetime;
+		Stored.Color = Point.Color;
+	}
+}
+
+void FLidarWorldStore::Update(TConstArrayView<FVector> Viewers, float PageInDistance, float PageOutDistance, int32 MaxTransitions,
+	TFunctionRef<void(const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)> OnPagedIn)
+{
+	CompleteTransitions(OnPagedIn);
+
+	// Nobody to measure against, keep everything where it is
+	if (Viewers.Num() == 0)
+		return;
+
+	// The gap between the two distances keeps a cell from paging back and forth at the border
+	const double PageInSquared = FMath::Square(static_cast<double>(PageInDistance));
+	const double PageOutSquared = FMath::Square(static_cast<double>(FMath::Max(PageOutDistance, PageInDistance)));
+
+	int32 Started = 0;
+	for (TPair<FIntVector, FCell>& Pair : Cells)
+	{
+		if (Started >= MaxTransitions)
+			break;
+
+		FCell& Cell = Pair.Value;
+		if (Cell.State != ECellState::Resident && Cell.State != ECellState::PagedOut)
+			continue;
+
+		const FVector Center = FLidarChunkTable::GetChunkCenter(Pair.Key);
+		double NearestSquared = TNumericLimits<double>::Max();
+		for (const FVector& Viewer : Viewers)
+		{
+			NearestSquared = FMath::Min(NearestSquared, FVector::DistSquared(Center, Viewer));
+		}
+
+		if (Cell.State == ECellState::Resident && NearestSquared > PageOutSquared && Cell.Points.Num() > 0)
+		{
+			StartPageOut(Pair.Key, Cell);
+			++Started;
+		}
+		else if (Cell.State == ECellState::PagedOut && NearestSquared < PageInSquared)
+		{
+			StartPageIn(Pair.Key, Cell);
+			++Started;
+		}
+	}
+}
+
+void FLidarWorldStore::CompleteTransitions(TFunctionRef<void(const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)> OnPagedIn)
+{
+	for (auto It = Transitions.CreateIterator(); It; ++It)
+	{
+		if (It->Value.IsCompleted() == false)
+			continue;
+
+		FPageResult& Result = It->Value.GetResult();
+		FCell& Cell = Cells.FindChecked(It->Key);
+
+		if (Cell.State == ECellState::PagingOut)
+		{
+			if (Result.bSucceeded)
+			{
+				Cell.State = ECellState::PagedOut;
+				Cell.FileOffset = Result.FileOffset;
+				Cell.FileSize = Result.FileSize;
+				Cell.PagedNum = Result.Num;
+			}
+			else
+			{
+				// Stays in memory, with the points that arrived meanwhile behind the ones handed over. Its old copy
+				// was released when the page out started
+				Result.Points.Append(Cell.Points);
+				Cell.Points = MoveTemp(Result.Points);
+				Cell.State = ECellState::Resident;
+			}
+		}
+		else if (Cell.State == ECellState::PagingIn)
+		{
+			if (Result.bSucceeded)
+			{
+				OnPagedIn(It->Key, Result.Points);
+
+				// The cache copy stays valid until the cell gets new points, see StartPageOut
+				Result.Points.Append(Cell.Points);
+				Cell.Points = MoveTemp(Result.Points);
+			}
+			else
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Lidar world store lost %d points of cell %s, %s could not be read back"),
+					Cell.PagedNum, *It->Key.ToString(), *CachePath);
+				ReleaseCopy(Cell);
+			}
+			Cell.State = ECellState::Resident;
+		}
+
+		It.RemoveCurrent();
+	}
+}
+
+void FLidarWorldStore::StartPageOut(const FIntVector& Coord, FCell& Cell)
+{
+	// Nothing was added since the cell came back in, its copy in the cache file is still complete
+	if (Cell.FileOffset != INDEX_NONE && Cell.Points.Num() == Cell.PagedNum)
+	{
+		Cell.Points.Empty();
+		Cell.State = ECellState::PagedOut;
+		return;
+	}
+
+	// The cell has points its copy lacks, the new copy may reuse the old one's bytes
+	ReleaseCopy(Cell);
+
+	Cell.State = ECellState::PagingOut;
+	Transitions.Add(Coord, Pipe.Launch(UE_SOURCE_LOCATION, [this, Points = MoveTemp(Cell.Points)]() mutable
+	{
+		return PageOut(MoveTemp(Points));
+	}));
+}
+
+void FLidarWorldStore::ReleaseCopy(FCell& Cell)
+{
+	if (Cell.FileOffset != INDEX_NONE)
+	{
+		// Queued behind every read of it already on the pipe
+		Pipe.Launch(UE_SOURCE_LOCATION, [this, Region = FFileRegion{Cell.FileOffset, Cell.FileSize}]() { FreeRegion(Region); });
+	}
+	Cell.FileOffset = INDEX_NONE;
+	Cell.FileSize = 0;
+	Cell.PagedNum = 0;
+}
+
+void FLidarWorldStore::StartPageIn(const FIntVector& Coord, FCell& Cell)
+{
+	Cell.State = ECellState::PagingIn;
+	Transitions.Add(Coord, Pipe.Launch(UE_SOURCE_LOCATION, [this, FileOffset = Cell.FileOffset, FileSize = Cell.FileSize, Num = Cell.PagedNum]()
+	{
+		return PageIn(FileOffset, FileSize, Num);
+	}));
+}
+
+FLidarWorldStore::FPageResult FLidarWorldStore::PageOut(TArray<FLidarStoredPoint>&& Points)
+{
+	FPageResult Result;
+
+	TArray<uint8> Raw;
+	Encode(Points, Raw);
+
+	TArray<uint8> Compressed;
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, Raw.Num());
+	Compressed.SetNumUninitialized(CompressedSize);
+
+	if (FCompression::CompressMemory(NAME_Oodle, Compressed.GetData(), CompressedSize, Raw.GetData(), Raw.Num()) == false
+		|| OpenCacheFile() == false)
+	{
+		Result.Points = MoveTemp(Points);
+		return Result;
+	}
+
+	const int64 FileOffset = AllocateRegion(CompressedSize);
+	if (CacheFile->Seek(FileOffset) == false || CacheFile->Write(Compressed.GetData(), CompressedSize) == false)
+	{
+		FreeRegion({FileOffset, CompressedSize});
+		Result.Points = MoveTemp(Points);
+		return Result;
+	}
+
+	Result.bSucceeded = true;
+	Result.FileOffset = FileOffset;
+	Result.FileSize = CompressedSize;
+	Result.Num = Points.Num();
+
+	CacheFileBytes.store(CacheFileEnd, std::memory_order_relaxed);
+	return Result;
+}
+
+int64 FLidarWorldStore::AllocateRegion(int64 Size)
+{
+	// First fit among the superseded copies, the rest of a bigger hole stays free
+	for (int32 i = 0; i < FreeRegions.Num(); ++i)
+	{
+		FFileRegion& Region = FreeRegions[i];
+		if (Region.Size < Size)
+			continue;
+
+		const int64 Offset = Region.Offset;
+		Region.Offset += Size;
+		Region.Size -= Size;
+		if (Region.Size == 0)
+		{
+			FreeRegions.RemoveAt(i);
+		}
+		return Offset;
+	}
+
+	const int64 Offset = CacheFileEnd;
+	CacheFileEnd += Size;
+	return Offset;
+}
+
+void FLidarWorldStore::FreeRegion(const FFileRegion& Region)
+{
+	if (Region.Size <= 0)
+		return;
+
+	// Neighbouring holes merge, so copies freed one by one still fit a bigger cell later
+	int32 Index = Algo::LowerBoundBy(FreeRegions, Region.Offset, &FFileRegion::Offset);
+	FreeRegions.Insert(Region, Index);
+	if (FreeRegions.IsValidIndex(Index + 1) && FreeRegions[Index].Offset + FreeRegions[Index].Size == FreeRegions[Index + 1].Offset)
+	{
+		FreeRegions[Index].Size += FreeRegions[Index + 1].Size;
+		FreeRegions.RemoveAt(Index + 1);
+	}
+	if (Index > 0 && FreeRegions[Index - 1].Offset + FreeRegions[Index - 1].Size == FreeRegions[Index].Offset)
+	{
+		FreeRegions[Index - 1].Size += FreeRegions[Index].Size;
+		FreeRegions.RemoveAt(Index);
+	}
+
+	// A hole at the end just moves the end back, the next page out writes over it
+	if (FreeRegions.Last().Offset + FreeRegions.Last().Size == CacheFileEnd)
+	{
+		CacheFileEnd = FreeRegions.Pop().Offset;
+		CacheFileBytes.store(CacheFileEnd, std::memory_order_relaxed);
+	}
+}
+
+FLidarWorldStore::FPageResult FLidarWorldStore::PageIn(int64 FileOffset, int32 FileSize, int32 Num)
+{
+	FPageResult Result;
+
+	TArray<uint8> Compressed;
+	Compressed.SetNumUninitialized(FileSize);
+	if (OpenCacheFile() == false
+		|| CacheFile->Seek(FileOffset) == false
+		|| CacheFile->Read(Compressed.GetData(), FileSize) == false)
+	{
+		return Result;
+	}
+
+	TArray<uint8> Raw;
+	Raw.SetNumUninitialized(Num * sizeof(FLidarStoredPoint));
+	if (FCompression::UncompressMemory(NAME_Oodle, Raw.GetData(), Raw.Num(), Compressed.GetData(), FileSize) == false)
+		return Result;
+
+	Result.bSucceeded = Decode(Raw, Num, Result.Points);
+	return Result;
+}
+
+bool FLidarWorldStore::OpenCacheFile()
+{
+	if (CacheFile.IsValid())
+		return true;
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(CachePath));
+
+	// Copies from an earlier session are kept, a file nothing points into starts over. Either way the index goes
+	// stale as soon as this store writes, so it is gone until the next Flush
+	CacheFile.Reset(PlatformFile.OpenWrite(*CachePath, CacheFileEnd > 0, true));
+	PlatformFile.DeleteFile(*GetIndexPath());
+	return CacheFile.IsValid();
+}
+
+void FLidarWorldStore::Reset()
+{
+	Wait();
+	Transitions.Reset();
+	Cells.Reset();
+
+	Pipe.Launch(UE_SOURCE_LOCATION, [this]()
+	{
+		CacheFile.Reset();
+		IFileManager::Get().Delete(*CachePath, false, false, true);
+		IFileManager::Get().Delete(*GetIndexPath(), false, false, true);
+		CacheFileEnd = 0;
+		FreeRegions.Reset();
+		CacheFileBytes.store(0, std::memory_order_relaxed);
+	}).Wait();
+}
+
+void FLidarWorldStore::Flush()
+{
+	LIDAR_SCOPE(WorldStore);
+
+	Wait();
+	CompleteTransitions(LidarWorldStore::IgnorePagedIn);
+
+	// Points added to a paged out cell only live in memory, the cell comes in so they go out with the rest
+	for (TPair<FIntVector, FCell>& Pair : Cells)
+	{
+		if (Pair.Value.State == ECellState::PagedOut && Pair.Value.Points.Num() > 0)
+		{
+			StartPageIn(Pair.Key, Pair.Value);
+		}
+	}
+	Wait();
+	CompleteTransitions(LidarWorldStore::IgnorePagedIn);
+
+	for (TPair<FIntVector, FCell>& Pair : Cells)
+	{
+		if (Pair.Value.State == ECellState::Resident && Pair.Value.Points.Num() > 0)
+		{
+			StartPageOut(Pair.Key, Pair.Value);
+		}
+	}
+	Wait();
+	CompleteTransitions(LidarWorldStore::IgnorePagedIn);
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	uint32 Magic = IndexMagic;
+	int32 Version = IndexVersion;
+	int32 CellCount = 0;
+	int64 LostPoints = 0;
+	for (const TPair<FIntVector, FCell>& Pair : Cells)
+	{
+		CellCount += Pair.Value.State == ECellState::PagedOut ? 1 : 0;
+		LostPoints += Pair.Value.State == ECellState::PagedOut ? 0 : Pair.Value.Points.Num();
+	}
+
+	// File end and free list belong to the pipe, which is idle now but still the one to read them
+	Pipe.Launch(UE_SOURCE_LOCATION, [this, &Writer, &Magic, &Version, &CellCount]()
+	{
+		int64 FileEnd = CacheFileEnd;
+		Writer << Magic << Version << FileEnd << CellCount;
+		for (TPair<FIntVector, FCell>& Pair : Cells)
+		{
+			FCell& Cell = Pair.Value;
+			if (Cell.State == ECellState::PagedOut)
+			{
+				Writer << Pair.Key.X << Pair.Key.Y << Pair.Key.Z << Cell.FileOffset << Cell.FileSize << Cell.PagedNum;
+			}
+		}
+
+		int32 FreeCount = FreeRegions.Num();
+		Writer << FreeCount;
+		for (FFileRegion& Region : FreeRegions)
+		{
+			Writer << Region.Offset << Region.Size;
+		}
+
+		if (CacheFile.IsValid())
+		{
+			CacheFile->Flush(true);
+		}
+	}).Wait();
+
+	if (FFileHelper::SaveArrayToFile(Bytes, *GetIndexPath()) == false)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Lidar world store could not save its index, %s starts over next time"), *CachePath);
+	}
+	if (LostPoints > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Lidar world store could not page out %lld points, they are not in %s"), LostPoints, *CachePath);
+	}
+}
+
+void FLidarWorldStore::Wait()
+{
+	for (TPair<FIntVector, UE::Tasks::TTask<FPageResult>>& Pair : Transitions)
+	{
+		Pair.Value.Wait();
+	}
+}
+
+FLidarWorldStoreStats FLidarWorldStore::GetStats() const
+{
+	FLidarWorldStoreStats Stats;
+	for (const TPair<FIntVector, FCell>& Pair : Cells)
+	{
+		const FCell& Cell = Pair.Value;
+		const bool bResident = Cell.State == ECellState::Resident || Cell.State == ECellState::PagingIn;
+		Stats.ResidentCells += bResident ? 1 : 0;
+		Stats.PagedCells += bResident ? 0 : 1;
+		Stats.ResidentPoints += Cell.Points.Num();
+		Stats.PagedPoints += bResident ? 0 : Cell.PagedNum;
+		Stats.ResidentBytes += Cell.Points.GetAllocatedSize();
+	}
+	Stats.ResidentBytes += Cells.GetAllocatedSize();
+	Stats.CacheFileBytes = CacheFileBytes.load(std::memory_order_relaxed);
+	return Stats;
+}
+
+FVector FLidarWorldStore::GetPosition(const FIntVector& Cell, const FLidarStoredPoint& Point)
+{
+	return FLidarChunkTable::GetChunkCenter(Cell) + FVector(Point.X, Point.Y, Point.Z) * FLidarChunkTable::QuantizationStep;
+}
+
+void FLidarWorldStore::Encode(TConstArrayView<FLidarStoredPoint> Points, TArray<uint8>& OutBytes)
+{
+	using namespace LidarWorldStore;
+
+	const int32 Num = Points.Num();
+	OutBytes.SetNumUninitialized(Num * PlaneCount);
+	uint8* Planes = OutBytes.GetData();
+
+	uint16 PreviousWords[WordCount] = {};
+	uint8 PreviousColor[4] = {};
+	for (int32 i = 0; i < Num; ++i)
+	{
+		const FLidarStoredPoint& Point = Points[i];
+
+		const uint16 Words[WordCount] = {static_cast<uint16>(Point.X), static_cast<uint16>(Point.Y), static_cast<uint16>(Point.Z), Point.Lifetime.Encoded};
+		for (int32 Word = 0; Word < WordCount; ++Word)
+		{
+			const uint16 Delta = ZigZag(static_cast<int16>(Words[Word] - PreviousWords[Word]));
+			Planes[(Word * 2) * Num + i] = static_cast<uint8>(Delta & 0xFF);
+			Planes[(Word * 2 + 1) * Num + i] = static_cast<uint8>(Delta >> 8);
+			PreviousWords[Word] = Words[Word];
+		}
+
+		const uint8 Color[4] = {Point.Color.R, Point.Color.G, Point.Color.B, Point.Color.A};
+		for (int32 Channel = 0; Channel < 4; ++Channel)
+		{
+			Planes[(ColorPlane + Channel) * Num + i] = static_cast<uint8>(Color[Channel] - PreviousColor[Channel]);
+			PreviousColor[Channel] = Color[Channel];
+		}
+	}
+}
+
+bool FLidarWorldStore::Decode(TConstArrayView<uint8> Bytes, int32 Num, TArray<FLidarStoredPoint>& OutPoints)
+{
+	using namespace LidarWorldStore;
+
+	if (Num < 0 || Bytes.Num() != Num * PlaneCount)
+		return false;
+
+	OutPoints.SetNumUninitialized(Num);
+	const uint8* Planes = Bytes.GetData();
+
+	uint16 Words[WordCount] = {};
+	uint8 Color[4] = {};
+	for (int32 i = 0; i < Num; ++i)
+	{
+		for (int32 Word = 0; Word < WordCount; ++Word)
+		{
+			const uint16 Delta = static_cast<uint16>(Planes[(Word * 2) * Num + i] | (Planes[(Word * 2 + 1) * Num + i] << 8));
+			Words[Word] = static_cast<uint16>(Words[Word] + UnZigZag(Delta));
+		}
+
+		for (int32 Channel = 0; Channel < 4; ++Channel)
+		{
+			Color[Channel] = static_cast<uint8>(Color[Channel] + Planes[(ColorPlane + Channel) * Num + i]);
+		}
+
+		FLidarStoredPoint& Point = OutPoints[i];
+		Point.X = static_cast<int16>(Words[0]);
+		Point.Y = static_cast<int16>(Words[1]);
+		Point.Z = static_cast<int16>(Words[2]);
+		Point.Lifetime.Encoded = Words[3];
+		Point.Color = FColor(Color[0], Color[1], Color[2], Color[3]);
+	}
+	return true;
+}
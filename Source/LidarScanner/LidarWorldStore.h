@@ -0,0 +1,151 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tasks/Pipe.h"
+#include "LidarPackedPoint.h"
+#include <atomic>
+
+class IFileHandle;
+
+/** One point of the world store, quantized against the center of its cell exactly like FLidarPackedPoint */
+struct FLidarStoredPoint
+{
+	int16 X = 0;
+	int16 Y = 0;
+	int16 Z = 0;
+	FFloat16 Lifetime;
+	FColor Color = FColor::White;
+};
+static_assert(sizeof(FLidarStoredPoint) == 12, "FLidarStoredPoint is paged to disk as raw bytes");
+
+struct FLidarWorldStoreStats
+{
+	int32 ResidentCells = 0;
+	int32 PagedCells = 0;
+	int64 ResidentPoints = 0;
+	int64 PagedPoints = 0;
+	int64 ResidentBytes = 0;
+	int64 CacheFileBytes = 0;
+};
+
+/**
+ * Every point a scanner ever added, bucketed into the 32 m cells of FLidarChunkTable. Cells far from every viewer are
+ * delta encoded, compressed and appended to a cache file, then read back and decompressed when a viewer returns.
+ * Encoding, compression and all file access run in order on one background pipe, so resident memory follows the
+ * area around the viewers instead of the length of the session. The file outlives the store: Flush saves an index
+ * next to it and the next store opened on the same path starts with those cells paged out.
+ */
+class LIDARSCANNER_API FLidarWorldStore
+{
+public:
+	/** Picks up the cells a previous store flushed to InCachePath, without a valid index the file starts over */
+	explicit FLidarWorldStore(const FString& InCachePath);
+	/** Waits for queued work. The file stays on disk, but only a flushed one is picked up again */
+	~FLidarWorldStore();
+
+	FLidarWorldStore(const FLidarWorldStore&) = delete;
+	FLidarWorldStore& operator=(const FLidarWorldStore&) = delete;
+
+	/** Adds points packed against Chunks to their cells, cells that are paged out keep them until they come back */
+	void Add(TConstArrayView<FLidarPackedPoint> Points, const FLidarChunkTable& Chunks);
+
+	/**
+	 * Starts paging out resident cells farther than PageOutDistance from every viewer, and paging in cells within
+	 * PageInDistance of one, at most MaxTransitions cells per call. Cells whose points came back since the last call
+	 * are passed to OnPagedIn, with only the points that had been paged out.
+	 */
+	void Update(TConstArrayView<FVector> Viewers, float PageInDistance, float PageOutDistance, int32 MaxTransitions,
+		TFunctionRef<void(const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)> OnPagedIn);
+
+	/** Drops every cell and empties the cache file */
+	void Reset();
+
+	/** Blocks until every queued page in and page out is done */
+	void Wait();
+
+	/** Pages every cell holding points out and saves the index, blocking until both are on disk */
+	void Flush();
+
+	FLidarWorldStoreStats GetStats() const;
+	const FString& GetCachePath() const { return CachePath; }
+
+	static FVector GetPosition(const FIntVector& Cell, const FLidarStoredPoint& Point);
+
+	/** Byte planes of per point deltas, far better input for the compressor than the raw points */
+	static void Encode(TConstArrayView<FLidarStoredPoint> Points, TArray<uint8>& OutBytes);
+	static bool Decode(TConstArrayView<uint8> Bytes, int32 Num, TArray<FLidarStoredPoint>& OutPoints);
+
+private:
+	enum class ECellState : uint8
+	{
+		Resident,
+		PagingOut,
+		PagedOut,
+		PagingIn
+	};
+
+	struct FCell
+	{
+		ECellState State = ECellState::Resident;
+		// All points while resident, otherwise the ones added since the cell started paging out
+		TArray<FLidarStoredPoint> Points;
+		// The copy in the cache file
+		int64 FileOffset = INDEX_NONE;
+		int32 FileSize = 0;
+		int32 PagedNum = 0;
+	};
+
+	/** A run of bytes in the cache file */
+	struct FFileRegion
+	{
+		int64 Offset = 0;
+		int64 Size = 0;
+	};
+
+	/** What a page out or page in task hands back to the game thread */
+	struct FPageResult
+	{
+		bool bSucceeded = false;
+		int64 FileOffset = INDEX_NONE;
+		int32 FileSize = 0;
+		int32 Num = 0;
+		// Page in: the decoded points. Page out: the points handed over, returned if the write failed
+		TArray<FLidarStoredPoint> Points;
+	};
+
+	static constexpr uint32 IndexMagic = 0x58445357; // "WSDX"
+	static constexpr int32 IndexVersion = 1;
+
+	FString GetIndexPath() const { return CachePath + TEXT(".lidarindex"); }
+	bool LoadIndex();
+
+	void CompleteTransitions(TFunctionRef<void(const FIntVector& Cell, TConstArrayView<FLidarStoredPoint> Points)> OnPagedIn);
+	void StartPageOut(const FIntVector& Coord, FCell& Cell);
+	void StartPageIn(const FIntVector& Coord, FCell& Cell);
+	/** Hands the bytes of a copy nothing refers to anymore back to the pipe */
+	void ReleaseCopy(FCell& Cell);
+
+	// Run on the pipe
+	FPageResult PageOut(TArray<FLidarStoredPoint>&& Points);
+	FPageResult PageIn(int64 FileOffset, int32 FileSize, int32 Num);
+	bool OpenCacheFile();
+	int64 AllocateRegion(int64 Size);
+	void FreeRegion(const FFileRegion& Region);
+
+	FString CachePath;
+
+	TMap<FIntVector, FCell> Cells;
+	TMap<FIntVector, UE::Tasks::TTask<FPageResult>> Transitions;
+
+	UE::Tasks::FPipe Pipe;
+
+	// Only touched by tasks on the pipe, which never run at the same time
+	TUniquePtr<IFileHandle> CacheFile;
+	int64 CacheFileEnd = 0;
+	// Superseded copies below CacheFileEnd, sorted by offset and never touching each other
+	TArray<FFileRegion> FreeRegions;
+
+	std::atomic<int64> CacheFileBytes{0};
+};
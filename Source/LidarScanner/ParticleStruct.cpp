@@ -1,5 +0,0 @@
-﻿// Fill out your copyright notice in the Description page of Project Settings.
-
-
-#include "ParticleStruct.h"
-
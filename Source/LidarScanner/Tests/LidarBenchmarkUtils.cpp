@@ -0,0 +1,189 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LidarBenchmarkUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	/** Forwards everything to the real allocator, counting calls from one thread */
+	class FLidarCountingMalloc final : public FMalloc
+	{
+	public:
+		explicit FLidarCountingMalloc(FMalloc* InInner)
+			: Inner(InInner)
+		{
+		}
+
+		void Restart(uint32 InThreadId)
+		{
+			ThreadId = InThreadId;
+			Allocations.store(0, std::memory_order_relaxed);
+		}
+
+		virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+		{
+			CountAllocation();
+			return Inner->Malloc(Count, Alignment);
+		}
+
+		virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override
+		{
+			CountAllocation();
+			return Inner->TryMalloc(Count, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+		{
+			// A realloc that moves or grows the block costs like an allocation
+			if (Count > 0)
+			{
+				CountAllocation();
+			}
+			return Inner->Realloc(Original, Count, Alignment);
+		}
+
+		virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override
+		{
+			if (Count > 0)
+			{
+				CountAllocation();
+			}
+			return Inner->TryRealloc(Original, Count, Alignment);
+		}
+
+		virtual void Free(void* Original) override { Inner->Free(Original); }
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+		virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+		virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+		FMalloc* GetInner() const { return Inner; }
+		int64 GetAllocations() const { return Allocations.load(std::memory_order_relaxed); }
+
+	private:
+		void CountAllocation()
+		{
+			if (FPlatformTLS::GetCurrentThreadId() == ThreadId.load(std::memory_order_relaxed))
+			{
+				Allocations.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		FMalloc* Inner;
+		std::atomic<uint32> ThreadId{0};
+		std::atomic<int64> Allocations{0};
+	};
+
+	// Created once and never destroyed, other threads may still be inside it right after the counter is removed
+	FLidarCountingMalloc* CountingMalloc = nullptr;
+}
+
+FLidarScopedAllocationCounter::FLidarScopedAllocationCounter()
+{
+	check(IsInGameThread());
+
+	if (CountingMalloc == nullptr)
+	{
+		CountingMalloc = new FLidarCountingMalloc(GMalloc);
+	}
+	check(GMalloc == CountingMalloc->GetInner());
+
+	CountingMalloc->Restart(FPlatformTLS::GetCurrentThreadId());
+	GMalloc = CountingMalloc;
+}
+
+FLidarScopedAllocationCounter::~FLidarScopedAllocationCounter()
+{
+	GMalloc = CountingMalloc->GetInner();
+}
+
+int64 FLidarScopedAllocationCounter::GetAllocations() const
+{
+	return CountingMalloc->GetAllocations();
+}
+
+FString LidarBenchmark::ToJson(const FString& Suite, TConstArrayView<FLidarBenchmarkResult> Results)
+{
+	FString Json = FString::Printf(TEXT("{\n  \"suite\": \"%s\",\n  \"results\": [\n"), *Suite);
+	for (int32 i = 0; i < Results.Num(); ++i)
+	{
+		const FLidarBenchmarkResult& Result = Results[i];
+		Json += FString::Printf(
+			TEXT("    {\"name\": \"%s\", \"iterations\": %lld, \"points_per_op\": %d, \"ns_per_op\": %.1f, \"points_per_second\": %.0f, \"allocs_per_op\": %.2f}%s\n"),
+			*Result.Name, Result.Iterations, Result.PointsPerOp, Result.NsPerOp, Result.PointsPerSecond, Result.AllocsPerOp,
+			i + 1 < Results.Num() ? TEXT(",") : TEXT(""));
+	}
+	Json += TEXT("  ]\n}\n");
+	return Json;
+}
+
+FString LidarBenchmark::SaveReport(const FString& FileName, const FString& Contents)
+{
+	const FString Path = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / TEXT("Lidar/Benchmarks") / FileName);
+	return FFileHelper::SaveStringToFile(Contents, *Path) ? Path : FString();
+}
+
+TArray<FLidarBenchmarkCeiling> LidarBenchmark::LoadCeilings(const FString& FileName)
+{
+	TArray<FLidarBenchmarkCeiling> Ceilings;
+	TArray<FString> Lines;
+	if (FFileHelper::LoadFileToStringArray(Lines, *(FPaths::GameSourceDir() / TEXT("LidarScanner/Tests/Baselines") / FileName)) == false)
+		return Ceilings;
+
+	// First line is the header
+	for (int32 i = 1; i < Lines.Num(); ++i)
+	{
+		TArray<FString> Columns;
+		Lines[i].ParseIntoArray(Columns, TEXT(","), false);
+		if (Columns.Num() < 3)
+			continue;
+
+		FLidarBenchmarkCeiling& Ceiling = Ceilings.AddDefaulted_GetRef();
+		Ceiling.Name = Columns[0].TrimStartAndEnd();
+		Ceiling.MaxNsPerOp = FCString::Atod(*Columns[1]);
+		Ceiling.MaxAllocsPerOp = FCString::Atod(*Columns[2]);
+	}
+	return Ceilings;
+}
+
+void LidarBenchmark::CompareWithCeilings(FAutomationTestBase& Test, TConstArrayView<FLidarBenchmarkResult> Results, TConstArrayView<FLidarBenchmarkCeiling> Ceilings)
+{
+	for (const FLidarBenchmarkResult& Result : Results)
+	{
+		const FLidarBenchmarkCeiling* Ceiling = Ceilings.FindByPredicate([&Result](const FLidarBenchmarkCeiling& Candidate) { return Candidate.Name == Result.Name; });
+		if (Ceiling == nullptr)
+		{
+			Test.AddError(FString::Printf(TEXT("%s has no ceiling in the baseline"), *Result.Name));
+			continue;
+		}
+
+		if (Result.NsPerOp > Ceiling->MaxNsPerOp)
+		{
+			Test.AddError(FString::Printf(TEXT("Regression: %s takes %.1f ns/op, ceiling %.1f"), *Result.Name, Result.NsPerOp, Ceiling->MaxNsPerOp));
+		}
+		if (Result.AllocsPerOp > Ceiling->MaxAllocsPerOp)
+		{
+			Test.AddError(FString::Printf(TEXT("Regression: %s makes %.2f allocs/op, ceiling %.2f"), *Result.Name, Result.AllocsPerOp, Ceiling->MaxAllocsPerOp));
+		}
+	}
+
+	for (const FLidarBenchmarkCeiling& Ceiling : Ceilings)
+	{
+		if (Results.FindByPredicate([&Ceiling](const FLidarBenchmarkResult& Result) { return Result.Name == Ceiling.Name; }) == nullptr)
+		{
+			Test.AddError(FString::Printf(TEXT("Ceiling %s was not measured"), *Ceiling.Name));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+class FAutomationTestBase;
+
+/** One timed kernel */
+struct FLidarBenchmarkResult
+{
+	FString Name;
+	int64 Iterations = 0;
+	int32 PointsPerOp = 0;
+	double NsPerOp = 0.0;
+	double PointsPerSecond = 0.0;
+	double AllocsPerOp = 0.0;
+};
+
+/** Budget of one kernel, a row of a Tests/Baselines csv */
+struct FLidarBenchmarkCeiling
+{
+	FString Name;
+	double MaxNsPerOp = 0.0;
+	double MaxAllocsPerOp = 0.0;
+};
+
+/**
+ * Counts the allocations made on the calling thread while it is alive. It wraps GMalloc,
+ * so only use it from single threaded benchmark code.
+ */
+class FLidarScopedAllocationCounter
+{
+public:
+	FLidarScopedAllocationCounter();
+	~FLidarScopedAllocationCounter();
+
+	int64 GetAllocations() const;
+};
+
+namespace LidarBenchmark
+{
+	// Each kernel runs at least this long, and at least MinIterations times
+	constexpr double MinSeconds = 0.25;
+	constexpr int32 MinIterations = 16;
+	constexpr int32 AllocationSampleIterations = 16;
+
+	/** Times Op (which handles PointsPerOp points per call), then counts its allocations in a separate pass */
+	template <typename FunctionType>
+	FLidarBenchmarkResult Run(const TCHAR* Name, int32 PointsPerOp, FunctionType&& Op)
+	{
+		// Warm up caches and any lazily built state
+		for (int32 i = 0; i < 3; ++i)
+		{
+			Op();
+		}
+
+		FLidarBenchmarkResult Result;
+		Result.Name = Name;
+		Result.PointsPerOp = PointsPerOp;
+
+		const double Start = FPlatformTime::Seconds();
+		double Elapsed = 0.0;
+		while (Result.Iterations < MinIterations || Elapsed < MinSeconds)
+		{
+			Op();
+			++Result.Iterations;
+			Elapsed = FPlatformTime::Seconds() - Start;
+		}
+
+		Result.NsPerOp = Elapsed * 1e9 / Result.Iterations;
+		Result.PointsPerSecond = Result.Iterations * static_cast<double>(PointsPerOp) / Elapsed;
+
+		{
+			FLidarScopedAllocationCounter Counter;
+			for (int32 i = 0; i < AllocationSampleIterations; ++i)
+			{
+				Op();
+			}
+			Result.AllocsPerOp = static_cast<double>(Counter.GetAllocations()) / AllocationSampleIterations;
+		}
+
+		return Result;
+	}
+
+	/** Results as a JSON document: {"suite": ..., "results": [{name, iterations, ns_per_op, ...}]} */
+	FString ToJson(const FString& Suite, TConstArrayView<FLidarBenchmarkResult> Results);
+
+	/** Writes Contents to Saved/Lidar/Benchmarks/FileName and returns the full path, empty on failure */
+	FString SaveReport(const FString& FileName, const FString& Contents);
+
+	/** Rows of Tests/Baselines/FileName (name,max_ns_per_op,max_allocs_per_op), empty if it is missing */
+	TArray<FLidarBenchmarkCeiling> LoadCeilings(const FString& FileName);
+
+	/** Fails Test for every result over its ceiling, every result without one and every ceiling nothing was measured for */
+	void CompareWithCeilings(FAutomationTestBase& Test, TConstArrayView<FLidarBenchmarkResult> Results, TConstArrayView<FLidarBenchmarkCeiling> Ceilings);
+}
+
+#endif
@@ -0,0 +1,145 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Kismet/GameplayStatics.h"
+#include "LidarPointCloud.h"
+#include "LidarCloudSave.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarCloudSaveRoundTripTest, "LidarScanner.Save.RoundTrip",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarCloudSaveTest
+{
+	constexpr int32 PointCount = 5000000;
+	// Past the palette limit, saved with raw colors
+	constexpr int32 RawPointCount = 100000;
+	constexpr double LoadSecondsBudget = 1.0;
+
+	FLidarCloudSnapshot MakeSnapshot(const FLidarPointCloud& Cloud)
+	{
+		FLidarCloudSnapshot Snapshot;
+		Snapshot.Points = Cloud.GetPoints();
+		for (const FVector& Origin : Cloud.GetChunks().GetOrigins())
+		{
+			Snapshot.ChunkCoords.Add(FLidarChunkTable::GetChunkCoord(Origin));
+		}
+		return Snapshot;
+	}
+
+	/** Number of points whose chunk, offset, color or lifetime changed */
+	int32 CountMismatches(const FLidarCloudSnapshot& Expected, const FLidarCloudSnapshot& Actual)
+	{
+		int32 Mismatches = 0;
+		for (int32 i = 0; i < Expected.Points.Num(); ++i)
+		{
+			const FLidarPackedPoint& A = Expected.Points[i];
+			const FLidarPackedPoint& B = Actual.Points[i];
+			const bool bSame = A.ChunkIndex == B.ChunkIndex && A.X == B.X && A.Y == B.Y && A.Z == B.Z
+				&& A.Color == B.Color && A.Lifetime.Encoded == B.Lifetime.Encoded;
+			Mismatches += bSame ? 0 : 1;
+		}
+		return Mismatches;
+	}
+}
+
+bool FLidarCloudSaveRoundTripTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarCloudSaveTest;
+
+	// A dictionary entry and a 256 step ramp, like the colors a scanner produces
+	TArray<FCustomParticleData> Dictionary;
+	FCustomParticleData& Glass = Dictionary.AddDefaulted_GetRef();
+	Glass.Color = FLinearColor(0.1f, 0.6f, 0.9f);
+	Glass.Lifetime = 4.f;
+
+	FLidarPointCloud Cloud;
+	Cloud.SetCapacity(PointCount);
+	FRandomStream Stream(2024);
+	FVector Position(-20000.f, -20000.f, 0.f);
+	for (int32 i = 0; i < PointCount; ++i)
+	{
+		// A walk over many chunks, neighbouring points close together like scan rows
+		Position += FVector(Stream.FRandRange(-2.f, 12.f), Stream.FRandRange(-2.f, 12.f), Stream.FRandRange(-5.f, 5.f));
+		Position.X = Position.X > 20000.f ? -20000.f : Position.X;
+		Position.Y = Position.Y > 20000.f ? -20000.f : Position.Y;
+
+		if (Stream.FRand() < 0.1f)
+		{
+			Cloud.Append(Position, Glass.Color, Glass.Lifetime);
+		}
+		else
+		{
+			const uint8 Step = static_cast<uint8>(Stream.RandRange(0, 255));
+			Cloud.Append(Position, FColor(Step, 255 - Step, 64).ReinterpretAsLinear(), 99999.f);
+		}
+	}
+
+	const FLidarCloudSnapshot Expected = MakeSnapshot(Cloud);
+
+	const double EncodeStart = FPlatformTime::Seconds();
+	ULidarCloudSaveGame* Save = NewObject<ULidarCloudSaveGame>();
+	Save->PointCount = Expected.Points.Num();
+	if (TestTrue(TEXT("Cloud encodes"), LidarCloudArchive::Encode(Expected, Dictionary, Save->CloudData)) == false)
+		return false;
+
+	TArray<uint8> SlotBytes;
+	if (TestTrue(TEXT("Save game serializes"), UGameplayStatics::SaveGameToMemory(Save, SlotBytes)) == false)
+		return false;
+	const double EncodeSeconds = FPlatformTime::Seconds() - EncodeStart;
+
+	// What a load does once the slot is read: deserialize the save game, then decode the cloud
+	const double LoadStart = FPlatformTime::Seconds();
+	const ULidarCloudSaveGame* Loaded = Cast<ULidarCloudSaveGame>(UGameplayStatics::LoadGameFromMemory(SlotBytes));
+	FLidarCloudSnapshot Actual;
+	const bool bDecoded = Loaded != nullptr && LidarCloudArchive::Decode(Loaded->CloudData, Actual);
+	const double LoadSeconds = FPlatformTime::Seconds() - LoadStart;
+
+	if (TestTrue(TEXT("Save game loads and decodes"), bDecoded) == false)
+		return false;
+
+	TestEqual(TEXT("Point count"), Actual.Points.Num(), Expected.Points.Num());
+	TestEqual(TEXT("Chunks"), Actual.ChunkCoords, Expected.ChunkCoords);
+	if (Actual.Points.Num() == Expected.Points.Num())
+	{
+		TestEqual(TEXT("Points changed by the round trip"), CountMismatches(Expected, Actual), 0);
+	}
+
+	AddInfo(FString::Printf(TEXT("%d points: %.1f MB packed, %.1f MB saved (%.2f bytes per point), encode %.0f ms, load %.0f ms"),
+		PointCount, Expected.Points.Num() * sizeof(FLidarPackedPoint) / (1024.0 * 1024.0), SlotBytes.Num() / (1024.0 * 1024.0),
+		static_cast<double>(SlotBytes.Num()) / PointCount, EncodeSeconds * 1000.0, LoadSeconds * 1000.0));
+
+	// Timing depends on the machine, so only flag it
+	if (LoadSeconds > LoadSecondsBudget)
+	{
+		AddWarning(FString::Printf(TEXT("Loading %d points took %.2f s, budget is %.2f s"), PointCount, LoadSeconds, LoadSecondsBudget));
+	}
+
+	// Too many distinct colors for a palette
+	FLidarPointCloud RawCloud;
+	RawCloud.SetCapacity(RawPointCount);
+	for (int32 i = 0; i < RawPointCount; ++i)
+	{
+		RawCloud.Append(FVector(Stream.FRandRange(-5000.f, 5000.f), Stream.FRandRange(-5000.f, 5000.f), 0.f),
+			FColor(static_cast<uint32>(Stream.GetUnsignedInt()) | 0xFF000000).ReinterpretAsLinear(), Stream.FRandRange(1.f, 100.f));
+	}
+
+	const FLidarCloudSnapshot RawExpected = MakeSnapshot(RawCloud);
+	TArray<uint8> RawBytes;
+	FLidarCloudSnapshot RawActual;
+	if (TestTrue(TEXT("Raw color cloud round trips"), LidarCloudArchive::Encode(RawExpected, {}, RawBytes) && LidarCloudArchive::Decode(RawBytes, RawActual)))
+	{
+		TestEqual(TEXT("Raw color point count"), RawActual.Points.Num(), RawExpected.Points.Num());
+		if (RawActual.Points.Num() == RawExpected.Points.Num())
+		{
+			TestEqual(TEXT("Raw color points changed by the round trip"), CountMismatches(RawExpected, RawActual), 0);
+		}
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "LidarColorRamp.h"
+#include "LidarScanPipeline.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarColorRampTest, "LidarScanner.Color.RampMatchesLerp",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarColorRampTest
+{
+	constexpr float MaxDistance = 800.f;
+	// Beyond both ends of the range too, where both clamp
+	constexpr float SampleMin = -0.1f * MaxDistance;
+	constexpr float SampleMax = 1.1f * MaxDistance;
+	constexpr int32 SampleCount = 10000;
+	// Per channel. The table is linear between its 256 HSV baked entries, the HSV blend is close to linear over one entry
+	constexpr float ChannelTolerance = 0.002f;
+
+	struct FColorPair
+	{
+		FLinearColor Close;
+		FLinearColor Far;
+	};
+}
+
+bool FLidarColorRampTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarColorRampTest;
+
+	// The component's default pair, plus pairs where saturation and value change along the ramp as well
+	const FColorPair Pairs[] = {
+		{FLinearColor::Red, FLinearColor::Blue},
+		{FLinearColor(0.2f, 0.8f, 0.1f), FLinearColor(0.9f, 0.3f, 0.6f)},
+		{FLinearColor(0.05f, 0.05f, 0.3f), FLinearColor(1.f, 0.9f, 0.2f)},
+	};
+
+	TArray<float> Inputs;
+	Inputs.SetNumUninitialized(SampleCount);
+	for (int32 i = 0; i < SampleCount; ++i)
+	{
+		Inputs[i] = FMath::Lerp(SampleMin, SampleMax, static_cast<float>(i) / (SampleCount - 1));
+	}
+
+	for (const FColorPair& Pair : Pairs)
+	{
+		const FLidarColorStop Stops[] = {{0.f, Pair.Close}, {1.f, Pair.Far}};
+		FLidarColorRamp Ramp;
+		Ramp.Build(Stops, ELidarColorMode::Distance, 0.f, MaxDistance);
+
+		TArray<FLinearColor> Batch;
+		Batch.SetNumUninitialized(SampleCount);
+		Ramp.SampleBatch(Inputs, Batch);
+
+		float MaxError = 0.f;
+		float WorstDistance = 0.f;
+		for (int32 i = 0; i < SampleCount; ++i)
+		{
+			const FLinearColor Expected = LidarScan::LerpColors(Pair.Close, Pair.Far, MaxDistance, Inputs[i]);
+			for (const FLinearColor& Actual : {Ramp.Sample(Inputs[i]), Batch[i]})
+			{
+				const float Error = FMath::Max(
+					FMath::Max(FMath::Abs(Actual.R - Expected.R), FMath::Abs(Actual.G - Expected.G)),
+					FMath::Max(FMath::Abs(Actual.B - Expected.B), FMath::Abs(Actual.A - Expected.A)));
+				if (Error > MaxError)
+				{
+					MaxError = Error;
+					WorstDistance = Inputs[i];
+				}
+			}
+		}
+
+		TestTrue(FString::Printf(TEXT("%s to %s within %.4f per channel (worst %.5f at %.1f)"),
+			*Pair.Close.ToString(), *Pair.Far.ToString(), ChannelTolerance, MaxError, WorstDistance), MaxError <= ChannelTolerance);
+	}
+
+	// No distance range at all, both sides fall back to the close color instead of dividing by zero
+	{
+		const FLidarColorStop Stops[] = {{0.f, FLinearColor::Red}, {1.f, FLinearColor::Blue}};
+		FLidarColorRamp Ramp;
+		Ramp.Build(Stops, ELidarColorMode::Distance, 0.f, 0.f);
+
+		for (const float Distance : {0.f, 100.f, MaxDistance})
+		{
+			const FLinearColor Expected = LidarScan::LerpColors(FLinearColor::Red, FLinearColor::Blue, 0.f, Distance);
+			TestTrue(FString::Printf(TEXT("Zero range at %.0f is the close color"), Distance), Expected.Equals(FLinearColor::Red));
+			TestTrue(FString::Printf(TEXT("Zero range ramp at %.0f matches the lerp"), Distance), Ramp.Sample(Distance).Equals(Expected, ChannelTolerance));
+		}
+	}
+
+	AddInfo(FString::Printf(TEXT("%d distances from %.0f to %.0f compared per color pair"), SampleCount, SampleMin, SampleMax));
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "LidarPointCloud.h"
+#include "LidarGpuUpload.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarGpuUploadPlannerTest, "LidarScanner.GpuUpload.Planner",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarGpuUploadTest
+{
+	constexpr int32 RingCapacity = 1000;
+	constexpr int32 RingFill = 800;
+	// Runs past the end of the ring, so it lands in two spans
+	constexpr int32 RingWrapAppend = 400;
+
+	FString SpansToString(const FLidarGpuUploadPlan& Plan)
+	{
+		FString Out;
+		for (const FLidarPointSpan& Span : Plan.UploadSpans)
+		{
+			Out += FString::Printf(TEXT("[%d, %d) "), Span.First, Span.First + Span.Num);
+		}
+		return Out;
+	}
+
+	bool SpansEqual(const FLidarGpuUploadPlan& Plan, TConstArrayView<FLidarPointSpan> Expected)
+	{
+		if (Plan.UploadSpans.Num() != Expected.Num())
+			return false;
+
+		for (int32 i = 0; i < Expected.Num(); ++i)
+		{
+			if (Plan.UploadSpans[i].First != Expected[i].First || Plan.UploadSpans[i].Num != Expected[i].Num)
+				return false;
+		}
+		return true;
+	}
+
+	void MarkAppendedSince(const FLidarPointCloud& Cloud, uint64 Cursor, FLidarGpuUploadPlanner& Planner)
+	{
+		FLidarPointSpan Spans[2];
+		const int32 SpanCount = Cloud.GetSpansSince(Cursor, Spans);
+		for (int32 i = 0; i < SpanCount; ++i)
+		{
+			Planner.MarkDirty(Spans[i].First, Spans[i].Num);
+		}
+	}
+}
+
+bool FLidarGpuUploadPlannerTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarGpuUploadTest;
+
+	// Adjacent and overlapping ranges become one
+	{
+		FLidarGpuUploadPlanner Planner;
+		const FLidarGpuUploadPlan First = Planner.Plan(100, 0);
+		TestTrue(TEXT("The first plan allocates"), First.bReallocate);
+		TestTrue(TEXT("The first plan uploads everything"), SpansEqual(First, {{0, 100}}));
+
+		Planner.MarkDirty(100, 50);
+		Planner.MarkDirty(150, 50);
+		Planner.MarkDirty(120, 10);
+		const FLidarGpuUploadPlan Merged = Planner.Plan(200, 0);
+		TestFalse(TEXT("Growing within the capacity keeps the buffers"), Merged.bReallocate);
+		TestTrue(FString::Printf(TEXT("Touching ranges merge, got %s"), *SpansToString(Merged)), SpansEqual(Merged, {{100, 100}}));
+
+		const FLidarGpuUploadPlan Clean = Planner.Plan(200, 0);
+		TestEqual(TEXT("A plan clears the dirty ranges"), Clean.UploadSpans.Num(), 0);
+	}
+
+	// Buffers grow geometrically and only when the particles no longer fit
+	{
+		TestEqual(TEXT("Capacity starts at the minimum"), FLidarGpuUploadPlanner::ComputeGrownCapacity(0, 1), FLidarGpuUploadPlanner::MinCapacity);
+		TestEqual(TEXT("Capacity doubles until it fits"), FLidarGpuUploadPlanner::ComputeGrownCapacity(1024, 5000), 8192);
+
+		FLidarGpuUploadPlanner Planner;
+		Planner.Plan(5000, 0);
+		TestEqual(TEXT("Capacity after the first plan"), Planner.GetGpuCapacity(), 8192);
+
+		Planner.MarkDirty(5000, 3192);
+		const FLidarGpuUploadPlan Full = Planner.Plan(8192, 0);
+		TestFalse(TEXT("Exactly full still fits"), Full.bReallocate);
+		TestTrue(TEXT("Only the new particles are sent"), SpansEqual(Full, {{5000, 3192}}));
+
+		Planner.MarkDirty(8192, 1);
+		const FLidarGpuUploadPlan Grown = Planner.Plan(8193, 0);
+		TestTrue(TEXT("One past the capacity reallocates"), Grown.bReallocate);
+		TestEqual(TEXT("Grown capacity"), Grown.Capacity, 16384);
+		TestTrue(TEXT("A reallocation uploads everything"), SpansEqual(Grown, {{0, 8193}}));
+
+		Planner.MarkDirty(9000, 100);
+		const FLidarGpuUploadPlan Stale = Planner.Plan(8193, 0);
+		TestEqual(TEXT("Ranges past the particle count are dropped"), Stale.UploadSpans.Num(), 0);
+	}
+
+	// Appends running over the end of the ring upload as two spans, packed in slot order
+	{
+		FLidarPointCloud Cloud;
+		Cloud.SetCapacity(RingCapacity);
+		FLidarGpuUploadPlanner Planner;
+
+		for (int32 i = 0; i < RingFill; ++i)
+		{
+			Cloud.Append(FVector(i, 0.f, 0.f), FLinearColor::White, 1.f);
+		}
+		MarkAppendedSince(Cloud, 0, Planner);
+		Planner.Plan(Cloud.Num(), Cloud.GetChunks().Num());
+
+		const uint64 Cursor = Cloud.GetTotalAppended();
+		for (int32 i = 0; i < RingWrapAppend; ++i)
+		{
+			Cloud.Append(FVector(i, 100.f, 0.f), FLinearColor::Red, 1.f);
+		}
+		MarkAppendedSince(Cloud, Cursor, Planner);
+
+		const FLidarGpuUploadPlan Wrapped = Planner.Plan(Cloud.Num(), Cloud.GetChunks().Num());
+		const int32 Overflow = RingFill + RingWrapAppend - RingCapacity;
+		TestFalse(TEXT("The ring never outgrows its buffers"), Wrapped.bReallocate);
+		TestTrue(FString::Printf(TEXT("Wrapped appends are two spans, got %s"), *SpansToString(Wrapped)),
+			SpansEqual(Wrapped, {{0, Overflow}, {RingFill, RingCapacity - RingFill}}));
+
+		FLidarGpuUploadPacket Packet;
+		LidarGpuUpload::PackRange(Cloud, Wrapped, Packet);
+		TestEqual(TEXT("Packed point count"), Packet.Points.Num(), RingWrapAppend);
+
+		bool bPackedInOrder = Packet.Points.Num() == RingWrapAppend;
+		int32 PacketIndex = 0;
+		for (const FLidarPointSpan& Span : Wrapped.UploadSpans)
+		{
+			for (int32 Slot = Span.First; bPackedInOrder && Slot < Span.First + Span.Num; ++Slot)
+			{
+				bPackedInOrder = FMemory::Memcmp(&Packet.Points[PacketIndex++], &Cloud.GetPoint(Slot), sizeof(FLidarPackedPoint)) == 0;
+			}
+		}
+		TestTrue(TEXT("Packed points are the planned slots back to back"), bPackedInOrder);
+	}
+
+	// Past MaxDirtyRanges the two ranges with the smallest gap merge, not everything into one
+	{
+		FLidarGpuUploadPlanner Planner;
+		Planner.Plan(1000, 0);
+
+		// Gaps of 2, 30, 140, 5 and 180 slots
+		Planner.MarkDirty(0, 10);
+		Planner.MarkDirty(12, 8);
+		Planner.MarkDirty(50, 10);
+		Planner.MarkDirty(200, 10);
+		Planner.MarkDirty(215, 5);
+		Planner.MarkDirty(400, 10);
+
+		const FLidarGpuUploadPlan Capped = Planner.Plan(1000, 0);
+		TestEqual(TEXT("Capped at MaxDirtyRanges"), Capped.UploadSpans.Num(), FLidarGpuUploadPlanner::MaxDirtyRanges);
+		TestTrue(FString::Printf(TEXT("Closest pairs merged, got %s"), *SpansToString(Capped)),
+			SpansEqual(Capped, {{0, 20}, {50, 10}, {200, 20}, {400, 10}}));
+
+		Planner.SetMaxDirtyRanges(1);
+		Planner.MarkDirty(0, 10);
+		Planner.MarkDirty(500, 10);
+		const FLidarGpuUploadPlan Single = Planner.Plan(1000, 0);
+		TestTrue(FString::Printf(TEXT("One range covers everything, got %s"), *SpansToString(Single)), SpansEqual(Single, {{0, 510}}));
+	}
+
+	return true;
+}
+
+#endif
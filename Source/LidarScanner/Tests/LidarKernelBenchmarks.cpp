@@ -0,0 +1,300 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "LidarBenchmarkUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Components/StaticMeshComponent.h"
+#include "LidarComponent.h"
+#include "LidarColorRamp.h"
+#include "LidarDataInterface.h"
+#include "LidarPointCloud.h"
+#include "LidarScanPattern.h"
+#include "LidarScanPipeline.h"
+#include "LidarTagCache.h"
+#include "VectorVM.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarKernelBenchmark, "LidarScanner.Benchmark.Kernels",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+namespace LidarKernelBenchmark
+{
+	// Rays per scan the direction kernels are timed at, the upper end of what the scanner is expected to fire
+	constexpr int32 ScanRays = 10000;
+	// Points per call for the per point kernels
+	constexpr int32 BatchSize = 1024;
+	const TCHAR* CeilingsFile = TEXT("LidarKernels.csv");
+
+	/** Synthetic hits: positions spread over a few chunks, distances over the color range */
+	struct FSyntheticHits
+	{
+		TArray<FVector> Positions;
+		TArray<FLinearColor> Colors;
+		TArray<float> Lifetimes;
+		TArray<float> Distances;
+
+		explicit FSyntheticHits(int32 Num)
+		{
+			FRandomStream Stream(1234);
+			for (int32 i = 0; i < Num; ++i)
+			{
+				Positions.Add(Stream.GetUnitVector() * Stream.FRandRange(0.f, 8000.f));
+				Colors.Add(FLinearColor(Stream.FRand(), Stream.FRand(), Stream.FRand(), 1.f));
+				Lifetimes.Add(Stream.FRandRange(1.f, 100.f));
+				Distances.Add(Stream.FRandRange(0.f, 1000.f));
+			}
+		}
+	};
+
+	/**
+	 * Registers laid out the way the VM hands them to a data interface function: the user pointer,
+	 * the Index input, then one float register per output component.
+	 */
+	struct FVMCallHarness
+	{
+		void* InstanceData = nullptr;
+		int32 UserPtrIndex = 0;
+		TArray<int32> Indices;
+		TArray<TArray<float>> Outputs;
+		TArray<uint32*> Registers;
+		// Bit 0 set for registers that advance per instance, clear for constants
+		TArray<uint8> RegisterIncrements;
+
+		FVMCallHarness(void* InInstanceData, int32 NumInstances, int32 OutputCount)
+			: InstanceData(InInstanceData)
+		{
+			Indices.SetNumUninitialized(NumInstances);
+			for (int32 i = 0; i < NumInstances; ++i)
+			{
+				Indices[i] = i;
+			}
+
+			Registers.Add(reinterpret_cast<uint32*>(&UserPtrIndex));
+			RegisterIncrements.Add(0);
+			Registers.Add(reinterpret_cast<uint32*>(Indices.GetData()));
+			RegisterIncrements.Add(1);
+
+			Outputs.SetNum(OutputCount);
+			for (TArray<float>& Output : Outputs)
+			{
+				Output.SetNumZeroed(NumInstances);
+				Registers.Add(reinterpret_cast<uint32*>(Output.GetData()));
+				RegisterIncrements.Add(1);
+			}
+		}
+
+		/** Fresh context for one call, the handlers consume the registers in order */
+		FVectorVMExternalFunctionContext MakeContext()
+		{
+			FVectorVMExternalFunctionContext Context;
+			Context.RegisterData = Registers.GetData();
+			Context.RegInc = RegisterIncrements.GetData();
+			Context.RegReadCount = 0;
+			Context.NumRegisters = Registers.Num();
+			Context.StartInstance = 0;
+			Context.NumInstances = Indices.Num();
+			Context.NumLoops = FMath::DivideAndRoundUp(Indices.Num(), 4);
+			Context.PerInstanceFnInstanceIdx = 0;
+			Context.UserPtrTable = &InstanceData;
+			Context.NumUserPtrs = 1;
+			return Context;
+		}
+	};
+}
+
+bool FLidarKernelBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace LidarKernelBenchmark;
+
+	TArray<FLidarBenchmarkResult> Results;
+	const FSyntheticHits Hits(BatchSize);
+	const FRotator Rotation(10.f, 35.f, 0.f);
+
+	// Direction generation
+	{
+		TArray<FVector> Directions;
+		Directions.SetNumUninitialized(ScanRays);
+
+		for (ELidarScanPattern Pattern : {ELidarScanPattern::UniformDisk, ELidarScanPattern::GoldenAngle, ELidarScanPattern::StratifiedJitter})
+		{
+			const TSharedRef<const FLidarScanPatternTable> Table = FLidarScanPatternTable::Build(Pattern, ScanRays);
+			int32 Seed = 0;
+			const FString Name = FString::Printf(TEXT("Directions.%s"), *StaticEnum<ELidarScanPattern>()->GetNameStringByValue(static_cast<int64>(Pattern)));
+			Results.Add(LidarBenchmark::Run(*Name, ScanRays, [&]()
+			{
+				LidarScanPattern::TransformDisk(*Table, FLidarDiskTransform::Make(*Table, Rotation, 1.f, ++Seed), 0, ScanRays, Directions.GetData());
+			}));
+		}
+
+		int32 Seed = 0;
+		Results.Add(LidarBenchmark::Run(TEXT("Directions.Fan"), ScanRays, [&]()
+		{
+			const FLidarFanTransform Fan = FLidarFanTransform::Make(Rotation, 15.f, 90.f, ScanRays, ++Seed);
+			LidarScanPattern::TransformFan(Fan, 0, ScanRays, Directions.GetData());
+		}));
+
+		// The per ray helpers the scans used to call, kept as a reference point
+		ULidarComponent* Scanner = NewObject<ULidarComponent>();
+		Results.Add(LidarBenchmark::Run(TEXT("Directions.GetRandomPointInsideCircle"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				Directions[i] = FVector(Scanner->GetRandomPointInsideCircle(1.f), 0.f);
+			}
+		}));
+		Results.Add(LidarBenchmark::Run(TEXT("Directions.ScanDirection"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				Directions[i] = LidarScan::ScanDirection(15.f, i * 0.1f, Rotation);
+			}
+		}));
+	}
+
+	// Coloring
+	{
+		TArray<FLinearColor> Colors;
+		Colors.SetNumUninitialized(BatchSize);
+
+		Results.Add(LidarBenchmark::Run(TEXT("Color.LerpUsingHSV"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				Colors[i] = LidarScan::LerpColors(FLinearColor::Red, FLinearColor::Blue, 800.f, Hits.Distances[i]);
+			}
+		}));
+
+		FLidarColorRamp Ramp;
+		Ramp.Build({{0.f, FLinearColor::Red}, {1.f, FLinearColor::Blue}}, ELidarColorMode::Distance, 0.f, 800.f);
+		Results.Add(LidarBenchmark::Run(TEXT("Color.RampSampleBatch"), BatchSize, [&]()
+		{
+			Ramp.SampleBatch(Hits.Distances, Colors);
+		}));
+	}
+
+	// Tag resolution, hits spread over a handful of tagged and untagged meshes
+	{
+		TMap<FName, FCustomParticleData> Dictionary;
+		for (int32 i = 0; i < 16; ++i)
+		{
+			Dictionary.Add(*FString::Printf(TEXT("LidarTag%d"), i));
+		}
+
+		TArray<UPrimitiveComponent*> Components;
+		for (int32 i = 0; i < 8; ++i)
+		{
+			UStaticMeshComponent* Component = NewObject<UStaticMeshComponent>();
+			Component->ComponentTags = {TEXT("Untracked"), TEXT("Other"), *FString::Printf(TEXT("LidarTag%d"), i * 3)};
+			Components.Add(Component);
+		}
+
+		FCustomParticleData Data;
+		Results.Add(LidarBenchmark::Run(TEXT("Tags.FindCustomData"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				if (const FCustomParticleData* Found = LidarScan::FindCustomData(Dictionary, Components[i % Components.Num()]->ComponentTags))
+				{
+					Data = *Found;
+				}
+			}
+		}));
+
+		FLidarTagCache Cache;
+		Cache.SetDictionary(Dictionary, 1);
+		Results.Add(LidarBenchmark::Run(TEXT("Tags.CachedResolve"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				Cache.Resolve(Components[i % Components.Num()], Data);
+			}
+		}));
+	}
+
+	// Packing into the point cloud, what AddParticleData ends in
+	{
+		FLidarPointCloud Cloud;
+		Cloud.SetCapacity(BatchSize * 64);
+		Results.Add(LidarBenchmark::Run(TEXT("Cloud.Append"), BatchSize, [&]()
+		{
+			for (int32 i = 0; i < BatchSize; ++i)
+			{
+				Cloud.Append(Hits.Positions[i], Hits.Colors[i], Hits.Lifetimes[i]);
+			}
+		}));
+
+		// The scalar unpack the data interface VM functions replaced, kept as a reference point
+		float Sum = 0.f;
+		Results.Add(LidarBenchmark::Run(TEXT("Cloud.UnpackForVM"), BatchSize, [&]()
+		{
+			for (int32 Slot = 0; Slot < BatchSize; ++Slot)
+			{
+				const FLidarPackedPoint& Point = Cloud.GetPoint(Slot);
+				const FVector Position = LidarPacking::UnpackPosition(Point, Cloud.GetChunks());
+				const FLinearColor Color = LidarPacking::UnpackColor(Point);
+				Sum += Position.X + Color.R + LidarPacking::UnpackLifetime(Point);
+			}
+		}));
+		AddInfo(FString::Printf(TEXT("Unpack checksum %f"), Sum));
+
+		// The data interface's VM function bodies, called through the same context the VM builds
+		ULidarDataInterface* DataInterface = NewObject<ULidarDataInterface>();
+		void* InstanceData = ULidarDataInterface::CreateDetachedInstanceData(Cloud);
+
+		FVMCallHarness Positions(InstanceData, BatchSize, 3);
+		Results.Add(LidarBenchmark::Run(TEXT("VM.GetParticlePosition"), BatchSize, [&]()
+		{
+			FVectorVMExternalFunctionContext Context = Positions.MakeContext();
+			DataInterface->GetParticlePosition(Context);
+		}));
+
+		FVMCallHarness Colors(InstanceData, BatchSize, 4);
+		Results.Add(LidarBenchmark::Run(TEXT("VM.GetParticleColor"), BatchSize, [&]()
+		{
+			FVectorVMExternalFunctionContext Context = Colors.MakeContext();
+			DataInterface->GetParticleColor(Context);
+		}));
+
+		FVMCallHarness Lifetimes(InstanceData, BatchSize, 1);
+		Results.Add(LidarBenchmark::Run(TEXT("VM.GetParticleLifetime"), BatchSize, [&]()
+		{
+			FVectorVMExternalFunctionContext Context = Lifetimes.MakeContext();
+			DataInterface->GetParticleLifetime(Context);
+		}));
+
+		// A harness that feeds the functions the wrong registers would time garbage, check a few lanes against the scalar unpack
+		for (const int32 Slot : {0, 1, 5, BatchSize - 1})
+		{
+			const FLidarPackedPoint& Point = Cloud.GetPoint(Slot);
+			const FVector Expected = LidarPacking::UnpackPosition(Point, Cloud.GetChunks());
+			TestNearlyEqual(TEXT("VM position matches the scalar unpack"),
+				FVector(Positions.Outputs[0][Slot], Positions.Outputs[1][Slot], Positions.Outputs[2][Slot]), Expected, 0.1f);
+			TestNearlyEqual(TEXT("VM color matches the scalar unpack"), Colors.Outputs[0][Slot], LidarPacking::UnpackColor(Point).R, 1e-4f);
+			TestNearlyEqual(TEXT("VM lifetime matches the scalar unpack"), Lifetimes.Outputs[0][Slot], LidarPacking::UnpackLifetime(Point), 1e-3f);
+		}
+
+		ULidarDataInterface::DestroyDetachedInstanceData(InstanceData);
+	}
+
+	for (const FLidarBenchmarkResult& Result : Results)
+	{
+		AddInfo(FString::Printf(TEXT("%-40s %10.1f ns/op %14.0f points/s %6.2f allocs/op"), *Result.Name, Result.NsPerOp, Result.PointsPerSecond, Result.AllocsPerOp));
+	}
+
+	const FString ReportPath = LidarBenchmark::SaveReport(TEXT("Kernels.json"), LidarBenchmark::ToJson(TEXT("LidarScanner.Kernels"), Results));
+	TestFalse(TEXT("Benchmark report was written"), ReportPath.IsEmpty());
+	AddInfo(FString::Printf(TEXT("Report: %s"), *ReportPath));
+
+	const TArray<FLidarBenchmarkCeiling> Ceilings = LidarBenchmark::LoadCeilings(CeilingsFile);
+	if (Ceilings.Num() == 0)
+	{
+		AddError(FString::Printf(TEXT("No kernel ceilings in Tests/Baselines/%s, nothing to compare against"), CeilingsFile));
+		return true;
+	}
+	LidarBenchmark::CompareWithCeilings(*this, Results, Ceilings);
+
+	return true;
+}
+
+#endif
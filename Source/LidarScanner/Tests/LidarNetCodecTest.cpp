@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "UObject/CoreNet.h"
+#include "LidarPointCloud.h"
+#include "LidarNetReplication.h"
+#include "LidarScanPipeline.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarNetCodecTest, "LidarScanner.Net.Codec",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarNetCodecTest
+{
+	constexpr int32 PointCount = 200000;
+	constexpr int32 BatchBytes = 1024;
+	constexpr float QuantizationCm = 1.f;
+
+	/** Serializes Scan the way an RPC would and reads it back */
+	FLidarNetScan RoundTrip(const FLidarNetScan& Scan, int32& OutBytes)
+	{
+		FLidarNetScan Copy = Scan;
+		bool bSuccess = false;
+
+		FNetBitWriter Writer(nullptr, 0);
+		Copy.NetSerialize(Writer, nullptr, bSuccess);
+		OutBytes = static_cast<int32>(Writer.GetNumBytes());
+
+		FLidarNetScan Result;
+		FNetBitReader Reader(nullptr, Writer.GetData(), Writer.GetNumBits());
+		Result.NetSerialize(Reader, nullptr, bSuccess);
+		return Result;
+	}
+}
+
+bool FLidarNetCodecTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarNetCodecTest;
+
+	// Scan rows over a few chunks, neighbouring points close together, colors from a small ramp
+	FLidarPointCloud Cloud;
+	Cloud.SetCapacity(PointCount);
+	FRandomStream Stream(7);
+	FVector Position(-6000.f, -6000.f, 100.f);
+	for (int32 i = 0; i < PointCount; ++i)
+	{
+		Position += FVector(Stream.FRandRange(-1.f, 6.f), Stream.FRandRange(-1.f, 6.f), Stream.FRandRange(-3.f, 3.f));
+		Position.X = Position.X > 6000.f ? -6000.f : Position.X;
+		Position.Y = Position.Y > 6000.f ? -6000.f : Position.Y;
+
+		const uint8 Step = static_cast<uint8>((i / 64) % 16 * 16);
+		Cloud.Append(Position, FColor(Step, 255 - Step, 64).ReinterpretAsLinear(), i % 1000 == 0 ? 3.f : 30.f);
+	}
+
+	TArray<TArray<uint8>> Batches;
+	TConstArrayView<FLidarPackedPoint> Remaining = Cloud.GetPoints().Left(Cloud.Num());
+	while (Remaining.Num() > 0)
+	{
+		TArray<uint8>& Batch = Batches.AddDefaulted_GetRef();
+		const int32 Count = LidarNetCodec::EncodePoints(Remaining, Cloud.GetChunks(), QuantizationCm, BatchBytes, Batch);
+		if (TestTrue(TEXT("Every batch takes points"), Count > 0) == false)
+			return false;
+
+		TestTrue(TEXT("Batch fits its budget"), Batch.Num() <= BatchBytes);
+		Remaining = Remaining.RightChop(Count);
+	}
+
+	// Half a net step of rounding on top of the packed point's own quantization
+	const float Tolerance = QuantizationCm * 0.5f + FLidarChunkTable::QuantizationStep;
+	int64 Bytes = 0;
+	int32 Index = 0;
+	int32 Mismatches = 0;
+	for (const TArray<uint8>& Batch : Batches)
+	{
+		Bytes += Batch.Num();
+		const bool bValid = LidarNetCodec::DecodePoints(Batch, [&](const FVector& Decoded, const FColor& Color, float Lifetime)
+		{
+			if (Index < Cloud.Num())
+			{
+				const FLidarPackedPoint& Point = Cloud.GetPoint(Index);
+				const FVector Expected = LidarPacking::UnpackPosition(Point, Cloud.GetChunks());
+				const bool bSame = (Decoded - Expected).GetAbsMax() <= Tolerance && Color == Point.Color && Lifetime == LidarPacking::UnpackLifetime(Point);
+				Mismatches += bSame ? 0 : 1;
+			}
+			++Index;
+		});
+		TestTrue(TEXT("Batch decodes"), bValid);
+	}
+
+	TestEqual(TEXT("Decoded point count"), Index, Cloud.Num());
+	TestEqual(TEXT("Points off by more than the quantization"), Mismatches, 0);
+
+	TArray<uint8> Truncated = Batches[0];
+	Truncated.SetNum(Truncated.Num() / 2);
+	TestFalse(TEXT("Truncated batch is rejected"), LidarNetCodec::DecodePoints(Truncated, [](const FVector&, const FColor&, float) {}));
+
+	// Scans: the quantized pose survives the wire unchanged, so receivers trace the same rays
+	FLidarScanRecord Record;
+	Record.Kind = static_cast<uint8>(FLidarScanJob::EKind::Normal);
+	Record.Pattern = ELidarScanPattern::GoldenAngle;
+	Record.Start = FVector(12345.678, -9876.543, 210.987);
+	Record.Rotation = FRotator(-12.34, 271.5, 0.0);
+	Record.Seed = 123456789;
+	Record.RayCount = 37;
+	Record.PatternRayCount = 1500;
+	Record.FirstRay = 740;
+	Record.ScanRadius = 1.7f;
+	Record.RaycastLength = 4321.6f;
+	FLidarNetScan::Quantize(Record);
+	TestEqual(TEXT("RaycastLength is rounded to whole centimeters"), Record.RaycastLength, 4322.f);
+
+	FLidarNetScan Scan;
+	Scan.Record = Record;
+	int32 ScanBytes = 0;
+	const FLidarScanRecord Received = RoundTrip(Scan, ScanBytes).Record;
+	TestTrue(TEXT("Scan pose"), Received.Start == Record.Start && Received.Rotation == Record.Rotation);
+	TestTrue(TEXT("Scan parameters"), Received.Kind == Record.Kind && Received.Pattern == Record.Pattern && Received.Seed == Record.Seed
+		&& Received.RayCount == Record.RayCount && Received.PatternRayCount == Record.PatternRayCount && Received.FirstRay == Record.FirstRay
+		&& Received.ScanRadius == Record.ScanRadius && Received.RaycastLength == Record.RaycastLength);
+
+	FLidarScanRecord Row;
+	Row.Kind = static_cast<uint8>(FLidarScanJob::EKind::Full);
+	Row.Start = Record.Start;
+	Row.Rotation = Record.Rotation;
+	Row.Seed = 42;
+	Row.RayCount = 20;
+	Row.VerticalAngle = -7.5f;
+	Row.HorizontalAngle = 30.f;
+	Row.FirstRay = 20;
+	Row.FanRayCount = 40;
+	FLidarNetScan::Quantize(Row);
+
+	FLidarNetScan RowScan;
+	RowScan.Record = Row;
+	int32 RowBytes = 0;
+	const FLidarScanRecord ReceivedRow = RoundTrip(RowScan, RowBytes).Record;
+	TestTrue(TEXT("Full scan row"), ReceivedRow.Start == Row.Start && ReceivedRow.Rotation == Row.Rotation && ReceivedRow.VerticalAngle == Row.VerticalAngle
+		&& ReceivedRow.HorizontalAngle == Row.HorizontalAngle && ReceivedRow.FirstRay == Row.FirstRay && ReceivedRow.FanRayCount == Row.FanRayCount);
+
+	AddInfo(FString::Printf(TEXT("%d points in %d batches: %.1f KB, %.2f bytes per point (%d packed). Normal scan %d bytes, full scan row %d bytes"),
+		Cloud.Num(), Batches.Num(), Bytes / 1024.0, static_cast<double>(Bytes) / Cloud.Num(), static_cast<int32>(sizeof(FLidarPackedPoint)), ScanBytes, RowBytes));
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,353 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS && WITH_EDITOR
+
+#include "Misc/AutomationTest.h"
+#include "Tests/AutomationCommon.h"
+#include "Tests/AutomationEditorCommon.h"
+#include "Editor.h"
+#include "Settings/LevelEditorPlaySettings.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerController.h"
+#include "LidarComponent.h"
+#include "LidarScannerCharacter.h"
+
+/**
+ * Runs the first person map as a listen server with two clients in one editor process, hands every client a
+ * scanner through the scanner pickup and checks what reaches the server and the other client:
+ *  - a client's scan is traced on the server and relayed to the other client with the client's RaycastLength,
+ *  - the server holds a client's RaycastLength to its own copy's, however long the client asks for.
+ */
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarNetPIETest, "LidarScanner.Net.MultiClientPIE",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+namespace LidarNetPIETest
+{
+	const TCHAR* MapPath = TEXT("/Game/FirstPerson/Maps/FirstPersonMap");
+	const TCHAR* PickupClassPath = TEXT("/Game/FirstPerson/Blueprints/BP_PickUp_Scanner.BP_PickUp_Scanner_C");
+
+	constexpr int32 ClientCount = 2;
+	// Every step gives up after this long, a session that hangs fails instead of blocking the run
+	constexpr double StepTimeoutSeconds = 30.0;
+	// Frames to keep waiting once the first points showed up, so the rest of the scan arrives too
+	constexpr int32 SettleFrames = 30;
+	// The client looks at the floor, so short rays still hit
+	constexpr float LookDownPitch = -70.f;
+	constexpr float ClientRaycastLength = 400.f;
+	constexpr float ServerRaycastLength = 250.f;
+	constexpr float LongRaycastLength = 100000.f;
+	// Client and server copies of the same scanner sit at slightly different poses
+	constexpr float PoseTolerance = 50.f;
+
+	/** The listen server world and the client worlds of the running PIE session */
+	bool FindWorlds(UWorld*& OutServer, TArray<UWorld*>& OutClients)
+	{
+		OutServer = nullptr;
+		OutClients.Reset();
+		for (const FWorldContext& Context : GEngine->GetWorldContexts())
+		{
+			UWorld* World = Context.WorldType == EWorldType::PIE ? Context.World() : nullptr;
+			if (World == nullptr)
+				continue;
+
+			if (World->GetNetMode() == NM_ListenServer)
+			{
+				OutServer = World;
+			}
+			else if (World->GetNetMode() == NM_Client)
+			{
+				OutClients.Add(World);
+			}
+		}
+		return OutServer != nullptr && OutClients.Num() == ClientCount;
+	}
+
+	ALidarScannerCharacter* GetLocalCharacter(UWorld* World)
+	{
+		const APlayerController* Controller = World->GetFirstPlayerController();
+		return Controller ? Cast<ALidarScannerCharacter>(Controller->GetPawn()) : nullptr;
+	}
+
+	/** The character of this world nearest to Location, within PoseTolerance */
+	ALidarScannerCharacter* FindCharacterNear(UWorld* World, const FVector& Location)
+	{
+		ALidarScannerCharacter* Nearest = nullptr;
+		double NearestDistance = PoseTolerance;
+		for (TActorIterator<ALidarScannerCharacter> It(World); It; ++It)
+		{
+			const double Distance = FVector::Dist(It->GetActorLocation(), Location);
+			if (Distance <= NearestDistance)
+			{
+				NearestDistance = Distance;
+				Nearest = *It;
+			}
+		}
+		return Nearest;
+	}
+
+	/** The scanner Character holds in its world, the weapon actor is owned by the character */
+	ULidarComponent* FindHeldScanner(UWorld* World, const AActor* Character)
+	{
+		for (TActorIterator<AActor> It(World); It; ++It)
+		{
+			if (It->GetOwner() != Character)
+				continue;
+
+			if (ULidarComponent* Scanner = It->FindComponentByClass<ULidarComponent>())
+				return Scanner;
+		}
+		return nullptr;
+	}
+
+	AActor* FindPickupNear(UWorld* World, UClass* PickupClass, const FVector& Location)
+	{
+		for (TActorIterator<AActor> It(World, PickupClass); It; ++It)
+		{
+			if (FVector::Dist(It->GetActorLocation(), Location) <= PoseTolerance)
+				return *It;
+		}
+		return nullptr;
+	}
+
+	/** Largest distance of the points Scanner appended since Cursor from Origin */
+	double GetFarthestPointSince(const ULidarComponent& Scanner, uint64 Cursor, const FVector& Origin, int32& OutNum)
+	{
+		const FLidarPointCloud& Cloud = Scanner.GetPointCloud();
+		FLidarPointSpan Spans[2];
+		const int32 SpanCount = Cloud.GetSpansSince(Cursor, Spans);
+
+		double Farthest = 0.0;
+		OutNum = 0;
+		for (int32 i = 0; i < SpanCount; ++i)
+		{
+			for (int32 Slot = Spans[i].First; Slot < Spans[i].First + Spans[i].Num; ++Slot)
+			{
+				Farthest = FMath::Max(Farthest, FVector::Dist(Cloud.GetPosition(Slot), Origin));
+				++OutNum;
+			}
+		}
+		return Farthest;
+	}
+}
+
+/** Steps through the scenario one frame at a time, each step waits for what the previous one set in motion */
+class FLidarNetPIEScenario : public IAutomationLatentCommand
+{
+public:
+	explicit FLidarNetPIEScenario(FAutomationTestBase* InTest)
+		: Test(InTest)
+	{
+	}
+
+	virtual bool Update() override;
+
+private:
+	enum class EStep
+	{
+		WaitForPlayers,
+		WaitForPickups,
+		WaitForScanners,
+		ClientScan,
+		WaitForClientScan,
+		LongClientScan,
+		WaitForLongClientScan
+	};
+
+	/** The copies of client 0's scanner on every machine */
+	struct FScannerCopies
+	{
+		TWeakObjectPtr<ULidarComponent> Client;
+		TWeakObjectPtr<ULidarComponent> Server;
+		TWeakObjectPtr<ULidarComponent> OtherClient;
+	};
+
+	bool Fail(const FString& Message)
+	{
+		Test->AddError(Message);
+		return true;
+	}
+
+	void NextStep(EStep Next)
+	{
+		Step = Next;
+		StepStart = FPlatformTime::Seconds();
+		SettledFrames = 0;
+	}
+
+	/** Fires a scan from client 0 and remembers where every copy's cloud stood */
+	void FireClientScan(float ClientLength, float ServerLength);
+	/** True once the server and the other client have all of the scan, false while they may still be receiving */
+	bool ReceivedClientScan(float ExpectedLength, const TCHAR* What);
+
+	FAutomationTestBase* Test;
+	EStep Step = EStep::WaitForPlayers;
+	double StepStart = FPlatformTime::Seconds();
+	int32 SettledFrames = 0;
+
+	UWorld* ServerWorld = nullptr;
+	TArray<UWorld*> ClientWorlds;
+	UClass* PickupClass = nullptr;
+	FScannerCopies Copies;
+	uint64 ServerCursor = 0;
+	uint64 OtherClientCursor = 0;
+};
+
+void FLidarNetPIEScenario::FireClientScan(float ClientLength, float ServerLength)
+{
+	ULidarComponent* Client = Copies.Client.Get();
+	Client->RaycastLength = ClientLength;
+	Copies.Server->RaycastLength = ServerLength;
+	ServerCursor = Copies.Server->GetPointCloud().GetTotalAppended();
+	OtherClientCursor = Copies.OtherClient->GetPointCloud().GetTotalAppended();
+
+	if (APlayerController* Controller = ClientWorlds[0]->GetFirstPlayerController())
+	{
+		Controller->SetControlRotation(FRotator(LookDownPitch, Controller->GetControlRotation().Yaw, 0.f));
+	}
+	Client->NormalScan();
+}
+
+bool FLidarNetPIEScenario::ReceivedClientScan(float ExpectedLength, const TCHAR* What)
+{
+	using namespace LidarNetPIETest;
+
+	const ULidarComponent* Server = Copies.Server.Get();
+	const ULidarComponent* OtherClient = Copies.OtherClient.Get();
+	if (Server->GetPointCloud().GetTotalAppended() == ServerCursor || OtherClient->GetPointCloud().GetTotalAppended() == OtherClientCursor)
+		return false;
+
+	if (++SettledFrames < SettleFrames)
+		return false;
+
+	const float Allowed = ExpectedLength + Server->MuzzleOffset.Size() + PoseTolerance;
+	int32 ServerNum = 0;
+	int32 OtherClientNum = 0;
+	const double ServerFarthest = GetFarthestPointSince(*Server, ServerCursor, Server->GetOwner()->GetActorLocation(), ServerNum);
+	const double OtherClientFarthest = GetFarthestPointSince(*OtherClient, OtherClientCursor, OtherClient->GetOwner()->GetActorLocation(), OtherClientNum);
+
+	Test->AddInfo(FString::Printf(TEXT("%s: server traced %d points up to %.0f cm, the other client %d up to %.0f cm"),
+		What, ServerNum, ServerFarthest, OtherClientNum, OtherClientFarthest));
+	Test->TestTrue(FString::Printf(TEXT("%s: the server traces no further than %.0f cm"), What, Allowed), ServerFarthest <= Allowed);
+	Test->TestTrue(FString::Printf(TEXT("%s: the other client traces no further than %.0f cm"), What, Allowed), OtherClientFarthest <= Allowed);
+	return true;
+}
+
+bool FLidarNetPIEScenario::Update()
+{
+	using namespace LidarNetPIETest;
+
+	if (FPlatformTime::Seconds() - StepStart > StepTimeoutSeconds)
+		return Fail(FString::Printf(TEXT("Step %d timed out after %.0f s"), static_cast<int32>(Step), StepTimeoutSeconds));
+
+	switch (Step)
+	{
+	case EStep::WaitForPlayers:
+	{
+		if (FindWorlds(ServerWorld, ClientWorlds) == false)
+			return false;
+
+		for (UWorld* Client : ClientWorlds)
+		{
+			if (GetLocalCharacter(Client) == nullptr)
+				return false;
+		}
+
+		PickupClass = LoadClass<AActor>(nullptr, PickupClassPath);
+		if (PickupClass == nullptr)
+			return Fail(FString::Printf(TEXT("Could not load %s"), PickupClassPath));
+
+		// Dropped right on each client's character, the overlap hands it over on the server and the client alike
+		for (UWorld* Client : ClientWorlds)
+		{
+			const ALidarScannerCharacter* Character = FindCharacterNear(ServerWorld, GetLocalCharacter(Client)->GetActorLocation());
+			if (Character == nullptr)
+				return Fail(TEXT("A client's character has no counterpart on the server"));
+			ServerWorld->SpawnActor<AActor>(PickupClass, Character->GetActorTransform());
+		}
+		NextStep(EStep::WaitForPickups);
+		return false;
+	}
+
+	case EStep::WaitForPickups:
+	{
+		for (UWorld* Client : ClientWorlds)
+		{
+			if (FindPickupNear(Client, PickupClass, GetLocalCharacter(Client)->GetActorLocation()) == nullptr && FindHeldScanner(Client, GetLocalCharacter(Client)) == nullptr)
+				return false;
+		}
+		NextStep(EStep::WaitForScanners);
+		return false;
+	}
+
+	case EStep::WaitForScanners:
+	{
+		ALidarScannerCharacter* ClientCharacter = GetLocalCharacter(ClientWorlds[0]);
+		ULidarComponent* Client = FindHeldScanner(ClientWorlds[0], ClientCharacter);
+		ALidarScannerCharacter* ServerCharacter = FindCharacterNear(ServerWorld, ClientCharacter->GetActorLocation());
+		ALidarScannerCharacter* OtherClientCharacter = FindCharacterNear(ClientWorlds[1], ClientCharacter->GetActorLocation());
+		ULidarComponent* Server = ServerCharacter ? FindHeldScanner(ServerWorld, ServerCharacter) : nullptr;
+		ULidarComponent* OtherClient = OtherClientCharacter ? FindHeldScanner(ClientWorlds[1], OtherClientCharacter) : nullptr;
+		if (Client == nullptr || Client->IsLocallyControlled() == false || Server == nullptr || OtherClient == nullptr)
+			return false;
+
+		Copies = {Client, Server, OtherClient};
+		NextStep(EStep::ClientScan);
+		return false;
+	}
+
+	case EStep::ClientScan:
+		// The server's copy is longer, what it traces shows the length that came over the wire
+		FireClientScan(ClientRaycastLength, LongRaycastLength);
+		NextStep(EStep::WaitForClientScan);
+		return false;
+
+	case EStep::WaitForClientScan:
+		if (Copies.Client.IsValid() == false || Copies.Server.IsValid() == false || Copies.OtherClient.IsValid() == false)
+			return Fail(TEXT("A scanner went away during the scan"));
+		if (ReceivedClientScan(ClientRaycastLength, TEXT("Client RaycastLength")) == false)
+			return false;
+		NextStep(EStep::LongClientScan);
+		return false;
+
+	case EStep::LongClientScan:
+		// Now the client asks for far more than the server's copy allows
+		FireClientScan(LongRaycastLength, ServerRaycastLength);
+		NextStep(EStep::WaitForLongClientScan);
+		return false;
+
+	case EStep::WaitForLongClientScan:
+		if (Copies.Client.IsValid() == false || Copies.Server.IsValid() == false || Copies.OtherClient.IsValid() == false)
+			return Fail(TEXT("A scanner went away during the scan"));
+		return ReceivedClientScan(ServerRaycastLength, TEXT("Clamped RaycastLength"));
+	}
+
+	return true;
+}
+
+bool FLidarNetPIETest::RunTest(const FString& Parameters)
+{
+	using namespace LidarNetPIETest;
+
+	FAutomationEditorCommonUtils::LoadMap(MapPath);
+
+	// Listen server plus two clients, all in this process so the test can look into every world
+	ULevelEditorPlaySettings* PlaySettings = NewObject<ULevelEditorPlaySettings>();
+	PlaySettings->SetPlayNetMode(EPlayNetMode::PIE_ListenServer);
+	PlaySettings->SetPlayNumberOfClients(ClientCount + 1);
+	PlaySettings->SetRunUnderOneProcess(true);
+
+	FRequestPlaySessionParams Params;
+	Params.WorldType = EPlaySessionWorldType::PlayInEditor;
+	Params.EditorPlaySettings = PlaySettings;
+	GEditor->RequestPlaySession(Params);
+
+	ADD_LATENT_AUTOMATION_COMMAND(FLidarNetPIEScenario(this));
+	ADD_LATENT_AUTOMATION_COMMAND(FEndPlayMapCommand());
+	return true;
+}
+
+#endif
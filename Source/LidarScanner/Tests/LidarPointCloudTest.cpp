@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "LidarPointCloud.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarChunkCompactionTest, "LidarScanner.PointCloud.ChunkCompaction",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarPointCloudTest
+{
+	constexpr int32 RingCapacity = 1000;
+	// Every point in a chunk of its own, well past what the table holds at once
+	constexpr int32 AppendCount = FLidarChunkTable::MaxChunks + 5000;
+	constexpr float PositionTolerance = FLidarChunkTable::QuantizationStep;
+
+	FVector MakePosition(int32 i)
+	{
+		// A row of chunks along X, a few rows deep so coordinates stay within float precision
+		const int32 Row = i / 4096;
+		return FVector((i % 4096) * FLidarChunkTable::ChunkSize + 10.f, Row * FLidarChunkTable::ChunkSize + 20.f, 30.f);
+	}
+}
+
+bool FLidarChunkCompactionTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarPointCloudTest;
+
+	FLidarPointCloud Cloud;
+	Cloud.SetCapacity(RingCapacity);
+	const uint32 StartGeneration = Cloud.GetChunkGeneration();
+
+	for (int32 i = 0; i < AppendCount; ++i)
+	{
+		Cloud.Append(MakePosition(i), FLinearColor::White, 1.f);
+	}
+
+	TestEqual(TEXT("No point dropped once the ring overwrote the old chunks"), Cloud.GetDroppedPoints(), static_cast<uint64>(0));
+	TestEqual(TEXT("Ring is full"), Cloud.Num(), RingCapacity);
+	TestTrue(TEXT("The table was compacted"), Cloud.GetChunkGeneration() != StartGeneration);
+	TestTrue(FString::Printf(TEXT("Table holds far fewer than MaxChunks, got %d"), Cloud.GetChunks().Num()), Cloud.GetChunks().Num() < FLidarChunkTable::MaxChunks);
+
+	// The newest RingCapacity points survive with their positions intact
+	float MaxError = 0.f;
+	FLidarPointSpan Spans[2];
+	const int32 SpanCount = Cloud.GetAllSpans(Spans);
+	int32 Index = AppendCount - RingCapacity;
+	for (int32 i = 0; i < SpanCount; ++i)
+	{
+		for (int32 Slot = Spans[i].First; Slot < Spans[i].First + Spans[i].Num; ++Slot)
+		{
+			MaxError = FMath::Max(MaxError, static_cast<float>(FVector::Dist(Cloud.GetPosition(Slot), MakePosition(Index++))));
+		}
+	}
+	TestTrue(FString::Printf(TEXT("Positions survive compaction (worst error %.4f)"), MaxError), MaxError <= PositionTolerance);
+
+	// Nothing to reclaim while every chunk still holds a live point
+	FLidarPointCloud Packed;
+	Packed.SetCapacity(FLidarChunkTable::MaxChunks + 1);
+	for (int32 i = 0; i <= FLidarChunkTable::MaxChunks; ++i)
+	{
+		Packed.Append(MakePosition(i), FLinearColor::White, 1.f);
+	}
+	TestEqual(TEXT("A point past a table of live chunks is dropped and counted"), Packed.GetDroppedPoints(), static_cast<uint64>(1));
+
+	return true;
+}
+
+#endif
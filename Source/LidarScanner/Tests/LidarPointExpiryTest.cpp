@@ -0,0 +1,95 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "LidarPointCloud.h"
+#include "LidarPointExpiry.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarPointExpiryTest, "LidarScanner.Expiry.PulsesAndPermanent",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarPointExpiryTest
+{
+	constexpr int32 Capacity = 10000;
+	constexpr int32 PermanentPoints = 4000;
+	// Many times the capacity of short lived pulse points goes through the ring
+	constexpr int32 Frames = 300;
+	constexpr int32 PulsePointsPerFrame = 300;
+	constexpr double FrameSeconds = 0.1;
+	constexpr float PulseLifetime = 1.f;
+	constexpr float PermanentLifetime = LidarPacking::MaxLifetime;
+	constexpr float BucketSeconds = 0.5f;
+	constexpr int32 CompactionZone = 2000;
+	constexpr int32 MaxChangedSlots = 2000;
+
+	void AppendTracked(FLidarPointCloud& Cloud, FLidarPointExpiry& Expiry, const FVector& Position, float Lifetime, double Now)
+	{
+		const int32 Slot = Cloud.Append(Position, FLinearColor::White, Lifetime);
+		Expiry.Track(Slot, Lifetime, Now);
+	}
+}
+
+bool FLidarPointExpiryTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarPointExpiryTest;
+
+	FLidarPointCloud Cloud;
+	Cloud.SetCapacity(Capacity);
+	FLidarPointExpiry Expiry;
+	Expiry.Reset(Capacity, BucketSeconds, 600.f);
+
+	FRandomStream Stream(11);
+	for (int32 i = 0; i < PermanentPoints; ++i)
+	{
+		AppendTracked(Cloud, Expiry, FVector(Stream.FRandRange(-5000.f, 5000.f), Stream.FRandRange(-5000.f, 5000.f), 0.f), PermanentLifetime, 0.0);
+	}
+
+	int32 MaxLivePulses = 0;
+	uint64 MaxUpdateEntries = 0;
+	for (int32 Frame = 1; Frame <= Frames; ++Frame)
+	{
+		const double Now = Frame * FrameSeconds;
+		for (int32 i = 0; i < PulsePointsPerFrame; ++i)
+		{
+			AppendTracked(Cloud, Expiry, FVector(Stream.FRandRange(-5000.f, 5000.f), Stream.FRandRange(-5000.f, 5000.f), 100.f), PulseLifetime, Now);
+		}
+
+		// A generous time budget, the test is about what survives, not about timing
+		const uint64 UpdatesBefore = Cloud.GetTotalUpdates();
+		Expiry.Update(Now, Cloud, nullptr, 1.0, CompactionZone, MaxChangedSlots);
+		MaxUpdateEntries = FMath::Max(MaxUpdateEntries, Cloud.GetTotalUpdates() - UpdatesBefore);
+
+		int32 LivePulses = 0;
+		for (const FLidarPackedPoint& Point : Cloud.GetPoints())
+		{
+			LivePulses += LidarPacking::IsDead(Point) == false && LidarPacking::UnpackLifetime(Point) < PermanentLifetime ? 1 : 0;
+		}
+		MaxLivePulses = FMath::Max(MaxLivePulses, LivePulses);
+	}
+
+	int32 LivePermanent = 0;
+	for (const FLidarPackedPoint& Point : Cloud.GetPoints())
+	{
+		LivePermanent += LidarPacking::IsDead(Point) == false && LidarPacking::UnpackLifetime(Point) >= PermanentLifetime ? 1 : 0;
+	}
+
+	const FLidarPointExpiryStats Stats = Expiry.GetStats();
+	TestEqual(TEXT("Permanent points outlive the pulses"), LivePermanent, PermanentPoints);
+	TestTrue(TEXT("Pulse points expire"), Stats.ExpiredPoints > 0);
+	TestTrue(TEXT("Permanent points were moved out of the overwrite zone"), Stats.RelocatedPoints > 0);
+	TestTrue(TEXT("Slots written per update stay within the cap"), MaxUpdateEntries <= static_cast<uint64>(MaxChangedSlots));
+
+	// A pulse lives its lifetime plus at most one bucket, and one more frame until Update runs
+	const int32 PulseFrames = FMath::CeilToInt32((PulseLifetime + BucketSeconds) / FrameSeconds) + 1;
+	TestTrue(TEXT("Expired pulses don't pile up"), MaxLivePulses <= PulseFrames * PulsePointsPerFrame);
+
+	AddInfo(FString::Printf(TEXT("%d pulse points through a %d point ring: %lld expired, %lld relocated, at most %d pulses alive"),
+		Frames * PulsePointsPerFrame, Capacity, Stats.ExpiredPoints, Stats.RelocatedPoints, MaxLivePulses));
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,192 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "LidarPointCloud.h"
+#include "LidarPointExport.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarPointExportRoundTripTest, "LidarScanner.Export.RoundTrip",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace LidarExportTest
+{
+	constexpr int32 PointCount = 20000;
+	// Float meters and the LAS integer scale both hold well under this
+	constexpr double PositionTolerance = 0.0002;
+
+	struct FReadPoint
+	{
+		FVector Meters;
+		FColor Color;
+	};
+
+	template <typename T>
+	T Read(const TArray<uint8>& Bytes, int64 Offset)
+	{
+		T Value;
+		FMemory::Memcpy(&Value, Bytes.GetData() + Offset, sizeof(T));
+		return Value;
+	}
+
+	/** Header text up to and including the line starting with EndToken, and where the binary data starts */
+	bool SplitHeader(const TArray<uint8>& Bytes, const ANSICHAR* EndToken, FString& OutHeader, int64& OutDataOffset)
+	{
+		const int32 TokenLength = FCStringAnsi::Strlen(EndToken);
+		for (int64 i = 0; i + TokenLength <= Bytes.Num() && i < 4096; ++i)
+		{
+			if (FMemory::Memcmp(Bytes.GetData() + i, EndToken, TokenLength) == 0)
+			{
+				OutDataOffset = i + TokenLength;
+				OutHeader = FString(static_cast<int32>(OutDataOffset), reinterpret_cast<const ANSICHAR*>(Bytes.GetData()));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int64 ParseHeaderCount(const FString& Header, const TCHAR* Key)
+	{
+		TArray<FString> Lines;
+		Header.ParseIntoArrayLines(Lines);
+		for (const FString& Line : Lines)
+		{
+			if (Line.StartsWith(Key))
+				return FCString::Atoi64(*Line.RightChop(FCString::Strlen(Key)).TrimStartAndEnd());
+		}
+		return -1;
+	}
+
+	bool ReadBack(const FString& Path, ELidarExportFormat Format, TArray<FReadPoint>& OutPoints)
+	{
+		TArray<uint8> Bytes;
+		if (FFileHelper::LoadFileToArray(Bytes, *Path) == false)
+			return false;
+
+		FString Header;
+		int64 Offset = 0;
+		int64 Count = 0;
+		int32 RecordSize = 0;
+
+		switch (Format)
+		{
+		case ELidarExportFormat::Ply:
+			if (SplitHeader(Bytes, "end_header\n", Header, Offset) == false)
+				return false;
+			Count = ParseHeaderCount(Header, TEXT("element vertex"));
+			RecordSize = 15;
+			break;
+		case ELidarExportFormat::Pcd:
+			if (SplitHeader(Bytes, "DATA binary\n", Header, Offset) == false)
+				return false;
+			Count = ParseHeaderCount(Header, TEXT("POINTS"));
+			RecordSize = 16;
+			break;
+		case ELidarExportFormat::Las:
+			if (Bytes.Num() < 227 || FMemory::Memcmp(Bytes.GetData(), "LASF", 4) != 0)
+				return false;
+			Offset = Read<uint32>(Bytes, 96);
+			RecordSize = Read<uint16>(Bytes, 105);
+			Count = Read<uint32>(Bytes, 107);
+			break;
+		}
+
+		if (Count < 0 || Offset + Count * RecordSize != Bytes.Num())
+			return false;
+
+		for (int64 i = 0; i < Count; ++i, Offset += RecordSize)
+		{
+			FReadPoint& Point = OutPoints.AddDefaulted_GetRef();
+			switch (Format)
+			{
+			case ELidarExportFormat::Ply:
+				Point.Meters = FVector(Read<float>(Bytes, Offset), Read<float>(Bytes, Offset + 4), Read<float>(Bytes, Offset + 8));
+				Point.Color = FColor(Bytes[Offset + 12], Bytes[Offset + 13], Bytes[Offset + 14]);
+				break;
+			case ELidarExportFormat::Pcd:
+			{
+				Point.Meters = FVector(Read<float>(Bytes, Offset), Read<float>(Bytes, Offset + 4), Read<float>(Bytes, Offset + 8));
+				const uint32 Rgb = Read<uint32>(Bytes, Offset + 12);
+				Point.Color = FColor((Rgb >> 16) & 0xFF, (Rgb >> 8) & 0xFF, Rgb & 0xFF);
+				break;
+			}
+			case ELidarExportFormat::Las:
+				Point.Meters = FVector(Read<int32>(Bytes, Offset), Read<int32>(Bytes, Offset + 4), Read<int32>(Bytes, Offset + 8)) * FLidarPointExporter::LasScale;
+				Point.Color = FColor(Read<uint16>(Bytes, Offset + 20) / 257, Read<uint16>(Bytes, Offset + 22) / 257, Read<uint16>(Bytes, Offset + 24) / 257);
+				break;
+			}
+		}
+		return true;
+	}
+}
+
+bool FLidarPointExportRoundTripTest::RunTest(const FString& Parameters)
+{
+	using namespace LidarExportTest;
+
+	// Spread over several chunks, with negative coordinates
+	FLidarPointCloud Cloud;
+	Cloud.SetCapacity(PointCount);
+	FRandomStream Stream(77);
+	for (int32 i = 0; i < PointCount; ++i)
+	{
+		const FVector Position(Stream.FRandRange(-9000.f, 9000.f), Stream.FRandRange(-9000.f, 9000.f), Stream.FRandRange(-500.f, 3000.f));
+		Cloud.Append(Position, FColor(Stream.RandRange(0, 255), Stream.RandRange(0, 255), Stream.RandRange(0, 255)).ReinterpretAsLinear(), 10.f);
+	}
+
+	// Two batches, the way the component hands them off over frames
+	const int32 Half = PointCount / 2;
+	TSharedRef<FLidarExportBatch> First = MakeShared<FLidarExportBatch>();
+	TSharedRef<FLidarExportBatch> Second = MakeShared<FLidarExportBatch>();
+	// The second batch adds no chunks, it reuses the ones the first one brought
+	First->NewChunkOrigins = Cloud.GetChunks().GetOrigins();
+	First->Points.Append(Cloud.GetPoints().Slice(0, Half));
+	Second->Points.Append(Cloud.GetPoints().Slice(Half, PointCount - Half));
+
+	for (ELidarExportFormat Format : {ELidarExportFormat::Ply, ELidarExportFormat::Pcd, ELidarExportFormat::Las})
+	{
+		const FString Name = FLidarPointExporter::GetExtension(Format);
+		const FString Path = FPaths::ProjectSavedDir() / TEXT("Lidar/Tests/RoundTrip") + Name;
+
+		{
+			FLidarPointExporter Exporter(Path, Format);
+			Exporter.Enqueue(First);
+			Exporter.Enqueue(Second);
+			Exporter.Finish();
+			Exporter.Wait();
+
+			TestFalse(Name + TEXT(" export failed"), Exporter.HasFailed());
+			TestEqual(Name + TEXT(" points written"), Exporter.GetPointsWritten(), static_cast<int64>(PointCount));
+		}
+
+		TArray<FReadPoint> Points;
+		if (TestTrue(Name + TEXT(" file reads back"), ReadBack(Path, Format, Points)) == false)
+			continue;
+		if (TestEqual(Name + TEXT(" point count"), Points.Num(), PointCount) == false)
+			continue;
+
+		int32 PositionErrors = 0;
+		int32 ColorErrors = 0;
+		for (int32 i = 0; i < PointCount; ++i)
+		{
+			const FVector Expected = Cloud.GetPosition(i) * 0.01;
+			PositionErrors += Points[i].Meters.Equals(Expected, PositionTolerance) ? 0 : 1;
+
+			const FColor ExpectedColor = Cloud.GetPoint(i).Color;
+			ColorErrors += Points[i].Color.R == ExpectedColor.R && Points[i].Color.G == ExpectedColor.G && Points[i].Color.B == ExpectedColor.B ? 0 : 1;
+		}
+		TestEqual(Name + TEXT(" positions off by more than the tolerance"), PositionErrors, 0);
+		TestEqual(Name + TEXT(" colors changed"), ColorErrors, 0);
+
+		IFileManager::Get().Delete(*Path);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,345 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "LidarBenchmarkUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Tests/AutomationCommon.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerStart.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Components/StaticMeshComponent.h"
+#include "LidarComponent.h"
+
+/**
+ * Loads the first person map, puts a scanner on a scripted pawn and runs a fixed scan sequence,
+ * then compares the numbers with Tests/Baselines/LidarScanPerf.csv. The scanner sits in a closed box so every ray
+ * hits, which makes rays_cast and points_stored exact. The timing and memory rows start out as budgets (a ceiling,
+ * or a floor for rays_per_second) until a baseline run on the perf machine replaces them. Meant to run headless:
+ *   UnrealEditor-Cmd LidarScanner.uproject -game -nullrhi -unattended -ExecCmds="Automation RunTests LidarScanner.Performance; Quit"
+ * Add -LidarPerfUpdateBaseline to write the measured values into the baseline instead.
+ */
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLidarScanPerfTest, "LidarScanner.Performance.EndToEnd",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+namespace LidarScanPerf
+{
+	const TCHAR* MapPath = TEXT("/Game/FirstPerson/Maps/FirstPersonMap");
+
+	constexpr int32 Seed = 20240917;
+	constexpr int32 NormalScanCount = 120;
+	// The pawn turns this much between normal scans, so the sequence sweeps the whole room
+	constexpr float YawStepPerScan = 3.f;
+	constexpr float FullScanDeltaTime = 1.f / 30.f;
+	constexpr int32 MaxFullScanFrames = 2000;
+	// Half the inner size of the box around the scanner, well inside RaycastLength
+	constexpr float EnclosureHalfSize = 1000.f;
+	constexpr float EnclosureWallThickness = 10.f;
+
+	struct FMetric
+	{
+		FString Name;
+		double Value = 0.0;
+	};
+
+	struct FBaselineEntry
+	{
+		FString Name;
+		TOptional<double> Baseline;
+		double TolerancePct = 0.0;
+		// lower, higher or equal: which way is better
+		FString Direction;
+	};
+
+	FString GetBaselinePath()
+	{
+		return FPaths::GameSourceDir() / TEXT("LidarScanner/Tests/Baselines/LidarScanPerf.csv");
+	}
+
+	TArray<FBaselineEntry> LoadBaseline(const FString& Path)
+	{
+		TArray<FBaselineEntry> Entries;
+		TArray<FString> Lines;
+		if (FFileHelper::LoadFileToStringArray(Lines, *Path) == false)
+			return Entries;
+
+		// First line is the header
+		for (int32 i = 1; i < Lines.Num(); ++i)
+		{
+			TArray<FString> Columns;
+			Lines[i].ParseIntoArray(Columns, TEXT(","), false);
+			if (Columns.Num() < 4)
+				continue;
+
+			FBaselineEntry& Entry = Entries.AddDefaulted_GetRef();
+			Entry.Name = Columns[0].TrimStartAndEnd();
+			if (Columns[1].TrimStartAndEnd().IsEmpty() == false)
+			{
+				Entry.Baseline = FCString::Atod(*Columns[1]);
+			}
+			Entry.TolerancePct = FCString::Atod(*Columns[2]);
+			Entry.Direction = Columns[3].TrimStartAndEnd();
+		}
+		return Entries;
+	}
+
+	bool SaveBaseline(const FString& Path, const TArray<FBaselineEntry>& Entries)
+	{
+		FString Csv = TEXT("metric,baseline,tolerance_pct,direction\n");
+		for (const FBaselineEntry& Entry : Entries)
+		{
+			Csv += FString::Printf(TEXT("%s,%s,%g,%s\n"), *Entry.Name,
+				Entry.Baseline.IsSet() ? *FString::Printf(TEXT("%.3f"), Entry.Baseline.GetValue()) : TEXT(""),
+				Entry.TolerancePct, *Entry.Direction);
+		}
+		return FFileHelper::SaveStringToFile(Csv, *Path);
+	}
+
+	UWorld* FindGameWorld()
+	{
+		for (const FWorldContext& Context : GEngine->GetWorldContexts())
+		{
+			if ((Context.WorldType == EWorldType::Game || Context.WorldType == EWorldType::PIE) && Context.World())
+				return Context.World();
+		}
+		return nullptr;
+	}
+
+	/** Six walls around Center so no ray escapes into the sky, the map's own geometry inside still counts as a hit */
+	TArray<AActor*> SpawnEnclosure(UWorld* World, const FVector& Center)
+	{
+		TArray<AActor*> Walls;
+		UStaticMesh* Cube = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+		if (Cube == nullptr)
+			return Walls;
+
+		// The engine cube is 100 units wide, walls overlap at the edges so there are no gaps
+		const float Span = 2.f * (EnclosureHalfSize + EnclosureWallThickness) / 100.f;
+		const float Thickness = EnclosureWallThickness / 100.f;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			for (const float Side : {-1.f, 1.f})
+			{
+				FVector Offset = FVector::ZeroVector;
+				Offset[Axis] = Side * (EnclosureHalfSize + EnclosureWallThickness * 0.5f);
+				FVector Scale(Span);
+				Scale[Axis] = Thickness;
+
+				AStaticMeshActor* Wall = World->SpawnActor<AStaticMeshActor>(AStaticMeshActor::StaticClass(), FTransform(FQuat::Identity, Center + Offset, Scale));
+				Wall->GetStaticMeshComponent()->SetMobility(EComponentMobility::Movable);
+				Wall->GetStaticMeshComponent()->SetStaticMesh(Cube);
+				Walls.Add(Wall);
+			}
+		}
+		return Walls;
+	}
+
+	double Percentile(TArray<double> Values, double Fraction)
+	{
+		if (Values.Num() == 0)
+			return 0.0;
+
+		Values.Sort();
+		return Values[FMath::Clamp(FMath::CeilToInt32(Fraction * Values.Num()) - 1, 0, Values.Num() - 1)];
+	}
+
+	double Mean(const TArray<double>& Values)
+	{
+		double Sum = 0.0;
+		for (double Value : Values)
+		{
+			Sum += Value;
+		}
+		return Values.Num() > 0 ? Sum / Values.Num() : 0.0;
+	}
+
+	/** Runs the scan sequence, false if the world or the scanner could not be set up */
+	bool RunSequence(FAutomationTestBase& Test, TArray<FMetric>& OutMetrics)
+	{
+		UWorld* World = FindGameWorld();
+		if (World == nullptr)
+		{
+			Test.AddError(TEXT("No game world, the map did not load"));
+			return false;
+		}
+
+		FTransform SpawnTransform(FVector(0.f, 0.f, 200.f));
+		if (TActorIterator<APlayerStart> It(World); It)
+		{
+			SpawnTransform = It->GetActorTransform();
+		}
+
+		const TArray<AActor*> Enclosure = SpawnEnclosure(World, SpawnTransform.GetLocation());
+		if (Enclosure.Num() == 0)
+		{
+			Test.AddError(TEXT("Could not load /Engine/BasicShapes/Cube for the enclosure"));
+			return false;
+		}
+
+		// No controller on purpose, the scanner falls back to its own transform
+		APawn* Pawn = World->SpawnActor<APawn>(APawn::StaticClass(), SpawnTransform);
+		ULidarComponent* Scanner = NewObject<ULidarComponent>(Pawn, TEXT("PerfScanner"));
+		Scanner->bRandomizeSeed = false;
+		Scanner->RandomSeed = Seed;
+		Scanner->TraceMode = ELidarTraceMode::Synchronous;
+		Scanner->EnableDebug = false;
+		// Nothing renders under -nullrhi, keep the Niagara upload out of the numbers
+		Scanner->bUseDeltaUpload = true;
+		// Every hit stays a point, nothing merges or expires
+		Scanner->bEnableVoxelDeduplication = false;
+		Scanner->bEnablePointExpiry = false;
+		Pawn->SetRootComponent(Scanner);
+		Scanner->RegisterComponent();
+		// The test ticks it by hand so every frame is measured
+		Scanner->SetComponentTickEnabled(false);
+
+		const double StartTime = FPlatformTime::Seconds();
+		TArray<double> NormalScanMs;
+		FRotator Rotation = SpawnTransform.Rotator();
+		for (int32 i = 0; i < NormalScanCount; ++i)
+		{
+			Rotation.Yaw += YawStepPerScan;
+			Pawn->SetActorRotation(Rotation);
+
+			const double ScanStart = FPlatformTime::Seconds();
+			Scanner->NormalScan();
+			NormalScanMs.Add((FPlatformTime::Seconds() - ScanStart) * 1000.0);
+		}
+
+		TArray<double> FullScanMs;
+		Scanner->StartFullScan();
+		for (int32 Frame = 0; Frame < MaxFullScanFrames && Scanner->IsFullScanInProgress(); ++Frame)
+		{
+			const double TickStart = FPlatformTime::Seconds();
+			Scanner->TickComponent(FullScanDeltaTime, LEVELTICK_All, &Scanner->PrimaryComponentTick);
+			FullScanMs.Add((FPlatformTime::Seconds() - TickStart) * 1000.0);
+		}
+
+		const int64 RaysCast = Scanner->GetScanCounters().RaysCast;
+		const int64 ExpectedRays = static_cast<int64>(NormalScanCount) * Scanner->ScanRayAmount + static_cast<int64>(Scanner->FullScanRowCount) * Scanner->FullScanRayAmount;
+		Test.TestEqual(TEXT("Every ray of the sequence is cast"), RaysCast, ExpectedRays);
+		Test.TestEqual(TEXT("Every ray hits the enclosure and is stored"), static_cast<int64>(Scanner->GetPointCount()), ExpectedRays);
+		const double ScanSeconds = FMath::Max((Mean(NormalScanMs) * NormalScanMs.Num() + Mean(FullScanMs) * FullScanMs.Num()) / 1000.0, UE_SMALL_NUMBER);
+		Test.AddInfo(FString::Printf(TEXT("Scan sequence took %.2f s wall time"), FPlatformTime::Seconds() - StartTime));
+
+		OutMetrics.Add({TEXT("normal_scan_ms_mean"), Mean(NormalScanMs)});
+		OutMetrics.Add({TEXT("normal_scan_ms_p95"), Percentile(NormalScanMs, 0.95)});
+		OutMetrics.Add({TEXT("full_scan_step_ms_mean"), Mean(FullScanMs)});
+		OutMetrics.Add({TEXT("rays_per_second"), RaysCast / ScanSeconds});
+		OutMetrics.Add({TEXT("rays_cast"), static_cast<double>(RaysCast)});
+		OutMetrics.Add({TEXT("points_stored"), static_cast<double>(Scanner->GetPointCount())});
+		OutMetrics.Add({TEXT("cloud_bytes"), static_cast<double>(Scanner->GetPointCloud().GetAllocatedSize())});
+		OutMetrics.Add({TEXT("peak_memory_mb"), FPlatformMemory::GetStats().PeakUsedPhysical / (1024.0 * 1024.0)});
+
+		Pawn->Destroy();
+		for (AActor* Wall : Enclosure)
+		{
+			Wall->Destroy();
+		}
+		return true;
+	}
+
+	/** Fails the test for every metric outside its tolerance, and for every metric and baseline row without a match */
+	void CompareWithBaseline(FAutomationTestBase& Test, const TArray<FMetric>& Metrics, TArray<FBaselineEntry>& Baseline, bool bUpdateBaseline)
+	{
+		for (const FMetric& Metric : Metrics)
+		{
+			FBaselineEntry* Entry = Baseline.FindByPredicate([&Metric](const FBaselineEntry& Candidate) { return Candidate.Name == Metric.Name; });
+			if (Entry == nullptr)
+			{
+				Test.AddError(FString::Printf(TEXT("%s has no baseline entry"), *Metric.Name));
+				continue;
+			}
+
+			if (bUpdateBaseline)
+			{
+				Entry->Baseline = Metric.Value;
+				continue;
+			}
+
+			if (Entry->Baseline.IsSet() == false)
+			{
+				Test.AddError(FString::Printf(TEXT("%s = %.3f has no baseline value, record one with -LidarPerfUpdateBaseline"), *Metric.Name, Metric.Value));
+				continue;
+			}
+
+			const double Base = Entry->Baseline.GetValue();
+			const double Allowed = FMath::Abs(Base) * Entry->TolerancePct / 100.0;
+			const bool bRegressed =
+				Entry->Direction == TEXT("higher") ? Metric.Value < Base - Allowed :
+				Entry->Direction == TEXT("equal") ? FMath::Abs(Metric.Value - Base) > Allowed :
+				Metric.Value > Base + Allowed;
+
+			const FString Message = FString::Printf(TEXT("%s = %.3f, baseline %.3f (%s is better, %.0f%% tolerance)"), *Metric.Name, Metric.Value, Base, *Entry->Direction, Entry->TolerancePct);
+			if (bRegressed)
+			{
+				Test.AddError(TEXT("Regression: ") + Message);
+			}
+			else
+			{
+				Test.AddInfo(Message);
+			}
+		}
+
+		// A row the sequence no longer measures would otherwise pass silently forever
+		for (const FBaselineEntry& Entry : Baseline)
+		{
+			if (Metrics.ContainsByPredicate([&Entry](const FMetric& Metric) { return Metric.Name == Entry.Name; }) == false)
+			{
+				Test.AddError(FString::Printf(TEXT("Baseline entry %s was not measured"), *Entry.Name));
+			}
+		}
+	}
+}
+
+DEFINE_LATENT_AUTOMATION_COMMAND_ONE_PARAMETER(FLidarRunScanPerfSequence, FAutomationTestBase*, Test);
+
+bool FLidarRunScanPerfSequence::Update()
+{
+	using namespace LidarScanPerf;
+
+	TArray<FMetric> Metrics;
+	if (RunSequence(*Test, Metrics) == false)
+		return true;
+
+	FString Csv = TEXT("metric,value\n");
+	for (const FMetric& Metric : Metrics)
+	{
+		Csv += FString::Printf(TEXT("%s,%.3f\n"), *Metric.Name, Metric.Value);
+	}
+	const FString ReportPath = LidarBenchmark::SaveReport(TEXT("ScanPerf.csv"), Csv);
+	Test->AddInfo(FString::Printf(TEXT("Report: %s"), *ReportPath));
+
+	const bool bUpdateBaseline = FParse::Param(FCommandLine::Get(), TEXT("LidarPerfUpdateBaseline"));
+	TArray<FBaselineEntry> Baseline = LoadBaseline(GetBaselinePath());
+	if (Baseline.Num() == 0)
+	{
+		Test->AddError(FString::Printf(TEXT("No baseline at %s, nothing to compare against"), *GetBaselinePath()));
+		return true;
+	}
+
+	CompareWithBaseline(*Test, Metrics, Baseline, bUpdateBaseline);
+
+	if (bUpdateBaseline)
+	{
+		Test->TestTrue(TEXT("Baseline was updated"), SaveBaseline(GetBaselinePath(), Baseline));
+	}
+	return true;
+}
+
+bool FLidarScanPerfTest::RunTest(const FString& Parameters)
+{
+	AutomationOpenMap(LidarScanPerf::MapPath);
+	ADD_LATENT_AUTOMATION_COMMAND(FLidarRunScanPerfSequence(this));
+	return true;
+}
+
+#endif